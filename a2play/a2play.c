@@ -46,12 +46,14 @@ typedef enum {
 } DUMPFLAGS;
 
 static DUMPFLAGS dump = 0;
+static int profile = 0;		/* Print VM profile after playing */
 
 /* Configuration */
 static const char *audiodriver = "default";
 static int samplerate = 48000;
 static int channels = 2;
 static int audiobuf = 4096;
+static int fragment = 0;	/* 0: A2_DEFAULTFRAG */
 static int a2flags = A2_TIMESTAMP;
 static const char *mididriver = NULL;
 
@@ -281,6 +283,84 @@ static void dump_exports(void)
 }
 
 
+/*-------------------------------------------------------------------
+	Profiling
+-------------------------------------------------------------------*/
+
+#define	PROFENTRIES	20
+
+/* Look for 'h' among the exports and private symbols of 'bank' */
+static const char *find_name(A2_handle bank, A2_handle h)
+{
+	int x;
+	for(x = 0; a2_GetExport(iface, bank, x) >= 0; ++x)
+		if(a2_GetExport(iface, bank, x) == h)
+			return a2_GetExportName(iface, bank, x);
+	for(x = -1; a2_GetExport(iface, bank, x) >= 0; --x)
+		if(a2_GetExport(iface, bank, x) == h)
+			return a2_GetExportName(iface, bank, x);
+	return NULL;
+}
+
+
+static void print_profile(void)
+{
+	int i, n;
+	uint64_t total = 0;
+	A2_profentry pe[PROFENTRIES];
+	uint64_t ops[256];
+	if((n = a2_GetProfile(iface, pe, PROFENTRIES)) < 0)
+	{
+		fprintf(stderr, "a2play: Could not get VM profile! (%s)\n",
+				a2_ErrorString(-n));
+		return;
+	}
+	printf(".--------------------------------------------------------\n");
+	printf("| VM profile (%d functions)\n", n);
+	printf("|--------------------------------------------------------\n");
+	printf("| %-24s %4s %12s %9s %9s\n", "program", "func",
+			"instructions", "calls", "spawns");
+	for(i = 0; i < n && i < PROFENTRIES; ++i)
+	{
+		const char *name = NULL;
+		if(pe[i].program < 0)
+		{
+			printf("| %-24s %4s %12llu\n", "<unaccounted>", "",
+					(unsigned long long)pe[i].instructions);
+			continue;
+		}
+		if(module >= 0)
+			name = find_name(module, pe[i].program);
+		if(!name)
+			name = find_name(A2_ROOTBANK, pe[i].program);
+		if(name)
+			printf("| %-24s", name);
+		else
+			printf("| %-24d", pe[i].program);
+		printf(" %4u %12llu %9llu %9llu\n", pe[i].func,
+				(unsigned long long)pe[i].instructions,
+				(unsigned long long)pe[i].calls,
+				(unsigned long long)pe[i].spawns);
+	}
+	if((n = a2_GetInstructionProfile(iface, ops, 256)) < 0)
+		return;
+	if(n > 256)
+		n = 256;
+	for(i = 0; i < n; ++i)
+		total += ops[i];
+	printf("|--------------------------------------------------------\n");
+	printf("| Instructions (%llu total)\n", (unsigned long long)total);
+	printf("|--------------------------------------------------------\n");
+	for(i = 0; i < n; ++i)
+		if(ops[i])
+			printf("| %-10s %12llu %6.2f%%\n",
+					a2_InstructionName(i),
+					(unsigned long long)ops[i],
+					100.0 * ops[i] / total);
+	printf("'--------------------------------------------------------\n");
+}
+
+
 /*-------------------------------------------------------------------
 	Loading
 -------------------------------------------------------------------*/
@@ -463,6 +543,8 @@ static void usage(const char *exename)
 			"                       Audio driver + options\n"
 			"           -d?         List available drivers\n"
 			"           -b<n>       Audio buffer size (frames)\n"
+			"           -f<n>       Processing fragment size "
+			"(frames)\n"
 			"           -r<n>       Audio sample rate (Hz)\n"
 			"           -c<n>       Number of audio channels\n"
 			"           -m<name>[,opt[,opt[,...]]]\n"
@@ -483,6 +565,9 @@ static void usage(const char *exename)
 			"           -xp         Dump with private symbols\n"
 			"           -xa         Dump with VM assembly code\n"
 			"           -xh         Dump with object handles\n"
+			"           -xprof      Print VM profile when done\n"
+			"           -nosimd     Use only scalar DSP code\n"
+			"           -float      Use 32 bit float processing\n"
 			"           -v          Print engine and header "
 			"versions\n"
 			"           -h          Help\n\n");
@@ -522,6 +607,17 @@ static void parse_args(int argc, const char *argv[])
 			audiobuf = atoi(&argv[i][2]);
 			printf("[Audio buffer: %d]\n", audiobuf);
 		}
+		/* Before "-f", which would match it too */
+		else if(strncmp(argv[i], "-float", 7) == 0)
+		{
+			a2flags |= A2_FLOATPROC;
+			printf("[32 bit float processing]\n");
+		}
+		else if(strncmp(argv[i], "-f", 2) == 0)
+		{
+			fragment = atoi(&argv[i][2]);
+			printf("[Fragment size: %d]\n", fragment);
+		}
 		else if(strncmp(argv[i], "-r", 2) == 0)
 		{
 			samplerate = atoi(&argv[i][2]);
@@ -573,6 +669,17 @@ static void parse_args(int argc, const char *argv[])
 			dump |= DF_MODULE | DF_ASM;
 		else if(strncmp(argv[i], "-xh", 3) == 0)
 			dump |= DF_MODULE | DF_HANDLES;
+		else if(strncmp(argv[i], "-xprof", 7) == 0)
+		{
+			profile = 1;
+			a2flags |= A2_PROFILE;
+			printf("[VM profiling enabled]\n");
+		}
+		else if(strncmp(argv[i], "-nosimd", 8) == 0)
+		{
+			a2flags |= A2_NOSIMD;
+			printf("[SIMD DSP code disabled]\n");
+		}
 		else if(strncmp(argv[i], "-h", 3) == 0)	/* No args! */
 		{
 			usage(argv[0]);
@@ -670,6 +777,7 @@ int main(int argc, const char *argv[])
 	if(!(cfg = a2_OpenConfig(samplerate, audiobuf, channels,
 			a2flags | A2_AUTOCLOSE)))
 		fail(a2_LastError());
+	cfg->fragment = fragment;
 	if(!(drv = a2_NewDriver(A2_AUDIODRIVER, audiodriver)))
 		fail(a2_LastError());
 	if(drv && a2_AddDriver(cfg, drv))
@@ -765,6 +873,8 @@ int main(int argc, const char *argv[])
 	}
 	fprintf(stderr, "a2play: Stopped. %d sample frames played.\n", 
 			playedframes);
+	if(profile)
+		print_profile();
 
 	/* Close and clean up */
 	a2_Close(iface);
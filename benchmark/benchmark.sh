@@ -1,15 +1,18 @@
 #/bin/sh
 
-player=${1:-a2play}
+SWEEP="16 32 64 128 256 512"
 
 usage()
 {
 cat << EOF
-usage: $0 options
+usage: $0 [options] [player]
 
 OPTIONS:
    -h      Show this message
    -v      Verbose
+   -s      Sweep processing fragment sizes (${SWEEP})
+   -f <n>  Processing fragment size(s), as a quoted list for a sweep
+   -F      Use 32 bit float processing (a2play -float)
 
 EOF
 }
@@ -18,7 +21,9 @@ echo ===== Audiality 2 offline rendering benchmark =====
 echo
 
 VERBOSE=
-while getopts "hv" OPTION
+FRAGMENTS=0
+FLOAT=
+while getopts "hvsf:F" OPTION
 do
    case $OPTION in
       h)
@@ -28,30 +33,48 @@ do
       v)
          VERBOSE=1
          ;;
+      s)
+         FRAGMENTS=${SWEEP}
+         ;;
+      f)
+         FRAGMENTS=${OPTARG}
+         ;;
+      F)
+         FLOAT=-float
+         ;;
       ?)
          usage
          exit
          ;;
    esac
 done
+shift $((OPTIND - 1))
+player=${1:-a2play}
 
-a2play -v
+${player} -v
 
 echo ===================================================
 
 for SONGNAME in $(ls *.a2s)
 do
-   echo
-   echo === $SONGNAME ===
-   for i in {1..3}
+   for FRAGMENT in ${FRAGMENTS}
    do
-      echo Pass $i
-      if [ ! -z $VERBOSE ]; then
-         time ${player} -dbuffer -r44100 $SONGNAME -pSong -st250
+      echo
+      if [ ${FRAGMENT} -eq 0 ]; then
+         echo === $SONGNAME ===
       else
-         time $(${player} -dbuffer -r44100 $SONGNAME -pSong -st250 > /dev/null 2>&1)
+         echo === $SONGNAME, fragment size ${FRAGMENT} ===
       fi
-      echo
+      for i in {1..3}
+      do
+         echo Pass $i
+         if [ ! -z $VERBOSE ]; then
+            time ${player} -dbuffer -r44100 -f${FRAGMENT} ${FLOAT} $SONGNAME -pSong -st250
+         else
+            time $(${player} -dbuffer -r44100 -f${FRAGMENT} ${FLOAT} $SONGNAME -pSong -st250 > /dev/null 2>&1)
+         fi
+         echo
+      done
    done
 done
 
@@ -0,0 +1,80 @@
+#/bin/bash
+
+# Compares VM instruction dispatch methods, by running the VM benchmark with
+# two builds of a2play; one with computed goto dispatch (the default), and one
+# configured with -DUSE_COMPUTED_GOTO=OFF. Use release builds for both!
+#
+# NOTE: The engine no longer accepts sample rates below 1000 Hz, so we render
+#       at 1000 Hz, for the same song time as vm-benchmark.sh.
+
+usage()
+{
+cat << EOF
+usage: $0 options <goto a2play> <switch a2play>
+
+OPTIONS:
+   -h      Show this message
+   -n<n>   Number of passes per song (default: 3)
+
+EOF
+}
+
+echo ===== Audiality 2 VM dispatch benchmark =====
+echo
+
+PASSES=3
+while getopts "hn:" OPTION
+do
+   case $OPTION in
+      h)
+         usage
+         exit 1
+         ;;
+      n)
+         PASSES=$OPTARG
+         ;;
+      ?)
+         usage
+         exit
+         ;;
+   esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 2 ]; then
+   usage
+   exit 1
+fi
+gotoplayer=$1
+switchplayer=$2
+
+# Best user time (seconds) out of $PASSES runs
+besttime()
+{
+   local best=
+   local t
+   TIMEFORMAT=%U
+   for i in $(seq 1 $PASSES)
+   do
+      t=$( { time $1 -dbuffer -r1000 $2 -pSong -st2500 > /dev/null 2>&1 ; } 2>&1 )
+      if [ -z "$best" ] || awk "BEGIN { exit !($t < $best) }"; then
+         best=$t
+      fi
+   done
+   echo $best
+}
+
+$gotoplayer -v
+
+echo ===================================================
+printf "%-20s %10s %10s %8s\n" "song" "goto" "switch" "speedup"
+
+for SONGNAME in $(ls *.a2s)
+do
+   g=$(besttime $gotoplayer $SONGNAME)
+   s=$(besttime $switchplayer $SONGNAME)
+   printf "%-20s %9ss %9ss %7sx\n" $SONGNAME $g $s \
+         $(awk "BEGIN { printf \"%.3f\", $s / $g }")
+done
+
+echo ===================================================
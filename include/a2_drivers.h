@@ -57,6 +57,7 @@ struct A2_config
 	int		blockpool;	/* Initial block pool size */
 	int		voicepool;	/* Initial voice pool size */
 	int		eventpool;	/* Initial event pool size */
+	int		fragment;	/* Processing fragment size (frames) */
 
 	/* Information (read-only; valid only after a2_Open()!) */
 	int		basepitch;	/* Middle C pitch (1.0/oct, 16:16) */
@@ -80,6 +81,11 @@ struct A2_config
  *	If left 0 (default), blockpool, voicepool, and eventpool are set to
  *	"reasonable" defaults automatically by a2_Open().
  *
+ *	'fragment' is the number of sample frames the engine processes at a
+ *	time, from 1 through A2_MAXFRAG, or 0 (default) for A2_DEFAULTFRAG.
+ *	Memory blocks, buses, and wave padding are sized to match. Substates
+ *	always use the fragment size of their master state.
+ *
  *	Also, if a realtime audio driver is used, a2_Open() automatically
  *	transfers the A2_REALTIME flag to the configuration. Applications
  *	should only set the A2_REALTIME flag when using a normally
@@ -269,6 +275,30 @@ TODO:	void (*APIFreeFromRT)(A2_sysdriver *driver, void *block);
 	/* (Implementation specific data may follow) */
 };
 
+/*
+ * Realtime memory manager statistics, as maintained by the "tlsf" sysdriver.
+ * All sizes are in bytes, and include allocator overhead.
+ */
+typedef struct A2_rtmemstats
+{
+	unsigned	size;		/* Total size of all arenas */
+	unsigned	arenas;		/* Number of arenas */
+	unsigned	used;		/* Currently allocated */
+	unsigned	highwater;	/* Peak allocated */
+	unsigned	refills;	/* Arenas added by the refill thread */
+	unsigned	failures;	/* Failed RTAlloc() calls */
+} A2_rtmemstats;
+
+/*
+ * Get the statistics of 'driver', which must be a "tlsf" sysdriver, or
+ * A2_NOTIMPLEMENTED is returned.
+ *
+ * NOTE:
+ *	The statistics are updated by the engine context without locking, so
+ *	they may be slightly out of date while the engine is running.
+ */
+A2_errors a2_GetRTMemStats(A2_sysdriver *driver, A2_rtmemstats *stats);
+
 
 /*
  * Public interface for A2_AUDIODRIVER
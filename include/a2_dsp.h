@@ -140,8 +140,8 @@ static inline void a2_PrepareRamper(A2_ramper *rr, int frames)
 	else
 	{
 		/*
-		 * This isn't accurate, but the error is limited by A2_MAXFRAG,
-		 * and it only ever happens with asynchronous ramps anyway!
+		 * This isn't accurate, but the error is limited by the fragment
+		 * size, and it only ever happens with asynchronous ramps anyway!
 		 */
 		rr->delta = (rr->target - rr->value) / frames;
 		rr->timer = 0;
@@ -169,6 +169,26 @@ static inline void a2_SetRamper(A2_ramper *rr, int target, int start,
 		rr->value += rr->delta * start >> 8;
 }
 
+
+/*---------------------------------------------------------
+	32 bit float processing (A2_PROCFLOAT)
+---------------------------------------------------------*/
+
+/* Scale factor from 8:24 to float samples, where 1.0f corresponds to 1.0 */
+#define	A2_FIX2FLOAT	(1.0f / 16777216.0f)
+
+/* Current value of ramper 'rr' as a float */
+static inline float a2_RamperValueF(A2_ramper *rr)
+{
+	return rr->value * A2_FIX2FLOAT;
+}
+
+/* Per-sample delta of ramper 'rr' as a float */
+static inline float a2_RamperDeltaF(A2_ramper *rr)
+{
+	return rr->delta * A2_FIX2FLOAT;
+}
+
 #ifdef __cplusplus
 };
 #endif
@@ -67,8 +67,20 @@ typedef enum A2_properties
 	A2_PSILENCEWINDOW,	/* Rolling window size for silence detection */
 	A2_PSILENCEGRACE,	/* Grace period before considering silence */
 	A2_PRANDSEED,		/* 'rand' instruction RNG seed/state */
-	A2_PNOISESEED,		/* 'wtosc' noise generator seed/state */
+	A2_PNOISESEED,		/* Voice 'rand' and noise RNG seed/state */
 	A2_PLOGLEVELS,		/* Loglevel (bit mask) */
+	A2_PRENDERTHREADS,	/* Voice processing threads (0: no lanes) */
+	A2_PBLOCKPOOL,		/* Preallocated blocks (can only grow) */
+	A2_PEVENTPOOL,		/* Preallocated events (can only grow) */
+	A2_PVOICEPOOL,		/* Preallocated voices (can only grow) */
+	A2_PBLOCKRESERVE,	/* Block pool reserve, refilled by the API */
+	A2_PEVENTRESERVE,	/* Event pool reserve, refilled by the API */
+	A2_PVOICERESERVE,	/* Voice pool reserve, refilled by the API */
+	A2_PVOICELIMIT,		/* Active voice budget (0: no limit) */
+	A2_PQUALITY,		/* Oscillator quality (A2_quality) */
+	A2_PCPULOADHIGH,	/* Load (%) to reduce quality at (0: never) */
+	A2_PCPULOADLOW,		/* Load (%) to restore quality at */
+	A2_PFRAGMENT,		/* Processing fragment size (frames) */
 
 	/*
 	 * Statistics (state)
@@ -88,7 +100,13 @@ typedef enum A2_properties
 	A2_PAPIMESSAGES,	/* Number of API messages received */
 	A2_PTSMARGINAVG,	/* Timestamp deadline margin; average */
 	A2_PTSMARGINMIN,	/* Timestamp deadline margin; minimum */
-	A2_PTSMARGINMAX		/* Timestamp deadline margin; maximum */
+	A2_PTSMARGINMAX,	/* Timestamp deadline margin; maximum */
+
+	A2_PSUSPENDEDVOICES,	/* Voices suspended by silence detection */
+	A2_PVOICEMEMORY,	/* Memory allocated for voices (bytes) */
+	A2_PSTOLENVOICES,	/* Voices stolen due to voice budgets */
+	A2_PCURRENTQUALITY,	/* Current quality, as reduced due to load */
+	A2_PLOADVOICELIMIT	/* Voice budget due to load (0: no limit) */
 
 } A2_properties;
 
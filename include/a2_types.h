@@ -273,6 +273,7 @@ typedef enum {
   A2_DEFERR(NOPORT,		"Port is unavailable or does not exist")\
   A2_DEFERR(NOINPUT,		"Unit with inputs where there is no audio")\
   A2_DEFERR(NONAME,		"Object has no name")\
+  A2_DEFERR(NODORMANT,		"'dormant' not allowed in this context")\
   \
   A2_DEFERR(INTERNAL,		"INTERNAL ERROR")	/* Must be last! */
 
@@ -298,6 +299,11 @@ typedef enum A2_initflags
 	A2_SILENT =	0x00001000,	/* Disable all log levels */
 	A2_RTSILENT =	0x00002000,	/* No engine context error messages */
 	A2_NOSHARED =	0x00004000,	/* No bank sharing (also a2_Load().)*/
+	A2_NOJIT =	0x00008000,	/* Don't translate VM code to native */
+	A2_PROFILE =	0x00010000,	/* Enable VM profiling (implies NOJIT) */
+	A2_SUSPENDSILENT = 0x00020000,	/* Don't run units of silent voices */
+	A2_NOSIMD =	0x00040000,	/* Use only scalar DSP code */
+	A2_FLOATPROC =	0x00080000,	/* 32 bit float audio processing */
 
 	A2_INITFLAGS =	0x000fff00,	/* Mask for the flags above */
 
@@ -312,6 +318,14 @@ typedef enum A2_initflags
 	A2_NOREF =	0x40000000	/* Don't count as parent reference */
 } A2_initflags;
 
+/* Oscillator quality levels (A2_PQUALITY) */
+typedef enum A2_quality
+{
+	A2_QLOFI = 0,	/* Linear interpolation; no oversampling */
+	A2_QSTANDARD,	/* Linear interpolation; some oversampling */
+	A2_QHIFI	/* Hermite interpolation; more oversampling */
+} A2_quality;
+
 #ifdef __cplusplus
 };
 #endif
@@ -69,10 +69,20 @@ typedef enum A2_unitflags
 {
 	/* Initialization callback flags */
 	A2_PROCADD =		0x00000001,	/* Adding Process() */
+	A2_PROCFLOAT =		0x00000002,	/* float I/O buffers */
 
 	/* A2_unitdesc flags */
 	A2_MATCHIO =		0x00010000,	/* ninputs == noutputs */
-	A2_XINSERT =		0x00020000	/* Supports xinsert APIs */
+	A2_XINSERT =		0x00020000,	/* Supports xinsert APIs */
+
+	/*
+	 * Output stays silent for as long as the inputs are silent, and the
+	 * control registers are left alone. (Not true for delays, sources of
+	 * external audio, units with control outputs and the like!)
+	 */
+	A2_SUSPENDABLE =	0x00040000,	/* Can be suspended when silent */
+
+	A2_FLOATIO =		0x00080000	/* Supports A2_PROCFLOAT */
 } A2_unitflags;
 
 /*
@@ -99,7 +109,8 @@ typedef enum A2_unitflags
  *	units to handle this by stretching the last segment of the ramp to the
  *	full length of the processing fragment the ramp should end in. This is
  *	still fairly accurate, as processing fragment size is restricted to
- *	A2_MAXFRAGMENT sample frames for cache footprint reasons.
+ *	the fragment size of the state (at most A2_MAXFRAG sample frames) for
+ *	cache footprint reasons.
  *
  *	'duration' is just a target point for ramping, so it may be land way
  *	beyond the end of the next fragment to be processed. Do not rely on it
@@ -171,7 +182,14 @@ typedef void (*A2_udclose_cb)(void *statedata);
  *	begin, and 'frames' specifies how many sample frames to process from
  *	that point on.
  *
- *	'frames' will never be greater than A2_MAXFRAGMENT.
+ *	'frames' will never be greater than the fragment size of the state,
+ *	which is at most A2_MAXFRAG.
+ *
+ *	If the A2_PROCFLOAT flag was passed to the initialization callback,
+ *	the state is using 32 bit float processing (A2_FLOATPROC), and the I/O
+ *	buffers actually hold float samples, where 1.0f corresponds to 1.0 in
+ *	8:24 fixed point. (See A2_FIX2FLOAT.) Units with audio inputs or
+ *	outputs must have the A2_FLOATIO flag to be used in such states.
  */
 typedef void (*A2_process_cb)(A2_unit *u, unsigned offset, unsigned frames);
 
@@ -53,6 +53,8 @@ typedef enum A2_cregisters
 {
 	R_TICK = 0,
 	R_TRANSPOSE,
+	R_PRIORITY,	/* Voice stealing priority (higher is kept longer) */
+	R_POLYPHONY,	/* Max number of subvoices (0: no limit) */
 	A2_CREGISTERS
 } A2_cregisters;
 
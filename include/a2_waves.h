@@ -37,9 +37,9 @@ extern "C" {
  *
  * One-shot waves are padded with zeroes, whereas looped waves are "wrapped."
  *
- * (These values are based on A2_MAXFRAG, the requirements of the interpolators
- * in <Audiality2/dsp.h>, and the mipmapping resamplers of the builtin 'wtosc'
- * unit.)
+ * (These values are based on the fragment size, the requirements of the
+ * interpolators in <Audiality2/dsp.h>, and the mipmapping resamplers of the
+ * builtin 'wtosc' unit.)
  */
 
 /* Number of samples before data[0] needed by interpolators */
@@ -59,9 +59,15 @@ extern "C" {
 /* Number of pad samples before data[0] of any wave, any mip level */
 #define	A2_WAVEPRE	A2_INTERPRE
 
-/* Number of pad samples after data[size - 1] of any wave, any mip level */
-#define	A2_WAVEPOST	\
-		(A2_INTERPOST + ((A2_MAXFRAG * A2_MAXPHINC + 255) >> 8) + 1)
+/*
+ * Number of pad samples after data[size - 1] of any wave, any mip level, for
+ * states processing 'frag' sample frames at a time. Waves are padded for the
+ * fragment size of the state they are created in (see A2_wave_wave), and
+ * A2_WAVEPOST is the worst case; that of A2_MAXFRAG.
+ */
+#define	A2_WAVEPOSTFRAG(frag)	\
+		(A2_INTERPOST + (((frag) * A2_MAXPHINC + 255) >> 8) + 1)
+#define	A2_WAVEPOST	A2_WAVEPOSTFRAG(A2_MAXFRAG)
 
 /*
  * Waveform period for full bandwidth down to 20 Hz fundamental. (The built-in
@@ -89,6 +95,7 @@ typedef struct A2_wave_wave
 {
 	int16_t		*data[A2_MIPLEVELS];	/* One buffer per mip level */
 	unsigned	size[A2_MIPLEVELS];	/* Sizes EXCLUDING pre/post! */
+	unsigned	post;			/* Pad samples after data */
 } A2_wave_wave;
 
 /* A2_object: Waveform with mipmaps */
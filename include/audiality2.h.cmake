@@ -46,8 +46,19 @@ extern "C" {
 /* Current version */
 #define	A2_VERSION	A2_MAKE_VERSION(@VERSION_MAJOR@, @VERSION_MINOR@, @VERSION_PATCH@, @VERSION_BUILD@)
 
-/* Maximum number of sample frames to process at a time */
-#define	A2_MAXFRAG		64
+/*
+ * Default and maximum number of sample frames to process at a time. The actual
+ * fragment size is selected per state, through the 'fragment' field of the
+ * A2_config. (See A2_PFRAGMENT.)
+ *
+ * NOTE:
+ *	A2_MAXFRAG used to be the fixed fragment size, 64, which is now
+ *	A2_DEFAULTFRAG. Code that sizes buffers with A2_MAXFRAG keeps working,
+ *	but gets buffers eight times the size of the default fragment. Use
+ *	A2_PFRAGMENT to get the fragment size of a state.
+ */
+#define	A2_DEFAULTFRAG		64
+#define	A2_MAXFRAG		512
 
 /* Minimum size of the blocks allocated by a2_AllocBlock() */
 #define	A2_BLOCK_SIZE		384
@@ -345,6 +356,32 @@ A2_handle a2_NewBank(A2_interface *i, const char *name, int flags);
 A2_handle a2_LoadString(A2_interface *i, const char *code, const char *name);
 A2_handle a2_Load(A2_interface *i, const char *fn, unsigned flags);
 
+/*
+ * Named compile time constant, for a2_LoadConst() and a2_LoadStringConst().
+ * (End array with { NULL, 0 }!)
+ */
+typedef struct A2_constdef
+{
+	const char	*name;		/* Symbol name */
+	double		value;		/* Value */
+} A2_constdef;
+
+/*
+ * Like a2_Load() and a2_LoadString(), except that the names in 'constants'
+ * are defined as values in the root namespace of the script being compiled.
+ * As these are compile time constants, they can be used to select code in
+ * 'if' statements and the like without any runtime overhead. For example, a
+ * bank can be loaded once per quality level, with no runtime tests. If
+ * 'constants' is NULL, these calls are equivalent to the plain versions.
+ *
+ * NOTE:
+ *	The constants are not passed on to banks imported by the script.
+ */
+A2_handle a2_LoadStringConst(A2_interface *i, const char *code,
+		const char *name, const A2_constdef *constants);
+A2_handle a2_LoadConst(A2_interface *i, const char *fn, unsigned flags,
+		const A2_constdef *constants);
+
 /*
  * Create a constant object of 'value'. Returns the handle of the constant
  * object, or a negative error code.
@@ -400,12 +437,47 @@ int a2_Run(A2_interface *i, unsigned frames);
  * 'length' is 0, when the output is silent.
  *
  * Returns number of sample frames rendered, or a negated A2_errors error code.
+ *
+ * NOTE:
+ *	Several threads may call this concurrently on the same master state,
+ *	provided each call writes to a different stream. No other API calls
+ *	may be made on the master state while this is going on, except for
+ *	calls on objects that only the calling thread is using.
  */
 int a2_Render(A2_interface *i,
 		A2_handle stream,
 		unsigned samplerate, unsigned length, A2_property *props,
 		A2_handle program, unsigned argc, int *argv);
 
+/* Render job for a2_RenderBatch() */
+typedef struct A2_renderjob
+{
+	/* Arguments for a2_Render() */
+	A2_handle	stream;
+	unsigned	samplerate;
+	unsigned	length;
+	A2_property	*props;
+	A2_handle	program;
+	unsigned	argc;
+	int		*argv;
+
+	/* Result from a2_Render() */
+	int		result;
+} A2_renderjob;
+
+/*
+ * Run the 'count' render jobs in 'jobs' as if by calling a2_Render() for each
+ * one of them, using up to 'threads' threads, including the calling thread.
+ * (0 or 1 renders all jobs on the calling thread.) Jobs are handed out in
+ * order, to whichever thread is available first. The result of each job is
+ * written to its 'result' field.
+ *
+ * Returns when all jobs are done. The return value is the number of jobs that
+ * failed, or a negated A2_errors error code, if no jobs could be run.
+ */
+int a2_RenderBatch(A2_interface *i, A2_renderjob *jobs, unsigned count,
+		unsigned threads);
+
 
 /*---------------------------------------------------------
 	Objects and exports
@@ -486,7 +558,10 @@ typedef A2_errors (*A2_xinsert_cb)(int32_t **buffers, unsigned nbuffers,
  * setting up callbacks to tap, inject, and process audio, respectively. The
  * callbacks will be called by the Process() method of the first unit that
  * supports this mechanism, found in the specified voice. These callbacks will
- * never be called with a 'frames' argument greater than A2_MAXFRAG.
+ * never be called with a 'frames' argument greater than the fragment size of the
+ * state (A2_PFRAGMENT), which is at most A2_MAXFRAG. Units that run callbacks
+ * through intermediate buffers split larger fragments, calling them with at
+ * most A2_DEFAULTFRAG frames at a time.
  *
  * The root voice, and groups created with a2_NewGroup(), have an 'xinsert'
  * unit last in their voice structures, so they support this API by default. To
@@ -577,6 +652,55 @@ A2_handle a2_OpenSource(A2_interface *i, A2_handle voice,
 		int channel, int size, unsigned flags);
 
 
+/*---------------------------------------------------------
+	VM profiling
+---------------------------------------------------------*/
+
+/*
+ * Counters for one function of a program. Function 0 is the main program; the
+ * other indices are local functions and message handlers.
+ */
+typedef struct A2_profentry
+{
+	A2_handle	program;	/* Program handle (-1: unaccounted) */
+	unsigned	func;		/* Function index */
+	uint64_t	instructions;	/* VM instructions executed */
+	uint64_t	calls;		/* Calls, and messages handled */
+	uint64_t	spawns;		/* Voices started (function 0 only) */
+} A2_profentry;
+
+/*
+ * Get the VM profiling counters accumulated since the state was opened, or
+ * since the last a2_ResetProfile(). Profiling is enabled by opening the state
+ * with the A2_PROFILE flag.
+ *
+ * Up to 'max' entries are written to 'entries', sorted by the number of
+ * instructions executed, in descending order. If the engine has run out of
+ * counter slots at some point, the instructions executed without a slot are
+ * reported in an entry with program -1.
+ *
+ * Returns the total number of entries available, or a negated error code.
+ *
+ * NOTE:
+ *	Counters are passed from the engine to the API at the end of each
+ *	engine cycle, and are not visible to the API until they have been
+ *	received by a2_PumpMessages(), which is done by these calls.
+ */
+int a2_GetProfile(A2_interface *i, A2_profentry *entries, unsigned max);
+
+/*
+ * Get per opcode VM instruction counts. Up to 'max' counters are written to
+ * 'counts', indexed by opcode. Returns the total number of opcodes, or a
+ * negated error code. a2_InstructionName() returns the name of an opcode, or
+ * NULL if 'opcode' is out of range.
+ */
+int a2_GetInstructionProfile(A2_interface *i, uint64_t *counts, unsigned max);
+const char *a2_InstructionName(unsigned opcode);
+
+/* Clear all VM profiling counters */
+A2_errors a2_ResetProfile(A2_interface *i);
+
+
 /*---------------------------------------------------------
 	Utilities
 ---------------------------------------------------------*/
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "internals.h"
+#include "workers.h"
 #include "compiler.h"
 #include "wtosc.h"
 #include "inline.h"
@@ -46,7 +47,7 @@ static void a2_CloseState(A2_state *st);
 	Error handling
 ---------------------------------------------------------*/
 
-A2_errors a2_last_error = A2_OK;
+A2_THREADLOCAL A2_errors a2_last_error = A2_OK;
 
 A2_errors a2_LastError(void)
 {
@@ -215,6 +216,13 @@ static A2_errors a2_OpenSharedState(A2_state *st)
 	st->ss = (A2_sharedstate *)calloc(1, sizeof(A2_sharedstate));
 	if(!st->ss)
 		return A2_OOMEMORY;
+	st->ss->wavepost = A2_WAVEPOSTFRAG(st->fragment);
+	if((res = a2_MutexOpen(&st->ss->statelock)))
+	{
+		free(st->ss);
+		st->ss = NULL;
+		return res;
+	}
 
 	/* Set up state property defaults */
 	st->ss->offlinebuffer = 256;
@@ -277,6 +285,7 @@ static A2_errors a2_OpenSharedState(A2_state *st)
 			"	}\n"
 			"	2(V) { vol V; ramp vol 100 }\n"
 			"	3(PX PY PZ) { pan PX; ramp pan 100 }\n"
+			"	4(N) { poly N }\n"
 			"}\n"
 			"\n"
 			"export a2_rootdriver_mono()\n"
@@ -288,6 +297,7 @@ static A2_errors a2_OpenSharedState(A2_state *st)
 			"	}\n"
 			"	2(V) { vol V; ramp vol 100 }\n"
 			"	3(PX PY PZ) { pan PX; ramp pan 100 }\n"
+			"	4(N) { poly N }\n"
 			"}\n"
 			"\n"
 			"export a2_groupdriver()\n"
@@ -299,6 +309,7 @@ static A2_errors a2_OpenSharedState(A2_state *st)
 			"	}\n"
 			"	2(V) { vol V; ramp vol 100 }\n"
 			"	3(PX PY PZ) { pan PX; ramp pan 100 }\n"
+			"	4(N) { poly N }\n"
 			"}\n"
 			"\n"
 			"export a2_terminator() {}\n", "rootbank")))
@@ -313,6 +324,19 @@ static A2_errors a2_OpenSharedState(A2_state *st)
 			"a2_groupdriver")))
 		return A2_INTERNAL + 6;
 
+	/* Drivers that may distribute their subvoices over render lanes */
+	for(j = 0; j < 3; ++j)
+	{
+		static const char *pdrivers[] = {
+			"a2_rootdriver", "a2_rootdriver_mono", "a2_groupdriver"
+		};
+		A2_program *p = a2_GetProgram(st,
+				a2_Get(i, A2_ROOTBANK, pdrivers[j]));
+		if(!p)
+			return A2_INTERNAL + 7;
+		p->vflags |= A2_PARALLEL;
+	}
+
 	return A2_OK;
 }
 
@@ -322,6 +346,7 @@ static void a2_CloseSharedState(A2_state *st)
 		return;
 	type_registry_cleanup(st);
 	rchm_Cleanup(&st->ss->hm);
+	a2_MutexClose(&st->ss->statelock);
 	free(st->ss->units);
 	free(st->ss);
 	st->ss = NULL;
@@ -406,7 +431,15 @@ static A2_state *a2_Open0(A2_config *config)
 static A2_errors a2_Open2(A2_state *st)
 {
 	A2_errors res;
-	int i;
+	int i, c;
+
+	/* Processing fragment size, and memory blocks sized to match */
+	if(!st->config->fragment)
+		st->config->fragment = A2_DEFAULTFRAG;
+	if((st->config->fragment < 1) || (st->config->fragment > A2_MAXFRAG))
+		return A2_VALUERANGE;
+	st->fragment = st->config->fragment;
+	st->blocksize = A2_BLOCKSIZE(st->fragment);
 
 	/* We set up initial pools by default for realtime states! */
 	if(st->config->flags & A2_REALTIME)
@@ -428,7 +461,7 @@ static A2_errors a2_Open2(A2_state *st)
 	/* Prepare memory block pool */
 	for(i = 0; i < st->config->blockpool; ++i)
 	{
-		A2_block *b = st->sys->RTAlloc(st->sys, sizeof(A2_block));
+		A2_block *b = st->sys->RTAlloc(st->sys, st->blocksize);
 		if(!b)
 			return A2_OOMEMORY;
 		b->next = st->blockpool;
@@ -439,19 +472,31 @@ static A2_errors a2_Open2(A2_state *st)
 	if(!(st->master = a2_AllocBus(st, st->config->channels)))
 		return A2_OOMEMORY;
 
-	/* Prepare initial voice pool */
-	for(i = 0; i < st->config->voicepool; ++i)
-	{
-		A2_voice *v = a2_VoiceAlloc(st);
-		if(!v)
-			return A2_OOMEMORY;
-		v->next = st->voicepool;
-		st->voicepool = v;
-	}
+	/* Prepare initial voice pool, spread over the size classes */
+	for(c = 0; c < A2_VOICECLASSES; ++c)
+		for(i = 0; i < st->config->voicepool >> (2 * c); ++i)
+		{
+			A2_voice *v = a2_VoiceAlloc(st, c);
+			if(!v)
+				return A2_OOMEMORY;
+			v->next = st->voicepool[c];
+			st->voicepool[c] = v;
+		}
 
 	/* Initialize the realtime control API */
 	if((res = a2_OpenAPI(st)))
 		return res;
+
+	/* Fill the pool reserves (Refilled by the API context as needed) */
+	if(st->config->flags & A2_REALTIME)
+	{
+		st->reserve[A2_BLOCKPOOL].size = A2_RESERVEBLOCKS;
+		st->reserve[A2_EVENTPOOL].size = A2_RESERVEEVENTS;
+		st->reserve[A2_VOICEPOOL].size = A2_RESERVEVOICES;
+	}
+	for(i = 0; i < A2_NPOOLS; ++i)
+		if((res = a2_FillReserve(st, i, st->reserve[i].size)))
+			return res;
 	st->now_ticks = a2_GetTicks();
 	st->now_micros = st->avgstart = a2_GetMicros();
 
@@ -481,14 +526,25 @@ static A2_errors a2_Open2(A2_state *st)
 		st->unitstate = malloc(sizeof(A2_unitstate) * st->ss->nunits);
 		if(!st->unitstate)
 			return A2_OOMEMORY;
+		/* Some units refcount process-wide data here! */
+		a2_MutexLock(&st->ss->statelock);
 		for(i = 0; i < st->ss->nunits; ++i)
 			a2_UnitOpenState(st, i);
+		a2_MutexUnlock(&st->ss->statelock);
 	}
 
 	/* Initialize RNGs for noise and RAND instructions */
 	st->randstate = A2_DEFAULT_RANDSEED;
 	st->noisestate = A2_DEFAULT_NOISESEED;
 
+	/* Oscillator quality; no CPU load adaptation by default */
+	st->quality = st->maxquality = A2_DEFAULTQUALITY;
+
+	/* SIMD DSP code, unless disabled */
+	if(!(st->config->flags & A2_NOSIMD))
+		st->simd = a2_CPUFeatures();
+	st->dsp = a2_DSPFuncs(st->simd);
+
 	/* Initialize stats */
 	st->tsstatreset = 1;
 	st->tsmin = INT32_MAX;
@@ -574,6 +630,8 @@ A2_interface *a2_OpenVersion(A2_config *config, unsigned headerversion)
 		printf("A2_event:\t%d\n", sizeof(A2_event));
 		printf("A2_apimessage:\t%d\n", sizeof(A2_apimessage));
 		printf("A2_voice:\t%d\n", sizeof(A2_voice));
+		printf("A2_VOICESIZE():\t%d..%d\n", (int)A2_VOICESIZE(0),
+				(int)A2_VOICESIZE(A2_VOICECLASSES - 1));
 		printf("A2_block:\t%d\n", sizeof(A2_block));
 		printf("A2_unit:\t%d\n", sizeof(A2_unit));
 		printf("A2_unitdesc:\t%d\n", sizeof(A2_unitdesc));
@@ -660,13 +718,18 @@ A2_interface *a2_SubState(A2_interface *parent, A2_config *config)
 	 */
 	config->flags |= A2_SUBSTATE;
 
+	/* Waves are shared, and padded for the fragment size of the master */
+	config->fragment = pst->config->fragment;
+
 	if(!(st = a2_Open0(config)))
 		return NULL;
 
 	/* Link the substate to the master state */
 	st->parent = pst;
+	a2_MutexLock(&pst->ss->statelock);
 	st->next = pst->next;
 	pst->next = st;
+	a2_MutexUnlock(&pst->ss->statelock);
 
 	if((res = a2_Open2(st)))
 	{
@@ -711,6 +774,30 @@ void a2_Close(A2_interface *i)
 }
 
 
+/*
+ * Unlink substate 'st' from its master state, so that no other states will
+ * try to lock it, or send messages to it. 'st->parent' is left in place.
+ */
+static void a2_DetachSubstate(A2_state *st)
+{
+	A2_state *s, *ps = NULL;
+	if(!st->parent)
+		return;
+	a2_MutexLock(&st->parent->ss->statelock);
+	for(s = st->parent->next; s; ps = s, s = s->next)
+		if(s == st)
+		{
+			if(ps)
+				ps->next = st->next;
+			else
+				st->parent->next = st->next;
+			break;
+		}
+	st->next = NULL;
+	a2_MutexUnlock(&st->parent->ss->statelock);
+}
+
+
 static void a2_CloseState(A2_state *st)
 {
 	A2_interface *i = st->interfaces ? &(st->interfaces->interface): NULL;
@@ -752,6 +839,13 @@ static void a2_CloseState(A2_state *st)
 			a2_UnloadAll(i);
 	}
 
+	/*
+	 * Detach substates before the final message pump, as other threads may
+	 * otherwise send messages (a2_WhenAllHaveProcessed()) that are never
+	 * processed.
+	 */
+	a2_DetachSubstate(st);
+
 	/* Handle engine/RT error messages, handle release notifications etc */
 	if(st->fromapi)
 		a2r_PumpEngineMessages(st, st->now_frames);
@@ -767,7 +861,15 @@ static void a2_CloseState(A2_state *st)
 	{
 		RCHM_handleinfo *hi = rchm_Get(&st->ss->hm, st->rootvoice);
 		if(hi && hi->d.data)
+		{
+			/*
+			 * We free the handle right here, so no A2MT_DETACH!
+			 * It would arrive after the handle has been freed,
+			 * and possibly reused by another thread.
+			 */
+			((A2_voice *)hi->d.data)->flags &= ~A2_APIHANDLE;
 			a2_VoiceFree(st, (A2_voice **)&hi->d.data);
+		}
 		rchm_Free(&st->ss->hm, st->rootvoice);
 	}
 
@@ -778,29 +880,40 @@ static void a2_CloseState(A2_state *st)
 	if(i && st->toapi)
 		a2_PumpMessages(i);
 
+	/* Lanes hand their pools back to us, so this goes before the pools! */
+	a2_CloseWorkers(st);
+
 	for(j = 0; j < A2_NESTLIMIT; ++j)
+	{
 		if(st->scratch[j])
 			a2_FreeBus(st, st->scratch[j]);
+		if(st->fadebus[j])
+			a2_FreeBus(st, st->fadebus[j]);
+	}
 	if(st->master)
 		a2_FreeBus(st, st->master);
-	while(st->voicepool)
-	{
-		A2_voice *v = st->voicepool;
-		st->voicepool = v->next;
-		st->sys->RTFree(st->sys, v);
-	}
+	for(j = 0; j < A2_VOICECLASSES; ++j)
+		while(st->voicepool[j])
+		{
+			A2_voice *v = st->voicepool[j];
+			st->voicepool[j] = v->next;
+			st->sys->RTFree(st->sys, v);
+		}
 	while(st->blockpool)
 	{
 		A2_block *b = st->blockpool;
 		st->blockpool = b->next;
 		st->sys->RTFree(st->sys, b);
 	}
+	a2_FreeReserves(st);
 
 	/* Close any unit shared state for this engine state */
 	if(st->unitstate)
 	{
+		a2_MutexLock(&st->ss->statelock);
 		for(j = 0; j < st->ss->nunits; ++j)
 			a2_UnitCloseState(st, j);
+		a2_MutexUnlock(&st->ss->statelock);
 		free(st->unitstate);
 	}
 
@@ -816,26 +929,6 @@ static void a2_CloseState(A2_state *st)
 		st->config->interface = NULL;
 	st->config = NULL;
 
-	/* Detach from master state, if any */
-	if(st->parent)
-	{
-		A2_state *s = st->parent->next;
-		A2_state *ps = NULL;
-		while(s)
-		{
-			if(s == st)
-			{
-				if(ps)
-					ps->next = st->next;
-				else
-					st->parent->next = st->next;
-				break;
-			}
-			ps = s;
-			s = s->next;
-		}
-	}
-
 	/* Detach from interfaces, if any, and close any A2_AUTOCLOSE ones */
 	while(st->interfaces)
 	{
@@ -26,6 +26,7 @@
 #include <string.h>
 #include "internals.h"
 #include "compiler.h"
+#include "vmjit.h"
 
 
 /*---------------------------------------------------------
@@ -72,8 +73,15 @@ static RCHM_errors a2_ProgramDestructor(RCHM_handleinfo *hi, void *ti,
 		p->wires = pp->next;
 		free(pp);
 	}
+	free(p->plan);
+	free(p->cregs);
 	for(i = 0; i < p->nfuncs; ++i)
+	{
 		free(p->funcs[i].code);
+#ifdef A2_VM_JIT
+		a2_FreeNative(p->funcs[i].native);
+#endif
+	}
 	free(p->funcs);
 	free(p);
 	return RCHM_OK;
@@ -155,13 +163,19 @@ A2_handle a2_NewBank(A2_interface *i, const char *name, int flags)
 	Loading and compiling scripts
 ---------------------------------------------------------*/
 
-A2_handle a2_LoadString(A2_interface *i, const char *code, const char *name)
+A2_handle a2_LoadStringConst(A2_interface *i, const char *code,
+		const char *name, const A2_constdef *constants)
 {
 	int res;
 	A2_handle h;
 	A2_compiler *c;
 	if(!(c = a2_OpenCompiler(i, 0)))
 		return -A2_OOMEMORY;
+	if((res = a2_AddConstants(c, constants)) != A2_OK)
+	{
+		a2_CloseCompiler(c);
+		return -res;
+	}
 	if((h = a2_NewBank(i, name, A2_APIOWNED)) < 0)
 	{
 		a2_CloseCompiler(c);
@@ -178,7 +192,14 @@ A2_handle a2_LoadString(A2_interface *i, const char *code, const char *name)
 }
 
 
-A2_handle a2_Load(A2_interface *i, const char *fn, unsigned flags)
+A2_handle a2_LoadString(A2_interface *i, const char *code, const char *name)
+{
+	return a2_LoadStringConst(i, code, name, NULL);
+}
+
+
+A2_handle a2_LoadConst(A2_interface *i, const char *fn, unsigned flags,
+		const A2_constdef *constants)
 {
 	int res;
 	A2_handle h;
@@ -206,6 +227,12 @@ A2_handle a2_Load(A2_interface *i, const char *fn, unsigned flags)
 		free(fnx);
 		return -A2_OOMEMORY;
 	}
+	if((res = a2_AddConstants(c, constants)) != A2_OK)
+	{
+		free(fnx);
+		a2_CloseCompiler(c);
+		return -res;
+	}
 	if((h = a2_NewBank(i, fn, A2_APIOWNED)) < 0)
 	{
 		free(fnx);
@@ -225,6 +252,12 @@ A2_handle a2_Load(A2_interface *i, const char *fn, unsigned flags)
 }
 
 
+A2_handle a2_Load(A2_interface *i, const char *fn, unsigned flags)
+{
+	return a2_LoadConst(i, fn, flags, NULL);
+}
+
+
 /*---------------------------------------------------------
 	Constants
 ---------------------------------------------------------*/
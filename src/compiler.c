@@ -32,6 +32,7 @@ WARNING: Calls with the a2c_ prefix MUST ONLY be used with a2_Try()!
 #include <string.h>
 #include <math.h>
 #include "compiler.h"
+#include "vmjit.h"
 #include "units/inline.h"
 
 
@@ -86,16 +87,25 @@ static void a2_DumpLine(A2_compiler *c, int pos, int mark, FILE *f)
 
 
 #define	A2_DI(x)	#x,
+#define	A2_CI(x)	#x "C",
 static const char *a2_insnames[A2_OPCODES] = {
 	/* Program flow control */
 	"END",
 	A2_ALLINSTRUCTIONS
 };
+#undef	A2_CI
 #undef	A2_DI
 
+const char *a2_InstructionName(unsigned opcode)
+{
+	if(opcode >= A2_OPCODES)
+		return NULL;
+	return a2_insnames[opcode];
+}
+
 
 static const char *a2_regnames[A2_CREGISTERS] = {
-	"TICK",	"TR"
+	"TICK",	"TR",	"PRI",	"POLY"
 };
 
 
@@ -108,10 +118,24 @@ static void a2_PrintRegName(unsigned r, FILE *stream)
 }
 
 
-unsigned a2_InsSize(A2_opcodes op)
+/* Translate control register write variants to the plain instructions */
+A2_opcodes a2_PlainOp(A2_opcodes op)
 {
 	switch(op)
 	{
+#define	A2_CI(x)	case OP_##x##C: return OP_##x;
+	A2_CONTROLWRITES
+#undef	A2_CI
+	  default:
+		return op;
+	}
+}
+
+
+unsigned a2_InsSize(A2_opcodes op)
+{
+	switch(a2_PlainOp(op))
+	{
 	  case OP_DELAY:
 	  case OP_TDELAY:
 	  case OP_LOAD:
@@ -124,6 +148,19 @@ unsigned a2_InsSize(A2_opcodes op)
 	  case OP_DEBUG:
 	  case OP_RAMP:
 	  case OP_RAMPALL:
+	  case OP_LDADD:
+	  case OP_GRJZ:
+	  case OP_LRJZ:
+	  case OP_GERJZ:
+	  case OP_LERJZ:
+	  case OP_EQRJZ:
+	  case OP_NERJZ:
+	  case OP_GRJNZ:
+	  case OP_LRJNZ:
+	  case OP_GERJNZ:
+	  case OP_LERJNZ:
+	  case OP_EQRJNZ:
+	  case OP_NERJNZ:
 		return 2;
 	  default:
 		return 1;
@@ -135,20 +172,25 @@ void a2_DumpIns(unsigned *code, unsigned pc, FILE *stream)
 {
 	A2_instruction *ins = (A2_instruction *)(code + pc);
 	fprintf(stream, "%6d: %-8.8s", pc, a2_insnames[ins->opcode]);
-	switch((A2_opcodes)ins->opcode)
+	switch(a2_PlainOp(ins->opcode))
 	{
 	  /* No arguments */
 	  case OP_END:
 	  case OP_RETURN:
 	  case OP_SLEEP:
+	  case OP_DORMANT:
 	  case OP_KILLA:
 	  case OP_DETACHA:
 	  case OP_INITV:
 	  case OP_SETALL:
 	  case A2_OPCODES:	/* (Warning eliminator) */
+	  default:
 		break;
-	  /* <integer(a2)> */
+	  /* <target(pc + a2)> */
 	  case OP_JUMP:
+		fprintf(stream, "%d", pc + (int16_t)ins->a2);
+		break;
+	  /* <integer(a2)> */
 	  case OP_WAKE:
 	  case OP_FORCE:
 	  case OP_SENDA:
@@ -192,7 +234,7 @@ void a2_DumpIns(unsigned *code, unsigned pc, FILE *stream)
 		a2_PrintRegName(ins->a1, stream);
 		fprintf(stream, " %f", ins->a3 / 65536.0f);
 		break;
-	  /* <register(a1), integer(a2)> */
+	  /* <register(a1), target(pc + a2)> */
 	  case OP_LOOP:
 	  case OP_JZ:
 	  case OP_JNZ:
@@ -200,6 +242,10 @@ void a2_DumpIns(unsigned *code, unsigned pc, FILE *stream)
 	  case OP_JL:
 	  case OP_JGE:
 	  case OP_JLE:
+		a2_PrintRegName(ins->a1, stream);
+		fprintf(stream, " %d", pc + (int16_t)ins->a2);
+		break;
+	  /* <register(a1), integer(a2)> */
 	  case OP_SPAWNV:
 		a2_PrintRegName(ins->a1, stream);
 		fprintf(stream, " %d", ins->a2);
@@ -240,10 +286,46 @@ void a2_DumpIns(unsigned *code, unsigned pc, FILE *stream)
 	  case OP_XORR:
 	  case OP_NOTR:
 	  case OP_RAMPR:
+	  case OP_PUSH2R:
 		a2_PrintRegName(ins->a1, stream);
 		fprintf(stream, " ");
 		a2_PrintRegName(ins->a2, stream);
 		break;
+	  /* <register(a1), register(a2 & 0xff), register(a2 >> 8)> */
+	  case OP_LDADDR:
+	  case OP_LDSUBR:
+	  case OP_LDMULR:
+		a2_PrintRegName(ins->a1, stream);
+		fprintf(stream, " ");
+		a2_PrintRegName(ins->a2 & 0xff, stream);
+		fprintf(stream, " ");
+		a2_PrintRegName(ins->a2 >> 8, stream);
+		break;
+	  /* <register(a1), register(a2), 16:16(a3)> */
+	  case OP_LDADD:
+		a2_PrintRegName(ins->a1, stream);
+		fprintf(stream, " ");
+		a2_PrintRegName(ins->a2, stream);
+		fprintf(stream, " %f", ins->a3 / 65536.0f);
+		break;
+	  /* <register(a1), register(a3), target(pc + a2)> */
+	  case OP_GRJZ:
+	  case OP_LRJZ:
+	  case OP_GERJZ:
+	  case OP_LERJZ:
+	  case OP_EQRJZ:
+	  case OP_NERJZ:
+	  case OP_GRJNZ:
+	  case OP_LRJNZ:
+	  case OP_GERJNZ:
+	  case OP_LERJNZ:
+	  case OP_EQRJNZ:
+	  case OP_NERJNZ:
+		a2_PrintRegName(ins->a1, stream);
+		fprintf(stream, " ");
+		a2_PrintRegName(ins->a3, stream);
+		fprintf(stream, " %d", pc + (int16_t)ins->a2);
+		break;
 	}
 	fprintf(stream, "\n");
 }
@@ -271,8 +353,8 @@ static inline void a2_DumpFunction(A2_program *p, unsigned fn, FILE *stream,
 			fprintf(stream, "%g ", f->argdefs[j] / 65536.0f);
 		fprintf(stream, "\n");
 	}
-	fprintf(stream, "%s | size: %d; topreg: %d\n", prefix,
-			f->size, f->topreg);
+	fprintf(stream, "%s | size: %d; topreg: %d; fused: %d\n", prefix,
+			f->size, f->topreg, f->fused);
 	fprintf(stream, "%s |\n", prefix);
 	for(j = 0; j < f->size; )
 	{
@@ -288,7 +370,7 @@ static inline void a2_DumpFunction(A2_program *p, unsigned fn, FILE *stream,
 A2_errors a2_DumpCode(A2_interface *i, A2_handle h, FILE *stream,
 		const char *prefix)
 {
-	int j;
+	int j, fused;
 	A2_interface_i *ii = (A2_interface_i *)i;
 	A2_state *st = ii->state;
 	A2_program *p;
@@ -320,6 +402,10 @@ A2_errors a2_DumpCode(A2_interface *i, A2_handle h, FILE *stream,
 					prefix, j);
 			a2_DumpFunction(p, j, stream, prefix);
 		}
+	for(j = fused = 0; j < p->nfuncs; ++j)
+		fused += p->funcs[j].fused;
+	fprintf(stream, "%s  %d instructions eliminated by fusion\n", prefix,
+			fused);
 	return A2_OK;
 }
 
@@ -481,6 +567,266 @@ static void a2c_AddDependency(A2_compiler *c, A2_handle h)
 }
 
 
+/*---------------------------------------------------------
+	Peephole optimizer
+---------------------------------------------------------*/
+
+/*
+ * Encode a branch from position 'pos' to position 'to' as a PC relative
+ * offset, for the a2 field of a branch instruction.
+ */
+static inline unsigned a2c_BranchOffset(A2_compiler *c, int pos, int to)
+{
+	int d = to - pos;
+	if((d < -32768) || (d > 32767))
+		a2c_Throw(c, A2_BADJUMP);
+	return d & 0xffff;
+}
+
+
+/*
+ * Returns "true" if 'op' is a local branch, with the target position in a2,
+ * relative to the position of the branch instruction.
+ */
+static inline int a2c_IsBranch(unsigned op)
+{
+	switch((A2_opcodes)op)
+	{
+	  case OP_JUMP:
+	  case OP_LOOP:
+	  case OP_JZ:
+	  case OP_JNZ:
+	  case OP_JG:
+	  case OP_JL:
+	  case OP_JGE:
+	  case OP_JLE:
+	  case OP_GRJZ:
+	  case OP_LRJZ:
+	  case OP_GERJZ:
+	  case OP_LERJZ:
+	  case OP_EQRJZ:
+	  case OP_NERJZ:
+	  case OP_GRJNZ:
+	  case OP_LRJNZ:
+	  case OP_GERJNZ:
+	  case OP_LERJNZ:
+	  case OP_EQRJNZ:
+	  case OP_NERJNZ:
+		return 1;
+	  default:
+		return 0;
+	}
+}
+
+
+/*
+ * Try to fuse instructions 'i1' and 'i2' into 'out'. Returns 1 if a fused
+ * instruction was generated, otherwise 0.
+ *
+ * NOTE:
+ *	The fused instruction must do exactly what the original pair did, as
+ *	we have no idea what registers are live after the pair!
+ */
+static int a2c_Fuse(A2_instruction *i1, A2_instruction *i2,
+		A2_instruction *out)
+{
+	/* Control register writes are fused into control register writes */
+	A2_opcodes op1 = a2_PlainOp(i1->opcode);
+	A2_opcodes op2 = a2_PlainOp(i2->opcode);
+	int ctrl = (op1 != i1->opcode);
+	if((op2 != i2->opcode) != ctrl)
+		return 0;
+	switch(op1)
+	{
+	  case OP_LOAD:
+		/* LOAD + ADD ==> LOAD */
+		if((op2 != OP_ADD) || (i2->a1 != i1->a1))
+			return 0;
+		*out = *i1;
+		out->a3 = (unsigned)i1->a3 + (unsigned)i2->a3;
+		return 1;
+	  case OP_LOADR:
+		/* LOADR + ADDR/SUBR/MULR/ADD ==> LDADDR/LDSUBR/LDMULR/LDADD */
+		if(i2->a1 != i1->a1)
+			return 0;
+		switch(op2)
+		{
+		  case OP_ADDR:
+			out->opcode = ctrl ? OP_LDADDRC : OP_LDADDR;
+			break;
+		  case OP_SUBR:
+			out->opcode = ctrl ? OP_LDSUBRC : OP_LDSUBR;
+			break;
+		  case OP_MULR:
+			out->opcode = ctrl ? OP_LDMULRC : OP_LDMULR;
+			break;
+		  case OP_ADD:
+			out->opcode = ctrl ? OP_LDADDC : OP_LDADD;
+			out->a1 = i1->a1;
+			out->a2 = i1->a2;
+			out->a3 = i2->a3;
+			return 1;
+		  default:
+			return 0;
+		}
+		out->a1 = i1->a1;
+		out->a2 = i1->a2 | (i2->a2 << 8);
+		return 1;
+	  case OP_GR:
+	  case OP_LR:
+	  case OP_GER:
+	  case OP_LER:
+	  case OP_EQR:
+	  case OP_NER:
+		/* <comparison> + JZ/JNZ ==> <comparison>JZ/<comparison>JNZ */
+		if(ctrl || (i2->a1 != i1->a1))
+			return 0;
+		if(i2->opcode == OP_JZ)
+			out->opcode = OP_GRJZ + i1->opcode - OP_GR;
+		else if(i2->opcode == OP_JNZ)
+			out->opcode = OP_GRJNZ + i1->opcode - OP_GR;
+		else
+			return 0;
+		out->a1 = i1->a1;
+		out->a2 = i2->a2;
+		out->a3 = i1->a2;
+		return 1;
+	  case OP_PUSHR:
+		/* PUSHR + PUSHR ==> PUSH2R */
+		if(i2->opcode != OP_PUSHR)
+			return 0;
+		out->opcode = OP_PUSH2R;
+		out->a1 = i1->a1;
+		out->a2 = i2->a1;
+		return 1;
+	  default:
+		return 0;
+	}
+}
+
+
+/*
+ * Scan the handlers of program 'p' for WAKE and FORCE instructions, which
+ * target positions in the main function. If 'relocate' is 0, the target
+ * positions are flagged in 'map', otherwise they are relocated through 'map'.
+ */
+static void a2c_MapWake(A2_program *p, unsigned *map, unsigned end,
+		int relocate)
+{
+	int f;
+	unsigned i;
+	for(f = 1; f < p->nfuncs; ++f)
+	{
+		A2_function *fn = &p->funcs[f];
+		A2_instruction *ins;
+		if(!fn->code)
+			continue;
+		for(i = 0; i < fn->size; i += a2_InsSize(ins->opcode))
+		{
+			ins = (A2_instruction *)(fn->code + i);
+			if((ins->opcode != OP_WAKE) && (ins->opcode != OP_FORCE))
+				continue;
+			if(ins->a2 > end)
+				continue;
+			if(relocate)
+				ins->a2 = map[ins->a2];
+			else
+				map[ins->a2] = 1;
+		}
+	}
+}
+
+
+/*
+ * Replace common instruction pairs in the code of coder 'cdr' with fused
+ * instructions, and relocate branches accordingly. Pairs are never fused if
+ * the second instruction is a branch target.
+ *
+ * NOTE:
+ *	Code is only fused when there are no pending fixups, as those would end
+ *	up pointing at the wrong instructions.
+ */
+static void a2c_Peephole(A2_compiler *c, A2_coder *cdr)
+{
+	A2_program *p = cdr->program;
+	A2_function *fn = p->funcs + cdr->func;
+	unsigned *code = cdr->code;
+	unsigned end = cdr->pos;
+	unsigned i, o, *map, *target, *dest;
+	A2_instruction *ins;
+	A2_symbol *s;
+	int fused = 0;
+	fn->fused = 0;
+	if(!end)
+		return;
+	for(s = c->symbols; s; s = s->next)
+		if(s->fixups)
+			return;
+	if(!(map = (unsigned *)calloc(3 * (end + 1), sizeof(unsigned))))
+		a2c_Throw(c, A2_OOMEMORY);
+	target = map + end + 1;
+	dest = target + end + 1;
+
+	/* Find branch targets, keeping absolute positions in 'dest' */
+	for(i = 0; i < end; i += a2_InsSize(ins->opcode))
+	{
+		ins = (A2_instruction *)(code + i);
+		if(!a2c_IsBranch(ins->opcode))
+			continue;
+		dest[i] = i + (int16_t)ins->a2;
+		if(dest[i] <= end)
+			target[dest[i]] = 1;
+	}
+	if(!cdr->func)
+		a2c_MapWake(p, target, end, 0);
+
+	/* Fuse instructions, building an old => new position map */
+	for(i = o = 0; i < end; )
+	{
+		A2_instruction fi;
+		unsigned j, size;
+		ins = (A2_instruction *)(code + i);
+		size = a2_InsSize(ins->opcode);
+		j = i + size;
+		map[i] = o;
+		if((j < end) && !target[j] &&
+				a2c_Fuse(ins, (A2_instruction *)(code + j), &fi))
+		{
+			map[j] = o;
+			dest[o] = dest[j];
+			i = j + a2_InsSize(((A2_instruction *)(code + j))->opcode);
+			size = a2_InsSize(fi.opcode);
+			memcpy(code + o, &fi, size * sizeof(unsigned));
+			o += size;
+			++fused;
+			continue;
+		}
+		memmove(code + o, code + i, size * sizeof(unsigned));
+		dest[o] = dest[i];
+		o += size;
+		i = j;
+	}
+	map[end] = o;
+
+	/* Relocate branches */
+	if(fused)
+	{
+		for(i = 0; i < o; i += a2_InsSize(ins->opcode))
+		{
+			ins = (A2_instruction *)(code + i);
+			if(a2c_IsBranch(ins->opcode) && (dest[i] <= end))
+				ins->a2 = a2c_BranchOffset(c, i, map[dest[i]]);
+		}
+		if(!cdr->func)
+			a2c_MapWake(p, map, end, 1);
+	}
+	free(map);
+	cdr->pos = o;
+	fn->fused = fused;
+	DUMPCODE(A2_DLOG("peephole: %d instructions eliminated\n", fused);)
+}
+
+
 /*---------------------------------------------------------
 	VM code generator
 ---------------------------------------------------------*/
@@ -545,6 +891,7 @@ static void a2c_PopCoder(A2_compiler *c)
 	A2_coder *cdr = c->coder;
 	if(!cdr)
 		a2c_Throw(c, A2_INTERNAL + 130);	/* No coder!? */
+	a2c_Peephole(c, cdr);
 	fn = cdr->program->funcs + cdr->func;
 	fn->size = cdr->pos + 1;
 	fn->code = (unsigned *)realloc(cdr->code, fn->size * sizeof(unsigned));
@@ -552,6 +899,10 @@ static void a2c_PopCoder(A2_compiler *c)
 		a2c_Throw(c, A2_OOMEMORY);
 	ins = (A2_instruction *)(fn->code + cdr->pos);
 	ins->opcode = OP_END;
+#ifdef A2_VM_JIT
+	if(!(c->state->config->flags & (A2_NOJIT | A2_PROFILE)))
+		fn->native = a2_Translate(fn);
+#endif
 	fn->topreg = cdr->topreg;
 	if(fn->topreg - fn->argv > A2_MAXSAVEREGS)
 		a2c_Throw(c, A2_LARGEFRAME);
@@ -560,6 +911,26 @@ static void a2c_PopCoder(A2_compiler *c)
 }
 
 
+/*
+ * Returns the control register write variant of 'op' if 'op' writes to 'reg',
+ * and 'reg' is a control register, otherwise 'op'.
+ */
+static A2_opcodes a2c_ControlOp(A2_compiler *c, A2_opcodes op, unsigned reg)
+{
+	if((reg < A2_FIRSTCONTROLREG) || (reg >= A2_REGISTERS) ||
+			(c->regmap[reg] != A2RT_CONTROL))
+		return op;
+	switch(op)
+	{
+#define	A2_CI(x)	case OP_##x: return OP_##x##C;
+	A2_CONTROLWRITES
+#undef	A2_CI
+	  default:
+		return op;
+	}
+}
+
+
 /*
  * Issue VM instruction 'op' with arguments 'reg' and 'arg'.
  * Argument range checking is done, and 'arg' is treated as integer or 16:16
@@ -654,6 +1025,7 @@ static void a2c_Code(A2_compiler *c, unsigned op, unsigned reg, int arg)
 				a2c_Throw(c, A2_INFLOOP);
 			if(arg > cdr->pos)
 				a2c_Throw(c, A2_BADJUMP);
+			arg = a2c_BranchOffset(c, cdr->pos, arg);
 		}
 		break;
 	  case OP_SPAWN:
@@ -718,6 +1090,7 @@ static void a2c_Code(A2_compiler *c, unsigned op, unsigned reg, int arg)
 	  case OP_DELAYR:
 	  case OP_TDELAYR:
 	  case OP_SLEEP:
+	  case OP_DORMANT:
 	  case OP_SETALL:
 	  case OP_PUSHR:
 	  case OP_KILL:
@@ -735,9 +1108,10 @@ static void a2c_Code(A2_compiler *c, unsigned op, unsigned reg, int arg)
 	  case OP_RAMPALLR:
 		/* No extra checks */
 	  case A2_OPCODES:	/* (Not an OP-code) */
+	  default:		/* (Fused and control write variants) */
 		break;
 	}
-	ins->opcode = op;
+	ins->opcode = a2c_ControlOp(c, op, reg);
 	ins->a1 = reg;
 	if(inssize == 2)
 	{
@@ -761,15 +1135,17 @@ static void a2c_Codef(A2_compiler *c, unsigned op, unsigned reg, double arg)
 }
 
 
-static inline void a2c_SetA2(A2_compiler *c, int pos, int val)
+/* Set the target of the branch instruction at 'pos' to position 'to' */
+static inline void a2c_SetBranch(A2_compiler *c, int pos, int to)
 {
-	if((val < 0) || (val > 0xffff))
-		a2c_Throw(c, A2_BADIMMARG);
+	if(to < 0)
+		a2c_Throw(c, A2_BADJUMP);
 #ifdef DEBUG
 	if((pos < 0) || (pos >= c->coder->size))
 		a2c_Throw(c, A2_INTERNAL + 104);	/* Bad code position! */
 #endif
-	((A2_instruction *)(c->coder->code + pos))->a2 = val;
+	((A2_instruction *)(c->coder->code + pos))->a2 =
+			a2c_BranchOffset(c, pos, to);
 }
 
 
@@ -779,7 +1155,7 @@ static void a2c_DoFixups(A2_compiler *c, A2_symbol *s)
 	{
 		A2_fixup *fx = s->fixups;
 		s->fixups = fx->next;
-		a2c_SetA2(c, fx->pos, s->v.i);
+		a2c_SetBranch(c, fx->pos, s->v.i);
 		DUMPCODE(
 			A2_DLOG("FIXUP: ");
 			a2_DumpIns(c->coder->code, fx->pos);
@@ -1505,7 +1881,7 @@ static void a2c_BeginScope(A2_compiler *c, A2_scope *sc)
 
 static void a2c_EndScope(A2_compiler *c, A2_scope *sc)
 {
-	int res = A2_OK;
+	int i, res = A2_OK;
 	A2_nametab *x = &c->target->exports;
 	A2_nametab *p = &c->target->private;
 	memcpy(c->regmap, sc->regmap, sizeof(A2_regmap));
@@ -1568,6 +1944,10 @@ static void a2c_EndScope(A2_compiler *c, A2_scope *sc)
 		}
 		else if(c->canexport && (h >= 0))
 			a2nt_AddItem(p, s->name, h);
+		/* Don't leave the lexer with tokens referring to 's'! */
+		for(i = 0; i < A2_LEXDEPTH; ++i)
+			if(a2_IsSymbol(c->l[i].token) && (c->l[i].v.sym == s))
+				c->l[i].v.sym = NULL;
 		a2_FreeSymbol(s);
 	}
 	SCOPEDBG(A2_DLOG("=================\n");)
@@ -1614,27 +1994,51 @@ static double a2c_Value(A2_compiler *c)
 }
 
 
+/* Returns 1 if a branch 'op' on a register holding 'v' is taken, otherwise 0 */
+static int a2c_BranchTaken(A2_compiler *c, A2_opcodes op, int v)
+{
+	switch(op)
+	{
+	  case OP_JZ:	return !v;
+	  case OP_JNZ:	return v != 0;
+	  case OP_JG:	return v > 0;
+	  case OP_JL:	return v < 0;
+	  case OP_JGE:	return v >= 0;
+	  case OP_JLE:	return v <= 0;
+	  default:
+		a2c_Throw(c, A2_INTERNAL + 108);
+	}
+}
+
+
 /*
  * Generate branch based on 'op' and the current lexer token. The target
  * position is specified via 'to', which can be A2_UNDEFJUMP if the position is
  * not yet known. If not NULL, 'fixpos' receives the position of the issued
- * branch instruction.
+ * branch instruction, or -1 if no branch was issued.
+ *
+ * If the condition is a value, it is evaluated at compile time, and either an
+ * unconditional jump, or no code at all is issued.
+ *
+ * Returns 1 if the branch is always taken, 0 if it is never taken, or -1 if
+ * it depends on a register.
  */
-static void a2c_Branch(A2_compiler *c, A2_opcodes op, unsigned to, int *fixpos)
+static int a2c_Branch(A2_compiler *c, A2_opcodes op, unsigned to, int *fixpos)
 {
 	int r;
 	if(a2_IsValue(c->l[0].token))
 	{
-		/* FIXME:
-		 *	These are no conditionals! They should be evaluated
-		 *	at compile time instead.
-		 */
-		r = a2c_AllocReg(c, A2RT_TEMPORARY);
-		a2c_Codef(c, OP_LOAD, r, a2c_GetValue(c, c->l));
+		if(!a2c_BranchTaken(c, op,
+				a2c_Num2VM(c, a2c_GetValue(c, c->l))))
+		{
+			if(fixpos)
+				*fixpos = -1;
+			return 0;
+		}
 		if(fixpos)
 			*fixpos = c->coder->pos;
-		a2c_Code(c, op, r, to);
-		a2c_FreeReg(c, r);
+		a2c_Code(c, OP_JUMP, 0, to);
+		return 1;
 	}
 	else if(a2_IsRegister(c->l[0].token))
 	{
@@ -1644,12 +2048,33 @@ static void a2c_Branch(A2_compiler *c, A2_opcodes op, unsigned to, int *fixpos)
 		a2c_Code(c, op, r, to);
 		if(c->l[0].token == TK_TEMPREG)
 			a2c_FreeReg(c, r);
+		return -1;
 	}
 	else
 		a2c_Throw(c, A2_INTERNAL + 101);
 }
 
 
+/*
+ * Discard the code from 'pos' up to the current position of the coder, unless
+ * labels have been defined since the label counter was 'labels', or there are
+ * pending fixups, as those could be referring to the discarded code. Returns 1
+ * if the code was discarded, otherwise 0.
+ */
+static int a2c_DiscardCode(A2_compiler *c, unsigned pos, unsigned labels)
+{
+	A2_symbol *s;
+	if(c->labels != labels)
+		return 0;
+	for(s = c->symbols; s; s = s->next)
+		if(s->fixups)
+			return 0;
+	DUMPCODE(A2_DLOG("DISCARD: %d..%d\n", pos, c->coder->pos - 1);)
+	c->coder->pos = pos;
+	return 1;
+}
+
+
 static void a2c_VarDecl(A2_compiler *c, A2_symbol *s)
 {
 	s->token = TK_REGISTER;
@@ -1872,6 +2297,29 @@ static int a2c_IsBinOp(A2_opcodes op)
 }
 
 
+/*
+ * Returns 1 if 'v' is the identity element of the binary operator 'op'; that
+ * is, if the operation leaves the other operand unchanged. 'left' indicates
+ * that 'v' is the left hand operand.
+ */
+static int a2c_IsIdentity(A2_opcodes op, double v, int left)
+{
+	switch(op)
+	{
+	  case OP_ADD:
+		return v == 0.0f;
+	  case OP_MUL:
+		return v == 1.0f;
+	  case OP_SUBR:
+		return !left && (v == 0.0f);
+	  case OP_DIVR:
+		return !left && (v == 1.0f);
+	  default:
+		return 0;
+	}
+}
+
+
 static void a2c_SimplExp(A2_compiler *c, int r);
 
 /*
@@ -1983,6 +2431,17 @@ static int a2c_Expression(A2_compiler *c, int r, int delim)
 			continue;
 		}
 
+		/* Operations that have no effect are not coded at all. */
+		if(a2_IsRegister(lopr.token) && (c->l[0].token == TK_VALUE) &&
+				a2c_IsIdentity(op, a2c_GetValue(c, c->l), 0))
+		{
+			a2c_SetToken(c, lopr.token, lopr.v.i);
+			continue;
+		}
+		if((lopr.token == TK_VALUE) && a2_IsRegister(c->l[0].token) &&
+				a2c_IsIdentity(op, a2c_GetValue(c, &lopr), 1))
+			continue;
+
 		/*
 		 * Right... We need to issue some code. First, make sure we
 		 * have a target register:
@@ -2254,6 +2713,9 @@ static void a2c_Instruction(A2_compiler *c, A2_opcodes op, int r)
 	int i, p;
 	switch(op)
 	{
+	  case OP_DORMANT:
+		if(c->inhandler)
+			a2c_Throw(c, A2_NODORMANT);
 	  case OP_END:
 	  case OP_SLEEP:
 	  case OP_RETURN:
@@ -2309,9 +2771,10 @@ static void a2c_Instruction(A2_compiler *c, A2_opcodes op, int r)
 			a2c_Code(c, op, p, 0);
 		else if((op == OP_SPAWN || op == OP_SPAWNR) && (r > 255))
 		{
+			/* VID via register; SPAWNV/SPAWNVR */
 			int tmpr = a2c_AllocReg(c, A2RT_TEMPORARY);
 			a2c_Codef(c, OP_LOAD, tmpr, r);
-			a2c_Code(c, op, tmpr, p);
+			a2c_Code(c, op + OP_SPAWNV - OP_SPAWN, tmpr, p);
 			a2c_FreeReg(c, tmpr);
 		}
 		else
@@ -2343,7 +2806,7 @@ static void a2c_Instruction(A2_compiler *c, A2_opcodes op, int r)
 		{
 			int tmpr = a2c_AllocReg(c, A2RT_TEMPORARY);
 			a2c_Codef(c, OP_LOAD, tmpr, r);
-			a2c_Code(c, op, tmpr, p);
+			a2c_Code(c, OP_SENDR, tmpr, p);
 			a2c_FreeReg(c, tmpr);
 		}
 		else
@@ -2366,9 +2829,10 @@ static void a2c_Instruction(A2_compiler *c, A2_opcodes op, int r)
 			r = a2c_Num2Int(c, a2c_GetValue(c, c->l));
 			if(r > 255)
 			{
+				/* VID via register; KILLR/DETACHR */
 				int tmpr = a2c_AllocReg(c, A2RT_TEMPORARY);
 				a2c_Codef(c, OP_LOAD, tmpr, r);
-				a2c_Code(c, op, tmpr, 0);
+				a2c_Code(c, op + 1, tmpr, 0);
 				a2c_FreeReg(c, tmpr);
 			}
 			else
@@ -2988,6 +3452,59 @@ static int a2c_DownstreamInputs(A2_compiler *c, A2_structitem *si)
 }
 
 
+/*
+ * Build the flattened voice structure of the current program, along with the
+ * control register template, for a2_PopulateVoice().
+ */
+static void a2c_StructPlan(A2_compiler *c)
+{
+	A2_program *p = c->coder->program;
+	A2_structitem *si;
+	int nunits = 0, ncregs = 0;
+	A2_unitplan *up;
+	for(si = p->units; si; si = si->next)
+	{
+		const A2_unitdesc *ud = c->state->ss->units[si->kind];
+		const A2_crdesc *crd;
+		for(crd = ud->registers; crd && crd->name; ++crd)
+			++ncregs;
+		++nunits;
+	}
+	if(nunits > 255)
+		a2c_Throw(c, A2_OVERFLOW);
+	if(ncregs > A2_REGISTERS)
+		a2c_Throw(c, A2_OUTOFREGS);
+	if(nunits && !(p->plan = (A2_unitplan *)calloc(nunits,
+			sizeof(A2_unitplan))))
+		a2c_Throw(c, A2_OOMEMORY);
+	if(ncregs && !(p->cregs = (A2_cport *)calloc(ncregs,
+			sizeof(A2_cport))))
+		a2c_Throw(c, A2_OOMEMORY);
+	p->nunits = nunits;
+	p->ncregs = ncregs;
+	p->suspendable = 1;
+	ncregs = 0;
+	for(si = p->units, up = p->plan; si; si = si->next, ++up)
+	{
+		const A2_unitdesc *ud = c->state->ss->units[si->kind];
+		up->descriptor = ud;
+		up->kind = si->kind;
+		up->flags = si->p.unit.flags;
+		up->ninputs = si->p.unit.ninputs;
+		up->noutputs = si->p.unit.noutputs;
+		if(ud->registers)
+			for(; ud->registers[up->ncregs].name; ++up->ncregs)
+				p->cregs[ncregs++].write =
+						ud->registers[up->ncregs].write;
+		if(ud->coutputs)
+			while(ud->coutputs[up->ncoutputs].name)
+				++up->ncoutputs;
+		if(!(ud->flags & A2_SUSPENDABLE))
+			p->suspendable = 0;
+	}
+}
+
+
 static void a2c_StructDef(A2_compiler *c)
 {
 	A2_program *p = c->coder->program;
@@ -3185,6 +3702,8 @@ static void a2c_StructDef(A2_compiler *c)
 		A2_DLOG(" SUBINLINE");
 	A2_DLOG("\n");
 #endif
+
+	a2c_StructPlan(c);
 }
 
 
@@ -3201,6 +3720,25 @@ static int a2c_AddFunction(A2_compiler *c)
 }
 
 
+/*
+ * Figure out how many VM registers voices running program 'p' need, so that
+ * they can be allocated from the smallest fitting voice size class.
+ */
+static void a2c_ProgRegs(A2_compiler *c, A2_program *p)
+{
+	int i;
+	unsigned nregs = p->funcs[0].argv + p->funcs[0].argc + p->ncregs;
+	for(i = 0; i < p->nfuncs; ++i)
+		if(p->funcs[i].topreg + 1 > nregs)
+			nregs = p->funcs[i].topreg + 1;
+	if(nregs < A2_FIXEDREGS)
+		nregs = A2_FIXEDREGS;
+	if(nregs > A2_REGISTERS)
+		a2c_Throw(c, A2_INTERNAL + 132);
+	p->vclass = a2_VoiceClass(nregs);
+}
+
+
 static void a2c_ProgDef(A2_compiler *c, A2_symbol *s, int export)
 {
 	int i, f;
@@ -3220,6 +3758,7 @@ static void a2c_ProgDef(A2_compiler *c, A2_symbol *s, int export)
 		free(p);
 		a2c_Throw(c, -s->v.i);
 	}
+	p->handle = s->v.i;
 	if((i = a2ht_AddItem(&c->target->deps, s->v.i)) < 0)
 		a2c_Throw(c, -i);
 	if(export)
@@ -3246,6 +3785,7 @@ static void a2c_ProgDef(A2_compiler *c, A2_symbol *s, int export)
 	a2c_EndScope(c, &sc);
 	a2c_PopCoder(c);
 	c->nocode = 1;
+	a2c_ProgRegs(c, p);
 }
 
 
@@ -3519,11 +4059,19 @@ static void a2c_WaveDef(A2_compiler *c, int export)
 }
 
 
+/*
+ * if/while statements. If the condition is a constant expression, the test is
+ * done at compile time, and the code of any body that can never run is thrown
+ * away, unless it defines labels.
+ */
 static void a2c_IfWhile(A2_compiler *c, A2_opcodes op, int loop)
 {
-	int fixpos, simple, braced, loopto = c->coder->pos;
+	int fixpos, simple, braced, taken, loopto = c->coder->pos;
+	int dead = 0;
+	unsigned labels;
 	simple = a2c_Expression(c, -1, 0);
-	a2c_Branch(c, op, A2_UNDEFJUMP, &fixpos);
+	taken = a2c_Branch(c, op, A2_UNDEFJUMP, &fixpos);
+	labels = c->labels;
 	a2c_SkipWhite(c, A2_LEX_WHITENEWLINE);
 	if(!simple)
 	{
@@ -3537,6 +4085,12 @@ static void a2c_IfWhile(A2_compiler *c, A2_opcodes op, int loop)
 		a2c_Unlex(c);
 		a2c_Statement(c, TK_EOS);
 	}
+	if((taken == 1) && a2c_DiscardCode(c, loopto, labels))
+	{
+		/* Dead body, and the jump over it, discarded */
+		fixpos = -1;
+		dead = 1;
+	}
 	braced = (c->l[0].token == '}');
 	if(a2c_Lex(c, A2_LEX_WHITENEWLINE) == KW_ELSE)
 	{
@@ -3545,10 +4099,14 @@ static void a2c_IfWhile(A2_compiler *c, A2_opcodes op, int loop)
 			a2c_Throw(c, A2_NEXPELSE);
 		if(!braced)
 			a2c_Throw(c, A2_BADELSE);
-		a2c_Code(c, OP_JUMP, 0, A2_UNDEFJUMP);	/* Skip 'else' body */
+		labels = c->labels;
+		if(dead)
+			fixelse = -1;	/* No 'if' body to skip 'else' after! */
+		else
+			a2c_Code(c, OP_JUMP, 0, A2_UNDEFJUMP);	/* Skip 'else' */
 		if(fixpos >= 0)		/* False condition lands here! */
 		{
-			a2c_SetA2(c, fixpos, c->coder->pos);
+			a2c_SetBranch(c, fixpos, c->coder->pos);
 			DUMPCODE(
 				A2_DLOG("FIXUP: ");
 				a2_DumpIns(c->coder->code, fixpos);
@@ -3561,7 +4119,11 @@ static void a2c_IfWhile(A2_compiler *c, A2_opcodes op, int loop)
 		a2c_SkipWhite(c, braced ? A2_LEX_WHITENEWLINE : 0);
 
 		a2c_Statement(c, TK_EOS);
-		a2c_SetA2(c, fixelse, c->coder->pos);
+		if(fixelse < 0)
+			return;
+		if((taken == 0) && a2c_DiscardCode(c, fixelse, labels))
+			return;		/* Dead 'else' body discarded */
+		a2c_SetBranch(c, fixelse, c->coder->pos);
 		DUMPCODE(
 			A2_DLOG("FIXUP: ");
 			a2_DumpIns(c->coder->code, fixelse);
@@ -3570,11 +4132,11 @@ static void a2c_IfWhile(A2_compiler *c, A2_opcodes op, int loop)
 	}
 	else
 		a2c_Unlex(c);
-	if(loop)
+	if(loop && !dead)
 		a2c_Code(c, OP_JUMP, 0, loopto);
 	if(fixpos >= 0)
 	{
-		a2c_SetA2(c, fixpos, c->coder->pos);
+		a2c_SetBranch(c, fixpos, c->coder->pos);
 		DUMPCODE(
 			A2_DLOG("FIXUP: ");
 			a2_DumpIns(c->coder->code, fixpos);
@@ -3783,6 +4345,7 @@ static int a2c_Statement(A2_compiler *c, A2_tokens terminator)
 			s->token = TK_LABEL;
 			s->v.i = c->coder->pos;
 			a2_PushSymbol(&c->symbols, s);
+			++c->labels;
 			DUMPCODE(A2_DLOG("label .%s:\n", s->name);)
 			if(c->l[0].token == TK_FWDECL)
 				a2c_DoFixups(c, s);
@@ -3951,10 +4514,13 @@ static struct
 	/* Hardwired control registers */
 	{ "tick",	TK_REGISTER,	R_TICK		},
 	{ "tr",		TK_REGISTER,	R_TRANSPOSE	},
+	{ "pri",	TK_REGISTER,	R_PRIORITY	},
+	{ "poly",	TK_REGISTER,	R_POLYPHONY	},
 
 	/* Instructions */
 	{ "end",	TK_INSTRUCTION,	OP_END		},
 	{ "sleep",	TK_INSTRUCTION,	OP_SLEEP	},
+	{ "dormant",	TK_INSTRUCTION,	OP_DORMANT	},
 	{ "return",	TK_INSTRUCTION,	OP_RETURN	},
 	{ "jump",	TK_INSTRUCTION,	OP_JUMP		},
 	{ "jz",		TK_INSTRUCTION,	OP_JZ		},
@@ -4085,6 +4651,31 @@ A2_compiler *a2_OpenCompiler(A2_interface *i, int flags)
 }
 
 
+A2_errors a2_AddConstants(A2_compiler *c, const A2_constdef *constants)
+{
+	int j;
+	if(!constants)
+		return A2_OK;
+	a2c_Try(c)
+	{
+		DUMPSTRUCT(A2_DLOG("constants:");)
+		for(j = 0; constants[j].name; ++j)
+		{
+			A2_symbol *s;
+			if(a2_FindSymbol(c->state, c->symbols, constants[j].name))
+				a2c_Throw(c, A2_SYMBOLDEF);
+			if(!(s = a2_NewSymbol(constants[j].name, TK_VALUE)))
+				a2c_Throw(c, A2_OOMEMORY);
+			s->v.f = constants[j].value;
+			a2_PushSymbol(&c->symbols, s);
+			DUMPSTRUCT(A2_DLOG(" %s=%f", s->name, s->v.f);)
+		}
+		DUMPSTRUCT(A2_DLOG("\n");)
+	}
+	return c->error;
+}
+
+
 void a2_CloseCompiler(A2_compiler *c)
 {
 	int i;
@@ -4109,6 +4700,7 @@ void a2_CloseCompiler(A2_compiler *c)
 
 static void a2_Compile(A2_compiler *c, A2_scope *sc, const char *source)
 {
+	A2_errors res;
 	a2c_Try(c)
 	{
 		a2c_BeginScope(c, sc);
@@ -4162,6 +4754,7 @@ static void a2_Compile(A2_compiler *c, A2_scope *sc, const char *source)
 		}
 	}
 	/* Try to avoid dangling wires and stuff... */
+	res = c->error;
 	a2c_Try(c)
 	{
 		while(c->coder)
@@ -4190,7 +4783,9 @@ static void a2_Compile(A2_compiler *c, A2_scope *sc, const char *source)
 		/* Nothing should ever go wrong here either. */
 		A2_LOG_INT("Emergency finalization 2: %s",
 				a2_ErrorString(c->error));
+		return;
 	}
+	c->error = res;		/* Report the original error, if any */
 }
 
 
@@ -283,6 +283,7 @@ struct A2_compiler
 	int		canexport;	/* Current context allows exports! */
 	int		inhandler;	/* Disallow timing, RUN, SLEEP ,... */
 	int		nocode;		/* Disallow code in current context  */
+	unsigned	labels;		/* Number of labels defined so far */
 	A2_jumpbuf	jumpbuf;	/* Buffer for a2c_Try()/a2c_Throw() */
 	A2_errors	error;		/* Error from a2c_Throw() */
 #ifdef THROWSOURCE
@@ -300,6 +301,12 @@ struct A2_compiler
 A2_compiler *a2_OpenCompiler(A2_interface *i, int flags);
 void a2_CloseCompiler(A2_compiler *c);
 
+/*
+ * Define the names in 'constants' as values in the root namespace, before
+ * compiling anything. 'constants' may be NULL.
+ */
+A2_errors a2_AddConstants(A2_compiler *c, const A2_constdef *constants);
+
 /* Compile Audiality 2 Script source code into VM code. */
 A2_errors a2_CompileString(A2_compiler *c, A2_handle bank, const char *code,
 		const char *source);
@@ -104,9 +104,15 @@
 #define	A2_MINEVENTS		256
 #define	A2_TIMEEVENTS		1000
 
-/* Quality for wavetable oscillators */
-#define	A2_HIFI
-#undef	A2_LOFI
+/* Default quality for wavetable and FM oscillators (A2_quality) */
+#define	A2_DEFAULTQUALITY	A2_QHIFI
+
+/*
+ * Minimum time (ms) between steps of CPU load adaptive quality scaling, and
+ * the fraction (1 / N) of the voices to cut per step, once at A2_QLOFI.
+ */
+#define	A2_QUALITYHOLD		250
+#define	A2_LOADCUTDIV		8
 
 /* Default tick duration; corresponds to 'tempo 120 4' */
 #define	A2_DEFAULTTICK		(125 << 16)
@@ -118,20 +124,95 @@
  */
 #define A2_INSLIMIT		1000
 
+/*
+ * Use "labels as values" (GCC, Clang) for direct threaded VM instruction
+ * dispatch, instead of a switch(). Define A2_VM_SWITCH to force the portable
+ * switch() based dispatcher.
+ */
+#if defined(__GNUC__) && !defined(A2_VM_SWITCH)
+#	define	A2_VM_COMPUTED_GOTO
+#endif
+
+/*
+ * Translate VM code into native code at load time, where supported. (Currently
+ * only x86-64 with GCC or Clang.) Define A2_VM_NOJIT to disable, or use the
+ * A2_NOJIT flag to disable it for a specific engine state.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(A2_VM_NOJIT) && \
+		(defined(__unix__) || defined(__APPLE__))
+#	define	A2_VM_JIT
+#endif
+
+/*
+ * Use SIMD versions of DSP inner loops where supported; SSE2 and AVX2 on
+ * x86-64, and NEON on AArch64. (GCC or Clang only.) The instruction set is
+ * picked at run-time, based on what the CPU supports. Define A2_DSP_NOSIMD to
+ * disable, or use the A2_NOSIMD flag to disable it for a specific engine state.
+ *
+ * NOTE:
+ *	The NEON code has not yet been built or verified against the scalar
+ *	code, so it is only used if A2_DSP_NEON is defined.
+ */
+#if defined(__GNUC__) && !defined(A2_DSP_NOSIMD)
+#	if defined(__x86_64__)
+#		define	A2_SIMD_SSE2
+#		define	A2_SIMD_AVX2
+#	elif defined(__aarch64__) && defined(A2_DSP_NEON)
+#		define	A2_SIMD_NEON
+#	endif
+#endif
+
 /*
  * Maximum allowed child voice nesting depth. (Recursive explosion inhibitor.)
  */
 #define	A2_NESTLIMIT		255
 
+/*
+ * Number of render lanes for parallel voice processing. (A2_PRENDERTHREADS)
+ * Voices are assigned to lanes regardless of the number of threads actually
+ * used, so output is identical for any thread count. Must be <= 32, as lanes
+ * are tracked using bit masks. This is also the maximum number of threads.
+ */
+#define	A2_RENDERLANES		16
+
 /* Default initial pool sizes for A2_REALTIME states */
 #define	A2_INITHANDLES		256
 #define	A2_INITVOICES		256
 #define	A2_INITBLOCKS		512
 
+/*
+ * Default pool reserve sizes for A2_REALTIME states. When a pool runs dry, the
+ * engine takes memory from the reserve, and the API context refills the
+ * reserve in the background, as the engine falls below half the size.
+ */
+#define	A2_RESERVEBLOCKS	128
+#define	A2_RESERVEEVENTS	256
+#define	A2_RESERVEVOICES	64
+
+/*
+ * Voice size classes. Voices are allocated with room for the registers of the
+ * program they run, and class 'c' fits (A2_MINVOICEREGS << c) registers. The
+ * initial voice pool is spread over the classes, with (A2_INITVOICES >> 2c)
+ * voices in class 'c'. The last class must cover A2_REGISTERS.
+ */
+#define	A2_MINVOICEREGS		16
+#define	A2_VOICECLASSES		3
+
 /* Size of temporary string buffers (bytes) */
 #define	A2_TMPSTRINGSIZE	256
 
+/* Duration of the fade-out of voices stolen due to voice budgets (ms) */
+#define	A2_STEALFADE		5
+
 /* Subvoice IDs covered by the subvoice LUT. Set to 0 to disable the LUT. */
 #define	A2_SV_LUT_SIZE		8
 
+/*
+ * Subvoice IDs above the LUT are looked up through a per-voice index, made of
+ * pages of memory blocks, that is allocated as IDs are used. This covers IDs
+ * below A2_SVX_END (see internals.h), and the voice list is searched for any
+ * IDs above that. Set to 0 to disable the index.
+ */
+#define	A2_SV_INDEX		1
+
 #endif /* A2_CONFIG_H */
@@ -26,6 +26,9 @@
 #include "internals.h"
 #include "inline.h"
 #include "xinsert.h"
+#include "vmjit.h"
+#include "profile.h"
+#include "workers.h"
 
 
 /*---------------------------------------------------------
@@ -58,7 +61,7 @@ static inline void a2_flush_event(A2_state *st, A2_event *e, A2_handle h)
 			am.b.common.action = A2MT_XICREMOVED;
 			am.b.common.timestamp = st->now_ticks;
 			am.b.xic.client = e->b.xic.client;
-			a2_writemsg(st->toapi, &am, A2_MSIZE(b.xic));
+			a2r_WriteMsg(st, &am, A2_MSIZE(b.xic));
 		}
 		else
 			free(e->b.xic.client);
@@ -78,7 +81,7 @@ void a2_FlushEventQueue(A2_state *st, A2_event **eq, A2_handle h)
 	while(*eq)
 	{
 		A2_event *e = *eq;
-		*eq = e->next;
+		a2_EventPop(eq);
 		a2_flush_event(st, e, h);
 		a2_FreeEvent(st, e);
 	}
@@ -140,19 +143,42 @@ static inline int a2_VoicePop(A2_state *st, A2_voice *v)
 }
 
 
+/* Take voice 'v' out of silence suspension, if it's suspended */
+static inline void a2_VoiceResume(A2_state *st, A2_voice *v)
+{
+	v->silentframes = 0;
+	if(v->flags & A2_SUSPENDED)
+	{
+		v->flags &= ~A2_SUSPENDED;
+		--st->suspendedvoices;
+	}
+}
+
+
 static inline void a2_VoiceControl(A2_state *st, A2_voice *v, unsigned reg,
 		unsigned start, unsigned duration)
 {
 	A2_cport *cp = &v->cregs[reg];
-	if(cp->write)
-		cp->write(cp->unit, v->s.r[reg], start & 255, duration);
+	if(!cp->write)
+		return;
+	if(v->sout)
+	{
+		/* Silence detection: Wake up, and keep track of ramps */
+		a2_VoiceResume(st, v);
+		if(a2_TSDiff(start + duration, v->rampend) > 0)
+			v->rampend = start + duration;
+	}
+	cp->write(cp->unit, v->s.r[reg], start & 255, duration);
 }
 
 
 /*
- * Instantiate, initialize and wire a unit as described by descriptor 'ud',
+ * Instantiate, initialize and wire a unit as described by plan entry 'up',
  * and add it at the end of the chain in voice 'v'.
  *
+ * The control register write callbacks have already been copied from the
+ * program template by a2_PopulateVoice(); we only hook them up to the unit.
+ *
  * NOTE:
  *	We're not keeping a pointer to the last unit in A2_voice (voice
  *	structures are "hardwired" by the compiler anyway, so they're never
@@ -160,16 +186,17 @@ static inline void a2_VoiceControl(A2_state *st, A2_voice *v, unsigned reg,
  *	constructing the voice, and pass it via the 'lastunit' argument
  *	instead.
  */
-static inline A2_unit *a2_AddUnit(A2_state *st, const A2_structitem *si,
+static inline A2_unit *a2_AddUnit(A2_state *st, const A2_unitplan *up,
 		A2_voice *v, A2_unit *lastunit, int32_t **scratch,
 		unsigned noutputs, int32_t **outputs)
 {
 	DBG(A2_interface *i = &st->interfaces->interface;)
 	A2_errors res;
-	int minoutputs, maxoutputs, ninputs;
+	int j, minoutputs, maxoutputs, ninputs;
 	A2_unit *u;
-	const A2_unitdesc *ud = st->ss->units[si->kind];
-	A2_unitstate *us = st->unitstate + si->kind;
+	const A2_unitdesc *ud = up->descriptor;
+	A2_unitstate *us = st->unitstate + up->kind;
+	unsigned flags = up->flags;
 
 	if(us->status)
 	{
@@ -178,6 +205,20 @@ static inline A2_unit *a2_AddUnit(A2_state *st, const A2_structitem *si,
 		return NULL;
 	}
 
+	if(st->config->flags & A2_FLOATPROC)
+	{
+		/* Units with audio I/O need to support float processing! */
+		if((ud->maxinputs || ud->maxoutputs) &&
+				!(ud->flags & A2_FLOATIO))
+		{
+			A2_LOG_DBG(i, "Unit '%s' does not support float "
+					"processing!", ud->name);
+			a2r_Error(st, A2_NOTIMPLEMENTED, "a2_AddUnit()[8]");
+			return NULL;
+		}
+		flags |= A2_PROCFLOAT;
+	}
+
 	if(!(u = &a2_AllocBlock(st)->unit))
 	{
 		a2r_Error(st, A2_OOMEMORY, "a2_AddUnit()[2]");
@@ -187,7 +228,7 @@ static inline A2_unit *a2_AddUnit(A2_state *st, const A2_structitem *si,
 	DUMPSTRUCTRT(A2_DLOG("Wiring %s... ", ud->name);)
 
 	/* Input wiring */
-	switch(si->p.unit.ninputs)
+	switch(up->ninputs)
 	{
 	  case A2_IO_MATCHOUT:
 		ninputs = noutputs;
@@ -203,7 +244,7 @@ static inline A2_unit *a2_AddUnit(A2_state *st, const A2_structitem *si,
 			ninputs = ud->maxinputs;
 		break;
 	  default:
-		ninputs = si->p.unit.ninputs;
+		ninputs = up->ninputs;
 		break;
 	}
 
@@ -217,7 +258,7 @@ static inline A2_unit *a2_AddUnit(A2_state *st, const A2_structitem *si,
 	}
 
 	/* Output wiring */
-	switch(si->p.unit.noutputs)
+	switch(up->noutputs)
 	{
 	  case A2_IO_WIREOUT:
 	  case A2_IO_MATCHOUT:
@@ -234,10 +275,10 @@ static inline A2_unit *a2_AddUnit(A2_state *st, const A2_structitem *si,
 			u->noutputs = maxoutputs;
 		break;
 	  default:
-		u->noutputs = si->p.unit.noutputs;
+		u->noutputs = up->noutputs;
 		break;
 	}
-	if(si->p.unit.noutputs == A2_IO_WIREOUT)
+	if(up->noutputs == A2_IO_WIREOUT)
 		u->outputs = outputs;
 	else
 		u->outputs = scratch;
@@ -245,16 +286,8 @@ static inline A2_unit *a2_AddUnit(A2_state *st, const A2_structitem *si,
 	/* Initialize instance struct and wire any control registers */
 	u->descriptor = ud;
 	u->registers = v->s.r + v->ncregs;
-	if(ud->registers)
-	{
-		int j;
-		for(j = 0; ud->registers[j].name; ++j)
-		{
-			v->cregs[v->ncregs].write = ud->registers[j].write;
-			v->cregs[v->ncregs].unit = u;
-			++v->ncregs;
-		}
-	}
+	for(j = 0; j < up->ncregs; ++j)
+		v->cregs[v->ncregs++].unit = u;
 	u->ninputs = ninputs;
 	u->inputs = scratch;
 	DUMPSTRUCTRT(A2_DLOG("in: %d\tout:%d", u->ninputs, u->noutputs);)
@@ -262,7 +295,6 @@ static inline A2_unit *a2_AddUnit(A2_state *st, const A2_structitem *si,
 	/* Initialize control outputs, if any */
 	if(ud->coutputs)
 	{
-		int j;
 /*HACK*/
 		if(!(u->coutputs = (A2_cport *)a2_AllocBlock(st)))
 		{
@@ -271,7 +303,7 @@ static inline A2_unit *a2_AddUnit(A2_state *st, const A2_structitem *si,
 			return NULL;
 		}
 /*/HACK*/
-		for(j = 0; ud->coutputs[j].name; ++j)
+		for(j = 0; j < up->ncoutputs; ++j)
 			u->coutputs[j].write = NULL;
 	}
 	else
@@ -287,7 +319,7 @@ static inline A2_unit *a2_AddUnit(A2_state *st, const A2_structitem *si,
 	}
 
 	/* Initialize the unit instance itself! */
-	if((res = ud->Initialize(u, &v->s, us->statedata, si->p.unit.flags)))
+	if((res = ud->Initialize(u, &v->s, us->statedata, flags)))
 	{
 		a2_FreeBlock(st, u);
 		A2_LOG_DBG(i, "Unit '%s' on voice %p failed to initialize! "
@@ -346,6 +378,11 @@ static inline A2_errors a2_ControlWire(A2_state *st, const A2_structitem *si,
 
 /*
  * Populate voice 'v' with units as described by program 'p'.
+ *
+ * With silence detection, units send their output to the 'sout' bus, right
+ * after the scratch buffers of the voice, rather than directly to the voice
+ * outputs. a2_VoiceProcess() then mixes that into the voice outputs, keeping
+ * track of the peak level as it goes.
  */
 static inline A2_errors a2_PopulateVoice(A2_state *st, const A2_program *p,
 		A2_voice *v)
@@ -353,31 +390,43 @@ static inline A2_errors a2_PopulateVoice(A2_state *st, const A2_program *p,
 	A2_structitem *si;
 	A2_unit *lastu = NULL;
 	int32_t **scratch = NULL;
+	int bmin = p->buffers;
+	int j, suspendable;
 
 	/* The 'inline' unit changes these! */
 	unsigned noutputs = v->noutputs;
 	int32_t **outputs = v->outputs;
 
-	if(!p->units)
+	if(!p->nunits)
 		return A2_OK;	/* No units - all done! */
 
+	if(bmin < 0)
+	{
+		/*
+		 * We have units using scratch buffers while adapting to the
+		 * voice output channel count! Make sure we have enough
+		 * buffers to match the bus, to safely handle autowiring.
+		 */
+		bmin = -bmin;
+		if(bmin < noutputs)
+			bmin = noutputs;
+	}
+
+	/*
+	 * Silence detection is used if it's enabled, and all units of the
+	 * program are able to deal with being suspended.
+	 */
+	suspendable = p->suspendable && noutputs &&
+			(st->config->flags & A2_SUSPENDSILENT) &&
+			(bmin + noutputs <= A2_MAXCHANNELS);
+
 	/* Make sure we have enough scratch buffers, if any are needed */
-	if(p->buffers)
+	if(bmin || suspendable)
 	{
 		A2_bus **b = st->scratch + v->nestlevel;
-		int bmin = p->buffers;
-		if(bmin < 0)
-		{
-			/*
-			 * We have units using scratch buffers while adapting
-			 * to the voice output channel count! Make sure we have
-			 * enough buffers to match the bus, to safely handle
-			 * autowiring.
-			 */
-			bmin = -bmin;
-			if(bmin < noutputs)
-				bmin = noutputs;
-		}
+		int base = bmin;
+		if(suspendable)
+			bmin += noutputs;
 		DUMPSTRUCTRT(A2_DLOG("%sllocating %d channel bus for voice %p,"
 				" nestlevel %d\n", *b ? "Rea" : "A",
 				bmin, v, v->nestlevel);)
@@ -392,11 +441,21 @@ static inline A2_errors a2_PopulateVoice(A2_state *st, const A2_program *p,
 				return A2_OOMEMORY;
 		}
 		scratch = (*b)->buffers;
+		if(suspendable)
+		{
+			outputs = v->sout = scratch + base;
+			v->silentframes = 0;
+			v->rampend = st->now_fragstart;
+			v->awake = 0;
+		}
 	}
 
 	/* Add and wire the voice units! */
-	for(si = p->units; si; si = si->next)
-		if(!(lastu = a2_AddUnit(st, si, v, lastu, scratch,
+	if(p->ncregs)
+		memcpy(v->cregs + v->ncregs, p->cregs,
+				p->ncregs * sizeof(A2_cport));
+	for(j = 0; j < p->nunits; ++j)
+		if(!(lastu = a2_AddUnit(st, p->plan + j, v, lastu, scratch,
 				noutputs, outputs)))
 			return A2_VOICEINIT;
 
@@ -420,30 +479,272 @@ static inline A2_errors a2_PopulateVoice(A2_state *st, const A2_program *p,
 }
 
 
+#if A2_SV_INDEX
+/*
+ * Return the index slot of subvoice ID 'vid' (A2_SV_LUT_SIZE <= 'vid' <
+ * A2_SVX_END) of voice 'v', or NULL if the page it would be in has not been
+ * allocated.
+ */
+static inline A2_voice **a2_SubvoiceSlot(A2_voice *v, unsigned vid)
+{
+	A2_voice **page;
+	if(!v->svx)
+		return NULL;
+	vid -= A2_SV_LUT_SIZE;
+	if(!(page = v->svx[vid / A2_SVX_PAGESIZE]))
+		return NULL;
+	return page + vid % A2_SVX_PAGESIZE;
+}
+
+
+/*
+ * Like a2_SubvoiceSlot(), but allocates any missing index blocks. Returns NULL
+ * if that fails.
+ */
+static A2_voice **a2_SubvoiceNewSlot(A2_state *st, A2_voice *v, unsigned vid)
+{
+	A2_voice **page;
+	vid -= A2_SV_LUT_SIZE;
+	if(!v->svx)
+	{
+		if(!(v->svx = (A2_voice ***)a2_AllocBlock(st)))
+			return NULL;
+		memset(v->svx, 0, sizeof(A2_block));
+	}
+	if(!(page = v->svx[vid / A2_SVX_PAGESIZE]))
+	{
+		if(!(page = (A2_voice **)a2_AllocBlock(st)))
+			return NULL;
+		memset(page, 0, sizeof(A2_block));
+		v->svx[vid / A2_SVX_PAGESIZE] = page;
+	}
+	return page + vid % A2_SVX_PAGESIZE;
+}
+
+
+/* Free the subvoice index of 'v', if any */
+static inline void a2_FreeSubvoiceIndex(A2_state *st, A2_voice *v)
+{
+	unsigned i;
+	if(!v->svx)
+		return;
+	for(i = 0; i < A2_SVX_PAGESIZE; ++i)
+		if(v->svx[i])
+			a2_FreeBlock(st, v->svx[i]);
+	a2_FreeBlock(st, v->svx);
+	v->svx = NULL;
+}
+#endif
+
+
+/*
+ * Remove subvoice 'sv' of 'v' from the subvoice LUT or index of 'v', if it's
+ * attached to an ID there.
+ */
+static inline void a2_UnlistSubvoice(A2_voice *v, A2_voice *sv)
+{
+	int vid = sv->handle;
+	if(!(sv->flags & A2_ATTACHED) || (sv->flags & A2_APIHANDLE) ||
+			(vid < 0))
+		return;
+#if A2_SV_LUT_SIZE
+	if(vid < A2_SV_LUT_SIZE)
+	{
+		if(v->sv[vid] == sv)
+			v->sv[vid] = NULL;
+		return;
+	}
+#endif
+#if A2_SV_INDEX
+	if((unsigned)vid < A2_SVX_END)
+	{
+		A2_voice **slot = a2_SubvoiceSlot(v, vid);
+		if(slot && (*slot == sv))
+			*slot = NULL;
+	}
+#endif
+}
+
+
+/* Length of the fade-out of stolen voices (frames) */
+static inline unsigned a2_StealFadeFrames(A2_state *st)
+{
+	return (A2_STEALFADE * st->msdur >> 16) + 1;
+}
+
+
+/*
+ * Returns 1 if voice 'a' is to be stolen before voice 'b'. Voices with lower
+ * priority go first, then voices with lower output level, and then the oldest
+ * voices.
+ */
+static inline int a2_StealFirst(A2_voice *a, A2_voice *b)
+{
+	if(a->s.r[R_PRIORITY] != b->s.r[R_PRIORITY])
+		return a->s.r[R_PRIORITY] < b->s.r[R_PRIORITY];
+	if(a->level != b->level)
+		return a->level < b->level;
+	return a2_TSDiff(a->started, b->started) < 0;
+}
+
+
+/*
+ * Steal subvoice 'v' of 'parent'. The voice is removed from the subvoice LUT
+ * and index of 'parent', and is then faded out and freed as it's processed.
+ * (See a2_VoiceFadeOut().)
+ */
+static void a2_VoiceSteal(A2_state *st, A2_voice *parent, A2_voice *v)
+{
+	a2_UnlistSubvoice(parent, v);
+	if(!(v->flags & A2_APIHANDLE))
+		v->handle = -1;
+	v->flags |= A2_STOLEN;
+	v->fade = a2_StealFadeFrames(st);
+	++st->fadingvoices;
+	++st->stolenvoices;
+}
+
+
+/*
+ * Steal subvoices of 'parent', as needed to make room for one more subvoice
+ * within the limit set by the 'poly' register of 'parent'.
+ */
+static void a2_PolyphonyBudget(A2_state *st, A2_voice *parent)
+{
+	int limit = parent->s.r[R_POLYPHONY] >> 16;
+	while(1)
+	{
+		A2_voice *sv, *victim = NULL;
+		int n = 0;
+		for(sv = parent->sub; sv; sv = sv->next)
+		{
+			if(sv->flags & A2_STOLEN)
+				continue;
+			++n;
+			if(!victim || a2_StealFirst(sv, victim))
+				victim = sv;
+		}
+		if(n < limit)
+			return;
+		a2_VoiceSteal(st, parent, victim);
+	}
+}
+
+
+/*
+ * Find the voice under 'v' that is to be stolen first, considering only voices
+ * that have no subvoices and no 'inline' unit, and that are not stolen already,
+ * nor under a stolen voice. 'best' is the best candidate so far, if any, and
+ * '*parent' is set to the parent of the voice returned.
+ */
+static A2_voice *a2_FindStealable(A2_voice *v, A2_voice *best,
+		A2_voice **parent)
+{
+	A2_voice *sv;
+	for(sv = v->sub; sv; sv = sv->next)
+	{
+		if(sv->flags & A2_STOLEN)
+			continue;
+		if(sv->sub)
+			best = a2_FindStealable(sv, best, parent);
+		else if(!(sv->flags & A2_SUBINLINE) &&
+				(!best || a2_StealFirst(sv, best)))
+		{
+			best = sv;
+			*parent = v;
+		}
+	}
+	return best;
+}
+
+
+/*
+ * Effective active voice budget of 'st'; the lower of A2_PVOICELIMIT and the
+ * limit set by CPU load adaptation, or 0 if there is no limit.
+ */
+static inline unsigned a2_VoiceLimit(A2_state *st)
+{
+	if(st->loadlimit && (!st->voicelimit || (st->loadlimit < st->voicelimit)))
+		return st->loadlimit;
+	return st->voicelimit;
+}
+
+
+/*
+ * Steal voices, as needed to bring the number of active voices in 'st' that are
+ * not fading out down to 'limit'.
+ *
+ * NOTE: This searches the whole voice tree, so it must not be used in lanes!
+ */
+static void a2_VoiceBudget(A2_state *st, int limit)
+{
+	RCHM_handleinfo *hi = rchm_Get(&st->ss->hm, st->rootvoice);
+	A2_voice *root = (A2_voice *)hi->d.data;
+	while((int)(st->activevoices - st->fadingvoices) > limit)
+	{
+		A2_voice *parent = NULL;
+		A2_voice *v = a2_FindStealable(root, NULL, &parent);
+		if(!v)
+			return;
+		a2_VoiceSteal(st, parent, v);
+	}
+}
+
+
 /*===========================================================================
  * WARNING: These are tuned for minimal init/cleanup overhead! Be careful...
  *===========================================================================*/
 
-A2_voice *a2_VoiceAlloc(A2_state *st)
+/*
+ * Initialize raw memory block 'v' of (at least) A2_VOICESIZE(vclass) bytes as
+ * a pool voice of 'st'.
+ */
+void a2_VoiceInit(A2_state *st, A2_voice *v, unsigned vclass)
 {
-	A2_voice *v = (A2_voice *)st->sys->RTAlloc(st->sys, sizeof(A2_voice));
-	if(!v)
-	{
-		a2r_Error(st, A2_OOMEMORY, "a2_VoiceAlloc()");
-		return NULL;
-	}
+	v->vclass = vclass;
+	v->cregs = (A2_cport *)((char *)v + A2_VOICECREGS(vclass));
+#if A2_SV_LUT_SIZE
+	v->sv = (A2_voice **)(v->cregs + (A2_MINVOICEREGS << vclass));
+#endif
 	v->sub = NULL;
 	v->stack = NULL;
 	v->program = NULL;
 	v->events = NULL;
 	v->units = NULL;
+	v->sout = NULL;
 	v->ncregs = A2_FIXEDREGS;	/* Start at the first free register */
 	v->handle = -1;
+	v->level = A2_UNKNOWNLEVEL;
 #if A2_SV_LUT_SIZE
-	memset(v->sv, 0, sizeof(v->sv));
+	memset(v->sv, 0, A2_SV_LUT_SIZE * sizeof(A2_voice *));
+#endif
+#if A2_SV_INDEX
+	v->svx = NULL;
 #endif
-	memset(v->cregs, 0, sizeof(v->cregs));
+	memset(v->cregs, 0, (A2_MINVOICEREGS << vclass) * sizeof(A2_cport));
 	++st->totalvoices;
+	st->voicememory += A2_VOICESIZE(vclass);
+}
+
+
+/*
+ * Allocate a voice of size class 'vclass'. Reserve voices are of the largest
+ * class, so they can serve any program.
+ */
+A2_voice *a2_VoiceAlloc(A2_state *st, unsigned vclass)
+{
+	A2_voice *v = (A2_voice *)a2r_TakeReserve(st, A2_VOICEPOOL);
+	if(v)
+	{
+		a2_VoiceInit(st, v, A2_VOICECLASSES - 1);
+		return v;
+	}
+	if(!(v = (A2_voice *)st->sys->RTAlloc(st->sys, A2_VOICESIZE(vclass))))
+	{
+		a2r_Error(st, A2_OOMEMORY, "a2_VoiceAlloc()");
+		return NULL;
+	}
+	a2_VoiceInit(st, v, vclass);
 #ifdef DEBUG
 	if(st->audio && st->audio->Process &&
 			(st->config->flags & A2_REALTIME))
@@ -454,30 +755,88 @@ A2_voice *a2_VoiceAlloc(A2_state *st)
 }
 
 
-A2_voice *a2_VoiceNew(A2_state *st, A2_voice *parent, unsigned when)
+/* Grab a voice of size class 'vclass' or larger from the pools of 'st' */
+static inline A2_voice *a2_VoicePoolTake(A2_state *st, unsigned vclass)
+{
+	for( ; vclass < A2_VOICECLASSES; ++vclass)
+		if(st->voicepool[vclass])
+		{
+			A2_voice *v = st->voicepool[vclass];
+			st->voicepool[vclass] = v->next;
+			return v;
+		}
+	return NULL;
+}
+
+
+/*
+ * Create a new subvoice of 'parent', with room for the registers of programs
+ * of voice size class 'vclass'.
+ */
+A2_voice *a2_VoiceNew(A2_state *st, A2_voice *parent, unsigned when,
+		unsigned vclass)
 {
-	A2_voice *v = st->voicepool;
+	A2_voice *v;
+	uint32_t *ns;
+	unsigned limit;
 	if(parent->nestlevel >= A2_NESTLIMIT - 1)
 	{
 		/* FIXME: Can we get the program name here instead? */
 		a2r_Error(st, A2_VOICENEST, "a2_VoiceNew()");
 		return NULL;
 	}
-	if(v)
-		st->voicepool = v->next;
-	else if(!(v = a2_VoiceAlloc(st)))
+
+	/* Voice budgets */
+	if(parent->s.r[R_POLYPHONY] >= 65536)
+		a2_PolyphonyBudget(st, parent);
+	if((limit = a2_VoiceLimit(st)) && !st->lanemaster &&
+			((int)(st->activevoices - st->fadingvoices) >= (int)limit))
+		a2_VoiceBudget(st, limit - 1);
+
+	v = a2_VoicePoolTake(st, vclass);
+	if(!v && st->workers)
+	{
+		a2_ReclaimLanePools(st);
+		v = a2_VoicePoolTake(st, vclass);
+	}
+	if(!v && !(v = st->lanemaster ? a2_LaneNewVoice(st, vclass) :
+			a2_VoiceAlloc(st, vclass)))
 		return NULL;
 	++st->activevoices;
 	if(st->activevoices > st->activevoicesmax)
 		st->activevoicesmax = st->activevoices;
 	v->nestlevel = parent->nestlevel + 1;
+
+	/*
+	 * Voices started under A2_PARALLEL voices are assigned to render lanes
+	 * by a2_ProcessLanes(), before they run. Others inherit the lane of
+	 * the parent, if any.
+	 */
+	if(!parent->lane && (parent->flags & A2_PARALLEL) && st->workers &&
+			st->workers->threads)
+		v->lane = A2_LANEPENDING;
+	else
+		v->lane = parent->lane;
 	v->next = parent->sub;
 	parent->sub = v;
 	v->s.waketime = when;
+	v->started = when;
 	v->s.r[R_TICK] = parent->s.r[R_TICK];
 	v->s.r[R_TRANSPOSE] = parent->s.r[R_TRANSPOSE];
+	v->s.r[R_PRIORITY] = parent->s.r[R_PRIORITY];
+	v->s.r[R_POLYPHONY] = 0;
 	v->noutputs = parent->noutputs;
 	v->outputs = parent->outputs;
+
+	/*
+	 * Each voice has an RNG of its own, seeded from that of the parent, or
+	 * from the state for voices on the root voice, so that the sequences
+	 * do not depend on the order in which voices are processed. Render
+	 * lanes thus give the same output as serial processing.
+	 */
+	ns = parent->nestlevel ? &parent->noisestate : &st->noisestate;
+	a2_Noise(ns);
+	v->noisestate = (*ns ^ 0x9e3779b9) * 2654435761U;
 	return v;
 }
 
@@ -499,7 +858,7 @@ A2_errors a2_init_root_voice(A2_state *st)
 	rootdriver = a2_GetProgram(st, a2_Get(i, A2_ROOTBANK, rd));
 	if(!rootdriver)
 		return A2_INTERNAL + 400;
-	if(!(v = a2_VoiceAlloc(st)))
+	if(!(v = a2_VoiceAlloc(st, rootdriver->vclass)))
 		return A2_OOMEMORY;
 	st->rootvoice = rchm_NewEx(&st->ss->hm, v, A2_TVOICE, A2_LOCKED, 1);
 	if(st->rootvoice < 0)
@@ -509,13 +868,17 @@ A2_errors a2_init_root_voice(A2_state *st)
 	if(st->activevoices > st->activevoicesmax)
 		st->activevoicesmax = st->activevoices;
 	v->nestlevel = 0;
+	v->lane = 0;
 	v->flags = A2_ATTACHED | A2_APIHANDLE;
 	v->s.waketime = st->now_fragstart;
 	v->next = NULL;
 	v->s.r[R_TICK] = A2_DEFAULTTICK;
 	v->s.r[R_TRANSPOSE] = 0;
+	v->s.r[R_PRIORITY] = 0;
+	v->s.r[R_POLYPHONY] = 0;
 	v->noutputs = st->master->channels;
 	v->outputs = st->master->buffers;
+	v->noisestate = st->noisestate;
 	for(j = A2_FIRSTCONTROLREG; j < v->ncregs; ++j)
 		a2_VoiceControl(st, v, j, 0, 0);
 	if((res = a2_VoiceStart(st, v, rootdriver, 0, NULL)))
@@ -534,8 +897,8 @@ void a2_VoiceFree(A2_state *st, A2_voice **head)
 	unsigned i;
 	A2_voice *v = *head;
 	*head = v->next;
-	v->next = st->voicepool;
-	st->voicepool = v;
+	v->next = st->voicepool[v->vclass];
+	st->voicepool[v->vclass] = v;
 	--st->activevoices;
 
 	if(v->flags & A2_APIHANDLE)
@@ -552,7 +915,10 @@ void a2_VoiceFree(A2_state *st, A2_voice **head)
 	while(v->sub)
 		a2_VoiceFree(st, &v->sub);
 #if A2_SV_LUT_SIZE
-	memset(v->sv, 0, sizeof(v->sv));
+	memset(v->sv, 0, A2_SV_LUT_SIZE * sizeof(A2_voice *));
+#endif
+#if A2_SV_INDEX
+	a2_FreeSubvoiceIndex(st, v);
 #endif
 
 	while(v->units)
@@ -569,7 +935,13 @@ void a2_VoiceFree(A2_state *st, A2_voice **head)
 	v->s.func = 0;
 	v->s.pc = 0;
 	v->s.state = A2_RUNNING;
+	if(v->flags & A2_SUSPENDED)
+		--st->suspendedvoices;
+	if(v->flags & A2_STOLEN)
+		--st->fadingvoices;
 	v->flags = 0;
+	v->sout = NULL;
+	v->level = A2_UNKNOWNLEVEL;
 	v->program = NULL;
 	for(i = A2_FIXEDREGS; i < v->ncregs; ++i)
 		v->cregs[i].write = NULL;
@@ -593,12 +965,14 @@ void a2_VoiceFree(A2_state *st, A2_voice **head)
 A2_errors a2_VoiceStart(A2_state *st, A2_voice *v,
 		A2_program *p, int argc, int *argv)
 {
-	int i;
 	v->program = p;
 	v->flags |= p->vflags;	/* A2_SUBINLINE etc */
+	if(st->prof)
+		a2_ProfSpawn(st->prof, p);
 	v->s.func = 0;
 	v->s.pc = 0;
 	v->s.state = A2_RUNNING;
+	v->tickrem = 0;
 
 	/* Grab the arguments! */
 	if(argc > p->funcs[0].argc)
@@ -606,8 +980,10 @@ A2_errors a2_VoiceStart(A2_state *st, A2_voice *v,
 	memcpy(v->s.r + p->funcs[0].argv, argv, argc * sizeof(int));
 
 	/* Get the defaults for any unspecified arguments */
-	for(i = argc; i < p->funcs[0].argc; ++i)
-		v->s.r[i + p->funcs[0].argv] = p->funcs[0].argdefs[i];
+	if(argc < p->funcs[0].argc)
+		memcpy(v->s.r + p->funcs[0].argv + argc,
+				p->funcs[0].argdefs + argc,
+				(p->funcs[0].argc - argc) * sizeof(int));
 
 	/* Unit control registers start after the main program arguments! */
 	v->ncregs = p->funcs->argv + p->funcs->argc;
@@ -627,6 +1003,8 @@ A2_errors a2_VoiceCall(A2_state *st, A2_voice *v, unsigned func,
 	A2_errors res;
 	if((res = a2_VoicePush(st, v, fn->argv, fn->topreg, interrupt)))
 		return res;
+	if(st->prof)
+		a2_ProfCall(st->prof, v->program, func);
 	v->s.func = func;
 	v->s.pc = 0;
 	if(interrupt)
@@ -659,7 +1037,7 @@ static inline A2_errors a2_VoiceSend(A2_state *st, A2_voice *v, unsigned when,
 	e->b.play.program = ep;
 	e->b.common.argc = argc;
 	memcpy(e->b.play.a, argv, argc * sizeof(int));
-	a2_SendEvent(&v->events, e);
+	a2_SendEvent(st, &v->events, e);
 	return A2_OK;
 }
 
@@ -672,7 +1050,7 @@ static inline A2_errors a2_VoiceKill(A2_state *st, A2_voice *v, unsigned when)
 	MSGTRACK(e->source = "a2_VoiceKill()";)
 	e->b.common.action = A2MT_KILL;
 	e->b.common.timestamp = when;
-	a2_SendEvent(&v->events, e);
+	a2_SendEvent(st, &v->events, e);
 	return A2_OK;
 }
 
@@ -685,6 +1063,13 @@ static inline A2_voice *a2_FindSubvoice(A2_voice *v, int vid)
 #if A2_SV_LUT_SIZE
 	if(vid < A2_SV_LUT_SIZE)
 		return v->sv[vid];
+#endif
+#if A2_SV_INDEX
+	if((unsigned)vid < A2_SVX_END)
+	{
+		A2_voice **slot = a2_SubvoiceSlot(v, vid);
+		return slot ? *slot : NULL;
+	}
 #endif
 	for(sv = v->sub; sv; sv = sv->next)
 		if((sv->handle == vid) && (sv->flags & A2_ATTACHED) &&
@@ -694,20 +1079,21 @@ static inline A2_voice *a2_FindSubvoice(A2_voice *v, int vid)
 }
 
 
-static inline void a2_AttachSubvoice(A2_voice *v, A2_voice *sv, int vid)
+static inline A2_errors a2_AttachSubvoice(A2_state *st, A2_voice *v,
+		A2_voice *sv, int vid)
 {
 #ifdef DEBUG
 	if(sv->flags & A2_APIHANDLE)
 	{
 		A2_LOG_DBG(NULL, "a2_AttachSubvoice(): %p already attached to "
 				" API handle %d!", sv, sv->handle);
-		return;
+		return A2_OK;
 	}
 	else if(sv->flags & A2_ATTACHED)
 	{
 		A2_LOG_DBG(NULL, "a2_AttachSubvoice(): %p already attached; "
 				"VID %d!", sv, sv->handle);
-		return;
+		return A2_OK;
 	}
 #endif
 	if(vid < 0)
@@ -717,60 +1103,74 @@ static inline void a2_AttachSubvoice(A2_voice *v, A2_voice *sv, int vid)
 			sv->flags |= A2_ATTACHED;
 			sv->handle = -1;
 		}
-		return;
+		return A2_OK;
 	}
 #if A2_SV_LUT_SIZE
 	if(vid < A2_SV_LUT_SIZE)
 		v->sv[vid] = sv;
+#endif
+#if A2_SV_INDEX
+	if((vid >= A2_SV_LUT_SIZE) && ((unsigned)vid < A2_SVX_END))
+	{
+		A2_voice **slot = a2_SubvoiceNewSlot(st, v, vid);
+		if(!slot)
+			return A2_OOMEMORY;
+		*slot = sv;
+	}
 #endif
 	sv->flags |= A2_ATTACHED;
 	sv->handle = vid;
+	return A2_OK;
 }
 
 
-static inline void a2_DetachSubvoice(A2_voice *v, int vid)
+/*
+ * Look up subvoice ID 'vid' of 'v' like a2_FindSubvoice(), removing it from the
+ * LUT or index. Returns NULL if there is no voice attached to 'vid'.
+ */
+static inline A2_voice *a2_UnmapSubvoice(A2_voice *v, int vid)
 {
 	A2_voice *sv;
-	if(vid < 0)
-		return;
 #if A2_SV_LUT_SIZE
-	if((vid < A2_SV_LUT_SIZE) && v->sv[vid])
+	if(vid < A2_SV_LUT_SIZE)
 	{
-		a2_VoiceDetach(v->sv[vid], v->s.waketime);
+		sv = v->sv[vid];
 		v->sv[vid] = NULL;
-		return;
+		return sv;
+	}
+#endif
+#if A2_SV_INDEX
+	if((unsigned)vid < A2_SVX_END)
+	{
+		A2_voice **slot = a2_SubvoiceSlot(v, vid);
+		if(!slot)
+			return NULL;
+		sv = *slot;
+		*slot = NULL;
+		return sv;
 	}
 #endif
 	for(sv = v->sub; sv; sv = sv->next)
 		if((sv->handle == vid) && (sv->flags & A2_ATTACHED) &&
 				!(sv->flags & A2_APIHANDLE))
-		{
-			a2_VoiceDetach(sv, v->s.waketime);
-			break;
-		}
+			return sv;
+	return NULL;
+}
+
+
+static inline void a2_DetachSubvoice(A2_voice *v, int vid)
+{
+	A2_voice *sv;
+	if((vid >= 0) && (sv = a2_UnmapSubvoice(v, vid)))
+		a2_VoiceDetach(sv, v->s.waketime);
 }
 
 
 static inline void a2_KillSubvoice(A2_state *st, A2_voice *v, int vid)
 {
 	A2_voice *sv;
-	if(vid < 0)
-		return;
-#if A2_SV_LUT_SIZE
-	if((vid < A2_SV_LUT_SIZE) && v->sv[vid])
-	{
-		a2_VoiceKill(st, v->sv[vid], v->s.waketime);
-		v->sv[vid] = NULL;
-		return;
-	}
-#endif
-	for(sv = v->sub; sv; sv = sv->next)
-		if((sv->handle == vid) && (sv->flags & A2_ATTACHED) &&
-				!(sv->flags & A2_APIHANDLE))
-		{
-			a2_VoiceKill(st, sv, v->s.waketime);
-			break;
-		}
+	if((vid >= 0) && (sv = a2_UnmapSubvoice(v, vid)))
+		a2_VoiceKill(st, sv, v->s.waketime);
 }
 
 
@@ -794,15 +1194,12 @@ static A2_errors a2_VoiceSpawn(A2_state *st, A2_voice *v, int vid,
 	a2_DetachSubvoice(v, vid);
 	if(!p)
 		return A2_BADPROGRAM;
-	if(!(nv = a2_VoiceNew(st, v, v->s.waketime)))
+	if(!(nv = a2_VoiceNew(st, v, v->s.waketime, p->vclass)))
 		return v->nestlevel < A2_NESTLIMIT ?
 				A2_VOICEALLOC : A2_VOICENEST;
 	nv->flags = 0;
-	a2_AttachSubvoice(v, nv, vid);
-	if(!nv)
-		return v->nestlevel < A2_NESTLIMIT ?
-				A2_VOICEALLOC : A2_VOICENEST;
-	if((res = a2_VoiceStart(st, nv, p, argc, argv)))
+	if((res = a2_AttachSubvoice(st, v, nv, vid)) ||
+			(res = a2_VoiceStart(st, nv, p, argc, argv)))
 		a2_VoiceFree(st, &v->sub);
 	return res;
 }
@@ -826,7 +1223,8 @@ static inline A2_errors a2_event_play(A2_state *st, A2_voice *parent,
 	A2_program *p = a2_GetProgram(st, eb->play.program);
 	if(!p)
 		return A2_BADPROGRAM;
-	if(!(v = a2_VoiceNew(st, parent, eb->common.timestamp)))
+	if(!(v = a2_VoiceNew(st, parent, eb->common.timestamp,
+			p->vclass)))
 		return parent->nestlevel < A2_NESTLIMIT ?
 				A2_VOICEALLOC : A2_VOICENEST;
 	v->flags = 0;
@@ -845,7 +1243,8 @@ static inline A2_errors a2_event_start(A2_state *st, A2_voice *parent,
 	A2_program *p = a2_GetProgram(st, eb->start.program);
 	if(!p)
 		return A2_BADPROGRAM;
-	if(!(v = a2_VoiceNew(st, parent, eb->common.timestamp)))
+	if(!(v = a2_VoiceNew(st, parent, eb->common.timestamp,
+			p->vclass)))
 		return parent->nestlevel < A2_NESTLIMIT ?
 				A2_VOICEALLOC : A2_VOICENEST;
 	/*
@@ -889,7 +1288,7 @@ static inline void a2_event_subforward(A2_state *st, A2_voice *parent,
 		return;
 	}
 #endif
-	a2_SendEvent(&sv->events, e);
+	a2_SendEvent(st, &sv->events, e);
 	if(!sv->next)
 		return;
 	if(e->b.common.argc)
@@ -908,7 +1307,7 @@ static inline void a2_event_subforward(A2_state *st, A2_voice *parent,
 		sv = sv->next;
 		memcpy(&ne->b, &e->b, esize);
 		MSGTRACK(ne->source = "a2_event_subforward()";)
-		a2_SendEvent(&sv->events, ne);
+		a2_SendEvent(st, &sv->events, ne);
 	}
 }
 
@@ -922,6 +1321,8 @@ static inline void a2_event_subforward(A2_state *st, A2_voice *parent,
 static inline A2_errors a2_VoiceProcessEvents(A2_state *st, A2_voice *v)
 {
 	unsigned current = v->events->b.common.timestamp;
+	if(v->sout)
+		a2_VoiceResume(st, v);
 	while(v->events)
 	{
 		int res;
@@ -1003,7 +1404,7 @@ static inline A2_errors a2_VoiceProcessEvents(A2_state *st, A2_voice *v)
 				break;
 			}
 			v->s.waketime = e->b.common.timestamp;
-			v->events = e->next;
+			a2_EventPop(&v->events);
 			a2_FreeEvent(st, e);
 			return A2_OK;	/* Spin the VM to process message! */
 		  }
@@ -1025,7 +1426,17 @@ static inline A2_errors a2_VoiceProcessEvents(A2_state *st, A2_voice *v)
 			{
 				/* Turn into non-SUB event! */
 				--e->b.common.action;
-				v->events = e->next;
+				a2_EventPop(&v->events);
+				if(e->b.common.action == A2MT_KILL)
+				{
+#if A2_SV_LUT_SIZE
+					memset(v->sv, 0, A2_SV_LUT_SIZE *
+							sizeof(A2_voice *));
+#endif
+#if A2_SV_INDEX
+					a2_FreeSubvoiceIndex(st, v);
+#endif
+				}
 				a2_event_subforward(st, v, e);
 				continue;	/* The event is reused! */
 			}
@@ -1051,7 +1462,7 @@ static inline A2_errors a2_VoiceProcessEvents(A2_state *st, A2_voice *v)
 			a2_VoiceDetach(v, e->b.common.timestamp);
 			break;
 		}
-		v->events = e->next;
+		a2_EventPop(&v->events);
 		a2_FreeEvent(st, e);
 	}
 	return A2_OK;
@@ -1061,13 +1472,6 @@ static inline A2_errors a2_VoiceProcessEvents(A2_state *st, A2_voice *v)
 /*
  * Register write tracker
  */
-typedef struct A2_regtracker
-{
-	uint32_t	mask;			/* One bit/register */
-	uint32_t	position;		/* Current index in regs[] */
-	uint8_t		regs[A2_REGISTERS];	/* Indices of written regs */
-} A2_regtracker;
-
 static inline void a2_RTInit(A2_regtracker *rt)
 {
 	rt->mask = rt->position = 0;
@@ -1075,7 +1479,7 @@ static inline void a2_RTInit(A2_regtracker *rt)
 
 static inline void a2_RTMark(A2_regtracker *rt, unsigned r)
 {
-	uint32_t b = 1 << r;
+	uint64_t b = (uint64_t)1 << r;
 	if(b & rt->mask)
 		return;		/* Already marked! --> */
 	rt->mask |= b;
@@ -1084,7 +1488,7 @@ static inline void a2_RTMark(A2_regtracker *rt, unsigned r)
 
 static inline void a2_RTUnmark(A2_regtracker *rt, unsigned r)
 {
-	uint32_t b = 1 << r;
+	uint64_t b = (uint64_t)1 << r;
 	if(b & rt->mask)
 	{
 		int i;
@@ -1116,12 +1520,31 @@ static inline void a2_RTSetAll(A2_regtracker *rt, A2_state *st, A2_voice *v,
 }
 
 
-/* Convert musical tick duration to audio frame delta time */
+/*
+ * Convert musical tick duration to audio frame delta time.
+ *
+ * 'd' (ticks) and R_TICK (ms/tick) are 16:16 fixp, so their product is ms in
+ * 32:32 fixp, and the exact result is d * tick * samplerate / (1000 << 24)
+ * frames in 24:8 fixp. The remainder of that division is the part of the
+ * musical time of the voice that is not yet accounted for in frame time. It is
+ * kept in the voice and carried over to the next TDELAY, so that any sequence
+ * of tick delays adds up to exactly the same time as a single delay of the
+ * same total length.
+ */
+#define	A2_TICKDIV	((uint64_t)1000 << 24)
 static inline unsigned a2_ticks2t(A2_state *st, A2_voice *v, int d)
 {
-	return ((((uint64_t)d * v->s.r[R_TICK] + 127) >> 8) *
-			st->msdur + 0x7fffffff) >> 32;
+	uint64_t p, hi, x;
+	unsigned sr = st->config->samplerate;
+	if((d <= 0) || (v->s.r[R_TICK] <= 0))
+		return 0;
+	p = (uint64_t)d * v->s.r[R_TICK];
+	hi = (p >> 24) * sr;
+	x = ((hi % 1000) << 24) + (p & 0xffffff) * sr + v->tickrem;
+	v->tickrem = x % A2_TICKDIV;
+	return hi / 1000 + x / A2_TICKDIV;
 }
+#undef	A2_TICKDIV
 
 
 /* Convert milliseconds to audio frame delta time */
@@ -1159,44 +1582,184 @@ static int a2_sizeof_object(A2_state *st, int handle)
  */
 #define	A2_VMABORT(e, m)					\
 	{							\
-		st->instructions += A2_INSLIMIT - inscount;	\
+		A2_VMSAVEPC;					\
+		A2_VMCOUNT;					\
 		a2r_Error(st, e, m);				\
 		return e;					\
 	}
+
+/*
+ * Instruction counting. A2_VMCOUNT is used whenever the VM is suspended. When
+ * profiling, A2_VMPROFMARK attributes the instructions executed since the last
+ * mark to the current function, and must be used before switching functions.
+ */
+#define	A2_VMPROFMARK							\
+	if(prof)							\
+	{								\
+		a2_ProfInstructions(prof, v->program, v->s.func,	\
+				profmark - inscount);			\
+		profmark = inscount;					\
+	}
+#define	A2_VMCOUNT							\
+	{								\
+		st->instructions += A2_INSLIMIT - inscount;		\
+		A2_VMPROFMARK						\
+	}
+
+/*
+ * The VM runs with a straight instruction pointer, 'pc', into the code of the
+ * current function. v->s.pc is only updated when the VM is suspended, or when
+ * calling code that needs it, such as a2_VoiceCall().
+ */
+#define	A2_VMSAVEPC	(v->s.pc = pc - code)
+#ifdef A2_VM_JIT
+#  define	A2_VMLOADPC						\
+	{								\
+		code = v->program->funcs[v->s.func].code;		\
+		native = v->program->funcs[v->s.func].native;		\
+		pc = code + v->s.pc;					\
+	}
+#else
+#  define	A2_VMLOADPC						\
+	{								\
+		code = v->program->funcs[v->s.func].code;		\
+		pc = code + v->s.pc;					\
+	}
+#endif
+
+/*
+ * If the instruction at pc has been translated, run native code until it gets
+ * to an instruction that the interpreter needs to handle. (See vmjit.c.)
+ */
+#ifdef A2_VM_JIT
+#  define	A2_VMNATIVE						\
+	if(native && native->entry[pc - code])				\
+		pc = code + ((A2_nativefunc)(native->code +		\
+				native->entry[pc - code]))(r, &inscount, &rt);
+#else
+#  define	A2_VMNATIVE
+#endif
+
+/*
+ * Instruction dispatch. A2_VMCASE() opens an instruction handler, A2_VMNEXT
+ * moves on to the next instruction, and A2_VMDISPATCH executes the instruction
+ * at pc, for use after jumps and calls.
+ *
+ * With A2_VM_COMPUTED_GOTO, each handler dispatches the next instruction
+ * directly through a label table generated from A2_ALLINSTRUCTIONS, rather
+ * than going back to the switch() at the top of the loop.
+ */
+#ifdef A2_VM_COMPUTED_GOTO
+#  define	A2_VMCASE(x)	case OP_##x: a2_vmop_##x
+#  define	A2_VMDEFAULT	case A2_OPCODES: default: a2_vmop_ILLEGAL
+#  define	A2_VMDISPATCH						\
+	{								\
+		A2_VMNATIVE						\
+		ins = (A2_instruction *)pc;				\
+		DUMPCODERT(						\
+			A2_DLOG("%p: ", v);				\
+			a2_DumpIns(code, pc - code, stdout);		\
+		)							\
+		if(!--inscount)						\
+			A2_VMABORT(A2_OVERLOAD, "VM");			\
+		goto *ops[ins->opcode];					\
+	}
+#  define	A2_VMNEXT	{ ++pc; A2_VMDISPATCH }
+#else
+#  define	A2_VMCASE(x)	case OP_##x
+#  define	A2_VMDEFAULT	case A2_OPCODES: default
+#  define	A2_VMDISPATCH	continue
+#  define	A2_VMNEXT	break
+#endif
+
+/*
+ * Fused compare + JZ/JNZ. The comparison result is still written to the
+ * register, as it may be used after the branch. 'z' is 1 for JZ, 0 for JNZ.
+ *
+ * NOTE: Branch targets are PC relative, as is the case with all local branches.
+ */
+#define	A2_VMCMPJ(x, cmp, z)						\
+	A2_VMCASE(x):							\
+		r[ins->a1] = (r[ins->a1] cmp r[ins->a3]) << 16;		\
+		if((!r[ins->a1]) != z)					\
+		{							\
+			++pc;						\
+			A2_VMNEXT;					\
+		}							\
+		pc += (int16_t)ins->a2;					\
+		A2_VMDISPATCH;
 static inline A2_errors a2_VoiceProcessVM(A2_state *st, A2_voice *v)
 {
 	int res;
 	int cargc = 0, cargv[A2_MAXARGS];	/* run/spawn argument stack */
 	unsigned *code = v->program->funcs[v->s.func].code;
+	unsigned *pc = code + v->s.pc;
+#ifdef A2_VM_JIT
+	A2_native *native = v->program->funcs[v->s.func].native;
+#endif
 	int *r = v->s.r;
 	unsigned inscount = A2_INSLIMIT;
+	A2_profblock *prof = st->prof;
+	unsigned profmark = A2_INSLIMIT;
+	unsigned dt;
+	A2_instruction *ins;
 	A2_regtracker rt;
+#ifdef A2_VM_COMPUTED_GOTO
+#define	A2_DI(x)	[OP_##x] = &&a2_vmop_##x,
+#define	A2_CI(x)	[OP_##x##C] = &&a2_vmop_##x##C,
+	static const void *const a2_vmops[256] = {
+		[0 ... 255] = &&a2_vmop_ILLEGAL,
+		[OP_END] = &&a2_vmop_END,
+		A2_ALLINSTRUCTIONS
+	};
+#undef	A2_CI
+#undef	A2_DI
+	/* When profiling, all instructions go through a2_vmop_PROFILE first */
+	static const void *const a2_vmprofops[256] = {
+		[0 ... 255] = &&a2_vmop_PROFILE
+	};
+	const void *const *ops = prof ? a2_vmprofops : a2_vmops;
+#endif
 	if(v->s.state == A2_WAITING)
 		v->s.state = A2_RUNNING;
+	v->flags &= ~A2_DORMANT;	/* Until we hit DORMANT or END again */
 	a2_RTInit(&rt);
 	while(1)
 	{
-		unsigned dt;
-		A2_instruction *ins = (A2_instruction *)(code + v->s.pc);
+#ifdef A2_VM_COMPUTED_GOTO
+		A2_VMDISPATCH
+	  a2_vmop_PROFILE:
+		++prof->ops[ins->opcode];
+		goto *a2_vmops[ins->opcode];
+#else
+		A2_VMNATIVE
+		ins = (A2_instruction *)pc;
 		DUMPCODERT(
 			A2_DLOG("%p: ", v);
-			a2_DumpIns(code, v->s.pc);
+			a2_DumpIns(code, pc - code, stdout);
 		)
 		if(!--inscount)
 			A2_VMABORT(A2_OVERLOAD, "VM");
+		if(prof)
+			++prof->ops[ins->opcode];
+#endif
 		switch((A2_opcodes)ins->opcode)
 		{
 
 		/* Program flow control */
-		  case OP_END:
+		  A2_VMCASE(DORMANT):
+			/* As END, but don't process the voice while waiting */
+			v->flags |= A2_DORMANT;
+		  A2_VMCASE(END):
 		  {
 		  	unsigned now = v->s.waketime;
+			A2_VMSAVEPC;
 			a2_RTApply(&rt, st, v, v->s.waketime, 0);
 			v->s.waketime += 1000000;
 			if(v->s.state == A2_FINALIZING)
 			{
 				/* Wait for subvoices to terminate */
-				st->instructions += A2_INSLIMIT - inscount;
+				A2_VMCOUNT;
 				DUMPCODERT(
 				  if(v->sub)
 				    A2_DLOG("%p: [still waiting for "
@@ -1209,8 +1772,14 @@ static inline A2_errors a2_VoiceProcessVM(A2_state *st, A2_voice *v)
 			v->s.state = A2_ENDING;
 			if((v->flags & A2_ATTACHED) || v->events)
 			{
-				/* Hang around until detached! */
-				st->instructions += A2_INSLIMIT - inscount;
+				/*
+				 * Hang around until detached! With no units,
+				 * there is nothing to do until then, except
+				 * handling messages.
+				 */
+				if(!v->units)
+					v->flags |= A2_DORMANT;
+				A2_VMCOUNT;
 				DUMPCODERT(A2_DLOG("%p: [waiting for "
 						"detach]\n", v);)
 				return A2_OK;
@@ -1219,30 +1788,34 @@ static inline A2_errors a2_VoiceProcessVM(A2_state *st, A2_voice *v)
 			if(!v->sub)
 			{
 				/* That's it - all done! */
-				st->instructions += A2_INSLIMIT - inscount;
+				A2_VMCOUNT;
 				DUMPCODERT(A2_DLOG("%p: [end]\n", v);)
 				return A2_END;
 			}
 			/* Detach subvoices, then wait for them to terminate */
 #if A2_SV_LUT_SIZE
-			memset(v->sv, 0, sizeof(v->sv));
+			memset(v->sv, 0, A2_SV_LUT_SIZE * sizeof(A2_voice *));
+#endif
+#if A2_SV_INDEX
+			a2_FreeSubvoiceIndex(st, v);
 #endif
+			A2_VMCOUNT;
 			for(v = v->sub; v; v = v->next)
 				a2_VoiceDetach(v, now);
-			st->instructions += A2_INSLIMIT - inscount;
 			DUMPCODERT(A2_DLOG("%p: [waiting for subvoices]\n",
 					v);)
 			return A2_OK;
 		  }
-		  case OP_RETURN:
+		  A2_VMCASE(RETURN):
 		  {
 			unsigned now = v->s.waketime;
+			A2_VMPROFMARK
 			if(a2_VoicePop(st, v))
 			{
 				/* Return from interrupt */
-				code = v->program->funcs[v->s.func].code;
+				A2_VMLOADPC;
 				if(v->s.state >= A2_ENDING)
-					continue;
+					A2_VMDISPATCH;
 				dt = v->s.waketime - now;
 				v->s.waketime = now;
 				goto timing_interrupt;
@@ -1250,11 +1823,11 @@ static inline A2_errors a2_VoiceProcessVM(A2_state *st, A2_voice *v)
 			else
 			{
 				/* Return from local function */
-				code = v->program->funcs[v->s.func].code;
-				continue;
+				A2_VMLOADPC;
+				A2_VMDISPATCH;
 			}
 		  }
-		  case OP_CALL:
+		  A2_VMCASE(CALL):
 		  {
 #ifdef DEBUG
 			A2_interface *i = &st->interfaces->interface;
@@ -1264,289 +1837,322 @@ static inline A2_errors a2_VoiceProcessVM(A2_state *st, A2_voice *v)
 				A2_LOG_DBG(i, "Function index %d out of "
 						"range!", ins->a2);
 #endif
+			A2_VMSAVEPC;
+			A2_VMPROFMARK
 			if((res = a2_VoiceCall(st, v, ins->a2, cargc, cargv,
 					0)))
 				A2_VMABORT(res, "VM:CALL");
-			code = v->program->funcs[v->s.func].code;
+			A2_VMLOADPC;
 			cargc = 0;
-			continue;
+			A2_VMDISPATCH;
 		  }
 
 		/* Local flow control */
-		  case OP_JUMP:
-			v->s.pc = ins->a2;
-			continue;
-		  case OP_LOOP:
+		  A2_VMCASE(JUMP):
+			pc += (int16_t)ins->a2;
+			A2_VMDISPATCH;
+		  A2_VMCASE(LOOP):
 			r[ins->a1] -= 65536;
 			if(r[ins->a1] <= 0)
-				break;
-			v->s.pc = ins->a2;
-			continue;
-		  case OP_JZ:
+				A2_VMNEXT;
+			pc += (int16_t)ins->a2;
+			A2_VMDISPATCH;
+		  A2_VMCASE(JZ):
 			if(r[ins->a1])
-				break;
-			v->s.pc = ins->a2;
-			continue;
-		  case OP_JNZ:
+				A2_VMNEXT;
+			pc += (int16_t)ins->a2;
+			A2_VMDISPATCH;
+		  A2_VMCASE(JNZ):
 			if(!r[ins->a1])
-				break;
-			v->s.pc = ins->a2;
-			continue;
-		  case OP_JG:
+				A2_VMNEXT;
+			pc += (int16_t)ins->a2;
+			A2_VMDISPATCH;
+		  A2_VMCASE(JG):
 			if(r[ins->a1] <= 0)
-				break;
-			v->s.pc = ins->a2;
-			continue;
-		  case OP_JL:
+				A2_VMNEXT;
+			pc += (int16_t)ins->a2;
+			A2_VMDISPATCH;
+		  A2_VMCASE(JL):
 			if(r[ins->a1] >= 0)
-				break;
-			v->s.pc = ins->a2;
-			continue;
-		  case OP_JGE:
+				A2_VMNEXT;
+			pc += (int16_t)ins->a2;
+			A2_VMDISPATCH;
+		  A2_VMCASE(JGE):
 			if(r[ins->a1] < 0)
-				break;
-			v->s.pc = ins->a2;
-			continue;
-		  case OP_JLE:
+				A2_VMNEXT;
+			pc += (int16_t)ins->a2;
+			A2_VMDISPATCH;
+		  A2_VMCASE(JLE):
 			if(r[ins->a1] > 0)
-				break;
-			v->s.pc = ins->a2;
-			continue;
+				A2_VMNEXT;
+			pc += (int16_t)ins->a2;
+			A2_VMDISPATCH;
 
 		/* Timing */
-		  case OP_DELAY:
+		  A2_VMCASE(DELAY):
 			dt = a2_ms2t(st, ins->a3);
-			++v->s.pc;
+			++pc;
 			goto timing;
-		  case OP_DELAYR:
+		  A2_VMCASE(DELAYR):
 			dt = a2_ms2t(st, r[ins->a1]);
 			goto timing;
-		  case OP_TDELAY:
+		  A2_VMCASE(TDELAY):
 			dt = a2_ticks2t(st, v, ins->a3);
-			++v->s.pc;
+			++pc;
 			goto timing;
-		  case OP_TDELAYR:
+		  A2_VMCASE(TDELAYR):
 			dt = a2_ticks2t(st, v, r[ins->a1]);
 			goto timing;
 
-		/* Arithmetics */
-		  case OP_SUBR:
+		/*
+		 * Arithmetics
+		 *	The *C variants, used for control registers, mark the
+		 *	target register for the write tracker, and then fall
+		 *	through into the plain versions.
+		 */
+		  A2_VMCASE(SUBRC):
+			a2_RTMark(&rt, ins->a1);
+		  A2_VMCASE(SUBR):
 			r[ins->a1] -= r[ins->a2];
+			A2_VMNEXT;
+		  A2_VMCASE(DIVRC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_DIVR:
+		  A2_VMCASE(DIVR):
 			if(!r[ins->a2])
 				A2_VMABORT(A2_DIVBYZERO, "VM:DIVR");
 			r[ins->a1] = ((int64_t)r[ins->a1] << 16) / r[ins->a2];
+			A2_VMNEXT;
+		  A2_VMCASE(P2DRC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_P2DR:
+		  A2_VMCASE(P2DR):
 			r[ins->a1] = A2_1K_DIV_MIDDLEC / a2_P2I(r[ins->a2]);
+			A2_VMNEXT;
+		  A2_VMCASE(NEGRC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_NEGR:
+		  A2_VMCASE(NEGR):
 			r[ins->a1] = -r[ins->a2];
+			A2_VMNEXT;
+		  A2_VMCASE(LOADC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_LOAD:
+		  A2_VMCASE(LOAD):
 			r[ins->a1] = ins->a3;
+			++pc;
+			A2_VMNEXT;
+		  A2_VMCASE(LOADRC):
 			a2_RTMark(&rt, ins->a1);
-			++v->s.pc;
-			break;
-		  case OP_LOADR:
+		  A2_VMCASE(LOADR):
 			r[ins->a1] = r[ins->a2];
+			A2_VMNEXT;
+		  A2_VMCASE(ADDC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_ADD:
+		  A2_VMCASE(ADD):
 			r[ins->a1] += ins->a3;
+			++pc;
+			A2_VMNEXT;
+		  A2_VMCASE(ADDRC):
 			a2_RTMark(&rt, ins->a1);
-			++v->s.pc;
-			break;
-		  case OP_ADDR:
+		  A2_VMCASE(ADDR):
 			r[ins->a1] += r[ins->a2];
+			A2_VMNEXT;
+		  A2_VMCASE(MULC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_MUL:
+		  A2_VMCASE(MUL):
 			r[ins->a1] = (int64_t)r[ins->a1] * ins->a3 >> 16;
+			++pc;
+			A2_VMNEXT;
+		  A2_VMCASE(MULRC):
 			a2_RTMark(&rt, ins->a1);
-			++v->s.pc;
-			break;
-		  case OP_MULR:
+		  A2_VMCASE(MULR):
 			r[ins->a1] = (int64_t)r[ins->a1] * r[ins->a2] >> 16;
+			A2_VMNEXT;
+		  A2_VMCASE(MODC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_MOD:
+		  A2_VMCASE(MOD):
 			r[ins->a1] %= ins->a3;
+			++pc;
+			A2_VMNEXT;
+		  A2_VMCASE(MODRC):
 			a2_RTMark(&rt, ins->a1);
-			++v->s.pc;
-			break;
-		  case OP_MODR:
+		  A2_VMCASE(MODR):
 			if(!r[ins->a2])
 				A2_VMABORT(A2_DIVBYZERO, "VM:MODR");
 			r[ins->a1] %= r[ins->a2];
+			A2_VMNEXT;
+		  A2_VMCASE(QUANTC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_QUANT:
+		  A2_VMCASE(QUANT):
 			r[ins->a1] = r[ins->a1] / ins->a3 * ins->a3;
+			++pc;
+			A2_VMNEXT;
+		  A2_VMCASE(QUANTRC):
 			a2_RTMark(&rt, ins->a1);
-			++v->s.pc;
-			break;
-		  case OP_QUANTR:
+		  A2_VMCASE(QUANTR):
 			if(!r[ins->a2])
 				A2_VMABORT(A2_DIVBYZERO, "VM:QUANTR");
 			r[ins->a1] = r[ins->a1] / r[ins->a2] * r[ins->a2];
+			A2_VMNEXT;
+		  A2_VMCASE(RANDC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_RAND:
-			r[ins->a1] = (int64_t)a2_Noise(&st->noisestate) *
+		  A2_VMCASE(RAND):
+			r[ins->a1] = (int64_t)a2_Noise(&v->noisestate) *
 					ins->a3 >> 16;
+			++pc;
+			A2_VMNEXT;
+		  A2_VMCASE(RANDRC):
 			a2_RTMark(&rt, ins->a1);
-			++v->s.pc;
-			break;
-		  case OP_RANDR:
-			r[ins->a1] = (int64_t)a2_Noise(&st->noisestate) *
+		  A2_VMCASE(RANDR):
+			r[ins->a1] = (int64_t)a2_Noise(&v->noisestate) *
 					r[ins->a2] >> 16;
-			a2_RTMark(&rt, ins->a1);
-			break;
+			A2_VMNEXT;
 
 		/* Comparison operators */
 /*TODO: Versions with an immediate second operand! */
-		  case OP_GR:
+		  A2_VMCASE(GRC):
+			a2_RTMark(&rt, ins->a1);
+		  A2_VMCASE(GR):
 			r[ins->a1] = (r[ins->a1] > r[ins->a2]) << 16;
+			A2_VMNEXT;
+		  A2_VMCASE(LRC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_LR:
+		  A2_VMCASE(LR):
 			r[ins->a1] = (r[ins->a1] < r[ins->a2]) << 16;
+			A2_VMNEXT;
+		  A2_VMCASE(GERC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_GER:
+		  A2_VMCASE(GER):
 			r[ins->a1] = (r[ins->a1] >= r[ins->a2]) << 16;
+			A2_VMNEXT;
+		  A2_VMCASE(LERC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_LER:
+		  A2_VMCASE(LER):
 			r[ins->a1] = (r[ins->a1] <= r[ins->a2]) << 16;
+			A2_VMNEXT;
+		  A2_VMCASE(EQRC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_EQR:
+		  A2_VMCASE(EQR):
 			r[ins->a1] = (r[ins->a1] == r[ins->a2]) << 16;
+			A2_VMNEXT;
+		  A2_VMCASE(NERC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_NER:
+		  A2_VMCASE(NER):
 			r[ins->a1] = (r[ins->a1] != r[ins->a2]) << 16;
-			a2_RTMark(&rt, ins->a1);
-			break;
+			A2_VMNEXT;
 
 		/* Boolean operators */
-		  case OP_ANDR:
+		  A2_VMCASE(ANDRC):
+			a2_RTMark(&rt, ins->a1);
+		  A2_VMCASE(ANDR):
 			r[ins->a1] = (r[ins->a1] && r[ins->a2]) << 16;
+			A2_VMNEXT;
+		  A2_VMCASE(ORRC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_ORR:
+		  A2_VMCASE(ORR):
 			r[ins->a1] = (r[ins->a1] || r[ins->a2]) << 16;
+			A2_VMNEXT;
+		  A2_VMCASE(XORRC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_XORR:
+		  A2_VMCASE(XORR):
 			r[ins->a1] = (!r[ins->a1] != !r[ins->a2]) << 16;
+			A2_VMNEXT;
+		  A2_VMCASE(NOTRC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_NOTR:
+		  A2_VMCASE(NOTR):
 			r[ins->a1] = (!r[ins->a2]) << 16;
-			a2_RTMark(&rt, ins->a1);
-			break;
+			A2_VMNEXT;
 
 		/* Unit control */
-		  case OP_SET:
+		  A2_VMCASE(SET):
 			a2_VoiceControl(st, v, ins->a1, v->s.waketime, 0);
 			a2_RTUnmark(&rt, ins->a1);
-			break;
+			A2_VMNEXT;
 
-		  case OP_SETALL:
+		  A2_VMCASE(SETALL):
 			a2_RTSetAll(&rt, st, v, v->s.waketime);
-			break;
+			A2_VMNEXT;
 
-		  case OP_RAMP:
+		  A2_VMCASE(RAMP):
 			a2_VoiceControl(st, v, ins->a1, v->s.waketime,
 					a2_ms2t(st, ins->a3));
 			a2_RTUnmark(&rt, ins->a1);
-			++v->s.pc;
-			break;
-		  case OP_RAMPR:
+			++pc;
+			A2_VMNEXT;
+		  A2_VMCASE(RAMPR):
 			a2_VoiceControl(st, v, ins->a1, v->s.waketime,
 					a2_ms2t(st, r[ins->a2]));
 			a2_RTUnmark(&rt, ins->a1);
-			break;
+			A2_VMNEXT;
 
-		  case OP_RAMPALL:
+		  A2_VMCASE(RAMPALL):
 			a2_RTApply(&rt, st, v, v->s.waketime,
 					a2_ms2t(st, ins->a3));
 			a2_RTInit(&rt);
-			++v->s.pc;
-			break;
-		  case OP_RAMPALLR:
+			++pc;
+			A2_VMNEXT;
+		  A2_VMCASE(RAMPALLR):
 			a2_RTApply(&rt, st, v, v->s.waketime,
 					a2_ms2t(st, r[ins->a1]));
 			a2_RTInit(&rt);
-			break;
+			A2_VMNEXT;
 
 		/* Subvoice control */
-		  case OP_PUSH:
+		  A2_VMCASE(PUSH):
 			if(cargc >= A2_MAXARGS)
 				A2_VMABORT(A2_MANYARGS, "VM:PUSH");
 			cargv[cargc++] = ins->a3;
-			++v->s.pc;
-			break;
-		  case OP_PUSHR:
+			++pc;
+			A2_VMNEXT;
+		  A2_VMCASE(PUSHR):
 			if(cargc >= A2_MAXARGS)
 				A2_VMABORT(A2_MANYARGS, "VM:PUSHR");
 			cargv[cargc++] = r[ins->a1];
-			break;
-		  case OP_SPAWNVR:
+			A2_VMNEXT;
+		  A2_VMCASE(SPAWNVR):
 			a2_VoiceSpawn(st, v, r[ins->a1] >> 16,
 					r[ins->a2] >> 16, cargc, cargv);
 			cargc = 0;
-			break;
-		  case OP_SPAWNV:
+			A2_VMNEXT;
+		  A2_VMCASE(SPAWNV):
 			a2_VoiceSpawn(st, v, r[ins->a1] >> 16,
 					ins->a2, cargc, cargv);
 			cargc = 0;
-			break;
-		  case OP_SPAWNR:
+			A2_VMNEXT;
+		  A2_VMCASE(SPAWNR):
 			a2_VoiceSpawn(st, v, ins->a1, r[ins->a2] >> 16,
 					cargc, cargv);
 			cargc = 0;
-			break;
-		  case OP_SPAWN:
+			A2_VMNEXT;
+		  A2_VMCASE(SPAWN):
 			a2_VoiceSpawn(st, v, ins->a1, ins->a2, cargc, cargv);
 			cargc = 0;
-			break;
-		  case OP_SPAWNDR:
+			A2_VMNEXT;
+		  A2_VMCASE(SPAWNDR):
 			a2_VoiceSpawn(st, v, -1, r[ins->a1] >> 16, cargc,
 					cargv);
 			cargc = 0;
-			break;
-		  case OP_SPAWND:
+			A2_VMNEXT;
+		  A2_VMCASE(SPAWND):
 			a2_VoiceSpawn(st, v, -1, ins->a2, cargc, cargv);
 			cargc = 0;
-			break;
-		  case OP_SPAWNAR:
+			A2_VMNEXT;
+		  A2_VMCASE(SPAWNAR):
 			a2_VoiceSpawn(st, v, -2, r[ins->a1] >> 16, cargc,
 					cargv);
 			cargc = 0;
-			break;
-		  case OP_SPAWNA:
+			A2_VMNEXT;
+		  A2_VMCASE(SPAWNA):
 			a2_VoiceSpawn(st, v, -2, ins->a2, cargc, cargv);
 			cargc = 0;
-			break;
-		  case OP_SENDR:
+			A2_VMNEXT;
+		  A2_VMCASE(SENDR):
 		  {
 			A2_voice *sv;
 			if((sv = a2_FindSubvoice(v, r[ins->a1] >> 16)))
 				a2_VoiceSend(st, sv, v->s.waketime, ins->a2,
 						cargc, cargv);
 			cargc = 0;
-			break;
+			A2_VMNEXT;
 		  }
-		  case OP_SEND:
+		  A2_VMCASE(SEND):
 		  {
 			A2_voice *sv;
 #ifdef DEBUG
@@ -1558,87 +2164,97 @@ static inline A2_errors a2_VoiceProcessVM(A2_state *st, A2_voice *v)
 				a2_VoiceSend(st, sv, v->s.waketime, ins->a2,
 						cargc, cargv);
 			cargc = 0;
-			break;
+			A2_VMNEXT;
 		  }
-		  case OP_SENDA:
+		  A2_VMCASE(SENDA):
 		  {
 			A2_voice *sv;
 			for(sv = v->sub; sv; sv = sv->next)
 				a2_VoiceSend(st, sv, v->s.waketime, ins->a2,
 						cargc, cargv);
 			cargc = 0;
-			break;
+			A2_VMNEXT;
 		  }
-		  case OP_SENDS:
+		  A2_VMCASE(SENDS):
 		  {
 			int ep = v->program->eps[ins->a2];
 			if(ep < 0)
 				A2_VMABORT(A2_BADENTRY, "VM:SENDS");
+			A2_VMSAVEPC;
+			A2_VMPROFMARK
 			if((res = a2_VoiceCall(st, v, ep, cargc, cargv, 1)))
 				A2_VMABORT(res, "VM:SENDS");
-			code = v->program->funcs[v->s.func].code;
+			A2_VMLOADPC;
 			cargc = 0;
-			break;
+			A2_VMNEXT;
 		  }
-		  case OP_WAIT:
+		  A2_VMCASE(WAIT):
 		  {
 			A2_voice *sv = a2_FindSubvoice(v, ins->a1);
 			if(!sv)
-				break;	/* No voice to wait for! */
+				A2_VMNEXT;	/* No voice to wait for! */
 			/* NOTE: This only waits with fragment granularity! */
 			if(sv->s.state >= A2_ENDING)
-				break;	/* Done! */
+				A2_VMNEXT;	/* Done! */
 			a2_RTApply(&rt, st, v, v->s.waketime, 0);
-			v->s.waketime = st->now_fragstart + (A2_MAXFRAG << 8);
+			A2_VMSAVEPC;
+			v->s.waketime = st->now_fragstart + (st->fragment << 8);
 			v->s.state = A2_WAITING;
-			st->instructions += A2_INSLIMIT - inscount;
+			A2_VMCOUNT;
 			DUMPCODERT(A2_DLOG("%p: [waiting]\n", v);)
 			return A2_OK;
 		  }
-		  case OP_KILLR:
+		  A2_VMCASE(KILLR):
 		  {
 			unsigned vid = r[ins->a1] >> 16;
 			a2_KillSubvoice(st, v, vid);
-			break;
+			A2_VMNEXT;
 		  }
-		  case OP_KILL:
+		  A2_VMCASE(KILL):
 			a2_KillSubvoice(st, v, ins->a1);
-			break;
-		  case OP_KILLA:
+			A2_VMNEXT;
+		  A2_VMCASE(KILLA):
 		  {
 			A2_voice *sv;
 			for(sv = v->sub; sv; sv = sv->next)
 				a2_VoiceKill(st, sv, v->s.waketime);
 #if A2_SV_LUT_SIZE
-			memset(v->sv, 0, sizeof(v->sv));
+			memset(v->sv, 0, A2_SV_LUT_SIZE * sizeof(A2_voice *));
 #endif
-			break;
+#if A2_SV_INDEX
+			a2_FreeSubvoiceIndex(st, v);
+#endif
+			A2_VMNEXT;
 		  }
-		  case OP_DETACHR:
+		  A2_VMCASE(DETACHR):
 		  {
 			unsigned vid = r[ins->a1] >> 16;
 			a2_DetachSubvoice(v, vid);
-			break;
+			A2_VMNEXT;
 		  }
-		  case OP_DETACH:
+		  A2_VMCASE(DETACH):
 			a2_DetachSubvoice(v, ins->a1);
-			break;
-		  case OP_DETACHA:
+			A2_VMNEXT;
+		  A2_VMCASE(DETACHA):
 		  {
 			A2_voice *sv;
 			for(sv = v->sub; sv; sv = sv->next)
 				a2_VoiceDetach(sv, v->s.waketime);
 #if A2_SV_LUT_SIZE
-			memset(v->sv, 0, sizeof(v->sv));
+			memset(v->sv, 0, A2_SV_LUT_SIZE * sizeof(A2_voice *));
 #endif
-			break;
+#if A2_SV_INDEX
+			a2_FreeSubvoiceIndex(st, v);
+#endif
+			A2_VMNEXT;
 		  }
 
 		/* Message handling */
-		  case OP_SLEEP:
+		  A2_VMCASE(SLEEP):
+			A2_VMSAVEPC;
 			a2_RTApply(&rt, st, v, v->s.waketime, 0);
 			v->s.state = A2_ENDING;
-			st->instructions += A2_INSLIMIT - inscount;
+			A2_VMCOUNT;
 			v->s.waketime += 1000000;
 			return A2_OK;
 #if 0
@@ -1661,19 +2277,19 @@ TODO:
 			break;
 		  }
 #endif
-		  case OP_WAKE:
+		  A2_VMCASE(WAKE):
 		  {
 			A2_stackentry *se = v->stack;
 			while(se->prev && (se->state == A2_INTERRUPT))
 				se = se->prev;
 			if(se->state < A2_ENDING)
-				break;
+				A2_VMNEXT;
 			se->pc = ins->a2;
 			se->state = A2_RUNNING;
 			se->waketime = v->s.waketime;
-			break;
+			A2_VMNEXT;
 		  }
-		  case OP_FORCE:
+		  A2_VMCASE(FORCE):
 		  {
 			A2_stackentry *se = v->stack;
 			while(se->prev && (se->state == A2_INTERRUPT))
@@ -1681,67 +2297,125 @@ TODO:
 			se->pc = ins->a2;
 			se->state = A2_RUNNING;
 			se->waketime = v->s.waketime;
-			break;
+			A2_VMNEXT;
 		  }
 
 		/* Debugging */
-		  case OP_DEBUGR:
+		  A2_VMCASE(DEBUGR):
 		  {
 			A2_interface *i = &st->interfaces->interface;
 			A2_LOG_MSG(i, "debug R%d=%f\t(%p)", ins->a1,
 					r[ins->a1] * (1.0f / 65536.0f), v);
-			break;
+			A2_VMNEXT;
 		  }
-		  case OP_DEBUG:
+		  A2_VMCASE(DEBUG):
 		  {
 			A2_interface *i = &st->interfaces->interface;
 			A2_LOG_MSG(i, "debug %f\t(%p)",
 					ins->a3 * (1.0f / 65536.0f), v);
-			++v->s.pc;
-			break;
+			++pc;
+			A2_VMNEXT;
 		  }
 
 		/* Special instructions */
-		  case OP_INITV:
+		  A2_VMCASE(INITV):
 			if((res = a2_PopulateVoice(st, v->program, v)))
 			{
-				st->instructions += A2_INSLIMIT - inscount;
+				A2_VMSAVEPC;
+				A2_VMCOUNT;
 				return res;
 			}
-			break;
-		  case OP_SIZEOF:
+			A2_VMNEXT;
+		  A2_VMCASE(SIZEOFC):
+			a2_RTMark(&rt, ins->a1);
+		  A2_VMCASE(SIZEOF):
 			if((res = a2_sizeof_object(st, ins->a2) < 0))
 				A2_VMABORT(-res >> 16, "VM:SIZEOF");
 			r[ins->a1] = res;
+			A2_VMNEXT;
+		  A2_VMCASE(SIZEOFRC):
 			a2_RTMark(&rt, ins->a1);
-			break;
-		  case OP_SIZEOFR:
+		  A2_VMCASE(SIZEOFR):
 			if((res = a2_sizeof_object(st, r[ins->a2] >> 16)) < 0)
 				A2_VMABORT(-res >> 16, "VM:SIZEOFR");
 			r[ins->a1] = res;
+			A2_VMNEXT;
+
+		/* Fused instructions */
+		  A2_VMCASE(LDADDRC):
 			a2_RTMark(&rt, ins->a1);
-			break;
+		  A2_VMCASE(LDADDR):
+			r[ins->a1] = r[ins->a2 & 0xff];
+			r[ins->a1] += r[ins->a2 >> 8];
+			A2_VMNEXT;
+		  A2_VMCASE(LDSUBRC):
+			a2_RTMark(&rt, ins->a1);
+		  A2_VMCASE(LDSUBR):
+			r[ins->a1] = r[ins->a2 & 0xff];
+			r[ins->a1] -= r[ins->a2 >> 8];
+			A2_VMNEXT;
+		  A2_VMCASE(LDMULRC):
+			a2_RTMark(&rt, ins->a1);
+		  A2_VMCASE(LDMULR):
+			r[ins->a1] = r[ins->a2 & 0xff];
+			r[ins->a1] = (int64_t)r[ins->a1] * r[ins->a2 >> 8] >> 16;
+			A2_VMNEXT;
+		  A2_VMCASE(LDADDC):
+			a2_RTMark(&rt, ins->a1);
+		  A2_VMCASE(LDADD):
+			r[ins->a1] = r[ins->a2];
+			r[ins->a1] += ins->a3;
+			++pc;
+			A2_VMNEXT;
+		  A2_VMCMPJ(GRJZ, >, 1)
+		  A2_VMCMPJ(LRJZ, <, 1)
+		  A2_VMCMPJ(GERJZ, >=, 1)
+		  A2_VMCMPJ(LERJZ, <=, 1)
+		  A2_VMCMPJ(EQRJZ, ==, 1)
+		  A2_VMCMPJ(NERJZ, !=, 1)
+		  A2_VMCMPJ(GRJNZ, >, 0)
+		  A2_VMCMPJ(LRJNZ, <, 0)
+		  A2_VMCMPJ(GERJNZ, >=, 0)
+		  A2_VMCMPJ(LERJNZ, <=, 0)
+		  A2_VMCMPJ(EQRJNZ, ==, 0)
+		  A2_VMCMPJ(NERJNZ, !=, 0)
+		  A2_VMCASE(PUSH2R):
+			if(cargc + 2 > A2_MAXARGS)
+				A2_VMABORT(A2_MANYARGS, "VM:PUSH2R");
+			cargv[cargc++] = r[ins->a1];
+			cargv[cargc++] = r[ins->a2];
+			A2_VMNEXT;
 
-		  case A2_OPCODES:
-		  default:
+		  A2_VMDEFAULT:
 			A2_VMABORT(A2_ILLEGALOP, "VM:ILLEGALOP");
 		}
-		++v->s.pc;
-		continue;
+		++pc;
+		A2_VMDISPATCH;
 	  timing:
-		++v->s.pc;
+		++pc;
 	  timing_interrupt:
+		A2_VMSAVEPC;
 		a2_RTApply(&rt, st, v, v->s.waketime, dt);
 		if(!dt)
-			continue;
+			A2_VMDISPATCH;
 		DUMPCODERT(A2_DLOG("%p: [reschedule; dt=%f]\n",
 				v, dt / 256.0f);)
 		v->s.state = A2_WAITING;
-		st->instructions += A2_INSLIMIT - inscount;
+		A2_VMCOUNT;
 		v->s.waketime += dt;
 		return A2_OK;
 	}
 }
+#undef	A2_VMCMPJ
+#undef	A2_VMCOUNT
+#undef	A2_VMPROFMARK
+#undef	A2_VMNEXT
+#undef	A2_VMDISPATCH
+#undef	A2_VMDEFAULT
+#undef	A2_VMCASE
+#undef	A2_VMNATIVE
+#undef	A2_VMLOADPC
+#undef	A2_VMSAVEPC
 #undef	A2_VMABORT
 
 
@@ -1751,7 +2425,10 @@ static inline void a2_ProcessSubvoices(A2_state *st, A2_voice *v,
 {
 	if(!v->sub)
 		return;
-	a2_ProcessVoices(st, &v->sub, offset, frames);
+	if(st->workers && (v->flags & A2_PARALLEL))
+		a2_ProcessLanes(st, v, offset, frames);
+	else
+		a2_ProcessVoices(st, &v->sub, offset, frames);
 	if(!v->sub)
 		if(v->s.state >= A2_ENDING)
 			/* Notify parent that subs are done! */
@@ -1771,7 +2448,7 @@ void a2_inline_Process(A2_unit *u, unsigned offset, unsigned frames)
 	A2_inline *il = a2_inline_cast(u);
 	int i;
 	for(i = 0; i < u->noutputs; ++i)
-		memset(u->outputs[i] + offset, 0, frames * sizeof(int));
+		il->state->dsp->Clear(u->outputs[i] + offset, frames);
 	a2_ProcessSubvoices(il->state, il->voice, offset, frames);
 }
 
@@ -1835,6 +2512,84 @@ static inline int a2_VoiceProcessVMEv(A2_state *st, A2_voice *v, unsigned now)
 }
 
 
+/*
+ * Mix frames [start, end) of the 'sout' bus of voice 'v' into the voice
+ * outputs, returning the peak level.
+ */
+static inline int32_t a2_VoiceMixPeak(A2_voice *v, int start, int end)
+{
+	int i, s;
+	int32_t peak = 0;
+	for(i = 0; i < v->noutputs; ++i)
+	{
+		int32_t *in = v->sout[i];
+		int32_t *out = v->outputs[i];
+		for(s = start; s < end; ++s)
+		{
+			int32_t x = in[s];
+			out[s] += x;
+			if(x < 0)
+				x = -x;
+			if(x > peak)
+				peak = x;
+		}
+	}
+	return peak;
+}
+
+/* Float version of a2_VoiceMixPeak(). (Returns the peak in 8:24.) */
+static inline int32_t a2_VoiceMixPeakF(A2_voice *v, int start, int end)
+{
+	int i, s;
+	float peak = 0.0f;
+	for(i = 0; i < v->noutputs; ++i)
+	{
+		float *in = (float *)v->sout[i];
+		float *out = (float *)v->outputs[i];
+		for(s = start; s < end; ++s)
+		{
+			float x = in[s];
+			out[s] += x;
+			if(x < 0.0f)
+				x = -x;
+			if(x > peak)
+				peak = x;
+		}
+	}
+	if(peak >= 127.0f)
+		return INT32_MAX;
+	return (int32_t)(peak * (1.0f / A2_FIX2FLOAT));
+}
+
+/*
+ * Mix frames [start, end) of the 'sout' bus of voice 'v' into the voice
+ * outputs, and suspend the voice if its peak output level has stayed at or
+ * below A2_PSILENCELEVEL, with no control changes or ramps in progress, for
+ * A2_PSILENCEWINDOW frames. Units can veto suspension by setting 'awake'.
+ */
+static inline void a2_VoiceDetectSilence(A2_state *st, A2_voice *v,
+		int start, int end)
+{
+	int32_t peak;
+	if(st->config->flags & A2_FLOATPROC)
+		peak = a2_VoiceMixPeakF(v, start, end);
+	else
+		peak = a2_VoiceMixPeak(v, start, end);
+	v->level = peak;
+	if((peak > st->ss->silencelevel) || v->awake || (a2_TSDiff(v->rampend,
+			st->now_fragstart + (end << 8)) > 0))
+	{
+		v->silentframes = 0;
+		v->awake = 0;
+	}
+	else if((v->silentframes += end - start) >= st->ss->silencewindow)
+	{
+		v->flags |= A2_SUSPENDED;
+		++st->suspendedvoices;
+	}
+}
+
+
 /*
  * Process a single voice, alternating between the VM and units (if any) as
  * needed. If the fragment is cut short by program termination, or an error,
@@ -1849,6 +2604,8 @@ static inline A2_errors a2_VoiceProcess(A2_state *st, A2_voice *v,
 {
 	int s = offset;
 	int s_stop = offset + *frames;	/* End of fragment */
+	int sstart = s_stop;		/* Start of unit output in 'sout' */
+	A2_errors err = A2_OK;
 	while(s < s_stop)
 	{
 		A2_unit *u;
@@ -1863,7 +2620,8 @@ static inline A2_errors a2_VoiceProcess(A2_state *st, A2_voice *v,
 			 */
 			*frames = s - offset;	/* Cut fragment short! */
 #endif
-			return -res;
+			err = -res;
+			break;
 		}
 #ifdef DEBUG
 		if(!res)
@@ -1872,11 +2630,123 @@ static inline A2_errors a2_VoiceProcess(A2_state *st, A2_voice *v,
 #endif
 		if(s + res > s_stop)
 			res = s_stop - s;
-		for(u = v->units; u; u = u->next)
-			u->Process(u, s, res);
+		if(!(v->flags & A2_SUSPENDED))
+		{
+			if(v->sout && (sstart > s))
+			{
+				/* Units use adding mode for the outputs! */
+				int i;
+				for(i = 0; i < v->noutputs; ++i)
+					st->dsp->Clear(v->sout[i] + s,
+							s_stop - s);
+				sstart = s;
+			}
+			for(u = v->units; u; u = u->next)
+				u->Process(u, s, res);
+		}
 		s += res;
 	}
-	return A2_OK;
+	if(v->sout && (sstart < s))
+		a2_VoiceDetectSilence(st, v, sstart, s);
+	return err;
+}
+
+
+/*
+ * Check if a dormant voice needs to wake up, that is, if it has been detached,
+ * has received events, or has subvoices that are handled by an 'inline' unit.
+ * Returns 1 if the voice is to be processed.
+ *
+ * The timer of a dormant voice is not maintained, so unless it has just been
+ * set by a2_VoiceDetach(), it's set to the current time, to have the VM go
+ * back to the instruction it's waiting in.
+ */
+static inline int a2_VoiceWake(A2_state *st, A2_voice *v, unsigned offset)
+{
+	if(!(v->flags & A2_ATTACHED))
+	{
+		v->flags &= ~A2_DORMANT;
+		return 1;
+	}
+	if(!v->events && !(v->sub && (v->flags & A2_SUBINLINE)))
+		return 0;
+	v->flags &= ~A2_DORMANT;
+	v->s.waketime = st->now_fragstart + (offset << 8);
+	return 1;
+}
+
+
+/*
+ * Process stolen voice 'v' like a2_VoiceProcessTree(), fading the output out.
+ * The voice output buffers are temporarily replaced with those of a fade bus,
+ * so that this also catches the output of subvoices writing to them. Returns
+ * a non-zero error code when the voice is to be freed.
+ */
+static A2_errors a2_VoiceFadeOut(A2_state *st, A2_voice *v, unsigned offset,
+		unsigned frames)
+{
+	A2_errors res = A2_OK;
+	A2_bus **b = st->fadebus + v->nestlevel;
+	int32_t *outputs[A2_MAXCHANNELS];
+	int total = a2_StealFadeFrames(st);
+	int dg = 65536 / total;
+	int i, n;
+	if(!*b)
+	{
+		if(!(*b = a2_AllocBus(st, v->noutputs)))
+			return A2_OOMEMORY;
+	}
+	else if(!a2_ReallocBus(st, *b, v->noutputs))
+		return A2_OOMEMORY;
+	a2_ClearBus(st, *b, offset, frames);
+	for(i = 0; i < v->noutputs; ++i)
+	{
+		outputs[i] = v->outputs[i];
+		v->outputs[i] = (*b)->buffers[i];
+	}
+
+	if(!(v->flags & A2_DORMANT) || a2_VoiceWake(st, v, offset))
+		res = a2_VoiceProcess(st, v, offset, &frames);
+	if(!(v->flags & A2_SUBINLINE))
+		a2_ProcessSubvoices(st, v, offset, frames);
+
+	n = frames < v->fade ? frames : v->fade;
+	for(i = 0; i < v->noutputs; ++i)
+	{
+		int g = ((int64_t)v->fade << 16) / total;
+		if(st->config->flags & A2_FLOATPROC)
+			st->dsp->RampAddF((float *)outputs[i] + offset,
+					(float *)v->outputs[i] + offset, n,
+					g * (1.0f / 65536.0f),
+					dg * (-1.0f / 65536.0f));
+		else
+			st->dsp->RampAdd(outputs[i] + offset,
+					v->outputs[i] + offset,
+					n, g << 8, -(dg << 8));
+		v->outputs[i] = outputs[i];
+	}
+	v->fade -= n;
+	if(res)
+		return res;
+	return v->fade ? A2_OK : A2_END;
+}
+
+
+/*
+ * Process voice 'v', and any subvoices that are not handled by an 'inline'
+ * unit. Returns a non-zero error code if the voice is to be freed.
+ */
+static inline A2_errors a2_VoiceProcessTree(A2_state *st, A2_voice *v,
+		unsigned offset, unsigned frames)
+{
+	A2_errors res = A2_OK;
+	if(v->flags & A2_STOLEN)
+		return a2_VoiceFadeOut(st, v, offset, frames);
+	if(!(v->flags & A2_DORMANT) || a2_VoiceWake(st, v, offset))
+		res = a2_VoiceProcess(st, v, offset, &frames);
+	if(!(v->flags & A2_SUBINLINE))
+		a2_ProcessSubvoices(st, v, offset, frames);
+	return res;
 }
 
 
@@ -1884,26 +2754,111 @@ void a2_ProcessVoices(A2_state *st, A2_voice **head, unsigned offset,
 		unsigned frames)
 {
 	while(*head)
-	{
-		A2_errors res = a2_VoiceProcess(st, *head, offset, &frames);
-		if(!((*head)->flags & A2_SUBINLINE))
-			a2_ProcessSubvoices(st, *head, offset, frames);
-		if(res)
+		if(a2_VoiceProcessTree(st, *head, offset, frames))
 			a2_VoiceFree(st, head);
 		else
 			head = &(*head)->next;
+}
+
+
+void a2_ProcessLanes(A2_state *st, A2_voice *v, unsigned offset,
+		unsigned frames)
+{
+	A2_workers *w = st->workers;
+	A2_voice **head = &v->sub;
+	A2_voice **tails[A2_RENDERLANES];
+	uint32_t lanes = 0;
+	int i, c;
+
+	/* Process voices outside lanes right away, and queue the others */
+	while(*head)
+	{
+		A2_voice *sv = *head;
+		if(sv->lane == A2_LANEPENDING)
+			a2_AssignLane(st, v, sv);
+		if(!sv->lane)
+		{
+			if(a2_VoiceProcessTree(st, sv, offset, frames))
+				a2_VoiceFree(st, head);
+			else
+				head = &sv->next;
+			continue;
+		}
+		i = sv->lane - 1;
+		if(!(lanes & (1 << i)))
+		{
+			lanes |= 1 << i;
+			tails[i] = &w->lanes[i]->jobs;
+		}
+		*tails[i] = sv;
+		tails[i] = &sv->lanenext;
+		head = &sv->next;
+	}
+	if(!lanes)
+		return;
+	for(i = 0; i < A2_RENDERLANES; ++i)
+		if(lanes & (1 << i))
+			*tails[i] = NULL;
+
+	a2_RunLanes(st, v, lanes, offset, frames);
+
+	/* Mix the lane outputs into the outputs of 'v', in lane order */
+	for(i = 0; i < A2_RENDERLANES; ++i)
+	{
+		A2_bus *b;
+		if(!(lanes & (1 << i)))
+			continue;
+		b = w->lanes[i]->bus[v->nestlevel];
+		for(c = 0; c < v->noutputs; ++c)
+			if(st->config->flags & A2_FLOATPROC)
+				st->dsp->AddF((float *)v->outputs[c] + offset,
+						(float *)b->buffers[c] + offset,
+						frames);
+			else
+				st->dsp->Add(v->outputs[c] + offset,
+						b->buffers[c] + offset, frames);
 	}
+
+	/* Free voices that terminated in the lanes */
+	head = &v->sub;
+	while(*head)
+		if((*head)->flags & A2_TERMINATED)
+			a2_VoiceFree(st, head);
+		else
+			head = &(*head)->next;
 }
 
 
-/* Pack the fragments from the master bus into the driver output buffers! */
+void a2_ProcessLane(A2_lane *l, A2_voice *group, unsigned offset,
+		unsigned frames)
+{
+	A2_state *st = &l->state;
+	A2_bus *b = l->bus[group->nestlevel];
+	A2_voice *v;
+	int c;
+	for(c = 0; c < group->noutputs; ++c)
+		st->dsp->Clear(b->buffers[c] + offset, frames);
+	for(v = l->jobs; v; v = v->lanenext)
+		if(a2_VoiceProcessTree(st, v, offset, frames))
+			v->flags |= A2_TERMINATED;
+}
+
+
+/*
+ * Pack the fragments from the master bus into the driver output buffers! This
+ * is also where float processing (A2_FLOATPROC) ends, as drivers use 8:24.
+ */
 static void a2_ProcessMaster(A2_state *st, unsigned offset, unsigned frames)
 {
 	int c;
 	int32_t **in = st->master->buffers;
 	int32_t **bufs = st->audio->buffers;
 	for(c = 0; c < st->config->channels; ++c)
-		memcpy(bufs[c] + offset, in[c], frames * sizeof(int32_t));
+		if(st->config->flags & A2_FLOATPROC)
+			st->dsp->FloatToFix(bufs[c] + offset,
+					(float *)in[c], frames);
+		else
+			st->dsp->Copy(bufs[c] + offset, in[c], frames);
 }
 
 
@@ -1924,6 +2879,49 @@ static void a2_PollMIDI(A2_state *st, unsigned frames)
 }
 
 
+/*
+ * CPU load adaptive quality scaling. When the smoothed DSP load reaches
+ * A2_PCPULOADHIGH, reduce oscillator quality one step, and once at A2_QLOFI,
+ * cut 1 / A2_LOADCUTDIV of the voices per step, through a voice budget. When
+ * the load drops below A2_PCPULOADLOW, lift the budget, and then restore the
+ * quality, one step at a time. Steps are at least A2_QUALITYHOLD ms apart.
+ */
+static void a2_AdaptQuality(A2_state *st, unsigned load, unsigned frames)
+{
+	int voices;
+	st->loadfilter += ((int)(load << 8) - (int)st->loadfilter) >> 2;
+	if(st->qualityhold > frames)
+	{
+		st->qualityhold -= frames;
+		return;
+	}
+	st->qualityhold = 0;
+	voices = st->activevoices - st->fadingvoices;
+	if((st->loadfilter >> 8) >= st->loadhigh)
+	{
+		if(st->quality > A2_QLOFI)
+			--st->quality;
+		else if(voices > 1)
+			st->loadlimit = voices - (voices + A2_LOADCUTDIV - 1) /
+					A2_LOADCUTDIV;
+		else
+			return;
+	}
+	else if((st->loadfilter >> 8) < st->loadlow)
+	{
+		if(st->loadlimit)
+			st->loadlimit = 0;
+		else if(st->quality < st->maxquality)
+			++st->quality;
+		else
+			return;
+	}
+	else
+		return;
+	st->qualityhold = (uint64_t)A2_QUALITYHOLD * st->msdur >> 16;
+}
+
+
 void a2_AudioCallback(A2_audiodriver *driver, unsigned frames)
 {
 	A2_state *st = (A2_state *)driver->state;
@@ -1963,8 +2961,12 @@ void a2_AudioCallback(A2_audiodriver *driver, unsigned frames)
 	/* Audio processing */
 	while(remain)
 	{
-		unsigned frag = remain > A2_MAXFRAG ? A2_MAXFRAG : remain;
-		a2_ClearBus(st->master, 0, frag);
+		unsigned frag = remain > st->fragment ? st->fragment : remain;
+		unsigned limit = a2_VoiceLimit(st);
+		a2_ClearBus(st, st->master, 0, frag);
+		if(limit && ((int)(st->activevoices - st->fadingvoices) >
+				(int)limit))
+			a2_VoiceBudget(st, limit);
 		a2_ProcessVoices(st, &rootvoice, 0, frag);
 		a2_ProcessMaster(st, offset, frag);
 		offset += frag;
@@ -1991,6 +2993,8 @@ void a2_AudioCallback(A2_audiodriver *driver, unsigned frames)
 		if(ld > st->cpuloadmax)
 			st->cpuloadmax = ld;
 		st->now_micros = t1u;
+		if(st->loadhigh)
+			a2_AdaptQuality(st, ld, frames);
 	}
 	st->cputimeavg = st->cputimesum / st->cputimecount;
 	if(t1u != st->avgstart)
@@ -2020,15 +3024,7 @@ static void a2_kill_subvoices_using_program(A2_state *st, A2_voice *v,
 		A2_voice *sv = *head;
 		if(sv->program == p)
 		{
-#if A2_SV_LUT_SIZE
-			int i;
-			for(i = 0; i < A2_SV_LUT_SIZE; ++i)
-				if(v->sv[i] == sv)
-				{
-					v->sv[i] = NULL;
-					break;
-				}
-#endif
+			a2_UnlistSubvoice(v, sv);
 			a2_VoiceFree(st, head);
 			/*
 			 * Since we may be killing voices started by scripts,
@@ -2048,13 +3044,15 @@ void a2_KillVoicesUsingProgram(A2_state *st, A2_handle program)
 {
 	/* Can't use a2_GetProgram() because we may see zero refcounts here! */
 	A2_program *p;
+	A2_state *ms;
 	RCHM_handleinfo *hi = rchm_Get(&st->ss->hm, program);
 	if(!hi || (hi->typecode != A2_TPROGRAM))
 		return;
 	p = (A2_program *)hi->d.data;
 	if(st->parent)
 		st = st->parent;
-	for( ; st; st = st->next)
+	a2_MutexLock(&st->ss->statelock);
+	for(ms = st; st; st = st->next)
 	{
 		hi = rchm_Get(&st->ss->hm, st->rootvoice);
 		if(!hi || (hi->typecode != A2_TVOICE) || (!hi->d.data))
@@ -2063,6 +3061,7 @@ void a2_KillVoicesUsingProgram(A2_state *st, A2_handle program)
 		a2_kill_subvoices_using_program(st, (A2_voice *)hi->d.data, p);
 		st->audio->Unlock(st->audio);
 	}
+	a2_MutexUnlock(&ms->ss->statelock);
 }
 
 
@@ -2071,6 +3070,7 @@ int a2_LockAllStates(A2_state *st)
 	int count = 0;
 	if(st->parent)
 		st = st->parent;
+	a2_MutexLock(&st->ss->statelock);
 	for( ; st; st = st->next, ++count)
 		st->audio->Lock(st->audio);
 	return count;
@@ -2080,9 +3080,11 @@ int a2_LockAllStates(A2_state *st)
 int a2_UnlockAllStates(A2_state *st)
 {
 	int count = 0;
+	A2_state *ms;
 	if(st->parent)
 		st = st->parent;
-	for( ; st; st = st->next, ++count)
+	for(ms = st; st; st = st->next, ++count)
 		st->audio->Unlock(st->audio);
+	a2_MutexUnlock(&ms->ss->statelock);
 	return count;
 }
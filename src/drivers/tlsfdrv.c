@@ -0,0 +1,511 @@
+/*
+ * tlsfdrv.c - Audiality 2 realtime memory manager system driver
+ *
+ *	This driver implements RTAlloc()/RTFree() using a TLSF (Two-Level
+ *	Segregated Fit) allocator over preallocated memory arenas, so that
+ *	allocations and frees from the audio context complete in bounded time,
+ *	without ever calling the system memory manager.
+ *
+ *	When the free space drops below the low watermark, the audio context
+ *	posts a request to a background thread, which allocates, prefaults and
+ *	(optionally) locks a new arena, and hands it back via a single slot. The
+ *	audio context adds the arena to the heap on the next RTAlloc() call.
+ *
+ *	Options:
+ *		arena=<KiB>	Initial arena size. (Default: config->poolsize,
+ *				or 4096 KiB, if that is 0.)
+ *		refill=<KiB>	Refill arena size, and low watermark. 0
+ *				disables the refill thread. (Default: arena/4)
+ *		mlock		Lock arenas into physical memory.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#ifndef _WIN32
+# include <sys/mman.h>
+#endif
+#include "tlsfdrv.h"
+#include "platform.h"
+#include "a2_log.h"
+
+/* Default initial arena size (bytes) */
+#define	A2_TLSF_DEFAULTARENA	(4096 * 1024)
+
+/* Largest arena we accept (bytes) */
+#define	A2_TLSF_MAXARENA	(1 << 30)
+
+/* How often the refill thread checks for requests (ms) */
+#define	A2_TLSF_REFILLPERIOD	5
+
+/*
+ * TLSF parameters. Blocks are aligned to, and sized in multiples of,
+ * TLSF_ALIGN bytes. Each power of two size range is split into TLSF_SLCOUNT
+ * free lists. Blocks smaller than TLSF_SMALL all go in the first level 0.
+ */
+#define	TLSF_ALIGN	16
+#define	TLSF_ALIGNLOG2	4
+#define	TLSF_SLBITS	4
+#define	TLSF_SLCOUNT	(1 << TLSF_SLBITS)
+#define	TLSF_FLSHIFT	(TLSF_SLBITS + TLSF_ALIGNLOG2)
+#define	TLSF_SMALL	(1 << TLSF_FLSHIFT)
+#define	TLSF_FLCOUNT	(31 - TLSF_FLSHIFT)
+
+/* Flag in TLSF_block 'size' */
+#define	TLSF_FREE	1
+
+/* Block header */
+typedef struct TLSF_block
+{
+	struct TLSF_block	*prevphys;	/* Previous block in arena */
+	size_t			size;		/* Data size | TLSF_FREE */
+} TLSF_block;
+
+/* Free list links, kept in the data area of free blocks */
+typedef struct TLSF_links
+{
+	TLSF_block	*next;
+	TLSF_block	*prev;
+} TLSF_links;
+
+#define	TLSF_ALIGNUP(x)	(((x) + TLSF_ALIGN - 1) & ~(size_t)(TLSF_ALIGN - 1))
+#define	TLSF_HDR	TLSF_ALIGNUP(sizeof(TLSF_block))
+#define	TLSF_MINSIZE	TLSF_ALIGNUP(sizeof(TLSF_links))
+
+#define	TLSF_SIZE(b)	((b)->size & ~(size_t)TLSF_FREE)
+#define	TLSF_LINKS(b)	((TLSF_links *)((char *)(b) + TLSF_HDR))
+#define	TLSF_DATA(b)	((void *)((char *)(b) + TLSF_HDR))
+#define	TLSF_BLOCK(p)	((TLSF_block *)((char *)(p) - TLSF_HDR))
+#define	TLSF_NEXT(b)	((TLSF_block *)((char *)(b) + TLSF_HDR + TLSF_SIZE(b)))
+
+/* Arena header; the heap blocks follow */
+typedef struct TLSF_arena
+{
+	struct TLSF_arena	*next;
+	size_t			size;		/* Total size, header included */
+} TLSF_arena;
+
+typedef struct A2_tlsfdriver
+{
+	A2_sysdriver	sd;
+
+	/* Heap (audio context) */
+	uint32_t	flmap;
+	uint32_t	slmap[TLSF_FLCOUNT];
+	TLSF_block	*heads[TLSF_FLCOUNT][TLSF_SLCOUNT];
+
+	/* Statistics (audio context) */
+	A2_rtmemstats	stats;
+	unsigned	capacity;	/* Total allocatable bytes */
+	int		requested;	/* Refill requested, not yet received */
+
+	/* Configuration */
+	int		arenasize;
+	int		refillsize;
+	int		lock;
+
+	/* Refill thread */
+	TLSF_arena	*arenas;	/* All arenas (thread owned) */
+	TLSF_arena	*pending;	/* Arena to add; valid when ready == 1 */
+	A2_atomic	ready;		/* 0: empty, 1: pending, 2: receiving */
+	A2_atomic	request;	/* Set by audio context to request arena */
+	A2_atomic	quit;
+	int		running;
+	A2_thread	thread;
+} A2_tlsfdriver;
+
+
+/*---------------------------------------------------------
+	TLSF heap
+---------------------------------------------------------*/
+
+static inline int tlsf_fls(uint32_t x)
+{
+#ifdef __GNUC__
+	return 31 - __builtin_clz(x);
+#else
+	int n = 0;
+	while(x >>= 1)
+		++n;
+	return n;
+#endif
+}
+
+static inline int tlsf_ffs(uint32_t x)
+{
+#ifdef __GNUC__
+	return __builtin_ctz(x);
+#else
+	int n = 0;
+	while(!(x & 1))
+	{
+		x >>= 1;
+		++n;
+	}
+	return n;
+#endif
+}
+
+static inline void tlsf_mapping(size_t size, int *fl, int *sl)
+{
+	if(size < TLSF_SMALL)
+	{
+		*fl = 0;
+		*sl = size / (TLSF_SMALL / TLSF_SLCOUNT);
+	}
+	else
+	{
+		int f = tlsf_fls(size);
+		*sl = (size >> (f - TLSF_SLBITS)) - TLSF_SLCOUNT;
+		*fl = f - TLSF_FLSHIFT + 1;
+	}
+}
+
+static inline void tlsf_insert(A2_tlsfdriver *td, TLSF_block *b)
+{
+	int fl, sl;
+	TLSF_links *l = TLSF_LINKS(b);
+	tlsf_mapping(TLSF_SIZE(b), &fl, &sl);
+	l->prev = NULL;
+	if((l->next = td->heads[fl][sl]))
+		TLSF_LINKS(l->next)->prev = b;
+	td->heads[fl][sl] = b;
+	td->flmap |= 1U << fl;
+	td->slmap[fl] |= 1U << sl;
+}
+
+static inline void tlsf_remove(A2_tlsfdriver *td, TLSF_block *b)
+{
+	int fl, sl;
+	TLSF_links *l = TLSF_LINKS(b);
+	tlsf_mapping(TLSF_SIZE(b), &fl, &sl);
+	if(l->next)
+		TLSF_LINKS(l->next)->prev = l->prev;
+	if(l->prev)
+		TLSF_LINKS(l->prev)->next = l->next;
+	else if(!(td->heads[fl][sl] = l->next))
+	{
+		td->slmap[fl] &= ~(1U << sl);
+		if(!td->slmap[fl])
+			td->flmap &= ~(1U << fl);
+	}
+}
+
+/* Find a free block of at least 'size' bytes */
+static inline TLSF_block *tlsf_find(A2_tlsfdriver *td, size_t size)
+{
+	int fl, sl;
+	uint32_t map;
+	if(size >= TLSF_SMALL)
+		size += (1 << (tlsf_fls(size) - TLSF_SLBITS)) - 1;
+	tlsf_mapping(size, &fl, &sl);
+	if(fl >= TLSF_FLCOUNT)
+		return NULL;
+	if(!(map = td->slmap[fl] & (~0U << sl)))
+	{
+		if(fl + 1 >= TLSF_FLCOUNT)
+			return NULL;
+		if(!(map = td->flmap & (~0U << (fl + 1))))
+			return NULL;
+		fl = tlsf_ffs(map);
+		map = td->slmap[fl];
+	}
+	sl = tlsf_ffs(map);
+	return td->heads[fl][sl];
+}
+
+/* Add the memory of arena 'a' to the heap */
+static void tlsf_addarena(A2_tlsfdriver *td, TLSF_arena *a)
+{
+	char *start = (char *)TLSF_ALIGNUP((size_t)(a + 1));
+	size_t size = ((char *)a + a->size - start) & ~(size_t)(TLSF_ALIGN - 1);
+	TLSF_block *b = (TLSF_block *)start;
+	TLSF_block *sentinel;
+	b->prevphys = NULL;
+	b->size = (size - 2 * TLSF_HDR) | TLSF_FREE;
+	sentinel = TLSF_NEXT(b);
+	sentinel->prevphys = b;
+	sentinel->size = 0;
+	tlsf_insert(td, b);
+	td->capacity += TLSF_HDR + TLSF_SIZE(b);
+	td->stats.size += a->size;
+	++td->stats.arenas;
+}
+
+static void *tlsf_alloc(A2_tlsfdriver *td, size_t size)
+{
+	TLSF_block *b;
+	size_t bsize;
+	if(size > A2_TLSF_MAXARENA)
+		return NULL;
+	size = TLSF_ALIGNUP(size);
+	if(size < TLSF_MINSIZE)
+		size = TLSF_MINSIZE;
+	if(!(b = tlsf_find(td, size)))
+		return NULL;
+	tlsf_remove(td, b);
+	bsize = TLSF_SIZE(b);
+	if(bsize - size >= TLSF_HDR + TLSF_MINSIZE)
+	{
+		/* Split, and put the tail back in the heap */
+		TLSF_block *n = (TLSF_block *)((char *)TLSF_DATA(b) + size);
+		n->prevphys = b;
+		n->size = (bsize - size - TLSF_HDR) | TLSF_FREE;
+		TLSF_NEXT(n)->prevphys = n;
+		tlsf_insert(td, n);
+		bsize = size;
+	}
+	b->size = bsize;
+	td->stats.used += TLSF_HDR + bsize;
+	return TLSF_DATA(b);
+}
+
+static void tlsf_free(A2_tlsfdriver *td, void *p)
+{
+	TLSF_block *b = TLSF_BLOCK(p);
+	TLSF_block *n = TLSF_NEXT(b);
+	td->stats.used -= TLSF_HDR + TLSF_SIZE(b);
+
+	/* Merge with next block, if free */
+	if(n->size & TLSF_FREE)
+	{
+		tlsf_remove(td, n);
+		b->size += TLSF_HDR + TLSF_SIZE(n);
+		TLSF_NEXT(b)->prevphys = b;
+	}
+
+	/* Merge with previous block, if free */
+	if(b->prevphys && (b->prevphys->size & TLSF_FREE))
+	{
+		TLSF_block *pb = b->prevphys;
+		tlsf_remove(td, pb);
+		pb->size += TLSF_HDR + TLSF_SIZE(b);
+		TLSF_NEXT(pb)->prevphys = pb;
+		b = pb;
+	}
+
+	b->size |= TLSF_FREE;
+	tlsf_insert(td, b);
+}
+
+
+/*---------------------------------------------------------
+	Arenas and refill thread
+---------------------------------------------------------*/
+
+/* Allocate, prefault and optionally lock an arena of 'size' bytes */
+static TLSF_arena *tlsfsd_newarena(A2_tlsfdriver *td, unsigned size)
+{
+	TLSF_arena *a = (TLSF_arena *)malloc(size);
+	if(!a)
+		return NULL;
+	memset(a, 0, size);
+	a->size = size;
+	if(td->lock)
+	{
+#ifdef _WIN32
+		if(!VirtualLock(a, size))
+#else
+		if(mlock(a, size))
+#endif
+			A2_LOG_WARN(td->sd.driver.config->interface,
+					"tlsf: Could not lock %u byte arena!",
+					size);
+	}
+	a->next = td->arenas;
+	td->arenas = a;
+	return a;
+}
+
+static void tlsfsd_refiller(void *data)
+{
+	A2_tlsfdriver *td = (A2_tlsfdriver *)data;
+	while(!a2_AtomicAdd(&td->quit, 0))
+	{
+		if(!a2_AtomicAdd(&td->ready, 0) &&
+				a2_AtomicCAS(&td->request, 1, 0))
+		{
+			TLSF_arena *a = tlsfsd_newarena(td, td->refillsize);
+			if(a)
+			{
+				td->pending = a;
+				a2_AtomicCAS(&td->ready, 0, 1);
+			}
+			else
+				a2_AtomicCAS(&td->request, 0, 1);	/* Retry */
+		}
+		a2_Sleep(A2_TLSF_REFILLPERIOD);
+	}
+}
+
+/*
+ * Pick up any arena delivered by the refill thread, and request a new one if
+ * we're below the low watermark.
+ */
+static inline void tlsfsd_refill(A2_tlsfdriver *td)
+{
+	if(td->requested && a2_AtomicCAS(&td->ready, 1, 2))
+	{
+		tlsf_addarena(td, td->pending);
+		++td->stats.refills;
+		td->requested = 0;
+		a2_AtomicCAS(&td->ready, 2, 0);
+	}
+	if(!td->requested && td->running &&
+			(td->capacity - td->stats.used < (unsigned)td->refillsize))
+	{
+		td->requested = 1;
+		a2_AtomicCAS(&td->request, 0, 1);
+	}
+}
+
+
+/*---------------------------------------------------------
+	Driver interface
+---------------------------------------------------------*/
+
+static void *tlsfsd_RTAlloc(A2_sysdriver *driver, unsigned size)
+{
+	A2_tlsfdriver *td = (A2_tlsfdriver *)driver;
+	void *p = tlsf_alloc(td, size);
+	tlsfsd_refill(td);
+	if(!p)
+	{
+		++td->stats.failures;
+		return NULL;
+	}
+	if(td->stats.used > td->stats.highwater)
+		td->stats.highwater = td->stats.used;
+	return p;
+}
+
+static void tlsfsd_RTFree(A2_sysdriver *driver, void *block)
+{
+	tlsf_free((A2_tlsfdriver *)driver, block);
+}
+
+static void tlsfsd_Close(A2_driver *driver);
+
+static A2_errors tlsfsd_Open(A2_driver *driver)
+{
+	A2_tlsfdriver *td = (A2_tlsfdriver *)driver;
+	A2_errors res;
+	int i;
+
+	/* Parse options */
+	td->arenasize = driver->config->poolsize > 0 ?
+			driver->config->poolsize : A2_TLSF_DEFAULTARENA;
+	td->refillsize = -1;
+	td->lock = 0;
+	for(i = 0; i < driver->optc; ++i)
+	{
+		const char *o = driver->optv[i];
+		if(!strncmp(o, "arena=", 6))
+			td->arenasize = atoi(o + 6) * 1024;
+		else if(!strncmp(o, "refill=", 7))
+			td->refillsize = atoi(o + 7) * 1024;
+		else if(!strcmp(o, "mlock"))
+			td->lock = 1;
+		else
+			A2_LOG_WARN(driver->config->interface,
+					"tlsf: Unknown option '%s'!", o);
+	}
+	if(td->refillsize < 0)
+		td->refillsize = td->arenasize / 4;
+	if((td->arenasize < 1024) || (td->arenasize > A2_TLSF_MAXARENA) ||
+			(td->refillsize > A2_TLSF_MAXARENA))
+		return A2_VALUERANGE;
+
+	/* Set up the heap with the initial arena */
+	memset(&td->stats, 0, sizeof(td->stats));
+	td->capacity = 0;
+	td->requested = 0;
+	if(!tlsfsd_newarena(td, td->arenasize))
+		return A2_OOMEMORY;
+	tlsf_addarena(td, td->arenas);
+
+	/* Start the refill thread */
+	td->ready = td->request = td->quit = 0;
+	if(td->refillsize)
+	{
+		if((res = a2_ThreadStart(&td->thread, tlsfsd_refiller, td)))
+		{
+			tlsfsd_Close(driver);
+			return res;
+		}
+		td->running = 1;
+	}
+
+	td->sd.RTAlloc = tlsfsd_RTAlloc;
+	td->sd.RTFree = tlsfsd_RTFree;
+	return A2_OK;
+}
+
+static void tlsfsd_Close(A2_driver *driver)
+{
+	A2_tlsfdriver *td = (A2_tlsfdriver *)driver;
+	if(td->running)
+	{
+		a2_AtomicAdd(&td->quit, 1);
+		a2_ThreadJoin(&td->thread);
+		td->running = 0;
+	}
+	while(td->arenas)
+	{
+		TLSF_arena *a = td->arenas;
+		td->arenas = a->next;
+		if(td->lock)
+#ifdef _WIN32
+			VirtualUnlock(a, a->size);
+#else
+			munlock(a, a->size);
+#endif
+		free(a);
+	}
+	td->pending = NULL;
+	td->flmap = 0;
+	memset(td->slmap, 0, sizeof(td->slmap));
+	memset(td->heads, 0, sizeof(td->heads));
+	td->sd.RTAlloc = NULL;
+	td->sd.RTFree = NULL;
+}
+
+A2_errors a2_GetRTMemStats(A2_sysdriver *driver, A2_rtmemstats *stats)
+{
+	if(driver->driver.Open != tlsfsd_Open)
+		return A2_NOTIMPLEMENTED;
+	*stats = ((A2_tlsfdriver *)driver)->stats;
+	return A2_OK;
+}
+
+A2_driver *a2_tlsf_sysdriver(A2_drivertypes type, const char *name)
+{
+	A2_tlsfdriver *td = calloc(1, sizeof(A2_tlsfdriver));
+	A2_driver *d = &td->sd.driver;
+	if(!td)
+		return NULL;
+	d->type = A2_SYSDRIVER;
+	d->name = "tlsf";
+	d->Open = tlsfsd_Open;
+	d->Close = tlsfsd_Close;
+	return d;
+}
@@ -0,0 +1,537 @@
+/*
+ * dspfuncs.c - Audiality 2 DSP primitives
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <string.h>
+#include "dspfuncs.h"
+#include "a2_dsp.h"
+#include "platform.h"
+#include "config.h"
+
+#if defined(A2_SIMD_SSE2) || defined(A2_SIMD_AVX2)
+#	include <immintrin.h>
+#endif
+#ifdef A2_SIMD_NEON
+#	include <arm_neon.h>
+#endif
+
+/*
+ * The gain of a ramp at frame 's'. (Unsigned, as the ramps are allowed to wrap
+ * the same way in all versions.)
+ */
+#define	A2_RAMPGAIN(g, dg, s)	((int)((unsigned)(g) + (unsigned)(dg) * (s)))
+
+
+/*---------------------------------------------------------
+	Scalar reference code
+---------------------------------------------------------*/
+
+static inline void scalar_gain(int32_t *out, const int32_t *in,
+		unsigned frames, int gain, int dgain, int add)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s)
+	{
+		int g = A2_RAMPGAIN(gain, dgain, s);
+		if(add)
+			out[s] += (int64_t)in[s] * g >> 24;
+		else
+			out[s] = (int64_t)in[s] * g >> 24;
+	}
+}
+
+static void scalar_Clear(int32_t *out, unsigned frames)
+{
+	memset(out, 0, frames * sizeof(int32_t));
+}
+
+static void scalar_Copy(int32_t *out, const int32_t *in, unsigned frames)
+{
+	memcpy(out, in, frames * sizeof(int32_t));
+}
+
+static void scalar_Add(int32_t *out, const int32_t *in, unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s)
+		out[s] += in[s];
+}
+
+static void scalar_Scale(int32_t *out, const int32_t *in, unsigned frames,
+		int gain)
+{
+	scalar_gain(out, in, frames, gain, 0, 0);
+}
+
+static void scalar_ScaleAdd(int32_t *out, const int32_t *in, unsigned frames,
+		int gain)
+{
+	scalar_gain(out, in, frames, gain, 0, 1);
+}
+
+static void scalar_Ramp(int32_t *out, const int32_t *in, unsigned frames,
+		int gain, int dgain)
+{
+	scalar_gain(out, in, frames, gain, dgain, 0);
+}
+
+static void scalar_RampAdd(int32_t *out, const int32_t *in, unsigned frames,
+		int gain, int dgain)
+{
+	scalar_gain(out, in, frames, gain, dgain, 1);
+}
+
+
+/*---------------------------------------------------------
+	32 bit float code
+---------------------------------------------------------*/
+
+/*
+ * These are plain C, written so that the compiler can vectorize them. Each
+ * instruction set gets its own copies, compiled for that instruction set.
+ * (No FMA, no reordering, so the results are still the same everywhere.)
+ */
+
+#define	A2_FLOATMAX	2147483520.0f	/* Largest float below 2^31 */
+
+static inline void float_add(float *out, const float *in, unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s)
+		out[s] += in[s];
+}
+
+static inline void float_scale(float *out, const float *in, unsigned frames,
+		float gain, int add)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s)
+		if(add)
+			out[s] += in[s] * gain;
+		else
+			out[s] = in[s] * gain;
+}
+
+static inline void float_gain(float *out, const float *in, unsigned frames,
+		float gain, float dgain, int add)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s)
+	{
+		float g = gain + (float)s * dgain;
+		if(add)
+			out[s] += in[s] * g;
+		else
+			out[s] = in[s] * g;
+	}
+}
+
+static inline void float_fromfix(float *out, const int32_t *in,
+		unsigned frames, int add)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s)
+		if(add)
+			out[s] += (float)in[s] * A2_FIX2FLOAT;
+		else
+			out[s] = (float)in[s] * A2_FIX2FLOAT;
+}
+
+static inline void float_tofix(int32_t *out, const float *in,
+		unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s)
+	{
+		float x = in[s] * (1.0f / A2_FIX2FLOAT);
+		x = x < A2_FLOATMAX ? x : A2_FLOATMAX;
+		x = x > -A2_FLOATMAX ? x : -A2_FLOATMAX;
+		out[s] = (int32_t)x;
+	}
+}
+
+/* Float entry points for 'isa' */
+#define	A2_DSPFUNCSF(isa, attr)						\
+static attr void isa##_AddF(float *out, const float *in,		\
+		unsigned frames)					\
+{									\
+	float_add(out, in, frames);					\
+}									\
+static attr void isa##_ScaleF(float *out, const float *in,		\
+		unsigned frames, float gain)				\
+{									\
+	float_scale(out, in, frames, gain, 0);				\
+}									\
+static attr void isa##_ScaleAddF(float *out, const float *in,		\
+		unsigned frames, float gain)				\
+{									\
+	float_scale(out, in, frames, gain, 1);				\
+}									\
+static attr void isa##_RampF(float *out, const float *in,		\
+		unsigned frames, float gain, float dgain)		\
+{									\
+	float_gain(out, in, frames, gain, dgain, 0);			\
+}									\
+static attr void isa##_RampAddF(float *out, const float *in,		\
+		unsigned frames, float gain, float dgain)		\
+{									\
+	float_gain(out, in, frames, gain, dgain, 1);			\
+}									\
+static attr void isa##_FixToFloat(float *out, const int32_t *in,	\
+		unsigned frames)					\
+{									\
+	float_fromfix(out, in, frames, 0);				\
+}									\
+static attr void isa##_FixToFloatAdd(float *out, const int32_t *in,	\
+		unsigned frames)					\
+{									\
+	float_fromfix(out, in, frames, 1);				\
+}									\
+static attr void isa##_FloatToFix(int32_t *out, const float *in,	\
+		unsigned frames)					\
+{									\
+	float_tofix(out, in, frames);					\
+}
+
+/* The rest of an A2_dspfuncs table initializer for 'isa' */
+#define	A2_DSPTABLEF(isa)						\
+	isa##_AddF,							\
+	isa##_ScaleF,							\
+	isa##_ScaleAddF,						\
+	isa##_RampF,							\
+	isa##_RampAddF,							\
+	isa##_FixToFloat,						\
+	isa##_FixToFloatAdd,						\
+	isa##_FloatToFix
+
+A2_DSPFUNCSF(scalar, )
+
+static const A2_dspfuncs scalar_funcs = {
+	scalar_Clear,
+	scalar_Copy,
+	scalar_Add,
+	scalar_Scale,
+	scalar_ScaleAdd,
+	scalar_Ramp,
+	scalar_RampAdd,
+	A2_DSPTABLEF(scalar)
+};
+
+
+/*
+ * Entry points and function table for 'isa', based on the inline functions
+ * isa_clear(), isa_copy(), isa_add() and isa_gain(), which process whole
+ * vectors of 'lanes' frames, leaving the rest to the scalar code. The float
+ * functions are just the generic code, compiled for 'isa'.
+ */
+#define	A2_DSPFUNCS(isa, attr, lanes)					\
+static attr void isa##_Clear(int32_t *out, unsigned frames)		\
+{									\
+	unsigned n = frames / (lanes) * (lanes);			\
+	isa##_clear(out, n);						\
+	scalar_Clear(out + n, frames - n);				\
+}									\
+static attr void isa##_Copy(int32_t *out, const int32_t *in,		\
+		unsigned frames)					\
+{									\
+	unsigned n = frames / (lanes) * (lanes);			\
+	isa##_copy(out, in, n);						\
+	scalar_Copy(out + n, in + n, frames - n);			\
+}									\
+static attr void isa##_Add(int32_t *out, const int32_t *in,		\
+		unsigned frames)					\
+{									\
+	unsigned n = frames / (lanes) * (lanes);			\
+	isa##_add(out, in, n);						\
+	scalar_Add(out + n, in + n, frames - n);			\
+}									\
+static attr void isa##_Scale(int32_t *out, const int32_t *in,		\
+		unsigned frames, int gain)				\
+{									\
+	unsigned n = frames / (lanes) * (lanes);			\
+	isa##_gain(out, in, n, gain, 0, 0);				\
+	scalar_gain(out + n, in + n, frames - n, gain, 0, 0);		\
+}									\
+static attr void isa##_ScaleAdd(int32_t *out, const int32_t *in,	\
+		unsigned frames, int gain)				\
+{									\
+	unsigned n = frames / (lanes) * (lanes);			\
+	isa##_gain(out, in, n, gain, 0, 1);				\
+	scalar_gain(out + n, in + n, frames - n, gain, 0, 1);		\
+}									\
+static attr void isa##_Ramp(int32_t *out, const int32_t *in,		\
+		unsigned frames, int gain, int dgain)			\
+{									\
+	unsigned n = frames / (lanes) * (lanes);			\
+	isa##_gain(out, in, n, gain, dgain, 0);				\
+	scalar_gain(out + n, in + n, frames - n,			\
+			A2_RAMPGAIN(gain, dgain, n), dgain, 0);		\
+}									\
+static attr void isa##_RampAdd(int32_t *out, const int32_t *in,	\
+		unsigned frames, int gain, int dgain)			\
+{									\
+	unsigned n = frames / (lanes) * (lanes);			\
+	isa##_gain(out, in, n, gain, dgain, 1);				\
+	scalar_gain(out + n, in + n, frames - n,			\
+			A2_RAMPGAIN(gain, dgain, n), dgain, 1);		\
+}									\
+A2_DSPFUNCSF(isa, attr)							\
+static const A2_dspfuncs isa##_funcs = {				\
+	isa##_Clear,							\
+	isa##_Copy,							\
+	isa##_Add,							\
+	isa##_Scale,							\
+	isa##_ScaleAdd,							\
+	isa##_Ramp,							\
+	isa##_RampAdd,							\
+	A2_DSPTABLEF(isa)						\
+};
+
+
+/*---------------------------------------------------------
+	SSE2 (x86-64)
+---------------------------------------------------------*/
+#ifdef A2_SIMD_SSE2
+
+/*
+ * Low 32 bits of ((int64_t)a * b) >> 24, from unsigned 32x32 bit products
+ * (pmuldq is SSE4.1), with the upper halves corrected for signed operands.
+ */
+static inline __m128i sse2_mulshr24(__m128i a, __m128i b)
+{
+	__m128i lo = _mm_set_epi32(0, -1, 0, -1);
+	__m128i e = _mm_srli_epi64(_mm_mul_epu32(a, b), 24);
+	__m128i o = _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32),
+			_mm_srli_epi64(b, 32)), 8);
+	__m128i c = _mm_add_epi32(_mm_and_si128(_mm_srai_epi32(a, 31), b),
+			_mm_and_si128(_mm_srai_epi32(b, 31), a));
+	return _mm_sub_epi32(_mm_or_si128(_mm_and_si128(e, lo),
+			_mm_andnot_si128(lo, o)), _mm_slli_epi32(c, 8));
+}
+
+static inline void sse2_clear(int32_t *out, unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; s += 4)
+		_mm_storeu_si128((__m128i *)(out + s), _mm_setzero_si128());
+}
+
+static inline void sse2_copy(int32_t *out, const int32_t *in,
+		unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; s += 4)
+		_mm_storeu_si128((__m128i *)(out + s),
+				_mm_loadu_si128((const __m128i *)(in + s)));
+}
+
+static inline void sse2_add(int32_t *out, const int32_t *in,
+		unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; s += 4)
+		_mm_storeu_si128((__m128i *)(out + s), _mm_add_epi32(
+				_mm_loadu_si128((const __m128i *)(out + s)),
+				_mm_loadu_si128((const __m128i *)(in + s))));
+}
+
+static inline void sse2_gain(int32_t *out, const int32_t *in,
+		unsigned frames, int gain, int dgain, int add)
+{
+	unsigned s;
+	__m128i g = _mm_set_epi32(A2_RAMPGAIN(gain, dgain, 3),
+			A2_RAMPGAIN(gain, dgain, 2),
+			A2_RAMPGAIN(gain, dgain, 1), gain);
+	__m128i dg = _mm_set1_epi32(A2_RAMPGAIN(0, dgain, 4));
+	for(s = 0; s < frames; s += 4)
+	{
+		__m128i v = sse2_mulshr24(
+				_mm_loadu_si128((const __m128i *)(in + s)), g);
+		if(add)
+			v = _mm_add_epi32(v,
+				_mm_loadu_si128((const __m128i *)(out + s)));
+		_mm_storeu_si128((__m128i *)(out + s), v);
+		g = _mm_add_epi32(g, dg);
+	}
+}
+
+A2_DSPFUNCS(sse2, , 4)
+
+#endif /* A2_SIMD_SSE2 */
+
+
+/*---------------------------------------------------------
+	AVX2 (x86-64)
+---------------------------------------------------------*/
+#ifdef A2_SIMD_AVX2
+
+#define	A2_AVX2	__attribute__((target("avx2")))
+
+/* Low 32 bits of ((int64_t)a * b) >> 24 */
+static inline A2_AVX2 __m256i avx2_mulshr24(__m256i a, __m256i b)
+{
+	__m256i e = _mm256_srli_epi64(_mm256_mul_epi32(a, b), 24);
+	__m256i o = _mm256_slli_epi64(_mm256_mul_epi32(
+			_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)),
+			8);
+	return _mm256_blend_epi32(e, o, 0xaa);
+}
+
+static inline A2_AVX2 void avx2_clear(int32_t *out, unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; s += 8)
+		_mm256_storeu_si256((__m256i *)(out + s),
+				_mm256_setzero_si256());
+}
+
+static inline A2_AVX2 void avx2_copy(int32_t *out, const int32_t *in,
+		unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; s += 8)
+		_mm256_storeu_si256((__m256i *)(out + s),
+				_mm256_loadu_si256((const __m256i *)(in + s)));
+}
+
+static inline A2_AVX2 void avx2_add(int32_t *out, const int32_t *in,
+		unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; s += 8)
+		_mm256_storeu_si256((__m256i *)(out + s), _mm256_add_epi32(
+				_mm256_loadu_si256((const __m256i *)(out + s)),
+				_mm256_loadu_si256((const __m256i *)(in + s))));
+}
+
+static inline A2_AVX2 void avx2_gain(int32_t *out, const int32_t *in,
+		unsigned frames, int gain, int dgain, int add)
+{
+	unsigned s;
+	__m256i g = _mm256_set_epi32(A2_RAMPGAIN(gain, dgain, 7),
+			A2_RAMPGAIN(gain, dgain, 6),
+			A2_RAMPGAIN(gain, dgain, 5),
+			A2_RAMPGAIN(gain, dgain, 4),
+			A2_RAMPGAIN(gain, dgain, 3),
+			A2_RAMPGAIN(gain, dgain, 2),
+			A2_RAMPGAIN(gain, dgain, 1), gain);
+	__m256i dg = _mm256_set1_epi32(A2_RAMPGAIN(0, dgain, 8));
+	for(s = 0; s < frames; s += 8)
+	{
+		__m256i v = avx2_mulshr24(
+				_mm256_loadu_si256((const __m256i *)(in + s)),
+				g);
+		if(add)
+			v = _mm256_add_epi32(v, _mm256_loadu_si256(
+					(const __m256i *)(out + s)));
+		_mm256_storeu_si256((__m256i *)(out + s), v);
+		g = _mm256_add_epi32(g, dg);
+	}
+}
+
+A2_DSPFUNCS(avx2, A2_AVX2, 8)
+
+#endif /* A2_SIMD_AVX2 */
+
+
+/*---------------------------------------------------------
+	NEON (AArch64)
+	NOTE: Not yet verified! Only built if A2_DSP_NEON is defined.
+---------------------------------------------------------*/
+#ifdef A2_SIMD_NEON
+
+/* Low 32 bits of ((int64_t)a * b) >> 24 */
+static inline int32x4_t neon_mulshr24(int32x4_t a, int32x4_t b)
+{
+	return vcombine_s32(
+			vshrn_n_s64(vmull_s32(vget_low_s32(a),
+					vget_low_s32(b)), 24),
+			vshrn_n_s64(vmull_high_s32(a, b), 24));
+}
+
+static inline void neon_clear(int32_t *out, unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; s += 4)
+		vst1q_s32(out + s, vdupq_n_s32(0));
+}
+
+static inline void neon_copy(int32_t *out, const int32_t *in,
+		unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; s += 4)
+		vst1q_s32(out + s, vld1q_s32(in + s));
+}
+
+static inline void neon_add(int32_t *out, const int32_t *in,
+		unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; s += 4)
+		vst1q_s32(out + s, vaddq_s32(vld1q_s32(out + s),
+				vld1q_s32(in + s)));
+}
+
+static inline void neon_gain(int32_t *out, const int32_t *in,
+		unsigned frames, int gain, int dgain, int add)
+{
+	unsigned s;
+	int32_t g0[4] = {
+		gain,
+		A2_RAMPGAIN(gain, dgain, 1),
+		A2_RAMPGAIN(gain, dgain, 2),
+		A2_RAMPGAIN(gain, dgain, 3)
+	};
+	int32x4_t g = vld1q_s32(g0);
+	int32x4_t dg = vdupq_n_s32(A2_RAMPGAIN(0, dgain, 4));
+	for(s = 0; s < frames; s += 4)
+	{
+		int32x4_t v = neon_mulshr24(vld1q_s32(in + s), g);
+		if(add)
+			v = vaddq_s32(v, vld1q_s32(out + s));
+		vst1q_s32(out + s, v);
+		g = vaddq_s32(g, dg);
+	}
+}
+
+A2_DSPFUNCS(neon, , 4)
+
+#endif /* A2_SIMD_NEON */
+
+
+const A2_dspfuncs *a2_DSPFuncs(unsigned simd)
+{
+#ifdef A2_SIMD_AVX2
+	if(simd & A2_CPU_AVX2)
+		return &avx2_funcs;
+#endif
+#ifdef A2_SIMD_SSE2
+	if(simd & A2_CPU_SSE2)
+		return &sse2_funcs;
+#endif
+#ifdef A2_SIMD_NEON
+	if(simd & A2_CPU_NEON)
+		return &neon_funcs;
+#endif
+	return &scalar_funcs;
+}
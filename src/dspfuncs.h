@@ -0,0 +1,95 @@
+/*
+ * dspfuncs.h - Audiality 2 DSP primitives
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef A2_DSPFUNCS_H
+#define A2_DSPFUNCS_H
+
+#include <stdint.h>
+
+/*
+ * Mixing primitives for 8:24 fixed point sample buffers. Gains are 8:24 as
+ * well, so scaling is done as (int64_t)in[s] * gain >> 24, and ramped gains
+ * change by 'dgain' per sample frame, just like an A2_ramper. There are SIMD
+ * versions for some CPUs, but they all give the exact same results.
+ *
+ * The float versions operate on 32 bit float buffers, where 1.0f corresponds
+ * to 1.0 (1 << 24) in 8:24, and have float gains, with 1.0f meaning unity.
+ */
+typedef struct A2_dspfuncs
+{
+	/* out[s] = 0 */
+	void (*Clear)(int32_t *out, unsigned frames);
+
+	/* out[s] = in[s] */
+	void (*Copy)(int32_t *out, const int32_t *in, unsigned frames);
+
+	/* out[s] += in[s] */
+	void (*Add)(int32_t *out, const int32_t *in, unsigned frames);
+
+	/* out[s] = in[s] * gain */
+	void (*Scale)(int32_t *out, const int32_t *in, unsigned frames,
+			int gain);
+
+	/* out[s] += in[s] * gain */
+	void (*ScaleAdd)(int32_t *out, const int32_t *in, unsigned frames,
+			int gain);
+
+	/* out[s] = in[s] * (gain + s * dgain) */
+	void (*Ramp)(int32_t *out, const int32_t *in, unsigned frames,
+			int gain, int dgain);
+
+	/* out[s] += in[s] * (gain + s * dgain) */
+	void (*RampAdd)(int32_t *out, const int32_t *in, unsigned frames,
+			int gain, int dgain);
+
+	/*
+	 * 32 bit float versions, for A2_FLOATPROC states. (Clear and Copy work
+	 * just as well on float buffers.)
+	 */
+	void (*AddF)(float *out, const float *in, unsigned frames);
+	void (*ScaleF)(float *out, const float *in, unsigned frames,
+			float gain);
+	void (*ScaleAddF)(float *out, const float *in, unsigned frames,
+			float gain);
+	void (*RampF)(float *out, const float *in, unsigned frames,
+			float gain, float dgain);
+	void (*RampAddF)(float *out, const float *in, unsigned frames,
+			float gain, float dgain);
+
+	/* out[s] = in[s] * A2_FIX2FLOAT */
+	void (*FixToFloat)(float *out, const int32_t *in, unsigned frames);
+
+	/* out[s] += in[s] * A2_FIX2FLOAT */
+	void (*FixToFloatAdd)(float *out, const int32_t *in, unsigned frames);
+
+	/* out[s] = in[s] / A2_FIX2FLOAT, clamped to the 8:24 range */
+	void (*FloatToFix)(int32_t *out, const float *in, unsigned frames);
+} A2_dspfuncs;
+
+/*
+ * Get the primitives for the best instruction set in 'simd' (A2_cpufeatures).
+ * With no supported instruction sets, this returns the scalar versions.
+ */
+const A2_dspfuncs *a2_DSPFuncs(unsigned simd);
+
+#endif /* A2_DSPFUNCS_H */
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "internals.h"
+#include "profile.h"
 
 
 /*---------------------------------------------------------
@@ -49,6 +50,7 @@ A2_errors a2_OpenAPI(A2_state *st)
 		nmessages = st->config->eventpool;
 	else
 		nmessages = A2_MINEVENTS + buffer * A2_TIMEEVENTS;
+	st->config->eventpool = nmessages;
 	for(j = 0; j < nmessages; ++j)
 	{
 		A2_event *e = a2_NewEvent(st);
@@ -62,12 +64,25 @@ A2_errors a2_OpenAPI(A2_state *st)
 		st->eventpool = e;
 	}
 	EVLEAKTRACK(A2_DLOG("Allocated %d events.\n", st->numevents);)
+
+	/* Initialize VM profiling, if enabled */
+	if(st->config->flags & A2_PROFILE)
+	{
+		A2_errors res = a2_OpenProfiler(st);
+		if(res)
+		{
+			A2_LOG_ERR(&st->interfaces->interface, "Could not "
+					"initialize VM profiler!");
+			return res;
+		}
+	}
 	return A2_OK;
 }
 
 
 void a2_CloseAPI(A2_state *st)
 {
+	a2_CloseProfiler(st);
 	if(st->fromapi)
 	{
 		sfifo_Close(st->fromapi);
@@ -90,6 +105,140 @@ void a2_CloseAPI(A2_state *st)
 }
 
 
+/*---------------------------------------------------------
+	Pool reserves
+---------------------------------------------------------*/
+
+static unsigned a2_PoolItemSize(A2_state *st, A2_pools pool)
+{
+	switch(pool)
+	{
+	  case A2_BLOCKPOOL:
+		return st->blocksize;
+	  case A2_EVENTPOOL:
+		return sizeof(A2_event);
+	  default:
+		return A2_VOICESIZE(A2_VOICECLASSES - 1);
+	}
+}
+
+
+void a2r_RequestReserve(A2_state *st, A2_pools pool)
+{
+	A2_apimessage am;
+	A2_reserve *r = &st->reserve[pool];
+	if(!st->toapi)
+		return;
+	am.target = 0;
+	am.b.common.action = A2MT_POOLLOW;
+	am.b.common.flags = 0;
+	am.b.common.timestamp = st->now_ticks;
+	am.b.pool.items = NULL;
+	am.b.pool.pool = pool;
+	am.b.pool.reserve = 1;
+	am.b.pool.count = r->size - r->count;
+	if(!a2r_WriteMsg(st, &am, A2_MSIZE(b.pool)))
+		r->requested = 1;
+}
+
+
+static void *a2_AllocPoolItems(A2_state *st, A2_pools pool, unsigned count,
+		unsigned *allocated)
+{
+	void **items = NULL;
+	unsigned n;
+	for(n = 0; n < count; ++n)
+	{
+		void **item = (void **)st->sys->RTAlloc(st->sys,
+				a2_PoolItemSize(st, pool));
+		if(!item)
+			break;
+		*item = items;
+		items = item;
+		EVLEAKTRACK(if(pool == A2_EVENTPOOL) ++st->numevents;)
+	}
+	*allocated = n;
+	return items;
+}
+
+
+static void a2_FreePoolItems(A2_state *st, A2_pools pool, void *items)
+{
+	void **item = (void **)items;
+	while(item)
+	{
+		void **next = (void **)*item;
+		st->sys->RTFree(st->sys, item);
+		EVLEAKTRACK(if(pool == A2_EVENTPOOL) --st->numevents;)
+		item = next;
+	}
+}
+
+
+A2_errors a2_SendPoolItems(A2_state *st, A2_pools pool, unsigned count,
+		int reserve)
+{
+	A2_apimessage am;
+	A2_errors res;
+	unsigned n;
+	void *items;
+	if(!count)
+		return A2_OK;
+
+	/* The sysdriver is not thread safe, so we need to lock the engine */
+	st->audio->Lock(st->audio);
+	items = a2_AllocPoolItems(st, pool, count, &n);
+	st->audio->Unlock(st->audio);
+	if(!items)
+		return A2_OOMEMORY;
+
+	am.target = 0;
+	am.b.common.action = A2MT_POOLREFILL;
+	am.b.common.flags = 0;
+	am.b.pool.items = items;
+	am.b.pool.pool = pool;
+	am.b.pool.reserve = reserve;
+	am.b.pool.count = n;
+	if((res = a2_writemsg(st->fromapi, &am, A2_MSIZE(b.pool))))
+	{
+		st->audio->Lock(st->audio);
+		a2_FreePoolItems(st, pool, items);
+		st->audio->Unlock(st->audio);
+		return res;
+	}
+	return n < count ? A2_OOMEMORY : A2_OK;
+}
+
+
+A2_errors a2_FillReserve(A2_state *st, A2_pools pool, unsigned count)
+{
+	A2_reserve *r = &st->reserve[pool];
+	unsigned n;
+	void **items = (void **)a2_AllocPoolItems(st, pool, count, &n);
+	while(items)
+	{
+		void **next = (void **)*items;
+		*items = r->items;
+		r->items = items;
+		++r->count;
+		items = next;
+	}
+	return n < count ? A2_OOMEMORY : A2_OK;
+}
+
+
+void a2_FreeReserves(A2_state *st)
+{
+	int p;
+	for(p = 0; p < A2_NPOOLS; ++p)
+	{
+		a2_FreePoolItems(st, p, st->reserve[p].items);
+		st->reserve[p].items = NULL;
+		st->reserve[p].count = 0;
+	}
+}
+
+
 /*---------------------------------------------------------
 	Timestamping utilities
 ---------------------------------------------------------*/
@@ -168,7 +317,43 @@ static inline void a2r_em_forwardevent(A2_state *st, A2_apimessage *am,
 	else
 		e->b.common.timestamp = latelimit;
 	MSGTRACK(e->source = "a2r_em_forwardevent()";)
-	a2_SendEvent(eq, e);
+	a2_SendEvent(st, eq, e);
+}
+
+static inline void a2r_em_poolrefill(A2_state *st, A2_apimessage *am)
+{
+	A2_reserve *r = &st->reserve[am->b.pool.pool];
+	void **item = (void **)am->b.pool.items;
+	while(item)
+	{
+		void **next = (void **)*item;
+		if(am->b.pool.reserve)
+		{
+			*item = r->items;
+			r->items = item;
+			++r->count;
+		}
+		else switch(am->b.pool.pool)
+		{
+		  case A2_BLOCKPOOL:
+			a2_FreeBlock(st, item);
+			break;
+		  case A2_EVENTPOOL:
+			a2_FreeEvent(st, (A2_event *)item);
+			break;
+		  case A2_VOICEPOOL:
+		  {
+			A2_voice *v = (A2_voice *)item;
+			a2_VoiceInit(st, v, A2_VOICECLASSES - 1);
+			v->next = st->voicepool[v->vclass];
+			st->voicepool[v->vclass] = v;
+			break;
+		  }
+		}
+		item = next;
+	}
+	if(am->b.pool.reserve)
+		r->requested = 0;
 }
 
 static inline void a2r_em_eocevent(A2_state *st, A2_apimessage *am)
@@ -223,6 +408,12 @@ void a2r_PumpEngineMessages(A2_state *st, unsigned latelimit)
 		  case A2MT_WAHP:
 			a2r_em_eocevent(st, &am);
 			break;
+		  case A2MT_PROFILE:
+			a2r_ReturnProfile(st, am.b.prof.block);
+			break;
+		  case A2MT_POOLREFILL:
+			a2r_em_poolrefill(st, &am);
+			break;
 		  case A2MT_MIDIHANDLER:
 		  {
 			A2_mididriver *md = am.b.midih.driver;
@@ -309,7 +500,7 @@ void a2_PumpMessages(A2_interface *i)
 		  case A2MT_WAHP:
 		  {
 			A2_wahp_entry *we = am.b.wahp.entry;
-			if(!--we->count)
+			if(a2_AtomicAdd(&we->count, -1) == 1)
 			{
 				/* Last response! Let's make the callback. */
 				we->callback(we->state, we->userdata);
@@ -317,6 +508,20 @@ void a2_PumpMessages(A2_interface *i)
 			}
 			break;
 		  }
+		  case A2MT_PROFILE:
+			a2_ReceiveProfile(st, am.b.prof.block);
+			break;
+		  case A2MT_POOLLOW:
+		  {
+			A2_errors res;
+			if(st->is_closing)
+				break;	/* Too late! Nothing would receive it. */
+			if((res = a2_SendPoolItems(st, am.b.pool.pool,
+					am.b.pool.count, 1)))
+				A2_LOG_ERR(i, "Could not refill pool reserve; "
+						"%s!", a2_ErrorString(res));
+			break;
+		  }
 		  default:
 			A2_LOG_INT("Unknown engine message %d!",
 					am.b.common.action);
@@ -360,6 +565,10 @@ void a2r_ProcessEOCEvents(A2_state *st, unsigned frames)
 		st->eocevents = e->next;
 		a2_FreeEvent(st, e);
 	}
+
+	/* Pass VM profiling counters on to the API */
+	if(st->prof)
+		a2r_SendProfile(st);
 }
 
 
@@ -367,6 +576,7 @@ A2_errors a2_WhenAllHaveProcessed(A2_state *st, A2_generic_cb cb,
 		void *userdata)
 {
 	A2_apimessage am;
+	int count = 0;
 	A2_state *pstate = st->parent ? st->parent : st;
 	A2_wahp_entry *we = (A2_wahp_entry *)malloc(sizeof(A2_wahp_entry));
 	if(!we)
@@ -374,11 +584,12 @@ A2_errors a2_WhenAllHaveProcessed(A2_state *st, A2_generic_cb cb,
 	we->state = st;
 	we->callback = cb;
 	we->userdata = userdata;
-	we->count = 0;
+	a2_MutexLock(&pstate->ss->statelock);
 	for(st = pstate; st; st = st->next)
 		if(st->fromapi)
-			++we->count;
-	if(we->count)
+			++count;
+	we->count = count;
+	if(count)
 	{
 		am.b.common.action = A2MT_WAHP;
 		am.b.wahp.entry = we;
@@ -387,7 +598,8 @@ A2_errors a2_WhenAllHaveProcessed(A2_state *st, A2_generic_cb cb,
 				a2_writemsg(st->fromapi, &am,
 						A2_MSIZE(b.wahp));
 	}
-	else
+	a2_MutexUnlock(&pstate->ss->statelock);
+	if(!count)
 	{
 		/* Emergency: No functional engine states present! */
 		we->callback(we->state, we->userdata);
@@ -413,7 +625,7 @@ A2_errors a2r_Error(A2_state *st, A2_errors e, const char *info)
 		am.b.common.timestamp = st->now_ticks;
 		am.b.error.code = e;
 		am.b.error.info = info;
-		return a2_writemsg(st->toapi, &am, A2_MSIZE(b.error));
+		return a2r_WriteMsg(st, &am, A2_MSIZE(b.error));
 	}
 	else
 	{
@@ -443,7 +655,7 @@ void a2r_DetachHandle(A2_state *st, A2_handle h)
 	am.b.common.action = A2MT_DETACH;
 	am.target = h;
 	/* NOTE: No timestamp on this one, so we stop at the 'action' field! */
-	a2_writemsg(st->toapi, &am, A2_MSIZE(b.common.action));
+	a2r_WriteMsg(st, &am, A2_MSIZE(b.common.action));
 }
 
 
@@ -771,7 +983,7 @@ static A2_handle a2_RT_Starta(A2_interface *i, A2_handle parent,
 	e->b.start.program = program;
 	e->b.start.voice = vh;
 	memcpy(&e->b.start.a, argv, argc * sizeof(int));
-	a2_SendEvent(eq, e);
+	a2_SendEvent(st, eq, e);
 	return vh;
 }
 
@@ -794,7 +1006,7 @@ static A2_errors a2_RT_Playa(A2_interface *i, A2_handle parent,
 	e->b.common.argc = argc;
 	e->b.play.program = program;
 	memcpy(&e->b.play.a, argv, argc * sizeof(int));
-	a2_SendEvent(eq, e);
+	a2_SendEvent(st, eq, e);
 	return A2_OK;
 }
 
@@ -819,7 +1031,7 @@ static A2_errors a2_RT_Senda(A2_interface *i, A2_handle voice, unsigned ep,
 	e->b.common.argc = argc;
 	e->b.play.program = ep;
 	memcpy(&e->b.play.a, argv, argc * sizeof(int));
-	a2_SendEvent(eq, e);
+	a2_SendEvent(st, eq, e);
 	return A2_OK;
 }
 
@@ -844,7 +1056,7 @@ static A2_errors a2_RT_SendSuba(A2_interface *i, A2_handle voice, unsigned ep,
 	e->b.common.argc = argc;
 	e->b.play.program = ep;
 	memcpy(&e->b.play.a, argv, argc * sizeof(int));
-	a2_SendEvent(eq, e);
+	a2_SendEvent(st, eq, e);
 	return A2_OK;
 }
 
@@ -861,7 +1073,7 @@ static A2_errors a2_RT_Kill(A2_interface *i, A2_handle voice)
 		return A2_OOMEMORY;
 	a2_RT_SetTimestamp(ii, e);
 	e->b.common.action = A2MT_KILL;
-	a2_SendEvent(eq, e);
+	a2_SendEvent(st, eq, e);
 	return A2_OK;
 }
 
@@ -878,7 +1090,7 @@ static A2_errors a2_RT_KillSub(A2_interface *i, A2_handle voice)
 		return A2_OOMEMORY;
 	a2_RT_SetTimestamp(ii, e);
 	e->b.common.action = A2MT_KILLSUB;
-	a2_SendEvent(eq, e);
+	a2_SendEvent(st, eq, e);
 	return A2_OK;
 }
 
@@ -34,6 +34,7 @@ WARNING: Calls with the a2c_ prefix MUST ONLY be used with a2c_Try()!
 #include "sfifo.h"
 #include "platform.h"
 #include "config.h"
+#include "dspfuncs.h"
 #include "xinsert.h"
 
 
@@ -52,6 +53,10 @@ typedef struct A2_stream A2_stream;
 typedef struct A2_wahp_entry A2_wahp_entry;
 typedef struct A2_interface_i A2_interface_i;
 typedef struct A2_state A2_state;
+typedef struct A2_native A2_native;
+typedef struct A2_profblock A2_profblock;
+typedef struct A2_profile A2_profile;
+typedef struct A2_workers A2_workers;
 
 
 /*
@@ -148,6 +153,11 @@ void a2_DumpConfig(A2_config *c);
  * NOTE:
  *	The END instruction, opcode 0, is left out here, as it needs special
  *	treatment in enums for safely portable code.
+ *
+ * NOTE:
+ *	The fused instructions are only generated by the peephole optimizer in
+ *	the compiler. The compare + branch instructions MUST be in the same
+ *	order as the corresponding comparison operators!
  */
 #define A2_ALLINSTRUCTIONS						\
 	/* Program flow control */					\
@@ -161,7 +171,7 @@ void a2_DumpConfig(A2_config *c);
 	A2_DI(DELAY)	A2_DI(DELAYR)	A2_DI(TDELAY)	A2_DI(TDELAYR)	\
 									\
 	/* Message handling */						\
-	A2_DI(SLEEP)	A2_DI(WAKE)	A2_DI(FORCE)			\
+	A2_DI(SLEEP)	A2_DI(WAKE)	A2_DI(FORCE)	A2_DI(DORMANT)	\
 									\
 	/* Arithmetics */						\
 	A2_DI(SUBR)	A2_DI(DIVR)	A2_DI(P2DR)	A2_DI(NEGR)	\
@@ -194,15 +204,46 @@ void a2_DumpConfig(A2_config *c);
 	A2_DI(DEBUG)	A2_DI(DEBUGR)					\
 									\
 	/* Special instructions */					\
-	A2_DI(INITV)	A2_DI(SIZEOF)	A2_DI(SIZEOFR)
+	A2_DI(INITV)	A2_DI(SIZEOF)	A2_DI(SIZEOFR)			\
+									\
+	/* Fused instructions */					\
+	A2_DI(LDADDR)	A2_DI(LDSUBR)	A2_DI(LDMULR)	A2_DI(LDADD)	\
+	A2_DI(GRJZ)	A2_DI(LRJZ)	A2_DI(GERJZ)	A2_DI(LERJZ)	\
+	A2_DI(EQRJZ)	A2_DI(NERJZ)					\
+	A2_DI(GRJNZ)	A2_DI(LRJNZ)	A2_DI(GERJNZ)	A2_DI(LERJNZ)	\
+	A2_DI(EQRJNZ)	A2_DI(NERJNZ)					\
+	A2_DI(PUSH2R)							\
+									\
+	/* Control register write variants */				\
+	A2_CONTROLWRITES
+
+/*
+ * Instructions that write to the register specified by a1. For each of these,
+ * there is a *C variant (generated via A2_CI()) that is used by the compiler
+ * when the target is a control register. Only the *C variants go through the
+ * register write tracker, as writes to variables and temporary registers have
+ * no side effects.
+ */
+#define A2_CONTROLWRITES						\
+	A2_CI(SUBR)	A2_CI(DIVR)	A2_CI(P2DR)	A2_CI(NEGR)	\
+	A2_CI(LOAD)	A2_CI(LOADR)	A2_CI(ADD)	A2_CI(ADDR)	\
+	A2_CI(MUL)	A2_CI(MULR)	A2_CI(MOD)	A2_CI(MODR)	\
+	A2_CI(QUANT)	A2_CI(QUANTR)	A2_CI(RAND)	A2_CI(RANDR)	\
+	A2_CI(GR)	A2_CI(LR)	A2_CI(GER)	A2_CI(LER)	\
+	A2_CI(EQR)	A2_CI(NER)					\
+	A2_CI(ANDR)	A2_CI(ORR)	A2_CI(XORR)	A2_CI(NOTR)	\
+	A2_CI(SIZEOF)	A2_CI(SIZEOFR)					\
+	A2_CI(LDADDR)	A2_CI(LDSUBR)	A2_CI(LDMULR)	A2_CI(LDADD)
 
 #define	A2_DI(x)	OP_##x,
+#define	A2_CI(x)	OP_##x##C,
 typedef enum A2_opcodes
 {
 	OP_END = 0,
 	A2_ALLINSTRUCTIONS
 	A2_OPCODES	/* Total number of VM opcodes */
 } A2_opcodes;
+#undef	A2_CI
 #undef	A2_DI
 
 /* First VM register that may have a write callback */
@@ -223,6 +264,7 @@ typedef struct A2_instruction
 } A2_instruction;
 
 unsigned a2_InsSize(A2_opcodes op);
+A2_opcodes a2_PlainOp(A2_opcodes op);
 void a2_DumpIns(unsigned *code, unsigned pc, FILE *stream);
 
 
@@ -414,6 +456,22 @@ TODO: registers in future versions!
 	} p;
 };
 
+/*
+ * Flattened unit list, built by the compiler from A2_program::units, so that
+ * voice instantiation doesn't have to walk the struct item list and decode
+ * unit descriptors for every voice spawned.
+ */
+typedef struct A2_unitplan
+{
+	const A2_unitdesc	*descriptor;
+	int			kind;		/* Unit index */
+	unsigned		flags;		/* A2_unitflags */
+	int16_t			ninputs;	/* Count/A2_iocodes */
+	int16_t			noutputs;	/* Count/A2_iocodes */
+	uint8_t			ncregs;		/* Number of control registers */
+	uint8_t			ncoutputs;	/* Number of control outputs */
+} A2_unitplan;
+
 typedef struct A2_function
 {
 	unsigned	*code;		/* VM code */
@@ -422,6 +480,10 @@ typedef struct A2_function
 	uint8_t		argv;		/* First register of argument list */
 	uint8_t		argc;		/* Number of arguments */
 	uint8_t		topreg;		/* Highest register used */
+	uint16_t	fused;		/* Instructions eliminated by fusion */
+#ifdef A2_VM_JIT
+	A2_native	*native;	/* Native code, if any (vmjit.c) */
+#endif
 } A2_function;
 
 struct A2_program
@@ -429,10 +491,17 @@ struct A2_program
 	A2_function	*funcs;		/* Function and handler entry points */
 	A2_structitem	*units;		/* Voice structure: units */
 	A2_structitem	*wires;		/* Voice structure: wires */
+	A2_unitplan	*plan;		/* Voice structure: flattened units */
+	A2_cport	*cregs;		/* Control register template */
 	int8_t		eps[A2_MAXEPS];	/* Message to funcs index map */
 	uint16_t	vflags;		/* Extra voice flags (A2_voiceflags) */
 	int8_t		buffers;	/* Number of scratch buffers needed */
 	uint8_t		nfuncs;		/* Number of local functions */
+	uint8_t		nunits;		/* Number of units in 'plan' */
+	uint8_t		ncregs;		/* Number of control registers */
+	uint8_t		suspendable;	/* All units are A2_SUSPENDABLE */
+	uint8_t		vclass;		/* Voice size class */
+	A2_handle	handle;		/* Own handle, for profiling */
 };
 
 /*
@@ -455,6 +524,16 @@ struct A2_stackentry
 #define	A2_MAXSAVEREGS	\
 	((sizeof(A2_block) - offsetof(A2_stackentry, r)) / sizeof(int))
 
+/*
+ * VM register write tracker
+ */
+typedef struct A2_regtracker
+{
+	uint64_t	mask;			/* One bit/register */
+	uint32_t	position;		/* Current index in regs[] */
+	uint8_t		regs[A2_REGISTERS];	/* Indices of written regs */
+} A2_regtracker;
+
 /*
  * Internal event struct - sent directly to voice event queues
  *
@@ -474,14 +553,17 @@ typedef enum A2_evactions
 	A2MT_ADDXIC,	/* Add xinsert client */
 	A2MT_REMOVEXIC,	/* Remove xinsert client */
 	A2MT_MIDIHANDLER,/* Set MIDI input handler */
+	A2MT_POOLREFILL,/* Items for pool or reserve (A2_reserve) */
 
 	/* Engine to API messages */
 	A2MT_DETACH,	/* Free handle if rc 0 otherwise type = A2_TDETACHED */
 	A2MT_XICREMOVED,/* xinsert client removed; clear to clean up */
 	A2MT_ERROR,	/* Error message from the engine */
+	A2MT_POOLLOW,	/* Reserve below low watermark; please refill */
 
 	/* Messages sent both ways */
 	A2MT_WAHP,	/* When-All-Have-Processed callback */
+	A2MT_PROFILE	/* VM profiling block (profile.c) */
 } A2_evactions;
 
 typedef enum A2_evflags
@@ -538,11 +620,26 @@ typedef union A2_eventbody
 		A2_mididriver	*driver;
 		int		channels;
 	} midih;
+	struct
+	{
+		A2_EVENT_COMMON
+		A2_profblock	*block;
+	} prof;
+	struct
+	{
+		A2_EVENT_COMMON
+		void		*items;		/* LIFO stack of items */
+		uint8_t		pool;		/* A2_pools */
+		uint8_t		reserve;	/* 1: To reserve; 0: To pool */
+		unsigned	count;		/* Number of items */
+	} pool;
 } A2_eventbody;
 
 struct A2_event
 {
-	A2_event	*next;		/* Next event en queue */
+	A2_event	*next;		/* Next event en queue, or sibling */
+	A2_event	*child;		/* First child in event queue heap */
+	unsigned	seq;		/* Send order, for equal timestamps */
 	A2_eventbody	b;
 	NUMMSGS(unsigned number;)
 	MSGTRACK(const char *source;)
@@ -552,39 +649,97 @@ typedef enum A2_voiceflags
 {
 	A2_SUBINLINE =	0x0100,	/* Subvoices as inline unit */
 	A2_ATTACHED =	0x0200,	/* Voice attached to handle or parent */
-	A2_APIHANDLE =	0x0400	/* 'handle' field is a valid API handle */
+	A2_APIHANDLE =	0x0400,	/* 'handle' field is a valid API handle */
+	A2_DORMANT =	0x0800,	/* Skip VM and units until woken up */
+	A2_SUSPENDED =	0x1000,	/* Silent; skip units until controlled */
+	A2_PARALLEL =	0x2000,	/* Subvoices may be processed in lanes */
+	A2_TERMINATED =	0x4000,	/* Terminated in a lane; free after join */
+	A2_STOLEN =	0x8000	/* Stolen; fading out, to be freed */
 } A2_voiceflags;
 
-/* Voice - node of the processing tree graph */
+/* A2_voice 'level' value for voices that don't do silence detection */
+#define	A2_UNKNOWNLEVEL	INT32_MAX
+
+/* A2_voice 'lane' value for voices that are yet to be assigned to a lane */
+#define	A2_LANEPENDING	255
+
+/*
+ * Voice - node of the processing tree graph
+ *
+ * Voices are allocated in size classes (see A2_VOICESIZE()), with the VM
+ * register file truncated to what the program needs. The control register
+ * table and the subvoice LUT are placed after the registers, and 'cregs' and
+ * 'sv' are set up by a2_VoiceInit() to point at them.
+ */
 struct A2_voice
 {
+	/* Hot: Touched by the voice tree walk every fragment */
 	A2_voice	*next;		/* Next voice in list */
 	A2_event	*events;	/* Event queue */
-	A2_stackentry	*stack;		/* VM call stack */
+	A2_unit		*units;		/* Chain of voice units */
+	A2_voice	*sub;		/* List of all subvoices */
+	A2_voice	*lanenext;	/* Next voice in the same render lane */
+	int32_t		**outputs;
+	int32_t		**sout;		/* Unit outputs, or NULL (silence det.) */
+	unsigned	noutputs;
+	uint16_t	flags;		/* A2_voiceflags */
+	uint8_t		nestlevel;	/* Nest level, for scratch buffers */
+	uint8_t		lane;		/* Render lane + 1, or 0 if none */
 
-	/* VM state */
+	/* VM, control registers and silence detection */
 	A2_program	*program;	/* Currently executing VM program */
-	A2_vmstate	s;		/* Control, special and work regs */
-
+	A2_stackentry	*stack;		/* VM call stack */
+	A2_cport	*cregs;		/* Register write info */
+	uint64_t	tickrem;	/* Musical time remainder (TDELAY) */
+	unsigned	silentframes;	/* Frames of silence output so far */
+	unsigned	rampend;	/* End time of last control ramp */
+	uint32_t	noisestate;	/* 'rand' and 'wtosc' noise RNG state */
 	A2_handle	handle;		/* Handle, if wired to the API */
-	uint16_t	flags;		/* A2_voiceflags */
-	uint8_t		nestlevel;	/* Nest level, for scratch buffers */
+	uint8_t		ncregs;		/* Number of wired regs */
+	uint8_t		vclass;		/* Size class */
+	uint8_t		awake;		/* Set by units to veto suspension */
 
-	/* Units and control registers */
-	uint8_t		ncregs;			/* Number of wired regs */
-	A2_cport	cregs[A2_REGISTERS];	/* Register write info */
-	A2_unit		*units;			/* Chain of voice units */
+	/* Voice stealing */
+	int32_t		level;		/* Last output peak, or A2_UNKNOWNLEVEL */
+	unsigned	started;	/* Start time (24:8 frames) */
+	unsigned	fade;		/* Frames left of steal fade-out */
 
-	/* Sub-voices */
-	A2_voice	*sub;			/* List of all subvoices */
+	/* Cold: Only used when addressing subvoices */
 #if A2_SV_LUT_SIZE
-	A2_voice	*sv[A2_SV_LUT_SIZE];	/* Quick subvoice LUT */
+	A2_voice	**sv;		/* Quick subvoice LUT */
+#endif
+#if A2_SV_INDEX
+	A2_voice	***svx;		/* Subvoice index pages, or NULL */
 #endif
 
-	unsigned	noutputs;
-	int32_t		**outputs;
+	/* VM state. NOTE: Must be last, as 'r' is cut to the size class! */
+	A2_vmstate	s;		/* Control, special and work regs */
 };
 
+/* Size of voice size class 'c', and the offset of the 'cregs' table */
+#define	A2_VOICECREGS(c)	((offsetof(A2_voice, s.r) +		\
+		(A2_MINVOICEREGS << (c)) * sizeof(int) +		\
+		sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+#define	A2_VOICESIZE(c)		(A2_VOICECREGS(c) +			\
+		(A2_MINVOICEREGS << (c)) * sizeof(A2_cport) +		\
+		A2_SV_LUT_SIZE * sizeof(A2_voice *))
+
+/*
+ * Subvoice index: One block of page pointers, each page being a block of
+ * A2_SVX_PAGESIZE voice pointers, covering IDs A2_SV_LUT_SIZE..A2_SVX_END-1.
+ */
+#define	A2_SVX_PAGESIZE	(sizeof(A2_block) / sizeof(A2_voice *))
+#define	A2_SVX_END	(A2_SV_LUT_SIZE + A2_SVX_PAGESIZE * A2_SVX_PAGESIZE)
+
+/* Smallest voice size class with room for 'nregs' VM registers */
+static inline unsigned a2_VoiceClass(unsigned nregs)
+{
+	unsigned c = 0;
+	while((A2_MINVOICEREGS << c) < nregs)
+		++c;
+	return c;
+}
+
 /* Audio bus */
 struct A2_bus
 {
@@ -592,27 +747,40 @@ struct A2_bus
 	int32_t		*buffers[A2_MAXCHANNELS];
 };
 
-/* Block - allocation unit for A2_stackentry and mixing buffers */
+/*
+ * Block - allocation unit for A2_stackentry and mixing buffers. The actual size
+ * of blocks is A2_state.blocksize, as the audio buffers are sized to match the
+ * fragment size of the state.
+ */
 typedef union A2_block A2_block;
 union A2_block
 {
 	A2_block	*next;			/* Free list link */
 	A2_stackentry	stackentry;		/* VM stack entry */
 	A2_unit		unit;			/* Voice unit instance */
-	int32_t		buffer[A2_MAXFRAG];	/* Audio buffer */
 	A2_bus		bus;			/* Audio bus */
 	char		minsize[A2_BLOCK_SIZE];
 };
 
+/*
+ * Size of the memory blocks of a state processing 'frag' sample frames at a
+ * time; large enough for any A2_block, and for an audio buffer. Unit instances,
+ * VM stack entries etc are sized by sizeof(A2_block), as that's the minimum.
+ */
+#define	A2_BLOCKSIZE(frag)	(sizeof(A2_block) > (frag) * sizeof(int32_t) ?\
+		sizeof(A2_block) : (frag) * sizeof(int32_t))
+
 /* State resources that are shared by master states and substates */
 struct A2_sharedstate
 {
 	RCHM_manager	hm;		/* Handle manager */
+	A2_mutex	statelock;	/* Substate list and cross-state msgs */
 	A2_program	*terminator;	/* Dummy program for killed voices */
 	A2_handle	groupdriver;	/* Program handle for a2_NewGroup() */
 	char		strbuf[A2_TMPSTRINGSIZE]; /* For API return strings */
 
 	unsigned	offlinebuffer;	/* A2_POFFLINEBUFFER */
+	unsigned	wavepost;	/* Wave post-padding for new waves */
 
 	unsigned	silencelevel;	/* A2_PSILENCELEVEL */
 	unsigned	silencewindow;	/* A2_PSILENCEWINDOW */
@@ -638,6 +806,31 @@ struct A2_interface_i
 	unsigned	loglevels;	/* Loglevel mask */
 };
 
+/* Engine pools */
+typedef enum A2_pools
+{
+	A2_BLOCKPOOL = 0,
+	A2_EVENTPOOL,
+	A2_VOICEPOOL,
+	A2_NPOOLS
+} A2_pools;
+
+/*
+ * Pool reserve. When a pool runs dry, the engine takes raw memory for new
+ * objects from the reserve, and when less than half of 'size' items remain,
+ * it asks the API context to refill it. (A2MT_POOLLOW, A2MT_POOLREFILL)
+ *
+ * Items are uninitialized memory blocks of the size of the pool objects,
+ * linked through their first word.
+ */
+typedef struct A2_reserve
+{
+	void		*items;		/* LIFO stack of items */
+	unsigned	count;		/* Number of items in the reserve */
+	unsigned	size;		/* Target size (A2_P*RESERVE) */
+	int		requested;	/* Refill requested, not yet received */
+} A2_reserve;
+
 /* Audiality 2 state */
 struct A2_state
 {
@@ -667,19 +860,39 @@ struct A2_state
 	SFIFO		*toapi;		/* Responses to the API context */
 	A2_event	*eocevents;	/* To be sent to API at end of cycle */
 
-	A2_voice	*voicepool;	/* LIFO stack of voices */
+	A2_voice	*voicepool[A2_VOICECLASSES];	/* LIFO voice stacks */
 	unsigned	totalvoices;	/* Number of voices in use + pool */
+	unsigned	voicememory;	/* Size of all voices (bytes) */
 	unsigned	activevoices;	/* Number of voices in use */
+	unsigned	suspendedvoices; /* Number of A2_SUSPENDED voices */
+	unsigned	fadingvoices;	/* Number of A2_STOLEN voices */
+	unsigned	stolenvoices;	/* Number of voices stolen so far */
+	unsigned	voicelimit;	/* Active voice budget (0: no limit) */
+
+	/* CPU load adaptive quality scaling */
+	unsigned	quality;	/* Current oscillator quality */
+	unsigned	maxquality;	/* Quality to restore (A2_PQUALITY) */
+	unsigned	loadhigh;	/* Load (%) to reduce quality at */
+	unsigned	loadlow;	/* Load (%) to restore quality at */
+	unsigned	loadfilter;	/* Smoothed CPU load (%, 24:8) */
+	unsigned	qualityhold;	/* Frames until next quality change */
+	unsigned	loadlimit;	/* Voice budget due to load (0: none) */
 
 	A2_block	*blockpool;	/* LIFO stack of memory blocks */
 	A2_event	*eventpool;	/* LIFO stack of event structs */
+	A2_reserve	reserve[A2_NPOOLS];	/* Pool reserves */
+	unsigned	eventseq;	/* Event send counter */
 	unsigned	now_fragstart;	/* For internal message timing */
 	NUMMSGS(unsigned msgnum;)
 	EVLEAKTRACK(unsigned numevents;)
 
 	unsigned	msdur;		/* One ms in sample frames (16:16) */
+	unsigned	fragment;	/* Processing fragment size (frames) */
+	unsigned	blocksize;	/* Size of memory blocks (bytes) */
 	uint32_t	randstate;	/* RAND* instruction RNG state */
-	uint32_t	noisestate;	/* 'wtosc' noise generator state */
+	uint32_t	noisestate;	/* Seeds voices started on the root voice */
+	unsigned	simd;		/* SIMD instruction sets in use */
+	const A2_dspfuncs *dsp;	/* DSP primitives in use */
 
 	/*
 	 * FIXME:
@@ -691,6 +904,11 @@ struct A2_state
 	unsigned	apimessages;	/* Number of API messages received */
 	unsigned	activevoicesmax;
 
+	/* VM profiling (profile.c) */
+	A2_profblock	*prof;		/* Current block, or NULL if disabled */
+	A2_profblock	*proffree;	/* LIFO stack of free blocks (engine) */
+	A2_profile	*profile;	/* API side totals */
+
 	int		statreset;	/* Flag to reset averaging/summing */
 	uint64_t	now_micros;	/* Performance monitoring timestamp */
 	uint64_t	avgstart;	/* Timestamp for averaging start */
@@ -708,9 +926,14 @@ struct A2_state
 	int		tsmin;		/* Minimum TS deadline margin (24:8) */
 	int		tsmax;		/* Maximum TS deadline margin (24:8) */
 
+	/* Parallel voice processing (workers.c) */
+	A2_workers	*workers;	/* Render lanes and threads, if any */
+	A2_state	*lanemaster;	/* Master state, if this is a lane */
+
 	/* Global audio buffers */
 	A2_bus		*master;		/* Master outputs */
 	A2_bus		*scratch[A2_NESTLIMIT];	/* Intermediate buffers */
+	A2_bus		*fadebus[A2_NESTLIMIT];	/* Steal fade-out buffers */
 };
 
 
@@ -778,14 +1001,100 @@ int a2_LockAllStates(A2_state *st);
 int a2_UnlockAllStates(A2_state *st);
 
 
+/*---------------------------------------------------------
+	Render lanes (workers.c)
+---------------------------------------------------------*/
+
+/*
+ * Get the state to process voice 'v' of state 'st' in. This is the state of
+ * the render lane of 'v', if it belongs to one, otherwise 'st'.
+ */
+A2_state *a2_VoiceState(A2_state *st, A2_voice *v);
+
+/*
+ * Lane side pool fallbacks. These grab objects from the pools of the master
+ * state, or allocate new ones, if the lane pools are empty.
+ */
+A2_block *a2_LaneNewBlock(A2_state *st);
+A2_event *a2_LaneNewEvent(A2_state *st);
+A2_voice *a2_LaneNewVoice(A2_state *st, unsigned vclass);
+
+/*
+ * Master side pool fallback: Take back objects that have accumulated in the
+ * pools of render lanes. Only to be called when the lanes are idle!
+ */
+void a2_ReclaimLanePools(A2_state *st);
+
+/* Serialize access to master state resources from render lanes */
+void a2_LaneLock(A2_state *st);
+void a2_LaneUnlock(A2_state *st);
+
+/*
+ * Allocate/free memory through the realtime memory manager of 'st', or of its
+ * master state, if 'st' is a render lane. For units and other code that may run
+ * in render lanes, where calling the sysdriver directly is not thread safe.
+ */
+void *a2_RTAlloc(A2_state *st, unsigned size);
+void a2_RTFree(A2_state *st, void *block);
+
+
 /*---------------------------------------------------------
 	Realtime block memory manager
 ---------------------------------------------------------*/
 
+/* Ask the API context to refill reserve 'pool' of 'st' */
+void a2r_RequestReserve(A2_state *st, A2_pools pool);
+
+/*
+ * Allocate 'count' items for 'pool' from the API context, and send them to
+ * the engine, to be added to the reserve if 'reserve' is 1, or the pool if 0.
+ */
+A2_errors a2_SendPoolItems(A2_state *st, A2_pools pool, unsigned count,
+		int reserve);
+
+/*
+ * Allocate 'count' items directly into reserve 'pool'. Only to be used while
+ * the engine is not running!
+ */
+A2_errors a2_FillReserve(A2_state *st, A2_pools pool, unsigned count);
+
+/* Free all reserves of 'st' */
+void a2_FreeReserves(A2_state *st);
+
+/*
+ * Take an item from reserve 'pool', requesting a refill if we're below the
+ * low watermark. Returns NULL if the reserve is empty.
+ */
+static inline void *a2r_TakeReserve(A2_state *st, A2_pools pool)
+{
+	A2_reserve *r = &st->reserve[pool];
+	void **item = (void **)r->items;
+	if(!item)
+		return NULL;
+	r->items = *item;
+	--r->count;
+	if(!r->requested && (r->count < r->size / 2))
+		a2r_RequestReserve(st, pool);
+	return item;
+}
+
 static inline A2_block *a2_NewBlock(A2_state *st)
 {
-	A2_block *b = st->sys->RTAlloc(st->sys, sizeof(A2_block));
-	if(!b)
+	A2_block *b;
+	if(st->lanemaster)
+		return a2_LaneNewBlock(st);
+	if(st->workers)
+	{
+		a2_ReclaimLanePools(st);
+		if((b = st->blockpool))
+		{
+			st->blockpool = b->next;
+			return b;
+		}
+	}
+	if((b = (A2_block *)a2r_TakeReserve(st, A2_BLOCKPOOL)))
+		return b;
+	if(!(b = st->sys->RTAlloc(st->sys, st->blocksize)))
 		return NULL;
 #ifdef DEBUG
 	if(st->config->flags & A2_REALTIME)
@@ -845,11 +1154,12 @@ static inline int a2_ReallocBus(A2_state *st, A2_bus *bus, unsigned channels)
 }
 
 /* Clear the specified subfragment of all channels of the specified bus */
-static inline void a2_ClearBus(A2_bus *bus, unsigned offset, unsigned frames)
+static inline void a2_ClearBus(A2_state *st, A2_bus *bus, unsigned offset,
+		unsigned frames)
 {
 	int i;
 	for(i = 0; i < bus->channels; ++i)
-		memset(bus->buffers[i] + offset, 0, sizeof(int32_t) * frames);
+		st->dsp->Clear(bus->buffers[i] + offset, frames);
 }
 
 /* Free a bus, including any buffers it may be using */
@@ -868,8 +1178,21 @@ static inline void a2_FreeBus(A2_state *st, A2_bus *bus)
 
 static inline A2_event *a2_NewEvent(A2_state *st)
 {
-	A2_event *e = st->sys->RTAlloc(st->sys, sizeof(A2_event));
-	if(!e)
+	A2_event *e;
+	if(st->lanemaster)
+		return a2_LaneNewEvent(st);
+	if(st->workers)
+	{
+		a2_ReclaimLanePools(st);
+		if((e = st->eventpool))
+		{
+			st->eventpool = e->next;
+			return e;
+		}
+	}
+	if((e = (A2_event *)a2r_TakeReserve(st, A2_EVENTPOOL)))
+		return e;
+	if(!(e = st->sys->RTAlloc(st->sys, sizeof(A2_event))))
 		return NULL;
 	EVLEAKTRACK(++st->numevents;)
 	return e;
@@ -924,23 +1247,87 @@ static inline A2_event **a2_GetEventQueue(A2_state *st, A2_handle handle)
 	}
 }
 
-static inline void a2_SendEvent(A2_event **q, A2_event *e)
+/*
+ * Event queues are pairing heaps, ordered by timestamp, and then by the order
+ * in which the events were sent. The queue pointer points to the root, which
+ * is the next event to process, and which never has any siblings. Each node
+ * has a list of child heaps, linked via 'next'.
+ *
+ * Sending is O(1), and removing the first event is amortized O(log n).
+ */
+
+/* Returns non-zero if event 'a' is to be processed before event 'b' */
+static inline int a2_EventBefore(A2_event *a, A2_event *b)
+{
+	int d = a2_TSDiff(a->b.common.timestamp, b->b.common.timestamp);
+	if(d)
+		return d < 0;
+	return (int)(a->seq - b->seq) < 0;
+}
+
+/*
+ * Merge two event heaps, returning the new root. The 'next' field of 'b' is
+ * overwritten, whereas the one of 'a' is left as is!
+ */
+static inline A2_event *a2_EventMerge(A2_event *a, A2_event *b)
 {
-	A2_event *pe = *q;
-	if(!pe || (a2_TSDiff(pe->b.common.timestamp,
-			e->b.common.timestamp) > 0))
+	if(a2_EventBefore(b, a))
 	{
-		e->next = pe;
-		*q = e;
+		A2_event *t = a;
+		a = b;
+		b = t;
 	}
+	b->next = a->child;
+	a->child = b;
+	return a;
+}
+
+static inline void a2_SendEvent(A2_state *st, A2_event **q, A2_event *e)
+{
+	e->next = e->child = NULL;
+	e->seq = st->eventseq++;
+	if(*q)
+		*q = a2_EventMerge(*q, e);
 	else
+		*q = e;
+}
+
+/* Remove the first event from queue 'q'. (The event is not freed!) */
+static inline void a2_EventPop(A2_event **q)
+{
+	A2_event *c = (*q)->child;
+	A2_event *pairs = NULL;
+	A2_event *root = NULL;
+
+	/* Merge the children in pairs, left to right */
+	while(c)
+	{
+		A2_event *a = c;
+		A2_event *b = c->next;
+		if(b)
+		{
+			c = b->next;
+			a->next = NULL;
+			a = a2_EventMerge(a, b);
+		}
+		else
+			c = NULL;
+		a->next = pairs;
+		pairs = a;
+	}
+
+	/* Merge the pairs into a single heap, right to left */
+	while(pairs)
 	{
-		while(pe->next && (a2_TSDiff(pe->next->b.common.timestamp,
-				e->b.common.timestamp) <= 0))
-			pe = pe->next;
-		e->next = pe->next;
-		pe->next = e;
+		A2_event *p = pairs;
+		pairs = p->next;
+		p->next = NULL;
+		if(root)
+			root = a2_EventMerge(root, p);
+		else
+			root = p;
 	}
+	*q = root;
 }
 
 /*
@@ -954,9 +1341,11 @@ void a2_FlushEventQueue(A2_state *st, A2_event **eq, A2_handle h);
 	Voice management
 ---------------------------------------------------------*/
 
-A2_voice *a2_VoiceAlloc(A2_state *st);
+A2_voice *a2_VoiceAlloc(A2_state *st, unsigned vclass);
+void a2_VoiceInit(A2_state *st, A2_voice *v, unsigned vclass);
 A2_errors a2_init_root_voice(A2_state *st);
-A2_voice *a2_VoiceNew(A2_state *st, A2_voice *parent, unsigned when);
+A2_voice *a2_VoiceNew(A2_state *st, A2_voice *parent, unsigned when,
+		unsigned vclass);
 A2_errors a2_VoiceStart(A2_state *st, A2_voice *v,
 		A2_program *p, int argc, int *argv);
 A2_errors a2_VoiceCall(A2_state *st, A2_voice *v, unsigned func,
@@ -1089,6 +1478,23 @@ static inline A2_errors a2_writemsgargs(SFIFO *f, A2_apimessage *m,
 }
 
 
+/*
+ * Write message 'm' to the API from the engine context of 'st'. Render lanes
+ * share the 'toapi' FIFO of their master state, and need to take turns.
+ */
+static inline A2_errors a2r_WriteMsg(A2_state *st, A2_apimessage *m,
+		unsigned size)
+{
+	A2_errors res;
+	if(!st->lanemaster)
+		return a2_writemsg(st->toapi, m, size);
+	a2_LaneLock(st);
+	res = a2_writemsg(st->toapi, m, size);
+	a2_LaneUnlock(st);
+	return res;
+}
+
+
 typedef void (*A2_generic_cb)(A2_state *st, void *userdata);
 
 struct A2_wahp_entry
@@ -1096,7 +1502,7 @@ struct A2_wahp_entry
 	A2_state	*state;
 	A2_generic_cb	callback;
 	void		*userdata;
-	int		count;	/* Number of states we're still waiting for. */
+	A2_atomic	count;	/* Number of states we're still waiting for. */
 };
 
 /*
@@ -1141,8 +1547,8 @@ A2_errors a2_XinsertRemoveClient(A2_xinsert_client *xic);
 	Error handling
 ---------------------------------------------------------*/
 
-/* Last error code for "top level" API calls */
-extern A2_errors a2_last_error;
+/* Last error code for "top level" API calls (per thread) */
+extern A2_THREADLOCAL A2_errors a2_last_error;
 
 /* Send an error message from an engine context to its API state. */
 A2_errors a2r_Error(A2_state *st, A2_errors e, const char *info);
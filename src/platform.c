@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include "platform.h"
+#include "config.h"
 
 #ifdef _WIN32
 char *strndup(const char *s, size_t size)
@@ -41,6 +42,53 @@ char *strndup(const char *s, size_t size)
 #endif
 
 
+/*---------------------------------------------------------
+	Threads
+---------------------------------------------------------*/
+
+#ifdef _WIN32
+static DWORD WINAPI a2_thread_main(LPVOID data)
+{
+	A2_thread *t = (A2_thread *)data;
+	t->func(t->data);
+	return 0;
+}
+#else
+static void *a2_thread_main(void *data)
+{
+	A2_thread *t = (A2_thread *)data;
+	t->func(t->data);
+	return NULL;
+}
+#endif
+
+
+A2_errors a2_ThreadStart(A2_thread *t, A2_threadfunc func, void *data)
+{
+	t->func = func;
+	t->data = data;
+#ifdef _WIN32
+	if(!(t->thread = CreateThread(NULL, 0, a2_thread_main, t, 0, NULL)))
+		return A2_DEVICEOPEN;
+#else
+	if(pthread_create(&t->thread, NULL, a2_thread_main, t))
+		return A2_DEVICEOPEN;
+#endif
+	return A2_OK;
+}
+
+
+void a2_ThreadJoin(A2_thread *t)
+{
+#ifdef _WIN32
+	WaitForSingleObject(t->thread, INFINITE);
+	CloseHandle(t->thread);
+#else
+	pthread_join(t->thread, NULL);
+#endif
+}
+
+
 /*---------------------------------------------------------
 	Timing
 ---------------------------------------------------------*/
@@ -141,3 +189,25 @@ unsigned a2_Sleep(unsigned milliseconds)
 	return now - t1;
 #endif
 }
+
+
+/*---------------------------------------------------------
+	CPU features
+---------------------------------------------------------*/
+
+unsigned a2_CPUFeatures(void)
+{
+	unsigned f = 0;
+#ifdef A2_SIMD_SSE2
+	f |= A2_CPU_SSE2;	/* Part of the x86-64 baseline */
+#endif
+#ifdef A2_SIMD_AVX2
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		f |= A2_CPU_AVX2;
+#endif
+#ifdef A2_SIMD_NEON
+	f |= A2_CPU_NEON;	/* Part of the AArch64 baseline */
+#endif
+	return f;
+}
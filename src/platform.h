@@ -49,6 +49,13 @@
 char *strndup(const char *s, size_t size);
 #endif
 
+/* Thread local storage class */
+#ifdef _MSC_VER
+# define A2_THREADLOCAL	__declspec(thread)
+#else
+# define A2_THREADLOCAL	__thread
+#endif
+
 
 /*---------------------------------------------------------
 	Atomics
@@ -72,12 +79,16 @@ static inline int a2_AtomicCAS(A2_atomic *a, int ov, int nv)
 
 static inline int a2_AtomicAdd(A2_atomic *a, int v)
 {
+#if !defined(_WIN32) && !defined(__MACOSX__)
+	return __sync_fetch_and_add(a, v);
+#else
 	while(1)
 	{
 		int ov = *a;
 		if(a2_AtomicCAS(a, ov, (ov + v)))
 			return ov;
 	}
+#endif
 }
 
 
@@ -165,6 +176,97 @@ static inline void a2_MutexClose(A2_mutex *mtx)
 #endif	/* _WIN32 */
 
 
+/*---------------------------------------------------------
+	Condition variable
+---------------------------------------------------------*/
+
+typedef struct A2_cond
+{
+#ifdef _WIN32
+	CONDITION_VARIABLE	cv;
+#else
+	pthread_cond_t		cond;
+#endif
+} A2_cond;
+
+
+/*
+ * WIN32 implementation
+ */
+#ifdef _WIN32
+static inline A2_errors a2_CondOpen(A2_cond *cond)
+{
+	InitializeConditionVariable(&cond->cv);
+	return A2_OK;
+}
+
+static inline void a2_CondWait(A2_cond *cond, A2_mutex *mtx)
+{
+	SleepConditionVariableCS(&cond->cv, &mtx->cs, INFINITE);
+}
+
+static inline void a2_CondBroadcast(A2_cond *cond)
+{
+	WakeAllConditionVariable(&cond->cv);
+}
+
+static inline void a2_CondClose(A2_cond *cond)
+{
+}
+
+
+/*
+ * pthreads implementation
+ */
+#else	/* _WIN32 */
+static inline A2_errors a2_CondOpen(A2_cond *cond)
+{
+	if(pthread_cond_init(&cond->cond, NULL))
+		return A2_DEVICEOPEN;
+	return A2_OK;
+}
+
+static inline void a2_CondWait(A2_cond *cond, A2_mutex *mtx)
+{
+	pthread_cond_wait(&cond->cond, &mtx->mutex);
+}
+
+static inline void a2_CondBroadcast(A2_cond *cond)
+{
+	pthread_cond_broadcast(&cond->cond);
+}
+
+static inline void a2_CondClose(A2_cond *cond)
+{
+	pthread_cond_destroy(&cond->cond);
+}
+#endif	/* _WIN32 */
+
+
+/*---------------------------------------------------------
+	Threads
+---------------------------------------------------------*/
+
+typedef void (*A2_threadfunc)(void *data);
+
+typedef struct A2_thread
+{
+#ifdef _WIN32
+	HANDLE		thread;
+#else
+	pthread_t	thread;
+#endif
+	A2_threadfunc	func;
+	void		*data;
+} A2_thread;
+
+/* Start a thread running 'func(data)' */
+A2_errors a2_ThreadStart(A2_thread *t, A2_threadfunc func, void *data);
+
+/* Wait for a thread to return from its thread function */
+void a2_ThreadJoin(A2_thread *t);
+
+
 /*---------------------------------------------------------
 	CPU yield
 ---------------------------------------------------------*/
@@ -192,4 +294,19 @@ void a2_time_close(void);
 
 uint64_t a2_GetMicros(void);
 
+
+/*---------------------------------------------------------
+	CPU features
+---------------------------------------------------------*/
+
+/* SIMD instruction sets, as supported by both the CPU and this build */
+typedef enum A2_cpufeatures
+{
+	A2_CPU_SSE2 =	0x00000001,
+	A2_CPU_AVX2 =	0x00000002,
+	A2_CPU_NEON =	0x00000004
+} A2_cpufeatures;
+
+unsigned a2_CPUFeatures(void);
+
 #endif /* A2_PLATFORM_H */
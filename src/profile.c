@@ -0,0 +1,263 @@
+/*
+ * profile.c - Audiality 2 VM profiler
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+
+/*---------------------------------------------------------
+	Open/close
+---------------------------------------------------------*/
+
+static void a2_ClearProfBlock(A2_profblock *pb)
+{
+	unsigned i;
+	for(i = 0; i < pb->nused; ++i)
+	{
+		A2_profslot *ps = pb->slots + pb->used[i];
+		ps->program = -1;
+		ps->func = 0;
+		ps->instructions = 0;
+		ps->calls = ps->spawns = 0;
+	}
+	pb->nused = 0;
+	pb->lost = 0;
+	memset(pb->ops, 0, sizeof(pb->ops));
+}
+
+
+A2_errors a2_OpenProfiler(A2_state *st)
+{
+	int i, j;
+	A2_profile *p = (A2_profile *)calloc(1, sizeof(A2_profile));
+	if(!p)
+		return A2_OOMEMORY;
+	st->profile = p;
+	p->blocks = (A2_profblock *)calloc(A2_PROFBLOCKS,
+			sizeof(A2_profblock));
+	if(!p->blocks)
+		return A2_OOMEMORY;
+	for(i = 0; i < A2_PROFBLOCKS; ++i)
+	{
+		A2_profblock *pb = p->blocks + i;
+		for(j = 0; j < A2_PROFSLOTS; ++j)
+			pb->slots[j].program = -1;
+		if(i)
+		{
+			pb->next = st->proffree;
+			st->proffree = pb;
+		}
+	}
+	st->prof = p->blocks;
+	return A2_OK;
+}
+
+
+void a2_CloseProfiler(A2_state *st)
+{
+	if(!st->profile)
+		return;
+	free(st->profile->blocks);
+	free(st->profile->entries);
+	free(st->profile);
+	st->profile = NULL;
+	st->prof = st->proffree = NULL;
+}
+
+
+/*---------------------------------------------------------
+	Engine side
+---------------------------------------------------------*/
+
+void a2r_SendProfile(A2_state *st)
+{
+	A2_apimessage am;
+	A2_profblock *pb = st->prof;
+	if(!pb || !st->proffree || (!pb->nused && !pb->lost))
+		return;
+	am.target = 0;
+	am.b.common.action = A2MT_PROFILE;
+	am.b.common.flags = 0;
+	am.b.common.timestamp = st->now_ticks;
+	am.b.prof.block = pb;
+	if(a2_writemsg(st->toapi, &am, A2_MSIZE(b.prof)))
+		return;	/* Keep counting into this one, and try again later */
+	st->prof = st->proffree;
+	st->proffree = st->prof->next;
+}
+
+
+void a2r_ReturnProfile(A2_state *st, A2_profblock *pb)
+{
+	pb->next = st->proffree;
+	st->proffree = pb;
+}
+
+
+/*---------------------------------------------------------
+	API side
+---------------------------------------------------------*/
+
+/*
+ * Find the entry for function 'func' of program 'program', creating it if it
+ * does not exist. Returns NULL if we run out of memory.
+ */
+static A2_profentry *a2_ProfEntry(A2_profile *p, A2_handle program,
+		unsigned func)
+{
+	A2_profentry *e;
+	unsigned lo = 0;
+	unsigned hi = p->nentries;
+	while(lo < hi)
+	{
+		unsigned mid = (lo + hi) / 2;
+		e = p->entries + mid;
+		if((e->program < program) ||
+				((e->program == program) && (e->func < func)))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if((lo < p->nentries) && (p->entries[lo].program == program) &&
+			(p->entries[lo].func == func))
+		return p->entries + lo;
+	if(p->nentries >= p->size)
+	{
+		unsigned ns = p->size ? p->size * 2 : 64;
+		e = (A2_profentry *)realloc(p->entries,
+				ns * sizeof(A2_profentry));
+		if(!e)
+			return NULL;
+		p->entries = e;
+		p->size = ns;
+	}
+	e = p->entries + lo;
+	memmove(e + 1, e, (p->nentries - lo) * sizeof(A2_profentry));
+	++p->nentries;
+	memset(e, 0, sizeof(A2_profentry));
+	e->program = program;
+	e->func = func;
+	return e;
+}
+
+
+void a2_ReceiveProfile(A2_state *st, A2_profblock *pb)
+{
+	A2_apimessage am;
+	A2_profile *p = st->profile;
+	unsigned i;
+	for(i = 0; i < pb->nused; ++i)
+	{
+		A2_profslot *ps = pb->slots + pb->used[i];
+		A2_profentry *e = a2_ProfEntry(p, ps->program, ps->func);
+		if(!e)
+		{
+			p->lost += ps->instructions;
+			continue;
+		}
+		e->instructions += ps->instructions;
+		e->calls += ps->calls;
+		e->spawns += ps->spawns;
+	}
+	for(i = 0; i < A2_OPCODES; ++i)
+		p->ops[i] += pb->ops[i];
+	p->lost += pb->lost;
+	a2_ClearProfBlock(pb);
+
+	am.target = 0;
+	am.b.common.action = A2MT_PROFILE;
+	am.b.common.flags = 0;
+	am.b.common.timestamp = 0;
+	am.b.prof.block = pb;
+	if(a2_writemsg(st->fromapi, &am, A2_MSIZE(b.prof)))
+		A2_LOG_INT("Could not return profiling block to the engine!");
+}
+
+
+static int a2_profcmp(const void *a, const void *b)
+{
+	const A2_profentry *ea = (const A2_profentry *)a;
+	const A2_profentry *eb = (const A2_profentry *)b;
+	if(ea->instructions > eb->instructions)
+		return -1;
+	else if(ea->instructions < eb->instructions)
+		return 1;
+	return 0;
+}
+
+
+int a2_GetProfile(A2_interface *i, A2_profentry *entries, unsigned max)
+{
+	A2_interface_i *ii = (A2_interface_i *)i;
+	A2_profile *p = ii->state->profile;
+	A2_profentry *sorted;
+	unsigned n;
+	if(!p)
+		return -A2_NOTIMPLEMENTED;
+	a2_PumpMessages(i);
+	n = p->nentries + (p->lost ? 1 : 0);
+	if(!max || !n)
+		return n;
+	if(!(sorted = (A2_profentry *)malloc(n * sizeof(A2_profentry))))
+		return -A2_OOMEMORY;
+	memcpy(sorted, p->entries, p->nentries * sizeof(A2_profentry));
+	if(p->lost)
+	{
+		A2_profentry *e = sorted + p->nentries;
+		memset(e, 0, sizeof(A2_profentry));
+		e->program = -1;
+		e->instructions = p->lost;
+	}
+	qsort(sorted, n, sizeof(A2_profentry), a2_profcmp);
+	memcpy(entries, sorted, (max < n ? max : n) * sizeof(A2_profentry));
+	free(sorted);
+	return n;
+}
+
+
+int a2_GetInstructionProfile(A2_interface *i, uint64_t *counts, unsigned max)
+{
+	A2_interface_i *ii = (A2_interface_i *)i;
+	A2_profile *p = ii->state->profile;
+	if(!p)
+		return -A2_NOTIMPLEMENTED;
+	a2_PumpMessages(i);
+	if(max > A2_OPCODES)
+		max = A2_OPCODES;
+	memcpy(counts, p->ops, max * sizeof(uint64_t));
+	return A2_OPCODES;
+}
+
+
+A2_errors a2_ResetProfile(A2_interface *i)
+{
+	A2_interface_i *ii = (A2_interface_i *)i;
+	A2_profile *p = ii->state->profile;
+	if(!p)
+		return A2_NOTIMPLEMENTED;
+	a2_PumpMessages(i);
+	p->nentries = 0;
+	p->lost = 0;
+	memset(p->ops, 0, sizeof(p->ops));
+	return A2_OK;
+}
@@ -0,0 +1,143 @@
+/*
+ * profile.h - Audiality 2 VM profiler
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * The engine counts into a profiling block, which is passed to the API via the
+ * 'toapi' FIFO at the end of each engine cycle, as long as there is a free
+ * block to switch to. The API adds the counts to its totals, clears the block,
+ * and passes it back to the engine via the 'fromapi' FIFO. If no free block is
+ * available, the engine just keeps counting into the current block.
+ */
+
+#ifndef A2_PROFILE_H
+#define A2_PROFILE_H
+
+#include "internals.h"
+
+/* Number of program/function slots per profiling block (power of two!) */
+#define	A2_PROFSLOTS	256
+
+/* Maximum number of slots to probe before giving up */
+#define	A2_PROFPROBES	16
+
+/* Number of profiling blocks passed around between the engine and the API */
+#define	A2_PROFBLOCKS	4
+
+/* Engine side counters for one function of one program */
+typedef struct A2_profslot
+{
+	A2_handle	program;	/* Program handle, or -1 if unused */
+	unsigned	func;		/* Function index */
+	uint64_t	instructions;	/* Instructions executed */
+	unsigned	calls;		/* Calls and messages handled */
+	unsigned	spawns;		/* Voices started */
+} A2_profslot;
+
+struct A2_profblock
+{
+	A2_profblock	*next;		/* Engine side free list link */
+	uint64_t	lost;		/* Instructions not accounted for */
+	unsigned	nused;		/* Number of slots in use */
+	uint16_t	used[A2_PROFSLOTS];	/* Indices of used slots */
+	A2_profslot	slots[A2_PROFSLOTS];
+	uint64_t	ops[A2_OPCODES];	/* Instructions executed/opcode */
+};
+
+/* API side totals */
+struct A2_profile
+{
+	A2_profblock	*blocks;	/* All blocks, for cleanup */
+	A2_profentry	*entries;	/* Sorted by program, then function */
+	unsigned	nentries;
+	unsigned	size;		/* Allocated size of 'entries' */
+	uint64_t	lost;		/* Instructions not accounted for */
+	uint64_t	ops[A2_OPCODES];
+};
+
+A2_errors a2_OpenProfiler(A2_state *st);
+void a2_CloseProfiler(A2_state *st);
+
+/* Engine: Send the current block to the API, if there is a free block */
+void a2r_SendProfile(A2_state *st);
+
+/* Engine: Take back a block from the API */
+void a2r_ReturnProfile(A2_state *st, A2_profblock *pb);
+
+/* API: Add the counts in 'pb' to the totals, and send it back to the engine */
+void a2_ReceiveProfile(A2_state *st, A2_profblock *pb);
+
+
+/*---------------------------------------------------------
+	Engine side counting
+---------------------------------------------------------*/
+
+/*
+ * Find or allocate the slot for function 'func' of program 'p'. Returns NULL
+ * if no slot could be found within A2_PROFPROBES probes.
+ */
+static inline A2_profslot *a2_ProfSlot(A2_profblock *pb, A2_program *p,
+		unsigned func)
+{
+	unsigned i = (p->handle * 31 + func) & (A2_PROFSLOTS - 1);
+	unsigned n;
+	for(n = 0; n < A2_PROFPROBES; ++n)
+	{
+		A2_profslot *ps = pb->slots + i;
+		if((ps->program == p->handle) && (ps->func == func))
+			return ps;
+		if(ps->program < 0)
+		{
+			ps->program = p->handle;
+			ps->func = func;
+			pb->used[pb->nused++] = i;
+			return ps;
+		}
+		i = (i + 1) & (A2_PROFSLOTS - 1);
+	}
+	return NULL;
+}
+
+static inline void a2_ProfInstructions(A2_profblock *pb, A2_program *p,
+		unsigned func, unsigned count)
+{
+	A2_profslot *ps = a2_ProfSlot(pb, p, func);
+	if(ps)
+		ps->instructions += count;
+	else
+		pb->lost += count;
+}
+
+static inline void a2_ProfCall(A2_profblock *pb, A2_program *p, unsigned func)
+{
+	A2_profslot *ps = a2_ProfSlot(pb, p, func);
+	if(ps)
+		++ps->calls;
+}
+
+static inline void a2_ProfSpawn(A2_profblock *pb, A2_program *p)
+{
+	A2_profslot *ps = a2_ProfSlot(pb, p, 0);
+	if(ps)
+		++ps->spawns;
+}
+
+#endif /* A2_PROFILE_H */
@@ -27,6 +27,7 @@
 #include <math.h>
 #include "internals.h"
 #include "compiler.h"
+#include "workers.h"
 
 
 A2_errors a2_GetStateProperty(A2_interface *i, A2_properties p, int *v)
@@ -71,6 +72,42 @@ A2_errors a2_GetStateProperty(A2_interface *i, A2_properties p, int *v)
 	  case A2_PLOGLEVELS:
 		*v = ii->loglevels;
 		return A2_OK;
+	  case A2_PRENDERTHREADS:
+		*v = st->workers ? st->workers->threads : 0;
+		return A2_OK;
+	  case A2_PBLOCKPOOL:
+		*v = st->config->blockpool;
+		return A2_OK;
+	  case A2_PEVENTPOOL:
+		*v = st->config->eventpool;
+		return A2_OK;
+	  case A2_PVOICEPOOL:
+		*v = st->config->voicepool;
+		return A2_OK;
+	  case A2_PBLOCKRESERVE:
+		*v = st->reserve[A2_BLOCKPOOL].size;
+		return A2_OK;
+	  case A2_PEVENTRESERVE:
+		*v = st->reserve[A2_EVENTPOOL].size;
+		return A2_OK;
+	  case A2_PVOICERESERVE:
+		*v = st->reserve[A2_VOICEPOOL].size;
+		return A2_OK;
+	  case A2_PVOICELIMIT:
+		*v = st->voicelimit;
+		return A2_OK;
+	  case A2_PQUALITY:
+		*v = st->maxquality;
+		return A2_OK;
+	  case A2_PCPULOADHIGH:
+		*v = st->loadhigh;
+		return A2_OK;
+	  case A2_PCPULOADLOW:
+		*v = st->loadlow;
+		return A2_OK;
+	  case A2_PFRAGMENT:
+		*v = st->fragment;
+		return A2_OK;
 
 	/*
 	 * FIXME:
@@ -138,6 +175,21 @@ A2_errors a2_GetStateProperty(A2_interface *i, A2_properties p, int *v)
 		else
 			*v = 0;
 		return A2_OK;
+	  case A2_PSUSPENDEDVOICES:
+		*v = st->suspendedvoices;
+		return A2_OK;
+	  case A2_PVOICEMEMORY:
+		*v = st->voicememory;
+		return A2_OK;
+	  case A2_PSTOLENVOICES:
+		*v = st->stolenvoices;
+		return A2_OK;
+	  case A2_PCURRENTQUALITY:
+		*v = st->quality;
+		return A2_OK;
+	  case A2_PLOADVOICELIMIT:
+		*v = st->loadlimit;
+		return A2_OK;
 
 	  default:
 		return A2_NOTFOUND;
@@ -256,6 +308,35 @@ A2_errors a2_GetProperty(A2_interface *i, A2_handle h, A2_properties p, int *v)
 }
 
 
+/* Grow pool 'pool' of 'st', currently of size '*size', to 'v' objects */
+static A2_errors a2_GrowPool(A2_state *st, A2_pools pool, int *size, int v)
+{
+	A2_errors res;
+	if(v < 0)
+		return A2_VALUERANGE;
+	if(v <= *size)
+		return A2_OK;
+	if((res = a2_SendPoolItems(st, pool, v - *size, 0)))
+		return res;
+	*size = v;
+	return A2_OK;
+}
+
+
+/* Set the reserve size of pool 'pool' of 'st' to 'v' objects */
+static A2_errors a2_SetReserve(A2_state *st, A2_pools pool, int v)
+{
+	A2_reserve *r = &st->reserve[pool];
+	unsigned size = r->size;
+	if(v < 0)
+		return A2_VALUERANGE;
+	r->size = v;
+	if(v <= size)
+		return A2_OK;
+	return a2_SendPoolItems(st, pool, v - size, 1);
+}
+
+
 A2_errors a2_SetStateProperty(A2_interface *i, A2_properties p, int v)
 {
 	A2_interface_i *ii = (A2_interface_i *)i;
@@ -270,6 +351,7 @@ A2_errors a2_SetStateProperty(A2_interface *i, A2_properties p, int v)
 	  /* A2_PSTATE */
 	  case A2_PSAMPLERATE:
 	  case A2_PBUFFER:
+	  case A2_PFRAGMENT:
 		return A2_READONLY;
 	  case A2_PTIMESTAMPMARGIN:
 		ii->tsmargin = v;
@@ -300,11 +382,68 @@ A2_errors a2_SetStateProperty(A2_interface *i, A2_properties p, int v)
 	  case A2_PLOGLEVELS:
 		ii->loglevels = v;
 		return A2_OK;
+	  case A2_PRENDERTHREADS:
+	  {
+		A2_errors res;
+		if(v < 0)
+			return A2_VALUERANGE;
+		if(st->config->flags & A2_SUBSTATE)
+			return A2_NOTIMPLEMENTED;
+		if(st->audio)
+			st->audio->Lock(st->audio);
+		res = a2_SetRenderThreads(st, v);
+		if(st->audio)
+			st->audio->Unlock(st->audio);
+		return res;
+	  }
+	  case A2_PBLOCKPOOL:
+		return a2_GrowPool(st, A2_BLOCKPOOL, &st->config->blockpool, v);
+	  case A2_PEVENTPOOL:
+		return a2_GrowPool(st, A2_EVENTPOOL, &st->config->eventpool, v);
+	  case A2_PVOICEPOOL:
+		return a2_GrowPool(st, A2_VOICEPOOL, &st->config->voicepool, v);
+	  case A2_PBLOCKRESERVE:
+		return a2_SetReserve(st, A2_BLOCKPOOL, v);
+	  case A2_PEVENTRESERVE:
+		return a2_SetReserve(st, A2_EVENTPOOL, v);
+	  case A2_PVOICERESERVE:
+		return a2_SetReserve(st, A2_VOICEPOOL, v);
+	  case A2_PVOICELIMIT:
+		if(v < 0)
+			return A2_VALUERANGE;
+		st->voicelimit = v;
+		return A2_OK;
+	  case A2_PQUALITY:
+		if((v < A2_QLOFI) || (v > A2_QHIFI))
+			return A2_VALUERANGE;
+		st->quality = st->maxquality = v;
+		st->loadlimit = 0;
+		return A2_OK;
+	  case A2_PCPULOADHIGH:
+		if(v < 0)
+			return A2_VALUERANGE;
+		st->loadhigh = v;
+		if(!v)
+		{
+			/* Adaptation disabled; back to full quality */
+			st->quality = st->maxquality;
+			st->loadlimit = 0;
+		}
+		return A2_OK;
+	  case A2_PCPULOADLOW:
+		if(v < 0)
+			return A2_VALUERANGE;
+		st->loadlow = v;
+		return A2_OK;
 
 	  /* A2_PSTATISTICS */
 	  case A2_PACTIVEVOICES:
 	  case A2_PFREEVOICES:
 	  case A2_PTOTALVOICES:
+	  case A2_PSUSPENDEDVOICES:
+	  case A2_PVOICEMEMORY:
+	  case A2_PCURRENTQUALITY:
+	  case A2_PLOADVOICELIMIT:
 		return A2_READONLY;
 	  case A2_PCPULOADAVG:
 	  case A2_PCPULOADMAX:
@@ -318,6 +457,9 @@ A2_errors a2_SetStateProperty(A2_interface *i, A2_properties p, int v)
 	  case A2_PINSTRUCTIONS:
 		st->instructions = 0;
 		return A2_OK;
+	  case A2_PSTOLENVOICES:
+		st->stolenvoices = 0;
+		return A2_OK;
 	  case A2_PAPIMESSAGES:
 		st->apimessages = 0;
 		return A2_OK;
@@ -1,5 +1,5 @@
 /*----------------------------------------------------------------------------.
-        rchm.h - Reference Counting Handle Manager 0.4                        |
+        rchm.h - Reference Counting Handle Manager 0.5                        |
  .----------------------------------------------------------------------------'
  | Copyright 2012-2014 David Olofson <david@olofson.net>
  |
@@ -23,7 +23,8 @@
  |
  |    Features:
  |	* Maps integer handles to pointers + type codes.
- |	* Thread safe and lock-free!
+ |	* Thread safe. Lookups are lock-free, and handle allocation and
+ |	  reference counting are serialized with a spinlock.
  |	* Up to 255 object types.
  |		* Type registry with application provided data for each type;
  |			* Type name	(C string)
@@ -34,7 +35,8 @@
  |
  |    Restrictions:
  |	1) The handle registry can never shrink - only grow.
- |	2) Only one API thread at a time can safely add or remove handles.
+ |	2) Destructors are called without the lock held, and may release other
+ |	   handles, but must not be invoked for the same handle concurrently.
  |	3) A handle can be freed only after it has been ensured that no other
  |	   thread will try to look up or use the handle.
  |	4) If a handle is used as a virtual reference (data pointer managed by
@@ -64,6 +66,16 @@
 #define	RCHM_MAXBLOCKS		4096
 #define	RCHM_BLOCKSIZE_POW2	8	/* 256 handles per block */
 
+/* Test-and-set spinlock for the handle pool and reference counts */
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#	define	RCHM_TAS(l)	_InterlockedExchange((long *)(l), 1)
+#	define	RCHM_CLEAR(l)	_InterlockedExchange((long *)(l), 0)
+#else
+#	define	RCHM_TAS(l)	__sync_lock_test_and_set((l), 1)
+#	define	RCHM_CLEAR(l)	__sync_lock_release(l)
+#endif
+
 #define	RCHM_BLOCKSIZE		(1 << (RCHM_BLOCKSIZE_POW2))
 #define	RCHM_BLOCKSIZE_MASK	((RCHM_BLOCKSIZE) - 1)
 
@@ -109,6 +121,7 @@ typedef struct RCHM_manager
 	RCHM_handleinfo	*blocktab[RCHM_MAXBLOCKS];
 	RCHM_handle	pool;		/* LIFO stack of free handles */
 	RCHM_handle	nexthandle;	/* Next handle to try if pool empty */
+	long		lock;		/* Pool and refcount spinlock */
 
 	/* Table of info about registered types */
 	int		ntypes;
@@ -145,6 +158,22 @@ static inline void *rchm_TypeUserdata(RCHM_manager *m, RCHM_typecode tc)
 }
 
 
+/*
+ * Lock/unlock the handle pool and reference counts. The lock is only held for
+ * a few instructions at a time (except when adding blocks), so we just spin.
+ */
+static inline void rchm_Lock(RCHM_manager *m)
+{
+	while(RCHM_TAS(&m->lock))
+		;
+}
+
+static inline void rchm_Unlock(RCHM_manager *m)
+{
+	RCHM_CLEAR(&m->lock);
+}
+
+
 /* Add a new block of handles, adding the handles to the pool */
 RCHM_errors rchm_AddBlock(RCHM_manager *m, int bi);
 
@@ -180,6 +209,7 @@ static inline RCHM_handle rchm_NewEx(RCHM_manager *m, void *data,
 {
 	RCHM_handle h;
 	RCHM_handleinfo *hi;
+	rchm_Lock(m);
 	if(m->pool >= 0)
 	{
 		/* Recycle one from the pool! */
@@ -192,13 +222,19 @@ static inline RCHM_handle rchm_NewEx(RCHM_manager *m, void *data,
 		/* Grab a new one off the end of the last block! */
 		int bi = m->nexthandle >> RCHM_BLOCKSIZE_POW2;
 		if(bi >= RCHM_MAXBLOCKS)
+		{
+			rchm_Unlock(m);
 			return -RCHM_OOHANDLES;	/* Can't add more blocks! --> */
+		}
 		if(!m->blocktab[bi])
 		{
 			/* Try to add a new block... */
 			RCHM_errors res = rchm_AddBlock(m, bi);
 			if(res)
+			{
+				rchm_Unlock(m);
 				return -res;
+			}
 		}
 		h = m->nexthandle++;
 		hi = &m->blocktab[bi][h & RCHM_BLOCKSIZE_MASK];
@@ -207,6 +243,7 @@ static inline RCHM_handle rchm_NewEx(RCHM_manager *m, void *data,
 	hi->typecode = tc;
 	hi->userbits = ub;
 	hi->refcount = initrc;
+	rchm_Unlock(m);
 	return h;
 }
 
@@ -248,13 +285,20 @@ static inline RCHM_handleinfo *rchm_Get(RCHM_manager *m, RCHM_handle h)
  */
 static inline void *rchm_Grab(RCHM_manager *m, RCHM_handle h, RCHM_typecode tc)
 {
+	void *d;
 	RCHM_handleinfo *hi = rchm_Locate(m, h);
 	if(!hi)
 		return NULL;
+	rchm_Lock(m);
 	if(hi->typecode != tc)
+	{
+		rchm_Unlock(m);
 		return NULL;	/* Handle is free or wrong type! --> */
+	}
 	++hi->refcount;
-	return hi->d.data;
+	d = hi->d.data;
+	rchm_Unlock(m);
+	return d;
 }
 
 
@@ -269,9 +313,14 @@ static inline RCHM_errors rchm_Retain(RCHM_manager *m, RCHM_handle h)
 	RCHM_handleinfo *hi = rchm_Locate(m, h);
 	if(!hi)
 		return RCHM_INVALIDHANDLE;	/* Doesn't exist! */
+	rchm_Lock(m);
 	if(!hi->typecode)
+	{
+		rchm_Unlock(m);
 		return RCHM_FREEHANDLE;		/* Too late? */
+	}
 	++hi->refcount;
+	rchm_Unlock(m);
 	return RCHM_OK;
 }
 
@@ -288,11 +337,16 @@ static inline RCHM_errors rchm_Free(RCHM_manager *m, RCHM_handle h)
 	RCHM_handleinfo *hi = rchm_Locate(m, h);
 	if(!hi)
 		return RCHM_INVALIDHANDLE;	/* Doesn't exist! */
+	rchm_Lock(m);
 	if(!hi->typecode)
+	{
+		rchm_Unlock(m);
 		return RCHM_FREEHANDLE;		/* Already gone! */
+	}
 	hi->typecode = 0;
 	hi->d.prev = m->pool;
 	m->pool = h;
+	rchm_Unlock(m);
 	return RCHM_OK;
 }
 
@@ -318,10 +372,19 @@ static inline int rchm_Release(RCHM_manager *m, RCHM_handle h)
 	RCHM_handleinfo *hi = rchm_Locate(m, h);
 	if(!hi)
 		return -RCHM_INVALIDHANDLE;	/* Doesn't exist! */
+	rchm_Lock(m);
 	if(!hi->typecode)
+	{
+		rchm_Unlock(m);
 		return -RCHM_FREEHANDLE;	/* Already gone! */
+	}
 	if(hi->refcount && --hi->refcount)	/* Don't wrap...! */
-		return hi->refcount;	/* There are still references! */
+	{
+		int rc = hi->refcount;
+		rchm_Unlock(m);
+		return rc;	/* There are still references! */
+	}
+	rchm_Unlock(m);
 	if(hi->typecode < m->ntypes)
 	{
 		/* Try to call a destructor, and see what that says... */
@@ -337,9 +400,11 @@ static inline int rchm_Release(RCHM_manager *m, RCHM_handle h)
 			}
 		}
 	}
+	rchm_Lock(m);
 	hi->typecode = 0;
 	hi->d.prev = m->pool;
 	m->pool = h;
+	rchm_Unlock(m);
 	return 0;	/* Done! */
 }
 
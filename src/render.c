@@ -20,7 +20,8 @@
  * 3. This notice may not be removed or altered from any source distribution.
  */
 
-#include "audiality2.h"
+#include <stdlib.h>
+#include "platform.h"
 
 /*
  * Run 'program' off-line with the specified arguments, rendering at
@@ -175,3 +176,74 @@ A2_handle a2_RenderWave(A2_interface *i,
 
 	return wh;
 }
+
+
+/*---------------------------------------------------------
+	Batch rendering
+---------------------------------------------------------*/
+
+typedef struct A2_renderbatch
+{
+	A2_interface	*interface;
+	A2_renderjob	*jobs;
+	unsigned	count;
+	A2_atomic	nextjob;	/* Next job to grab */
+} A2_renderbatch;
+
+
+static void a2_render_worker(void *data)
+{
+	A2_renderbatch *rb = (A2_renderbatch *)data;
+	while(1)
+	{
+		A2_renderjob *j;
+		unsigned ji = a2_AtomicAdd(&rb->nextjob, 1);
+		if(ji >= rb->count)
+			return;
+		j = rb->jobs + ji;
+		j->result = a2_Render(rb->interface, j->stream, j->samplerate,
+				j->length, j->props, j->program, j->argc,
+				j->argv);
+	}
+}
+
+
+int a2_RenderBatch(A2_interface *i, A2_renderjob *jobs, unsigned count,
+		unsigned threads)
+{
+	A2_renderbatch rb;
+	A2_thread *t = NULL;
+	unsigned j, nthreads = 0;
+	int failed = 0;
+	rb.interface = i;
+	rb.jobs = jobs;
+	rb.count = count;
+	rb.nextjob = 0;
+
+	/* Start worker threads. If we can't get all of them, we make do. */
+	if(threads > count)
+		threads = count;
+	if(threads > 1)
+	{
+		if(!(t = (A2_thread *)malloc(sizeof(A2_thread) *
+				(threads - 1))))
+			return -A2_OOMEMORY;
+		while(nthreads < threads - 1)
+		{
+			if(a2_ThreadStart(&t[nthreads], a2_render_worker, &rb))
+				break;
+			++nthreads;
+		}
+	}
+
+	/* Help out, and then wait for the workers to finish */
+	a2_render_worker(&rb);
+	for(j = 0; j < nthreads; ++j)
+		a2_ThreadJoin(&t[j]);
+	free(t);
+
+	for(j = 0; j < count; ++j)
+		if(jobs[j].result < 0)
+			++failed;
+	return failed;
+}
@@ -54,8 +54,27 @@ static inline A2_dc *dc_cast(A2_unit *u)
 }
 
 
+/* out[s] (+)= v (8:24), with fixed point or float (fp) output buffers */
+static inline void dc_write(int32_t *out, unsigned s, int v, int add, int fp)
+{
+	if(fp)
+	{
+		if(add)
+			((float *)out)[s] += v * A2_FIX2FLOAT;
+		else
+			((float *)out)[s] = v * A2_FIX2FLOAT;
+	}
+	else
+	{
+		if(add)
+			out[s] += v;
+		else
+			out[s] = v;
+	}
+}
+
 static inline void dc_process(A2_unit *u, unsigned offset, unsigned frames,
-		int outputs, int add)
+		int outputs, int add, int fp)
 {
 	A2_dc *dc = dc_cast(u);
 	A2_ramper *v = &dc->value;
@@ -83,10 +102,7 @@ static inline void dc_process(A2_unit *u, unsigned offset, unsigned frames,
 			}
 			for( ; s < e2; ++s)
 				for(o = 0; o < outputs; ++o)
-					if(add)
-						out[o][s] += v->value;
-					else
-						out[o][s] = v->value;
+					dc_write(out[o], s, v->value, add, fp);
 		}
 
 		/* One "transient" sample */
@@ -97,10 +113,7 @@ static inline void dc_process(A2_unit *u, unsigned offset, unsigned frames,
 					(v->target >> 4) * (256 - v->timer)
 					) >> 4;
 			for(o = 0; o < outputs; ++o)
-				if(add)
-					out[o][s] += tv;
-				else
-					out[o][s] = tv;
+				dc_write(out[o], s, tv, add, fp);
 			++s;
 			v->timer = 0;
 			v->value = v->target;	/* Switch! */
@@ -109,10 +122,7 @@ static inline void dc_process(A2_unit *u, unsigned offset, unsigned frames,
 		/* Fill with v->target from switch point to infinity */
 		for( ; s < end; ++s)
 			for(o = 0; o < outputs; ++o)
-				if(add)
-					out[o][s] += v->target;
-				else
-					out[o][s] = v->target;
+				dc_write(out[o], s, v->target, add, fp);
 		break;
 	  }
 	  case A2DCRM_LINEAR:
@@ -122,10 +132,7 @@ static inline void dc_process(A2_unit *u, unsigned offset, unsigned frames,
 		for(s = offset; s < end; ++s)
 		{
 			for(o = 0; o < outputs; ++o)
-				if(add)
-					out[o][s] += v->value;
-				else
-					out[o][s] = v->value;
+				dc_write(out[o], s, v->value, add, fp);
 			a2_RunRamper(v, 1);
 		}
 		break;
@@ -141,25 +148,49 @@ static inline void dc_process(A2_unit *u, unsigned offset, unsigned frames,
 
 static void dc_Process1(A2_unit *u, unsigned offset, unsigned frames)
 {
-	dc_process(u, offset, frames, 1, 0);
+	dc_process(u, offset, frames, 1, 0, 0);
 }
 
 
 static void dc_Process2(A2_unit *u, unsigned offset, unsigned frames)
 {
-	dc_process(u, offset, frames, 2, 0);
+	dc_process(u, offset, frames, 2, 0, 0);
 }
 
 
 static void dc_Process1Add(A2_unit *u, unsigned offset, unsigned frames)
 {
-	dc_process(u, offset, frames, 1, 1);
+	dc_process(u, offset, frames, 1, 1, 0);
 }
 
 
 static void dc_Process2Add(A2_unit *u, unsigned offset, unsigned frames)
 {
-	dc_process(u, offset, frames, 2, 1);
+	dc_process(u, offset, frames, 2, 1, 0);
+}
+
+
+static void dc_Process1F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	dc_process(u, offset, frames, 1, 0, 1);
+}
+
+
+static void dc_Process2F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	dc_process(u, offset, frames, 2, 0, 1);
+}
+
+
+static void dc_Process1AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	dc_process(u, offset, frames, 1, 1, 1);
+}
+
+
+static void dc_Process2AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	dc_process(u, offset, frames, 2, 1, 1);
 }
 
 
@@ -178,7 +209,22 @@ static A2_errors dc_Initialize(A2_unit *u, A2_vmstate *vms,
 	ur[A2DCR_MODE] = A2DCRM_LINEAR << 16;
 
 	/* Install Process callback */
-	if(flags & A2_PROCADD)
+	if(flags & A2_PROCFLOAT)
+	{
+		if(flags & A2_PROCADD)
+			switch(u->noutputs)
+			{
+			  case 1: u->Process = dc_Process1AddF; break;
+			  case 2: u->Process = dc_Process2AddF; break;
+			}
+		else
+			switch(u->noutputs)
+			{
+			  case 1: u->Process = dc_Process1F; break;
+			  case 2: u->Process = dc_Process2F; break;
+			}
+	}
+	else if(flags & A2_PROCADD)
 		switch(u->noutputs)
 		{
 		  case 1: u->Process = dc_Process1Add; break;
@@ -268,7 +314,7 @@ const A2_unitdesc a2_dc_unitdesc =
 {
 	"dc",			/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	regs,			/* registers */
 	NULL,			/* coutputs */
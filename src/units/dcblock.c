@@ -45,6 +45,8 @@ typedef struct A2_dcblock
 	int		f1;	/* Current pitch coefficient */
 	int		d1[A2DCB_MAXCHANNELS];
 	int		d2[A2DCB_MAXCHANNELS];
+	float		fd1[A2DCB_MAXCHANNELS];	/* A2_PROCFLOAT state */
+	float		fd2[A2DCB_MAXCHANNELS];
 } A2_dcblock;
 
 
@@ -93,6 +95,36 @@ static inline void dcb_process(A2_unit *u, unsigned offset, unsigned frames,
 	}
 }
 
+/* Floating point version of dcb_process(), for A2_PROCFLOAT */
+static inline void dcb_processf(A2_unit *u, unsigned offset, unsigned frames,
+		int add, int channels)
+{
+	A2_dcblock *dcb = dcb_cast(u);
+	unsigned s, c, end = offset + frames;
+	float *in[A2DCB_MAXCHANNELS], *out[A2DCB_MAXCHANNELS];
+	float f = dcb->f1 * A2_FIX2FLOAT;
+	for(c = 0; c < channels; ++c)
+	{
+		in[c] = (float *)u->inputs[c];
+		out[c] = (float *)u->outputs[c];
+	}
+	for(s = offset; s < end; ++s)
+	{
+		for(c = 0; c < channels; ++c)
+		{
+			float d1 = dcb->fd1[c];
+			float l = dcb->fd2[c] + f * d1;
+			float h = in[c][s] - l - d1;
+			if(add)
+				out[c][s] += h;
+			else
+				out[c][s] = h;
+			dcb->fd1[c] = f * h + d1;
+			dcb->fd2[c] = l;
+		}
+	}
+}
+
 static void dcb_Process11Add(A2_unit *u, unsigned offset, unsigned frames)
 {
 	dcb_process(u, offset, frames, 1, 1);
@@ -113,6 +145,26 @@ static void dcb_Process22(A2_unit *u, unsigned offset, unsigned frames)
 	dcb_process(u, offset, frames, 0, 2);
 }
 
+static void dcb_Process11AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	dcb_processf(u, offset, frames, 1, 1);
+}
+
+static void dcb_Process11F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	dcb_processf(u, offset, frames, 0, 1);
+}
+
+static void dcb_Process22AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	dcb_processf(u, offset, frames, 1, 2);
+}
+
+static void dcb_Process22F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	dcb_processf(u, offset, frames, 0, 2);
+}
+
 static void dcb_CutOff(A2_unit *u, int v, unsigned start, unsigned dur)
 {
 	A2_dcblock *dcb = dcb_cast(u);
@@ -135,8 +187,26 @@ static A2_errors dcb_Initialize(A2_unit *u, A2_vmstate *vms, void *statedata,
 	dcb_CutOff(u, ur[A2DCBR_CUTOFF], 0, 0);
 
 	for(c = 0; c < u->ninputs; ++c)
+	{
 		dcb->d1[c] = dcb->d2[c] = 0;
-	if(flags & A2_PROCADD)
+		dcb->fd1[c] = dcb->fd2[c] = 0.0f;
+	}
+	if(flags & A2_PROCFLOAT)
+	{
+		if(flags & A2_PROCADD)
+			switch(u->ninputs)
+			{
+			  case 1: u->Process = dcb_Process11AddF; break;
+			  case 2: u->Process = dcb_Process22AddF; break;
+			}
+		else
+			switch(u->ninputs)
+			{
+			  case 1: u->Process = dcb_Process11F; break;
+			  case 2: u->Process = dcb_Process22F; break;
+			}
+	}
+	else if(flags & A2_PROCADD)
 		switch(u->ninputs)
 		{
 		  case 1: u->Process = dcb_Process11Add; break;
@@ -170,7 +240,7 @@ const A2_unitdesc a2_dcblock_unitdesc =
 {
 	"dcblock",		/* name */
 
-	A2_MATCHIO,
+	A2_MATCHIO | A2_SUSPENDABLE | A2_FLOATIO,
 
 	regs,			/* registers */
 	NULL,			/* coutputs */
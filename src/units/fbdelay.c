@@ -52,7 +52,7 @@ typedef struct A2_fbdelay
 	int		lgain;
 	int		rgain;
 
-	/* Delay buffers */
+	/* Delay buffers (float with A2_PROCFLOAT) */
 	int32_t		*lbuf;
 	int32_t		*rbuf;
 	int		bufpos;
@@ -124,6 +124,66 @@ static inline void fbdelay_process(A2_unit *u, unsigned offset,
 		++fbd->bufpos;
 	}
 }
+
+/* Floating point version of fbdelay_process(), for A2_PROCFLOAT */
+static inline void fbdelay_processf(A2_unit *u, unsigned offset,
+		unsigned frames, int add, int stereoin, int stereoout)
+{
+	A2_fbdelay *fbd = fbdelay_cast(u);
+	unsigned s, end = offset + frames;
+	float *b0 = (float *)fbd->lbuf;
+	float *b1 = (float *)fbd->rbuf;
+	float *in0 = (float *)u->inputs[0];
+	float *in1 = (float *)u->inputs[stereoin ? 1 : 0];
+	float *out0 = (float *)u->outputs[0];
+	float *out1;
+	float fbgain = fbd->fbgain * (1.0f / 65536.0f);
+	float lgain = fbd->lgain * (1.0f / 65536.0f);
+	float rgain = fbd->rgain * (1.0f / 65536.0f);
+	float drygain = fbd->drygain * (1.0f / 65536.0f);
+	if(stereoout)
+		out1 = (float *)u->outputs[1];
+	for(s = offset; s < end; ++s)
+	{
+		float i0 = in0[s];
+		float i1 = in1[s];
+
+		/* Feedback delay taps (NOTE: Reverse stereo!) */
+		float o0 = b1[WI(fbd->fbdelay)] * fbgain;
+		float o1 = b0[WI(fbd->fbdelay)] * fbgain;
+
+		/* Inject input + feedback into the buffers */
+		b0[WI(0)] = i0 + o0;
+		b1[WI(0)] = i1 + o1;
+
+		/* Delay taps and dry bypass */
+		o0 += b0[WI(fbd->ldelay)] * lgain + i0 * drygain;
+		o1 += b1[WI(fbd->rdelay)] * rgain + i1 * drygain;
+
+		/* Output */
+		if(add)
+		{
+			if(stereoout)
+			{
+				out0[s] += o0;
+				out1[s] += o1;
+			}
+			else
+				out0[s] += (o0 + o1) * .5f;
+		}
+		else
+		{
+			if(stereoout)
+			{
+				out0[s] = o0;
+				out1[s] = o1;
+			}
+			else
+				out0[s] = (o0 + o1) * .5f;
+		}
+		++fbd->bufpos;
+	}
+}
 #undef	WI
 
 static void fbdelay_Process22Add(A2_unit *u, unsigned offset, unsigned frames)
@@ -166,6 +226,46 @@ static void fbdelay_Process11(A2_unit *u, unsigned offset, unsigned frames)
 	fbdelay_process(u, offset, frames, 0, 0, 0);
 }
 
+static void fbdelay_Process22AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	fbdelay_processf(u, offset, frames, 1, 1, 1);
+}
+
+static void fbdelay_Process22F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	fbdelay_processf(u, offset, frames, 0, 1, 1);
+}
+
+static void fbdelay_Process12AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	fbdelay_processf(u, offset, frames, 1, 0, 1);
+}
+
+static void fbdelay_Process12F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	fbdelay_processf(u, offset, frames, 0, 0, 1);
+}
+
+static void fbdelay_Process21AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	fbdelay_processf(u, offset, frames, 1, 1, 0);
+}
+
+static void fbdelay_Process21F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	fbdelay_processf(u, offset, frames, 0, 1, 0);
+}
+
+static void fbdelay_Process11AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	fbdelay_processf(u, offset, frames, 1, 0, 0);
+}
+
+static void fbdelay_Process11F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	fbdelay_processf(u, offset, frames, 0, 0, 0);
+}
+
 
 static A2_errors fbdelay_Initialize(A2_unit *u, A2_vmstate *vms,
 		void *statedata, unsigned flags)
@@ -199,7 +299,26 @@ static A2_errors fbdelay_Initialize(A2_unit *u, A2_vmstate *vms,
 	fbd->lgain = ur[A2FBDR_LGAIN] = 32768;
 	fbd->rgain = ur[A2FBDR_RGAIN] = 32768;
 
-	if(flags & A2_PROCADD)
+	if(flags & A2_PROCFLOAT)
+	{
+		if(flags & A2_PROCADD)
+			switch(((u->ninputs - 1) << 1) + (u->noutputs - 1))
+			{
+			  case 0: u->Process = fbdelay_Process11AddF; break;
+			  case 1: u->Process = fbdelay_Process12AddF; break;
+			  case 2: u->Process = fbdelay_Process21AddF; break;
+			  case 3: u->Process = fbdelay_Process22AddF; break;
+			}
+		else
+			switch(((u->ninputs - 1) << 1) + (u->noutputs - 1))
+			{
+			  case 0: u->Process = fbdelay_Process11F; break;
+			  case 1: u->Process = fbdelay_Process12F; break;
+			  case 2: u->Process = fbdelay_Process21F; break;
+			  case 3: u->Process = fbdelay_Process22F; break;
+			}
+	}
+	else if(flags & A2_PROCADD)
 		switch(((u->ninputs - 1) << 1) + (u->noutputs - 1))
 		{
 		  case 0: u->Process = fbdelay_Process11Add; break;
@@ -290,7 +409,7 @@ const A2_unitdesc a2_fbdelay_unitdesc =
 {
 	"fbdelay",		/* name */
 
-	0,			/* flags */
+	A2_FLOATIO,		/* flags */
 
 	regs,			/* registers */
 	NULL,			/* coutputs */
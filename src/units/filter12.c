@@ -53,6 +53,8 @@ typedef struct A2_filter12
 	int		f1;	/* Current pitch coefficient */
 	int		d1[A2F12_MAXCHANNELS];
 	int		d2[A2F12_MAXCHANNELS];
+	float		fd1[A2F12_MAXCHANNELS];	/* A2_PROCFLOAT state */
+	float		fd2[A2F12_MAXCHANNELS];
 } A2_filter12;
 
 
@@ -118,6 +120,56 @@ static inline void f12_process(A2_unit *u, unsigned offset, unsigned frames,
 	}
 }
 
+/* Floating point version of f12_process(), for A2_PROCFLOAT */
+static inline void f12_processf(A2_unit *u, unsigned offset, unsigned frames,
+		int add, int channels)
+{
+	A2_filter12 *f12 = f12_cast(u);
+	unsigned s, c, end = offset + frames;
+	float *in[A2F12_MAXCHANNELS], *out[A2F12_MAXCHANNELS];
+	float lp = f12->lp * (1.0f / 256.0f);
+	float bp = f12->bp * (1.0f / 256.0f);
+	float hp = f12->hp * (1.0f / 256.0f);
+	int df;
+	int f0 = f12->f1;
+	for(c = 0; c < channels; ++c)
+	{
+		in[c] = (float *)u->inputs[c];
+		out[c] = (float *)u->outputs[c];
+	}
+	a2_PrepareRamper(&f12->q, frames);
+	a2_PrepareRamper(&f12->cutoff, frames);
+	if(f12->cutoff.delta)
+	{
+		a2_RunRamper(&f12->cutoff, frames);
+		f12->f1 = f12_pitch2coeff(f12);
+		df = (f12->f1 - f0 + ((int)frames >> 1)) / (int)frames;
+	}
+	else
+		df = 0;
+	for(s = offset; s < end; ++s)
+	{
+		float f = f0 * A2_FIX2FLOAT;
+		float q = a2_RamperValueF(&f12->q);
+		for(c = 0; c < channels; ++c)
+		{
+			float d1 = f12->fd1[c];
+			float l = f12->fd2[c] + f * d1;
+			float h = in[c][s] - l - q * d1;
+			float b = f * h + d1;
+			float fout = l * lp + b * bp + h * hp;
+			if(add)
+				out[c][s] += fout;
+			else
+				out[c][s] = fout;
+			f12->fd1[c] = b;
+			f12->fd2[c] = l;
+		}
+		f0 += df;
+		a2_RunRamper(&f12->q, 1);
+	}
+}
+
 static void f12_Process11Add(A2_unit *u, unsigned offset, unsigned frames)
 {
 	f12_process(u, offset, frames, 1, 1);
@@ -138,6 +190,26 @@ static void f12_Process22(A2_unit *u, unsigned offset, unsigned frames)
 	f12_process(u, offset, frames, 0, 2);
 }
 
+static void f12_Process11AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	f12_processf(u, offset, frames, 1, 1);
+}
+
+static void f12_Process11F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	f12_processf(u, offset, frames, 0, 1);
+}
+
+static void f12_Process22AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	f12_processf(u, offset, frames, 1, 2);
+}
+
+static void f12_Process22F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	f12_processf(u, offset, frames, 0, 2);
+}
+
 static void f12_CutOff(A2_unit *u, int v, unsigned start, unsigned dur)
 {
 	A2_filter12 *f12 = f12_cast(u);
@@ -203,8 +275,26 @@ static A2_errors f12_Initialize(A2_unit *u, A2_vmstate *vms, void *statedata,
 	f12->hp = ur[A2F12R_HP] >> 8;
 
 	for(c = 0; c < u->ninputs; ++c)
+	{
 		f12->d1[c] = f12->d2[c] = 0;
-	if(flags & A2_PROCADD)
+		f12->fd1[c] = f12->fd2[c] = 0.0f;
+	}
+	if(flags & A2_PROCFLOAT)
+	{
+		if(flags & A2_PROCADD)
+			switch(u->ninputs)
+			{
+			  case 1: u->Process = f12_Process11AddF; break;
+			  case 2: u->Process = f12_Process22AddF; break;
+			}
+		else
+			switch(u->ninputs)
+			{
+			  case 1: u->Process = f12_Process11F; break;
+			  case 2: u->Process = f12_Process22F; break;
+			}
+	}
+	else if(flags & A2_PROCADD)
 		switch(u->ninputs)
 		{
 		  case 1: u->Process = f12_Process11Add; break;
@@ -242,7 +332,7 @@ const A2_unitdesc a2_filter12_unitdesc =
 {
 	"filter12",		/* name */
 
-	A2_MATCHIO,
+	A2_MATCHIO | A2_SUSPENDABLE | A2_FLOATIO,
 
 	regs,			/* registers */
 	NULL,			/* coutputs */
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include "fm.h"
+#include "internals.h"
 
 #define	A2FM_MAX_OPERATORS	4
 
@@ -33,22 +34,12 @@
 #define	A2FM_WAVEPERIOD_MASK	(A2FM_WAVEPERIOD - 1)
 #define	A2FM_WAVEPAD		1
 
-#ifdef A2_HIFI
-#  define	A2FM1_OVERSAMPLE_BITS	1
-#  define	A2FM2_OVERSAMPLE_BITS	2
-#  define	A2FM3_OVERSAMPLE_BITS	3
-#  define	A2FM4_OVERSAMPLE_BITS	4
-#elif (defined A2_LOFI)
-#  define	A2FM1_OVERSAMPLE_BITS	0
-#  define	A2FM2_OVERSAMPLE_BITS	0
-#  define	A2FM3_OVERSAMPLE_BITS	0
-#  define	A2FM4_OVERSAMPLE_BITS	0
-#else
-#  define	A2FM1_OVERSAMPLE_BITS	0
-#  define	A2FM2_OVERSAMPLE_BITS	1
-#  define	A2FM3_OVERSAMPLE_BITS	2
-#  define	A2FM4_OVERSAMPLE_BITS	2
-#endif
+/*
+ * Oversampling (log2) by quality level (A2_quality), for structures of N
+ * operators. A2_QLOFI does no oversampling.
+ */
+#define	A2FM_HIFI_OSBITS(n)	((n) < 3 ? (n) - 1 : 2)
+#define	A2FM_STANDARD_OSBITS(n)	((n) < 3 ? 0 : 1)
 
 /* Control register frame enumeration */
 typedef enum A2FM_cregisters
@@ -97,6 +88,9 @@ typedef struct A2_fm
 	int		basepitch;	/* Pitch of middle C (1.0/octave) */
 	int		*transpose;
 
+	unsigned	*quality;	/* Oversampling etc (A2_quality) */
+	int		fp;		/* Float output (A2_PROCFLOAT) */
+
 	/* Oscillators/operators */
 	unsigned	nops;
 	A2_fmosc	op[A2FM_MAX_OPERATORS];
@@ -108,16 +102,15 @@ static int sinerc = 0;
 static int16_t *sine = NULL;
 
 
-static inline int32_t fm_osc(A2_fmosc *o, int mod)
+static inline int32_t fm_osc(A2_fmosc *o, int mod, int lerp)
 {
 	int fb = (int64_t)(o->last) * o->fb.value >> 17;
 	unsigned ph = (o->phase + mod + fb) >> (24 - 8 - A2FM_WAVEPERIOD_BITS);
-#ifdef A2_LOFI
-	o->last = sine[(ph >> 8) & A2FM_WAVEPERIOD_MASK];
-#else
-	/* We don't go beyond linear here, so "standard" == A2_HIFI. */
-	o->last = a2_Lerp(sine, ph & ((A2FM_WAVEPERIOD << 8) - 1));
-#endif
+	/* We don't go beyond linear here, so "standard" == A2_QHIFI. */
+	if(lerp)
+		o->last = a2_Lerp(sine, ph & ((A2FM_WAVEPERIOD << 8) - 1));
+	else
+		o->last = sine[(ph >> 8) & A2FM_WAVEPERIOD_MASK];
 	return (int64_t)(o->last) * o->a.value >> 16;
 }
 
@@ -147,16 +140,17 @@ static inline A2_fm *fm_cast(A2_unit *u)
 
 
 /* Calculate one (sub)sample; chain and parallel structures. */
-static inline int fm_sample(A2_fm *fm, int osbits, int operators, int parallel)
+static inline int fm_sample(A2_fm *fm, int osbits, int operators, int parallel,
+		int lerp)
 {
 	int i;
 	int v = 0;
 	for(i = operators - 1; i >= 0; --i)
 	{
 		if(i && parallel)
-			v += fm_osc(&fm->op[i], 0);
+			v += fm_osc(&fm->op[i], 0, lerp);
 		else
-			v = fm_osc(&fm->op[i], v);
+			v = fm_osc(&fm->op[i], v, lerp);
 		fm->op[i].phase += fm->op[i].dphase >> osbits;
 	}
 	return v;
@@ -167,20 +161,22 @@ static inline int fm_sample(A2_fm *fm, int osbits, int operators, int parallel)
  *
  * NOTE: This one only works for 2 and 4 operators!
  */
-static inline int fm_sample_rm(A2_fm *fm, int osbits, int operators)
+static inline int fm_sample_rm(A2_fm *fm, int osbits, int operators,
+		int lerp)
 {
 	int i;
 	int v[2];
 	if(operators == 2)
 		for(i = 0; i < 2; ++i)
 		{
-			v[i] = fm_osc(&fm->op[i], 0);
+			v[i] = fm_osc(&fm->op[i], 0, lerp);
 			fm->op[i].phase += fm->op[i].dphase >> osbits;
 		}
 	else if(operators == 4)
 		for(i = 0; i < 2; ++i)
 		{
-			v[i] = fm_osc(&fm->op[i], fm_osc(&fm->op[i + 2], 0));
+			v[i] = fm_osc(&fm->op[i], fm_osc(&fm->op[i + 2], 0, lerp),
+					lerp);
 			fm->op[i].phase += fm->op[i].dphase >> osbits;
 			fm->op[i + 2].phase += fm->op[i + 2].dphase >> osbits;
 		}
@@ -192,7 +188,8 @@ static inline int fm_sample_rm(A2_fm *fm, int osbits, int operators)
 }
 
 static inline void fm_process(A2_unit *u, unsigned offset, unsigned frames,
-		int osbits, int operators, int parallel, int add)
+		int osbits, int operators, int parallel, int add, int lerp,
+		int fp)
 {
 	A2_fm *fm = fm_cast(u);
 	int i;
@@ -214,10 +211,11 @@ static inline void fm_process(A2_unit *u, unsigned offset, unsigned frames,
 		int vsum = 0;
 		for(os = 0; os < oversample; ++os)
 			if(parallel == 2)
-				vsum += fm_sample_rm(fm, osbits, operators);
+				vsum += fm_sample_rm(fm, osbits, operators,
+						lerp);
 			else
 				vsum += fm_sample(fm, osbits, operators,
-						parallel);
+						parallel, lerp);
 		for(i = 0; i < operators; ++i)
 		{
 			a2_RunRamper(&fm->op[i].a, 1);
@@ -225,99 +223,143 @@ static inline void fm_process(A2_unit *u, unsigned offset, unsigned frames,
 			/* Fix the rounding error buildup! */
 			fm->op[i].phase += fm->op[i].dphase & (oversample - 1);
 		}
-		if(add)
+		if(fp)
+		{
+			float *fout = (float *)out;
+			if(add)
+				fout[s] += (vsum >> osbits) * A2_FIX2FLOAT;
+			else
+				fout[s] = (vsum >> osbits) * A2_FIX2FLOAT;
+		}
+		else if(add)
 			out[s] += vsum >> osbits;
 		else
 			out[s] = vsum >> osbits;
 	}
 }
 
+/*
+ * Pick oversampling and interpolation for the current quality level, once per
+ * fragment. 'osops' is the number of operators to scale oversampling for.
+ */
+static inline void fm_process_qf(A2_unit *u, unsigned offset, unsigned frames,
+		int osops, int operators, int parallel, int add, int fp)
+{
+	switch(*fm_cast(u)->quality)
+	{
+	  case A2_QLOFI:
+		fm_process(u, offset, frames, 0, operators, parallel, add, 0,
+				fp);
+		break;
+	  case A2_QSTANDARD:
+		fm_process(u, offset, frames, A2FM_STANDARD_OSBITS(osops),
+				operators, parallel, add, 1, fp);
+		break;
+	  default:
+		fm_process(u, offset, frames, A2FM_HIFI_OSBITS(osops),
+				operators, parallel, add, 1, fp);
+		break;
+	}
+}
+
+/* ...and the output format; fixed point or float (A2_PROCFLOAT) */
+static inline void fm_process_q(A2_unit *u, unsigned offset, unsigned frames,
+		int osops, int operators, int parallel, int add)
+{
+	if(fm_cast(u)->fp)
+		fm_process_qf(u, offset, frames, osops, operators, parallel,
+				add, 1);
+	else
+		fm_process_qf(u, offset, frames, osops, operators, parallel,
+				add, 0);
+}
+
 /* fm1 */
 static void fm1_ProcessAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM1_OVERSAMPLE_BITS, 1, 0, 1);
+	fm_process_q(u, offset, frames, 1, 1, 0, 1);
 }
 
 static void fm1_Process(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM1_OVERSAMPLE_BITS, 1, 0, 0);
+	fm_process_q(u, offset, frames, 1, 1, 0, 0);
 }
 
 /* fm2 */
 static void fm2_ProcessAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM2_OVERSAMPLE_BITS, 2, 0, 1);
+	fm_process_q(u, offset, frames, 2, 2, 0, 1);
 }
 
 static void fm2_Process(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM2_OVERSAMPLE_BITS, 2, 0, 0);
+	fm_process_q(u, offset, frames, 2, 2, 0, 0);
 }
 
 /* fm3 */
 static void fm3_ProcessAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM3_OVERSAMPLE_BITS, 3, 0, 1);
+	fm_process_q(u, offset, frames, 3, 3, 0, 1);
 }
 
 static void fm3_Process(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM3_OVERSAMPLE_BITS, 3, 0, 0);
+	fm_process_q(u, offset, frames, 3, 3, 0, 0);
 }
 
 /* fm4 */
 static void fm4_ProcessAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM4_OVERSAMPLE_BITS, 4, 0, 1);
+	fm_process_q(u, offset, frames, 4, 4, 0, 1);
 }
 
 static void fm4_Process(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM4_OVERSAMPLE_BITS, 4, 0, 0);
+	fm_process_q(u, offset, frames, 4, 4, 0, 0);
 }
 
 /* fm3p */
 static void fm3p_ProcessAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM3_OVERSAMPLE_BITS, 3, 1, 1);
+	fm_process_q(u, offset, frames, 3, 3, 1, 1);
 }
 
 static void fm3p_Process(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM3_OVERSAMPLE_BITS, 3, 1, 0);
+	fm_process_q(u, offset, frames, 3, 3, 1, 0);
 }
 
 /* fm4p */
 static void fm4p_ProcessAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM3_OVERSAMPLE_BITS, 4, 1, 1);
+	fm_process_q(u, offset, frames, 3, 4, 1, 1);
 }
 
 static void fm4p_Process(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM3_OVERSAMPLE_BITS, 4, 1, 0);
+	fm_process_q(u, offset, frames, 3, 4, 1, 0);
 }
 
 /* fm2r */
 static void fm2r_ProcessAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM2_OVERSAMPLE_BITS, 2, 2, 1);
+	fm_process_q(u, offset, frames, 2, 2, 2, 1);
 }
 
 static void fm2r_Process(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM2_OVERSAMPLE_BITS, 2, 2, 0);
+	fm_process_q(u, offset, frames, 2, 2, 2, 0);
 }
 
 /* fm4r */
 static void fm4r_ProcessAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM3_OVERSAMPLE_BITS, 4, 2, 1);
+	fm_process_q(u, offset, frames, 3, 4, 2, 1);
 }
 
 static void fm4r_Process(A2_unit *u, unsigned offset, unsigned frames)
 {
-	fm_process(u, offset, frames, A2FM3_OVERSAMPLE_BITS, 4, 2, 0);
+	fm_process_q(u, offset, frames, 3, 4, 2, 0);
 }
 
 
@@ -353,6 +395,8 @@ static A2_errors fm_Initialize(A2_unit *u, A2_vmstate *vms, void *statedata,
 	/* Internal state initialization */
 	fm->basepitch = cfg->basepitch;
 	fm->transpose = vms->r + R_TRANSPOSE;
+	fm->quality = &((A2_interface_i *)cfg->interface)->state->quality;
+	fm->fp = (flags & A2_PROCFLOAT) ? 1 : 0;
 
 	for(i = 0; i < fm->nops; ++i)
 	{
@@ -533,7 +577,7 @@ const A2_unitdesc a2_fm1_unitdesc =
 {
 	"fm1",			/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	fm1_regs,		/* registers */
 	NULL,			/* coutputs */
@@ -580,7 +624,7 @@ const A2_unitdesc a2_fm2_unitdesc =
 {
 	"fm2",			/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	fm2_regs,		/* registers */
 	NULL,			/* coutputs */
@@ -632,7 +676,7 @@ const A2_unitdesc a2_fm3_unitdesc =
 {
 	"fm3",			/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	fm3_regs,		/* registers */
 	NULL,			/* coutputs */
@@ -689,7 +733,7 @@ const A2_unitdesc a2_fm4_unitdesc =
 {
 	"fm4",			/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	fm4_regs,		/* registers */
 	NULL,			/* coutputs */
@@ -720,7 +764,7 @@ const A2_unitdesc a2_fm3p_unitdesc =
 {
 	"fm3p",			/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	fm3_regs,		/* registers */
 	NULL,			/* coutputs */
@@ -753,7 +797,7 @@ const A2_unitdesc a2_fm4p_unitdesc =
 {
 	"fm4p",			/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	fm4_regs,		/* registers */
 	NULL,			/* coutputs */
@@ -784,7 +828,7 @@ const A2_unitdesc a2_fm2r_unitdesc =
 {
 	"fm2r",			/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	fm2_regs,		/* registers */
 	NULL,			/* coutputs */
@@ -815,7 +859,7 @@ const A2_unitdesc a2_fm4r_unitdesc =
 {
 	"fm4r",			/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	fm4_regs,		/* registers */
 	NULL,			/* coutputs */
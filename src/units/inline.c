@@ -27,8 +27,8 @@ static A2_errors a2i_Initialize(A2_unit *u, A2_vmstate *vms, void *statedata,
 		unsigned flags)
 {
 	A2_inline *il = a2_inline_cast(u);
-	il->state = (A2_state *)statedata;
 	il->voice = a2_voice_from_vms(vms);
+	il->state = a2_VoiceState((A2_state *)statedata, il->voice);
 	il->voice->noutputs = u->noutputs;
 	il->voice->outputs = u->outputs;
 	if(flags & A2_PROCADD)
@@ -50,7 +50,7 @@ const A2_unitdesc a2_inline_unitdesc =
 {
 	"inline",		/* name */
 
-	0,			/* flags */
+	A2_FLOATIO,		/* flags */
 
 	NULL,			/* registers */
 	NULL,			/* coutputs */
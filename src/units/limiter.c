@@ -21,24 +21,52 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "limiter.h"
+#include "internals.h"
 
 #define	A2L_MAXCHANNELS	2
 
+/* Maximum lookahead delay (ms) */
+#define	A2L_MAXLOOKAHEAD	10
+
 /* Control register frame enumeration */
 typedef enum A2L_cregisters
 {
 	A2LR_RELEASE = 0,
-	A2LR_THRESHOLD
+	A2LR_THRESHOLD,
+	A2LR_LOOKAHEAD
 } A2L_cregisters;
 
 typedef struct A2_limiter
 {
 	A2_unit		header;
+	A2_state	*state;
 	int		samplerate;
 	unsigned	threshold;	/* Reaction threshold */
 	int		release;	/* Release "speed" */
 	unsigned	peak;		/* Filtered peak value */
+	float		fpeak;		/* Filtered peak (A2_PROCFLOAT) */
+
+	/*
+	 * Lookahead state. The buffers are allocated from the realtime memory
+	 * manager when lookahead is first enabled, and hold floats with
+	 * A2_PROCFLOAT.
+	 */
+	unsigned	lookahead;	/* Lookahead delay (frames); 0 if off */
+	unsigned	lamask;		/* Buffer size - 1 */
+	unsigned	lapos;		/* Buffer write position */
+	int32_t		*ladelay[A2L_MAXCHANNELS];	/* Delay lines */
+	uint32_t	*lawin;		/* Window peaks, for the average */
+	uint64_t	lasum;		/* Sum of 'lawin' (24 bit scale) */
+	uint64_t	lainv;		/* (1 << 32) / lookahead, rounded up */
+	double		flasum;		/* Sum of 'lawin' (A2_PROCFLOAT) */
+	uint32_t	*dqpeak;	/* Sliding window max deque; peaks... */
+	uint32_t	*dqtime;	/* ...and their timestamps */
+	unsigned	dqhead;		/* Deque head index */
+	unsigned	dqcount;	/* Number of deque entries */
+	unsigned	latime;		/* Deque timestamp of next frame */
 } A2_limiter;
 
 
@@ -48,47 +76,41 @@ static inline A2_limiter *limiter_cast(A2_unit *u)
 }
 
 
-static inline void limiter_process11(A2_unit *u, unsigned offset,
-		unsigned frames, int add)
+/*
+ * Calculate the 16:16 gain for filtered peak 'p'. The dividend fits in 32 bits,
+ * so there is no need for a 64 bit division here.
+ */
+static inline int limiter_gain(unsigned p)
 {
-	A2_limiter *lim = limiter_cast(u);
-	unsigned s, end = offset + frames;
-	int32_t *in = u->inputs[0];
-	int32_t *out = u->outputs[0];
-	for(s = offset; s < end; ++s)
-	{
-		int gain;
-		unsigned p = (unsigned)abs(in[s]);
-		if(p > lim->peak)
-			lim->peak = p;
-		else
-		{
-			lim->peak -= lim->release;
-			if(lim->peak < lim->threshold)
-				lim->peak = lim->threshold;
-			p = lim->peak;
-		}
-		gain = (32767LL << 16) / ((p + 511) >> 9);
-		if(add)
-			out[s] += (int64_t)in[s] * gain >> 16;
-		else
-			out[s] = (int64_t)in[s] * gain >> 16;
-	}
+	return (uint32_t)(32767 << 16) / ((p + 511) >> 9);
 }
 
-static void limiter_Process11Add(A2_unit *u, unsigned offset, unsigned frames)
+/* Update and return the filtered peak value */
+static inline unsigned limiter_peak(unsigned *peak, unsigned p,
+		unsigned release, unsigned threshold)
 {
-	limiter_process11(u, offset, frames, 1);
+	if(p > *peak)
+		return *peak = p;
+	*peak -= release;
+	if(*peak < threshold)
+		*peak = threshold;
+	return *peak;
 }
 
-static void limiter_Process11(A2_unit *u, unsigned offset, unsigned frames)
+/* Update and return the filtered peak value for A2_PROCFLOAT processing */
+static inline float limiter_peakf(float *peak, float p, float release,
+		float threshold)
 {
-	limiter_process11(u, offset, frames, 0);
+	if(p > *peak)
+		return *peak = p;
+	*peak -= release;
+	if(*peak < threshold)
+		*peak = threshold;
+	return *peak;
 }
 
-
 /*
- * Smart Stereo version.
+ * Smart Stereo peak detection.
  *
  * This algorithm takes both channels in account in a way
  * that reduces the effect of the center appearing to have
@@ -103,72 +125,364 @@ static void limiter_Process11(A2_unit *u, unsigned offset, unsigned frames)
  * relatively centered), this limiter gets an extra 3 dB
  * compared to a limiter that checks (L+R).
  */
-static inline void limiter_process22(A2_unit *u, unsigned offset,
-		unsigned frames, int add)
+static inline unsigned limiter_detect(int32_t *in0, int32_t *in1, unsigned s,
+		int channels)
+{
+	int lp, rp;
+	unsigned p;
+	if(channels == 1)
+		return (unsigned)abs(in0[s]);
+	lp = abs(in0[s]);
+	rp = abs(in1[s]);
+	p = (unsigned)(lp > rp ? lp : rp);
+	return p + ((p - abs(lp - rp)) >> 1);
+}
+
+static inline float limiter_detectf(float *in0, float *in1, unsigned s,
+		int channels)
+{
+	float lp, rp, p;
+	if(channels == 1)
+		return fabsf(in0[s]);
+	lp = fabsf(in0[s]);
+	rp = fabsf(in1[s]);
+	p = lp > rp ? lp : rp;
+	return p + (p - fabsf(lp - rp)) * .5f;
+}
+
+static inline void limiter_write(int32_t *out, unsigned s, int32_t v, int gain,
+		int add)
+{
+	if(add)
+		out[s] += (int64_t)v * gain >> 16;
+	else
+		out[s] = (int64_t)v * gain >> 16;
+}
+
+static inline void limiter_writef(float *out, unsigned s, float v, float gain,
+		int add)
+{
+	if(add)
+		out[s] += v * gain;
+	else
+		out[s] = v * gain;
+}
+
+
+/*
+ * The gain only needs to be recalculated when the filtered peak changes, which
+ * it does not while the signal stays below the threshold.
+ */
+static inline void limiter_process(A2_unit *u, unsigned offset,
+		unsigned frames, int add, int channels)
 {
 	A2_limiter *lim = limiter_cast(u);
 	unsigned s, end = offset + frames;
 	int32_t *in0 = u->inputs[0];
-	int32_t *in1 = u->inputs[1];
+	int32_t *in1 = u->inputs[channels - 1];
 	int32_t *out0 = u->outputs[0];
-	int32_t *out1 = u->outputs[1];
+	int32_t *out1 = u->outputs[channels - 1];
+	unsigned peak = lim->peak;
+	unsigned release = lim->release;
+	unsigned threshold = lim->threshold;
+	unsigned gpeak = 0;	/* Peak value 'gain' was calculated for */
+	int gain = 0;
 	for(s = offset; s < end; ++s)
 	{
-		int gain;
-		int lp = abs(in0[s]);
-		int rp = abs(in1[s]);
-		unsigned p = (unsigned)(lp > rp ? lp : rp);
-		p = p + ((p - abs(lp - rp)) >> 1);
-		if(p > lim->peak)
-			lim->peak = p;
-		else
-		{
-			lim->peak -= lim->release;
-			if(lim->peak < lim->threshold)
-				lim->peak = lim->threshold;
-			p = lim->peak;
-		}
-		gain = (32767LL << 16) / ((p + 511) >> 9);
-		if(add)
+		unsigned p = limiter_peak(&peak, limiter_detect(in0, in1, s,
+				channels), release, threshold);
+		if(p != gpeak)
+			gain = limiter_gain(gpeak = p);
+		limiter_write(out0, s, in0[s], gain, add);
+		if(channels == 2)
+			limiter_write(out1, s, in1[s], gain, add);
+	}
+	lim->peak = peak;
+}
+
+static inline void limiter_processf(A2_unit *u, unsigned offset,
+		unsigned frames, int add, int channels)
+{
+	A2_limiter *lim = limiter_cast(u);
+	unsigned s, end = offset + frames;
+	float *in0 = (float *)u->inputs[0];
+	float *in1 = (float *)u->inputs[channels - 1];
+	float *out0 = (float *)u->outputs[0];
+	float *out1 = (float *)u->outputs[channels - 1];
+	float peak = lim->fpeak;
+	float release = lim->release * A2_FIX2FLOAT;
+	float threshold = lim->threshold * A2_FIX2FLOAT;
+	float gpeak = 0.0f;
+	float gain = 0.0f;
+	for(s = offset; s < end; ++s)
+	{
+		float p = limiter_peakf(&peak, limiter_detectf(in0, in1, s,
+				channels), release, threshold);
+		if(p != gpeak)
+			gain = 1.0f / (gpeak = p);
+		limiter_writef(out0, s, in0[s], gain, add);
+		if(channels == 2)
+			limiter_writef(out1, s, in1[s], gain, add);
+	}
+	lim->fpeak = peak;
+}
+
+
+/*
+ * Lookahead mode
+ *
+ * The input is delayed by 'lookahead' frames, while the detected peaks go
+ * through a sliding window max filter covering the delay line, followed by a
+ * moving average of the same length. The result reaches the level of any peak
+ * by the time that peak leaves the delay line, so the gain is faded down over
+ * the lookahead time, instead of being switched down instantly.
+ */
+
+/* Add a peak to the sliding window, and return the maximum of the window */
+static inline uint32_t limiter_window(A2_limiter *lim, uint32_t p)
+{
+	unsigned m = lim->lamask;
+	unsigned t = lim->latime++;
+	unsigned i;
+	while(lim->dqcount && (lim->dqpeak[(lim->dqhead + lim->dqcount - 1) &
+			m] <= p))
+		--lim->dqcount;
+	i = (lim->dqhead + lim->dqcount++) & m;
+	lim->dqpeak[i] = p;
+	lim->dqtime[i] = t;
+	if(t - lim->dqtime[lim->dqhead] > lim->lookahead)
+	{
+		lim->dqhead = (lim->dqhead + 1) & m;
+		--lim->dqcount;
+	}
+	return lim->dqpeak[lim->dqhead];
+}
+
+static inline float limiter_windowf(A2_limiter *lim, float p)
+{
+	unsigned m = lim->lamask;
+	unsigned t = lim->latime++;
+	unsigned i;
+	float *dqpeak = (float *)lim->dqpeak;
+	while(lim->dqcount && (dqpeak[(lim->dqhead + lim->dqcount - 1) & m] <=
+			p))
+		--lim->dqcount;
+	i = (lim->dqhead + lim->dqcount++) & m;
+	dqpeak[i] = p;
+	lim->dqtime[i] = t;
+	if(t - lim->dqtime[lim->dqhead] > lim->lookahead)
+	{
+		lim->dqhead = (lim->dqhead + 1) & m;
+		--lim->dqcount;
+	}
+	return dqpeak[lim->dqhead];
+}
+
+static inline void limiter_process_la(A2_unit *u, unsigned offset,
+		unsigned frames, int add, int channels)
+{
+	A2_limiter *lim = limiter_cast(u);
+	unsigned s, end = offset + frames;
+	unsigned m = lim->lamask;
+	unsigned la = lim->lookahead;
+	unsigned pos = lim->lapos;
+	uint64_t sum = lim->lasum;
+	uint64_t inv = lim->lainv;
+	uint32_t *win = lim->lawin;
+	int32_t *d0 = lim->ladelay[0];
+	int32_t *d1 = lim->ladelay[channels - 1];
+	int32_t *in0 = u->inputs[0];
+	int32_t *in1 = u->inputs[channels - 1];
+	int32_t *out0 = u->outputs[0];
+	int32_t *out1 = u->outputs[channels - 1];
+	unsigned peak = lim->peak;
+	unsigned release = lim->release;
+	unsigned threshold = lim->threshold;
+	unsigned gpeak = 0;
+	int gain = 0;
+	for(s = offset; s < end; ++s)
+	{
+		unsigned dpos = (pos - la) & m;
+		int32_t i0 = in0[s];
+		int32_t i1 = in1[s];
+		uint32_t w = limiter_window(lim, limiter_detect(in0, in1, s,
+				channels)) >> 8;
+		unsigned p;
+		sum += w;
+		sum -= win[dpos];
+		win[pos] = w;
+		p = limiter_peak(&peak, (uint32_t)(sum * inv >> 32) << 8,
+				release, threshold);
+		if(p != gpeak)
+			gain = limiter_gain(gpeak = p);
+		/* The outputs may share buffers with the inputs! */
+		limiter_write(out0, s, d0[dpos], gain, add);
+		d0[pos] = i0;
+		if(channels == 2)
 		{
-			out0[s] += (int64_t)in0[s] * gain >> 16;
-			out1[s] += (int64_t)in1[s] * gain >> 16;
+			limiter_write(out1, s, d1[dpos], gain, add);
+			d1[pos] = i1;
 		}
-		else
+		pos = (pos + 1) & m;
+	}
+	lim->lapos = pos;
+	lim->lasum = sum;
+	lim->peak = peak;
+}
+
+static inline void limiter_process_laf(A2_unit *u, unsigned offset,
+		unsigned frames, int add, int channels)
+{
+	A2_limiter *lim = limiter_cast(u);
+	unsigned s, end = offset + frames;
+	unsigned m = lim->lamask;
+	unsigned la = lim->lookahead;
+	unsigned pos = lim->lapos;
+	double sum = lim->flasum;
+	double scale = 1.0 / la;
+	float *win = (float *)lim->lawin;
+	float *d0 = (float *)lim->ladelay[0];
+	float *d1 = (float *)lim->ladelay[channels - 1];
+	float *in0 = (float *)u->inputs[0];
+	float *in1 = (float *)u->inputs[channels - 1];
+	float *out0 = (float *)u->outputs[0];
+	float *out1 = (float *)u->outputs[channels - 1];
+	float peak = lim->fpeak;
+	float release = lim->release * A2_FIX2FLOAT;
+	float threshold = lim->threshold * A2_FIX2FLOAT;
+	float gpeak = 0.0f;
+	float gain = 0.0f;
+	for(s = offset; s < end; ++s)
+	{
+		unsigned dpos = (pos - la) & m;
+		float i0 = in0[s];
+		float i1 = in1[s];
+		float w = limiter_windowf(lim, limiter_detectf(in0, in1, s,
+				channels));
+		float p;
+		sum += (double)w - win[dpos];
+		win[pos] = w;
+		p = limiter_peakf(&peak, sum * scale, release, threshold);
+		if(p != gpeak)
+			gain = 1.0f / (gpeak = p);
+		limiter_writef(out0, s, d0[dpos], gain, add);
+		d0[pos] = i0;
+		if(channels == 2)
 		{
-			out0[s] = (int64_t)in0[s] * gain >> 16;
-			out1[s] = (int64_t)in1[s] * gain >> 16;
+			limiter_writef(out1, s, d1[dpos], gain, add);
+			d1[pos] = i1;
 		}
+		pos = (pos + 1) & m;
 	}
+	lim->lapos = pos;
+	lim->flasum = sum;
+	lim->fpeak = peak;
+}
+
+
+static void limiter_Process11Add(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(limiter_cast(u)->lookahead)
+		limiter_process_la(u, offset, frames, 1, 1);
+	else
+		limiter_process(u, offset, frames, 1, 1);
+}
+
+static void limiter_Process11(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(limiter_cast(u)->lookahead)
+		limiter_process_la(u, offset, frames, 0, 1);
+	else
+		limiter_process(u, offset, frames, 0, 1);
 }
 
 static void limiter_Process22Add(A2_unit *u, unsigned offset, unsigned frames)
 {
-	limiter_process22(u, offset, frames, 1);
+	if(limiter_cast(u)->lookahead)
+		limiter_process_la(u, offset, frames, 1, 2);
+	else
+		limiter_process(u, offset, frames, 1, 2);
 }
 
 static void limiter_Process22(A2_unit *u, unsigned offset, unsigned frames)
 {
-	limiter_process22(u, offset, frames, 0);
+	if(limiter_cast(u)->lookahead)
+		limiter_process_la(u, offset, frames, 0, 2);
+	else
+		limiter_process(u, offset, frames, 0, 2);
+}
+
+
+static void limiter_Process11AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(limiter_cast(u)->lookahead)
+		limiter_process_laf(u, offset, frames, 1, 1);
+	else
+		limiter_processf(u, offset, frames, 1, 1);
+}
+
+static void limiter_Process11F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(limiter_cast(u)->lookahead)
+		limiter_process_laf(u, offset, frames, 0, 1);
+	else
+		limiter_processf(u, offset, frames, 0, 1);
+}
+
+static void limiter_Process22AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(limiter_cast(u)->lookahead)
+		limiter_process_laf(u, offset, frames, 1, 2);
+	else
+		limiter_processf(u, offset, frames, 1, 2);
+}
+
+static void limiter_Process22F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(limiter_cast(u)->lookahead)
+		limiter_process_laf(u, offset, frames, 0, 2);
+	else
+		limiter_processf(u, offset, frames, 0, 2);
 }
 
 
 static A2_errors limiter_Initialize(A2_unit *u, A2_vmstate *vms,
 		void *statedata, unsigned flags)
 {
-	A2_config *cfg = (A2_config *)statedata;
+	A2_state *st = (A2_state *)statedata;
+	A2_config *cfg = st->config;
 	A2_limiter *lim = limiter_cast(u);
 	int *ur = u->registers;
 
 	ur[A2LR_RELEASE] = 64 << 16;
 	ur[A2LR_THRESHOLD] = 1 << 16;
+	ur[A2LR_LOOKAHEAD] = 0;
 
+	lim->state = st;
 	lim->samplerate = cfg->samplerate;
 	lim->release = (ur[A2LR_RELEASE] << 8) / cfg->samplerate;
 	lim->threshold = (unsigned)(ur[A2LR_THRESHOLD] << 8);
 	lim->peak = 32768 << 8;
+	lim->fpeak = 1.0f;
+	lim->lookahead = 0;
+	lim->lawin = NULL;
 
-	if(flags & A2_PROCADD)
+	if(flags & A2_PROCFLOAT)
+	{
+		if(flags & A2_PROCADD)
+			switch(u->ninputs)
+			{
+			  case 1: u->Process = limiter_Process11AddF; break;
+			  case 2: u->Process = limiter_Process22AddF; break;
+			}
+		else
+			switch(u->ninputs)
+			{
+			  case 1: u->Process = limiter_Process11F; break;
+			  case 2: u->Process = limiter_Process22F; break;
+			}
+	}
+	else if(flags & A2_PROCADD)
 		switch(u->ninputs)
 		{
 		  case 1: u->Process = limiter_Process11Add; break;
@@ -199,10 +513,66 @@ static void limiter_Threshold(A2_unit *u, int v, unsigned start, unsigned dur)
 		lim->threshold = 256;
 }
 
+static void limiter_Lookahead(A2_unit *u, int v, unsigned start, unsigned dur)
+{
+	A2_limiter *lim = limiter_cast(u);
+	unsigned size, la = v > 0 ? (int64_t)v * lim->samplerate / 65536000 : 0;
+	if(la && !lim->lawin)
+	{
+		/* Buffers for A2L_MAXLOOKAHEAD ms, rounded up to 2^n frames */
+		for(size = 1; size <= lim->samplerate * A2L_MAXLOOKAHEAD / 1000;
+				size <<= 1)
+			;
+		if(!(lim->lawin = (uint32_t *)a2_RTAlloc(lim->state,
+				size * (A2L_MAXCHANNELS + 3) * sizeof(uint32_t))))
+		{
+			lim->lookahead = 0;
+			return;
+		}
+		lim->ladelay[0] = (int32_t *)lim->lawin + size;
+		lim->ladelay[1] = lim->ladelay[0] + size;
+		lim->dqpeak = (uint32_t *)lim->ladelay[1] + size;
+		lim->dqtime = lim->dqpeak + size;
+		lim->lamask = size - 1;
+	}
+	if(la > lim->lamask)
+		la = lim->lamask;
+	if(la == lim->lookahead)
+		return;
+
+	/*
+	 * Restart with an empty delay line. Starting at position 0, the first
+	 * 'la' frames read the top 'la' entries of the delay lines and the
+	 * window, so those are the only ones that need clearing. The deque
+	 * starts out empty, and is never read beyond its entries.
+	 */
+	lim->lookahead = la;
+	if(!la)
+		return;
+	size = lim->lamask + 1;
+	memset(lim->lawin + size - la, 0, la * sizeof(uint32_t));
+	memset(lim->ladelay[0] + size - la, 0, la * sizeof(int32_t));
+	memset(lim->ladelay[1] + size - la, 0, la * sizeof(int32_t));
+	lim->lapos = 0;
+	lim->lasum = 0;
+	lim->flasum = 0.0;
+	lim->lainv = ((1ULL << 32) + la - 1) / la;
+	lim->dqhead = lim->dqcount = 0;
+	lim->latime = 0;
+}
+
+
+static void limiter_Deinitialize(A2_unit *u)
+{
+	A2_limiter *lim = limiter_cast(u);
+	if(lim->lawin)
+		a2_RTFree(lim->state, lim->lawin);
+}
+
 
 static A2_errors limiter_OpenState(A2_config *cfg, void **statedata)
 {
-	*statedata = cfg;
+	*statedata = ((A2_interface_i *)cfg->interface)->state;
 	return A2_OK;
 }
 
@@ -211,6 +581,7 @@ static const A2_crdesc regs[] =
 {
 	{ "release",	limiter_Release		},	/* A2LR_RELEASE */
 	{ "threshold",	limiter_Threshold	},	/* A2LR_THRESHOLD */
+	{ "lookahead",	limiter_Lookahead	},	/* A2LR_LOOKAHEAD */
 	{ NULL,	NULL				}
 };
 
@@ -218,7 +589,7 @@ const A2_unitdesc a2_limiter_unitdesc =
 {
 	"limiter",		/* name */
 
-	A2_MATCHIO,		/* flags */
+	A2_MATCHIO | A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	regs,			/* registers */
 	NULL,			/* coutputs */
@@ -230,7 +601,7 @@ const A2_unitdesc a2_limiter_unitdesc =
 
 	sizeof(A2_limiter),	/* instancesize */
 	limiter_Initialize,	/* Initialize */
-	NULL,			/* Deinitialize */
+	limiter_Deinitialize,	/* Deinitialize */
 
 	limiter_OpenState,	/* OpenState */
 	NULL			/* CloseState */
@@ -21,6 +21,7 @@
  */
 
 #include "panmix.h"
+#include "internals.h"
 
 #define	A2PM_MAXINPUTS	2
 #define	A2PM_MAXOUTPUTS	2
@@ -37,6 +38,7 @@ typedef struct A2_panmix
 	A2_unit		header;
 	A2_ramper	vol;		/* Volume */
 	A2_ramper	pan;		/* Horizontal pan position */
+	const A2_dspfuncs *dsp;		/* DSP primitives */
 } A2_panmix;
 
 
@@ -46,37 +48,168 @@ static inline A2_panmix *panmix_cast(A2_unit *u)
 }
 
 
+/* out[] (+)= in[] * gain (8:24), with fixed point or float (fp) buffers */
+static inline void panmix_scale(A2_panmix *pm, int32_t *out, int32_t *in,
+		unsigned frames, int gain, int add, int fp)
+{
+	if(fp)
+	{
+		float g = gain * A2_FIX2FLOAT;
+		if(add)
+			pm->dsp->ScaleAddF((float *)out, (float *)in, frames, g);
+		else
+			pm->dsp->ScaleF((float *)out, (float *)in, frames, g);
+	}
+	else
+	{
+		if(add)
+			pm->dsp->ScaleAdd(out, in, frames, gain);
+		else
+			pm->dsp->Scale(out, in, frames, gain);
+	}
+}
+
+/* out[s] (+)= in[s] * gain (8:24), with fixed point or float (fp) buffers */
+static inline void panmix_sample(int32_t *out, int32_t *in, unsigned s,
+		int gain, int add, int fp)
+{
+	if(fp)
+	{
+		float v = ((float *)in)[s] * (gain * A2_FIX2FLOAT);
+		if(add)
+			((float *)out)[s] += v;
+		else
+			((float *)out)[s] = v;
+	}
+	else
+	{
+		if(add)
+			out[s] += (int64_t)in[s] * gain >> 24;
+		else
+			out[s] = (int64_t)in[s] * gain >> 24;
+	}
+}
+
+/*
+ * out0[s] (+)= in[s] * gain0, out1[s] (+)= in[s] * gain1 (8:24), with fixed
+ * point or float (fp) buffers. 'in' is read before writing, as it may be the
+ * same buffer as one of the outputs.
+ */
+static inline void panmix_sample12(int32_t *out0, int32_t *out1, int32_t *in,
+		unsigned s, int gain0, int gain1, int add, int fp)
+{
+	if(fp)
+	{
+		float ins = ((float *)in)[s];
+		float v0 = ins * (gain0 * A2_FIX2FLOAT);
+		float v1 = ins * (gain1 * A2_FIX2FLOAT);
+		if(add)
+		{
+			((float *)out0)[s] += v0;
+			((float *)out1)[s] += v1;
+		}
+		else
+		{
+			((float *)out0)[s] = v0;
+			((float *)out1)[s] = v1;
+		}
+	}
+	else
+	{
+		int ins = in[s];
+		if(add)
+		{
+			out0[s] += (int64_t)ins * gain0 >> 24;
+			out1[s] += (int64_t)ins * gain1 >> 24;
+		}
+		else
+		{
+			out0[s] = (int64_t)ins * gain0 >> 24;
+			out1[s] = (int64_t)ins * gain1 >> 24;
+		}
+	}
+}
+
+/*
+ * Calculate the left/right gains for the current vol and pan values. If
+ * 'clamp' is set, gains are limited to twice the volume, for pan values
+ * outside [LEFT, RIGHT].
+ */
+static inline void panmix_gains(A2_panmix *pm, int *v0, int *v1, int clamp)
+{
+	int vp = (int64_t)pm->pan.value * pm->vol.value >> 24;
+	*v0 = pm->vol.value - vp;
+	*v1 = pm->vol.value + vp;
+	if(clamp)
+	{
+		if(*v0 > pm->vol.value << 1)
+			*v0 = pm->vol.value << 1;
+		if(*v1 > pm->vol.value << 1)
+			*v1 = pm->vol.value << 1;
+	}
+}
+
+/* Check if gains need clamping (pan outside [LEFT, RIGHT]) this fragment */
+static inline int panmix_clamp(A2_panmix *pm)
+{
+	return pm->pan.target > 0xffffff || pm->pan.target < -0xffffff ||
+			pm->pan.value > 0xffffff || pm->pan.value < -0xffffff;
+}
+
+
 static inline void panmix_process11(A2_unit *u, unsigned offset,
-		unsigned frames, int add)
+		unsigned frames, int add, int fp)
 {
 	A2_panmix *pm = panmix_cast(u);
-	unsigned s, end = offset + frames;
-	int32_t *in = u->inputs[0];
-	int32_t *out = u->outputs[0];
+	int32_t *in = u->inputs[0] + offset;
+	int32_t *out = u->outputs[0] + offset;
 	a2_PrepareRamper(&pm->vol, frames);
-	for(s = offset; s < end; ++s)
+	if(fp)
 	{
+		float g = a2_RamperValueF(&pm->vol);
+		float dg = a2_RamperDeltaF(&pm->vol);
 		if(add)
-			out[s] += (int64_t)in[s] * pm->vol.value >> 24;
+			pm->dsp->RampAddF((float *)out, (float *)in, frames,
+					g, dg);
 		else
-			out[s] = (int64_t)in[s] * pm->vol.value >> 24;
-		a2_RunRamper(&pm->vol, 1);
+			pm->dsp->RampF((float *)out, (float *)in, frames,
+					g, dg);
+	}
+	else
+	{
+		if(add)
+			pm->dsp->RampAdd(out, in, frames, pm->vol.value,
+					pm->vol.delta);
+		else
+			pm->dsp->Ramp(out, in, frames, pm->vol.value,
+					pm->vol.delta);
 	}
+	a2_RunRamper(&pm->vol, frames);
 }
 
 static void panmix_Process11Add(A2_unit *u, unsigned offset, unsigned frames)
 {
-	panmix_process11(u, offset, frames, 1);
+	panmix_process11(u, offset, frames, 1, 0);
 }
 
 static void panmix_Process11(A2_unit *u, unsigned offset, unsigned frames)
 {
-	panmix_process11(u, offset, frames, 0);
+	panmix_process11(u, offset, frames, 0, 0);
+}
+
+static void panmix_Process11AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	panmix_process11(u, offset, frames, 1, 1);
+}
+
+static void panmix_Process11F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	panmix_process11(u, offset, frames, 0, 1);
 }
 
 
 static inline void panmix_process12(A2_unit *u, unsigned offset,
-		unsigned frames, int add, int clamp)
+		unsigned frames, int add, int clamp, int fp)
 {
 	A2_panmix *pm = panmix_cast(u);
 	unsigned s, end = offset + frames;
@@ -86,29 +219,32 @@ static inline void panmix_process12(A2_unit *u, unsigned offset,
 /* TODO: Proper constant power panning! */
 	a2_PrepareRamper(&pm->vol, frames);
 	a2_PrepareRamper(&pm->pan, frames);
-	for(s = offset; s < end; ++s)
+	if(!pm->vol.delta && !pm->pan.delta)
 	{
-		int vp = (int64_t)pm->pan.value * pm->vol.value >> 24;
-		int v0 = pm->vol.value - vp;
-		int v1 = pm->vol.value + vp;
-		int ins = in[s];
-		if(clamp)
-		{
-			if(v0 > pm->vol.value << 1)
-				v0 = pm->vol.value << 1;
-			if(v1 > pm->vol.value << 1)
-				v1 = pm->vol.value << 1;
-		}
-		if(add)
+		int v0, v1;
+		panmix_gains(pm, &v0, &v1, clamp);
+		/* 'in' may share buffer with an output, so write that one last */
+		if(in == out0)
 		{
-			out0[s] += (int64_t)ins * v0 >> 24;
-			out1[s] += (int64_t)ins * v1 >> 24;
+			panmix_scale(pm, out1 + offset, in + offset, frames,
+					v1, add, fp);
+			panmix_scale(pm, out0 + offset, in + offset, frames,
+					v0, add, fp);
 		}
 		else
 		{
-			out0[s] = (int64_t)ins * v0 >> 24;
-			out1[s] = (int64_t)ins * v1 >> 24;
+			panmix_scale(pm, out0 + offset, in + offset, frames,
+					v0, add, fp);
+			panmix_scale(pm, out1 + offset, in + offset, frames,
+					v1, add, fp);
 		}
+		return;
+	}
+	for(s = offset; s < end; ++s)
+	{
+		int v0, v1;
+		panmix_gains(pm, &v0, &v1, clamp);
+		panmix_sample12(out0, out1, in, s, v0, v1, add, fp);
 		a2_RunRamper(&pm->vol, 1);
 		a2_RunRamper(&pm->pan, 1);
 	}
@@ -116,26 +252,39 @@ static inline void panmix_process12(A2_unit *u, unsigned offset,
 
 static void panmix_Process12Add(A2_unit *u, unsigned offset, unsigned frames)
 {
-	A2_panmix *pm = panmix_cast(u);
-	if(pm->pan.target > 0xffffff || pm->pan.target < -0xffffff ||
-			pm->pan.value > 0xffffff || pm->pan.value < -0xffffff)
-		panmix_process12(u, offset, frames, 1, 1);
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process12(u, offset, frames, 1, 1, 0);
 	else
-		panmix_process12(u, offset, frames, 1, 0);
+		panmix_process12(u, offset, frames, 1, 0, 0);
 }
 
 static void panmix_Process12(A2_unit *u, unsigned offset, unsigned frames)
 {
-	A2_panmix *pm = panmix_cast(u);
-	if(pm->pan.target > 0xffffff || pm->pan.target < -0xffffff ||
-			pm->pan.value > 0xffffff || pm->pan.value < -0xffffff)
-		panmix_process12(u, offset, frames, 0, 1);
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process12(u, offset, frames, 0, 1, 0);
 	else
-		panmix_process12(u, offset, frames, 0, 0);
+		panmix_process12(u, offset, frames, 0, 0, 0);
 }
 
+static void panmix_Process12AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process12(u, offset, frames, 1, 1, 1);
+	else
+		panmix_process12(u, offset, frames, 1, 0, 1);
+}
+
+static void panmix_Process12F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process12(u, offset, frames, 0, 1, 1);
+	else
+		panmix_process12(u, offset, frames, 0, 0, 1);
+}
+
+
 static inline void panmix_process21(A2_unit *u, unsigned offset,
-		unsigned frames, int add, int clamp)
+		unsigned frames, int add, int clamp, int fp)
 {
 	A2_panmix *pm = panmix_cast(u);
 	unsigned s, end = offset + frames;
@@ -146,17 +295,19 @@ static inline void panmix_process21(A2_unit *u, unsigned offset,
 	a2_PrepareRamper(&pm->pan, frames);
 	for(s = offset; s < end; ++s)
 	{
-		int vp = (int64_t)pm->pan.value * pm->vol.value >> 24;
-		int v0 = pm->vol.value - vp;
-		int v1 = pm->vol.value + vp;
-		if(clamp)
+		int v0, v1;
+		panmix_gains(pm, &v0, &v1, clamp);
+		if(fp)
 		{
-			if(v0 > pm->vol.value << 1)
-				v0 = pm->vol.value << 1;
-			if(v1 > pm->vol.value << 1)
-				v1 = pm->vol.value << 1;
+			float v = (((float *)in0)[s] * v0 +
+					((float *)in1)[s] * v1) *
+					(.5f * A2_FIX2FLOAT);
+			if(add)
+				((float *)out)[s] += v;
+			else
+				((float *)out)[s] = v;
 		}
-		if(add)
+		else if(add)
 			out[s] += ((int64_t)in0[s] * v0 +
 					(int64_t)in1[s] * v1) >> 25;
 		else
@@ -169,27 +320,39 @@ static inline void panmix_process21(A2_unit *u, unsigned offset,
 
 static void panmix_Process21Add(A2_unit *u, unsigned offset, unsigned frames)
 {
-	A2_panmix *pm = panmix_cast(u);
-	if(pm->pan.target > 0xffffff || pm->pan.target < -0xffffff ||
-			pm->pan.value > 0xffffff || pm->pan.value < -0xffffff)
-		panmix_process21(u, offset, frames, 1, 1);
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process21(u, offset, frames, 1, 1, 0);
 	else
-		panmix_process21(u, offset, frames, 1, 0);
+		panmix_process21(u, offset, frames, 1, 0, 0);
 }
 
 static void panmix_Process21(A2_unit *u, unsigned offset, unsigned frames)
 {
-	A2_panmix *pm = panmix_cast(u);
-	if(pm->pan.target > 0xffffff || pm->pan.target < -0xffffff ||
-			pm->pan.value > 0xffffff || pm->pan.value < -0xffffff)
-		panmix_process21(u, offset, frames, 0, 1);
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process21(u, offset, frames, 0, 1, 0);
+	else
+		panmix_process21(u, offset, frames, 0, 0, 0);
+}
+
+static void panmix_Process21AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process21(u, offset, frames, 1, 1, 1);
+	else
+		panmix_process21(u, offset, frames, 1, 0, 1);
+}
+
+static void panmix_Process21F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process21(u, offset, frames, 0, 1, 1);
 	else
-		panmix_process21(u, offset, frames, 0, 0);
+		panmix_process21(u, offset, frames, 0, 0, 1);
 }
 
 
 static inline void panmix_process22(A2_unit *u, unsigned offset,
-		unsigned frames, int add, int clamp)
+		unsigned frames, int add, int clamp, int fp)
 {
 	A2_panmix *pm = panmix_cast(u);
 	unsigned s, end = offset + frames;
@@ -199,30 +362,22 @@ static inline void panmix_process22(A2_unit *u, unsigned offset,
 	int32_t *out1 = u->outputs[1];
 	a2_PrepareRamper(&pm->vol, frames);
 	a2_PrepareRamper(&pm->pan, frames);
+	if(!pm->vol.delta && !pm->pan.delta)
+	{
+		int v0, v1;
+		panmix_gains(pm, &v0, &v1, clamp);
+		panmix_scale(pm, out0 + offset, in0 + offset, frames, v0, add,
+				fp);
+		panmix_scale(pm, out1 + offset, in1 + offset, frames, v1, add,
+				fp);
+		return;
+	}
 	for(s = offset; s < end; ++s)
 	{
-		int vp = (int64_t)pm->pan.value * pm->vol.value >> 24;
-		int v0 = pm->vol.value - vp;
-		int v1 = pm->vol.value + vp;
-		int in0s = in0[s];
-		int in1s = in1[s];
-		if(clamp)
-		{
-			if(v0 > pm->vol.value << 1)
-				v0 = pm->vol.value << 1;
-			if(v1 > pm->vol.value << 1)
-				v1 = pm->vol.value << 1;
-		}
-		if(add)
-		{
-			out0[s] += (int64_t)in0s * v0 >> 24;
-			out1[s] += (int64_t)in1s * v1 >> 24;
-		}
-		else
-		{
-			out0[s] = (int64_t)in0s * v0 >> 24;
-			out1[s] = (int64_t)in1s * v1 >> 24;
-		}
+		int v0, v1;
+		panmix_gains(pm, &v0, &v1, clamp);
+		panmix_sample(out0, in0, s, v0, add, fp);
+		panmix_sample(out1, in1, s, v1, add, fp);
 		a2_RunRamper(&pm->vol, 1);
 		a2_RunRamper(&pm->pan, 1);
 	}
@@ -230,25 +385,53 @@ static inline void panmix_process22(A2_unit *u, unsigned offset,
 
 static void panmix_Process22Add(A2_unit *u, unsigned offset, unsigned frames)
 {
-	A2_panmix *pm = panmix_cast(u);
-	if(pm->pan.target > 0xffffff || pm->pan.target < -0xffffff ||
-			pm->pan.value > 0xffffff || pm->pan.value < -0xffffff)
-		panmix_process22(u, offset, frames, 1, 1);
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process22(u, offset, frames, 1, 1, 0);
 	else
-		panmix_process22(u, offset, frames, 1, 0);
+		panmix_process22(u, offset, frames, 1, 0, 0);
 }
 
 static void panmix_Process22(A2_unit *u, unsigned offset, unsigned frames)
 {
-	A2_panmix *pm = panmix_cast(u);
-	if(pm->pan.target > 0xffffff || pm->pan.target < -0xffffff ||
-			pm->pan.value > 0xffffff || pm->pan.value < -0xffffff)
-		panmix_process22(u, offset, frames, 0, 1);
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process22(u, offset, frames, 0, 1, 0);
+	else
+		panmix_process22(u, offset, frames, 0, 0, 0);
+}
+
+static void panmix_Process22AddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process22(u, offset, frames, 1, 1, 1);
+	else
+		panmix_process22(u, offset, frames, 1, 0, 1);
+}
+
+static void panmix_Process22F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	if(panmix_clamp(panmix_cast(u)))
+		panmix_process22(u, offset, frames, 0, 1, 1);
 	else
-		panmix_process22(u, offset, frames, 0, 0);
+		panmix_process22(u, offset, frames, 0, 0, 1);
 }
 
 
+static const A2_process_cb panmix_procs[2][2][4] = {
+	{	/* Fixed point */
+		{ panmix_Process11, panmix_Process12,
+				panmix_Process21, panmix_Process22 },
+		{ panmix_Process11Add, panmix_Process12Add,
+				panmix_Process21Add, panmix_Process22Add }
+	},
+	{	/* Float */
+		{ panmix_Process11F, panmix_Process12F,
+				panmix_Process21F, panmix_Process22F },
+		{ panmix_Process11AddF, panmix_Process12AddF,
+				panmix_Process21AddF, panmix_Process22AddF }
+	}
+};
+
+
 static A2_errors panmix_Initialize(A2_unit *u, A2_vmstate *vms,
 		void *statedata, unsigned flags)
 {
@@ -256,6 +439,7 @@ static A2_errors panmix_Initialize(A2_unit *u, A2_vmstate *vms,
 	int *ur = u->registers;
 
 	/* Internal state initialization */
+	pm->dsp = ((A2_state *)statedata)->dsp;
 	a2_InitRamper(&pm->vol, 65536);
 	a2_InitRamper(&pm->pan, 0);
 
@@ -264,22 +448,16 @@ static A2_errors panmix_Initialize(A2_unit *u, A2_vmstate *vms,
 	ur[A2PMR_PAN] = 0;
 
 	/* Install Process callback */
-	if(flags & A2_PROCADD)
-		switch(((u->ninputs - 1) << 1) + (u->noutputs - 1))
-		{
-		  case 0: u->Process = panmix_Process11Add; break;
-		  case 1: u->Process = panmix_Process12Add; break;
-		  case 2: u->Process = panmix_Process21Add; break;
-		  case 3: u->Process = panmix_Process22Add; break;
-		}
-	else
-		switch(((u->ninputs - 1) << 1) + (u->noutputs - 1))
-		{
-		  case 0: u->Process = panmix_Process11; break;
-		  case 1: u->Process = panmix_Process12; break;
-		  case 2: u->Process = panmix_Process21; break;
-		  case 3: u->Process = panmix_Process22; break;
-		}
+	u->Process = panmix_procs[(flags & A2_PROCFLOAT) ? 1 : 0]
+			[(flags & A2_PROCADD) ? 1 : 0]
+			[((u->ninputs - 1) << 1) + (u->noutputs - 1)];
+	return A2_OK;
+}
+
+
+static A2_errors panmix_OpenState(A2_config *cfg, void **statedata)
+{
+	*statedata = ((A2_interface_i *)cfg->interface)->state;
 	return A2_OK;
 }
 
@@ -314,7 +492,7 @@ const A2_unitdesc a2_panmix_unitdesc =
 {
 	"panmix",		/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	regs,			/* registers */
 	NULL,			/* coutputs */
@@ -328,6 +506,6 @@ const A2_unitdesc a2_panmix_unitdesc =
 	panmix_Initialize,	/* Initialize */
 	NULL,			/* Deinitialize */
 
-	NULL,			/* OpenState */
+	panmix_OpenState,	/* OpenState */
 	NULL			/* CloseState */
 };
@@ -29,6 +29,7 @@
  * 3. This notice may not be removed or altered from any source distribution.
  */
 
+#include <math.h>
 #include "waveshaper.h"
 
 #define	A2WS_MAXCHANNELS	2
@@ -107,6 +108,39 @@ static inline void waveshaper_process(A2_unit *u, unsigned offset,
 	}
 }
 
+/* Floating point version of waveshaper_process(), for A2_PROCFLOAT */
+static inline void waveshaper_processf(A2_unit *u, unsigned offset,
+		unsigned frames, int add, int channels)
+{
+	A2_waveshaper *ws = waveshaper_cast(u);
+	unsigned s, c, end = offset + frames;
+	float *in[A2WS_MAXCHANNELS], *out[A2WS_MAXCHANNELS];
+	a2_PrepareRamper(&ws->amount, frames);
+	for(c = 0; c < channels; ++c)
+	{
+		in[c] = (float *)u->inputs[c];
+		out[c] = (float *)u->outputs[c];
+	}
+	/* Same [-.5, .5] scaling as the fixed point implementation */
+	for(s = offset; s < end; ++s)
+	{
+		float a = a2_RamperValueF(&ws->amount);
+		float a3p1 = 3.0f * a + 1.0f;
+		float asqr = a * a;
+		for(c = 0; c < channels; ++c)
+		{
+			float v = in[c][s] * 2.0f;
+			float vout = (a3p1 * v - 2.0f * a * (v * fabsf(v))) /
+					(v * v * asqr + 1.0f) * .5f;
+			if(add)
+				out[c][s] += vout;
+			else
+				out[c][s] = vout;
+		}
+		a2_RunRamper(&ws->amount, 1);
+	}
+}
+
 static void waveshaper_Process11Add(A2_unit *u, unsigned offset,
 		unsigned frames)
 {
@@ -129,6 +163,28 @@ static void waveshaper_Process22(A2_unit *u, unsigned offset, unsigned frames)
 	waveshaper_process(u, offset, frames, 0, 2);
 }
 
+static void waveshaper_Process11AddF(A2_unit *u, unsigned offset,
+		unsigned frames)
+{
+	waveshaper_processf(u, offset, frames, 1, 1);
+}
+
+static void waveshaper_Process11F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	waveshaper_processf(u, offset, frames, 0, 1);
+}
+
+static void waveshaper_Process22AddF(A2_unit *u, unsigned offset,
+		unsigned frames)
+{
+	waveshaper_processf(u, offset, frames, 1, 2);
+}
+
+static void waveshaper_Process22F(A2_unit *u, unsigned offset, unsigned frames)
+{
+	waveshaper_processf(u, offset, frames, 0, 2);
+}
+
 
 static A2_errors waveshaper_Initialize(A2_unit *u, A2_vmstate *vms,
 		void *statedata, unsigned flags)
@@ -140,7 +196,22 @@ static A2_errors waveshaper_Initialize(A2_unit *u, A2_vmstate *vms,
 
 	ur[A2WSR_AMOUNT] = 0;
 
-	if(flags & A2_PROCADD)
+	if(flags & A2_PROCFLOAT)
+	{
+		if(flags & A2_PROCADD)
+			switch(u->ninputs)
+			{
+			  case 1: u->Process = waveshaper_Process11AddF; break;
+			  case 2: u->Process = waveshaper_Process22AddF; break;
+			}
+		else
+			switch(u->ninputs)
+			{
+			  case 1: u->Process = waveshaper_Process11F; break;
+			  case 2: u->Process = waveshaper_Process22F; break;
+			}
+	}
+	else if(flags & A2_PROCADD)
 		switch(u->ninputs)
 		{
 		  case 1: u->Process = waveshaper_Process11Add; break;
@@ -174,7 +245,7 @@ const A2_unitdesc a2_waveshaper_unitdesc =
 {
 	"waveshaper",		/* name */
 
-	A2_MATCHIO,		/* flags */
+	A2_MATCHIO | A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	regs,			/* registers */
 	NULL,			/* coutputs */
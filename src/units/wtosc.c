@@ -22,28 +22,13 @@
 
 #include <string.h>
 #include "wtosc.h"
+#include "wtoscsimd.h"
 #include "internals.h"
 
-/* NOTE: These all return doubled amplitude samples! */
-#ifdef A2_HIFI
-/* Hermite interpolation with 2x oversampling */
-static inline int wtosc_Inter(int16_t *d, unsigned ph, unsigned dph)
-{
-	return a2_Hermite(d, ph) + a2_Hermite(d, ph + (dph >> 1));
-}
-#elif (defined A2_LOFI)
-/* Linear interpolation */
-static inline int wtosc_Inter(int16_t *d, unsigned ph, unsigned dph)
-{
-	return a2_Lerp(d, ph) << 1;
-}
-#else
-/* Linear interpolation with 2x oversampling */
-static inline int wtosc_Inter(int16_t *d, unsigned ph, unsigned dph)
-{
-	return a2_Lerp(d, ph) + a2_Lerp(d, ph + (dph >> 1));
-}
-#endif
+/*
+ * Number of frames to interpolate per SIMD kernel call. (Stack buffer size.)
+ */
+#define	A2_WTOSC_CHUNK		64
 
 /*
  * Maximum supported number of sample frames in a wave.
@@ -76,7 +61,12 @@ typedef struct A2_wtosc
 	A2_ramper	a;		/* Amplitude ramper */
 	A2_wave		*wave;		/* Current waveform */
 	A2_interface	*interface;	/* For changing waves */
+	uint32_t	*nstate;	/* Noise generator state */
+	uint8_t		*awake;		/* Voice suspension veto */
 	int		*transpose;	/* Needed for pitch calculations */
+	unsigned	*quality;	/* Interpolation quality (A2_quality) */
+	const A2_wtinterfunc *kernels;	/* SIMD kernels, or NULL */
+	const A2_dspfuncs *dsp;		/* DSP primitives */
 } A2_wtosc;
 
 
@@ -105,6 +95,31 @@ static inline void wtosc_run_pitch(A2_wtosc *o, unsigned frames)
 }
 
 
+/*
+ * out[s] (+)= v (8:24), with fixed point or float (A2_PROCFLOAT) output. The
+ * oscillators themselves are fixed point either way, as the wavetables, phase
+ * accumulators and interpolation are integer.
+ */
+static inline void wtosc_write(int32_t *out, unsigned s, int32_t v, int add,
+		int fp)
+{
+	if(fp)
+	{
+		if(add)
+			((float *)out)[s] += v * A2_FIX2FLOAT;
+		else
+			((float *)out)[s] = v * A2_FIX2FLOAT;
+	}
+	else
+	{
+		if(add)
+			out[s] += v;
+		else
+			out[s] = v;
+	}
+}
+
+
 static void wtosc_OffAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
 	A2_wtosc *o = wtosc_cast(u);
@@ -127,13 +142,12 @@ static void wtosc_Off(A2_unit *u, unsigned offset, unsigned frames)
 
 
 static inline void wtosc_noise(A2_unit *u, unsigned offset, unsigned frames,
-		int add)
+		int add, int fp)
 {
 	A2_wtosc *o = wtosc_cast(u);
 	unsigned s, end = offset + frames;
 	int32_t *out = u->outputs[0];
-	A2_state *st = ((A2_interface_i *)o->interface)->state;
-	uint32_t *nstate = &st->noisestate;
+	uint32_t *nstate = o->nstate;
 	wtosc_run_pitch(o, frames);
 	a2_PrepareRamper(&o->a, frames);
 
@@ -143,10 +157,8 @@ static inline void wtosc_noise(A2_unit *u, unsigned offset, unsigned frames,
 		if((o->dphase >= (1 << 23)) || ((nph ^ o->phase) >> 23))
 			o->noise = a2_Noise(nstate) - 32767;
 		o->phase = nph;
-		if(add)
-			out[s] += o->noise * (o->a.value >> 10) >> 6;
-		else
-			out[s] = o->noise * (o->a.value >> 10) >> 6;
+		wtosc_write(out, s, o->noise * (o->a.value >> 10) >> 6, add,
+				fp);
 		a2_RunRamper(&o->a, 1);
 	}
 }
@@ -154,13 +166,25 @@ static inline void wtosc_noise(A2_unit *u, unsigned offset, unsigned frames,
 
 static void wtosc_NoiseAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	wtosc_noise(u, offset, frames, 1);
+	wtosc_noise(u, offset, frames, 1, 0);
 }
 
 
 static void wtosc_Noise(A2_unit *u, unsigned offset, unsigned frames)
 {
-	wtosc_noise(u, offset, frames, 0);
+	wtosc_noise(u, offset, frames, 0, 0);
+}
+
+
+static void wtosc_NoiseAddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	wtosc_noise(u, offset, frames, 1, 1);
+}
+
+
+static void wtosc_NoiseF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	wtosc_noise(u, offset, frames, 0, 1);
 }
 
 
@@ -192,14 +216,16 @@ static inline int wtosc_check_unloaded(A2_unit *u, A2_wave *w)
  *	ph	Phase accumulator
  *	dph	Per output sample frame phase increment
  *	add	(flag) Adding mode
+ *	fp	(flag) Float output (A2_PROCFLOAT)
  *	looped	(flag) Wave is looped (ignored if wsize == 0)
  *	wsize	Size of wave. Pass 0 to disable loop/end checks.
+ *	quality	Interpolation quality (A2_quality)
  *
  * Returns the final state of the phase accumulator.
  */
 static inline uint64_t wtosc_do_fragment(A2_wtosc *o, int16_t *d, int32_t *out,
 		unsigned offset, unsigned frames, uint64_t ph, unsigned dph,
-		int add, int looped, unsigned wsize)
+		int add, int fp, int looped, unsigned wsize, int quality)
 {
 	unsigned s;
 	unsigned end = offset + frames;
@@ -224,20 +250,93 @@ static inline uint64_t wtosc_do_fragment(A2_wtosc *o, int16_t *d, int32_t *out,
 				break;
 			}
 		}
-		v = wtosc_Inter(d, ph >> 16, dph >> 16);
-		if(add)
-			out[s] += (int64_t)v * o->a.value >> (16 + 1);
-		else
-			out[s] = (int64_t)v * o->a.value >> (16 + 1);
+		v = wtosc_Inter(d, ph >> 16, dph >> 16, quality);
+		wtosc_write(out, s, (int64_t)v * o->a.value >> (16 + 1), add,
+				fp);
 		ph += dph;
 		a2_RunRamper(&o->a, 1);
 	}
 	return ph;
 }
 
+/*
+ * Inner loop using SIMD interpolation kernel 'inter', for the case without
+ * loop/end checks. Interpolates chunks of frames into a buffer, and then
+ * applies the amplitude ramp. (Arguments as for wtosc_do_fragment().)
+ */
+static inline uint64_t wtosc_do_fragment_simd(A2_wtosc *o, int16_t *d,
+		int32_t *out, unsigned offset, unsigned frames, uint64_t ph,
+		unsigned dph, int add, int fp, A2_wtinterfunc inter)
+{
+	int32_t v[A2_WTOSC_CHUNK];
+	float vf[A2_WTOSC_CHUNK];
+	while(frames)
+	{
+		unsigned n = frames < A2_WTOSC_CHUNK ? frames : A2_WTOSC_CHUNK;
+		inter(d, v, n, ph, dph);
+		ph += (uint64_t)dph * n;
+		if(fp)
+		{
+			float *fout = (float *)out + offset;
+			o->dsp->FixToFloat(vf, v, n);
+			if(add)
+				o->dsp->RampAddF(fout, vf, n,
+						a2_RamperValueF(&o->a),
+						a2_RamperDeltaF(&o->a));
+			else
+				o->dsp->RampF(fout, vf, n,
+						a2_RamperValueF(&o->a),
+						a2_RamperDeltaF(&o->a));
+		}
+		else if(add)
+			o->dsp->RampAdd(out + offset, v, n, o->a.value,
+					o->a.delta);
+		else
+			o->dsp->Ramp(out + offset, v, n, o->a.value,
+					o->a.delta);
+		a2_RunRamper(&o->a, n);
+		offset += n;
+		frames -= n;
+	}
+	return ph;
+}
+
+/*
+ * Pick the inner loop for the current quality level, once per fragment, so
+ * that the interpolation can be changed at run-time, without a per-sample
+ * cost. (Arguments as for wtosc_do_fragment(), except 'quality'.)
+ */
+static inline uint64_t wtosc_fragment(A2_wtosc *o, int16_t *d, int32_t *out,
+		unsigned offset, unsigned frames, uint64_t ph, unsigned dph,
+		int add, int fp, int looped, unsigned wsize)
+{
+	/*
+	 * Sampled and one-shot waves may have silent sections longer than the
+	 * silence window, so we don't let the voice be suspended while we're
+	 * playing a wave, unless the amplitude is 0, and not ramping.
+	 */
+	if(o->a.value || o->a.delta)
+		*o->awake = 1;
+	if(!wsize && o->kernels)
+		return wtosc_do_fragment_simd(o, d, out, offset, frames,
+				ph, dph, add, fp, o->kernels[*o->quality]);
+	switch(*o->quality)
+	{
+	  case A2_QLOFI:
+		return wtosc_do_fragment(o, d, out, offset, frames, ph, dph,
+				add, fp, looped, wsize, A2_QLOFI);
+	  case A2_QSTANDARD:
+		return wtosc_do_fragment(o, d, out, offset, frames, ph, dph,
+				add, fp, looped, wsize, A2_QSTANDARD);
+	  default:
+		return wtosc_do_fragment(o, d, out, offset, frames, ph, dph,
+				add, fp, looped, wsize, A2_QHIFI);
+	}
+}
+
 
 static inline void wtosc_wavetable(A2_unit *u, unsigned offset,
-		unsigned frames, int add)
+		unsigned frames, int add, int fp)
 {
 	A2_wtosc *o = wtosc_cast(u);
 	unsigned mm, dph;
@@ -279,27 +378,39 @@ static inline void wtosc_wavetable(A2_unit *u, unsigned offset,
 	}
 	else
 	{
-		o->phase = wtosc_do_fragment(o,
+		o->phase = wtosc_fragment(o,
 				w->d.wave.data[mm] + A2_WAVEPRE, out,
-				offset, frames, ph, dph, add, 0, 0) << mm;
+				offset, frames, ph, dph, add, fp, 0, 0) << mm;
 	}
 }
 
 
 static void wtosc_WavetableAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	wtosc_wavetable(u, offset, frames, 1);
+	wtosc_wavetable(u, offset, frames, 1, 0);
 }
 
 
 static void wtosc_Wavetable(A2_unit *u, unsigned offset, unsigned frames)
 {
-	wtosc_wavetable(u, offset, frames, 0);
+	wtosc_wavetable(u, offset, frames, 0, 0);
+}
+
+
+static void wtosc_WavetableAddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	wtosc_wavetable(u, offset, frames, 1, 1);
+}
+
+
+static void wtosc_WavetableF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	wtosc_wavetable(u, offset, frames, 0, 1);
 }
 
 
 static inline void wtosc_wavetable_no_mip(A2_unit *u, unsigned offset,
-		unsigned frames, int add)
+		unsigned frames, int add, int fp)
 {
 	A2_wtosc *o = wtosc_cast(u);
 	uint64_t dph;
@@ -330,13 +441,13 @@ static inline void wtosc_wavetable_no_mip(A2_unit *u, unsigned offset,
 		 * above the output sample rate, and are muted above that.)
 		 */
 		if(w->flags & A2_LOOPED)
-			o->phase = wtosc_do_fragment(o, d, out, offset, frames,
+			o->phase = wtosc_fragment(o, d, out, offset, frames,
 					o->phase, dph,
-					add, 1, w->d.wave.size[0]);
+					add, fp, 1, w->d.wave.size[0]);
 		else
-			o->phase = wtosc_do_fragment(o, d, out, offset, frames,
+			o->phase = wtosc_fragment(o, d, out, offset, frames,
 					o->phase, dph,
-					add, 0, w->d.wave.size[0]);
+					add, fp, 0, w->d.wave.size[0]);
 	}
 	else
 	{
@@ -351,9 +462,9 @@ static inline void wtosc_wavetable_no_mip(A2_unit *u, unsigned offset,
 				memset(out + offset, 0, frames * sizeof(int));
 			return;		/* All played! */
 		}
-		o->phase = wtosc_do_fragment(o, d, out, offset, frames,
+		o->phase = wtosc_fragment(o, d, out, offset, frames,
 				o->phase, dph,
-				add, 0, 0);
+				add, fp, 0, 0);
 	}
 }
 
@@ -361,13 +472,26 @@ static inline void wtosc_wavetable_no_mip(A2_unit *u, unsigned offset,
 static void wtosc_WavetableNoMipAdd(A2_unit *u, unsigned offset,
 		unsigned frames)
 {
-	wtosc_wavetable_no_mip(u, offset, frames, 1);
+	wtosc_wavetable_no_mip(u, offset, frames, 1, 0);
 }
 
 
 static void wtosc_WavetableNoMip(A2_unit *u, unsigned offset, unsigned frames)
 {
-	wtosc_wavetable_no_mip(u, offset, frames, 0);
+	wtosc_wavetable_no_mip(u, offset, frames, 0, 0);
+}
+
+
+static void wtosc_WavetableNoMipAddF(A2_unit *u, unsigned offset,
+		unsigned frames)
+{
+	wtosc_wavetable_no_mip(u, offset, frames, 1, 1);
+}
+
+
+static void wtosc_WavetableNoMipF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	wtosc_wavetable_no_mip(u, offset, frames, 0, 1);
 }
 
 
@@ -396,8 +520,14 @@ static A2_errors wtosc_Initialize(A2_unit *u, A2_vmstate *vms, void *statedata,
 
 	/* Internal state initialization */
 	o->interface = cfg->interface;
+	o->nstate = &a2_voice_from_vms(vms)->noisestate;
+	o->awake = &a2_voice_from_vms(vms)->awake;
 	o->basepitch = cfg->basepitch;
 	o->transpose = vms->r + R_TRANSPOSE;
+	o->quality = &((A2_interface_i *)cfg->interface)->state->quality;
+	o->kernels = a2_WTOscKernels(
+			((A2_interface_i *)cfg->interface)->state->simd);
+	o->dsp = ((A2_interface_i *)cfg->interface)->state->dsp;
 	o->noise = 0;
 	o->wave = NULL;
 	a2_InitRamper(&o->a, 0);
@@ -412,7 +542,12 @@ static A2_errors wtosc_Initialize(A2_unit *u, A2_vmstate *vms, void *statedata,
 	ur[A2OR_AMPLITUDE] = 0;
 	ur[A2OR_PHASE] = 0;
 
-	/* Install Process callback (Can change at run-time as needed!) */
+	/*
+	 * Install Process callback (Can change at run-time as needed!)
+	 *
+	 * NOTE: wtosc_Off() and wtosc_OffAdd() also serve for A2_PROCFLOAT,
+	 *       as 0.0f is all zero bits.
+	 */
 	o->flags = flags;
 	if(flags & A2_PROCADD)
 		u->Process = wtosc_OffAdd;
@@ -462,19 +597,29 @@ static void wtosc_Wave(A2_unit *u, int v, unsigned start, unsigned dur)
 			u->Process = wtosc_Off;
 		break;
 	  case A2_WNOISE:
-		if(o->flags & A2_PROCADD)
+		if(o->flags & A2_PROCFLOAT)
+			u->Process = (o->flags & A2_PROCADD) ?
+					wtosc_NoiseAddF : wtosc_NoiseF;
+		else if(o->flags & A2_PROCADD)
 			u->Process = wtosc_NoiseAdd;
 		else
 			u->Process = wtosc_Noise;
 		break;
 	  case A2_WWAVE:
-		if(o->flags & A2_PROCADD)
+		if(o->flags & A2_PROCFLOAT)
+			u->Process = (o->flags & A2_PROCADD) ?
+					wtosc_WavetableNoMipAddF :
+					wtosc_WavetableNoMipF;
+		else if(o->flags & A2_PROCADD)
 			u->Process = wtosc_WavetableNoMipAdd;
 		else
 			u->Process = wtosc_WavetableNoMip;
 		break;
 	  case A2_WMIPWAVE:
-		if(o->flags & A2_PROCADD)
+		if(o->flags & A2_PROCFLOAT)
+			u->Process = (o->flags & A2_PROCADD) ?
+					wtosc_WavetableAddF : wtosc_WavetableF;
+		else if(o->flags & A2_PROCADD)
 			u->Process = wtosc_WavetableAdd;
 		else
 			u->Process = wtosc_Wavetable;
@@ -517,7 +662,7 @@ const A2_unitdesc a2_wtosc_unitdesc =
 {
 	"wtosc",		/* name */
 
-	0,			/* flags */
+	A2_SUSPENDABLE | A2_FLOATIO,	/* flags */
 
 	regs,			/* registers */
 	NULL,			/* coutputs */
@@ -0,0 +1,440 @@
+/*
+ * wtoscsimd.c - Audiality 2 wavetable oscillator SIMD kernels
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * These kernels do the exact same 32 bit integer operations as a2_Lerp() and
+ * a2_Hermite(), including the (in practice) wrapping multiplications, only
+ * on several frames at a time, so the output is bit exact. Frames that don't
+ * fill a vector go through the scalar reference code.
+ */
+
+#include "wtoscsimd.h"
+#include "internals.h"
+
+#if defined(A2_SIMD_SSE2) || defined(A2_SIMD_AVX2)
+#	include <immintrin.h>
+#endif
+#ifdef A2_SIMD_NEON
+#	include <arm_neon.h>
+#endif
+
+/*
+ * The 16:16 phases (1.0/sample) passed to wtosc_Inter() are tracked per lane
+ * as 32 bit integer parts ('hi'; the phases we need) and 16 bit fractions
+ * ('lo'), stepped by 'n' frames at a time. This gives the exact same results
+ * as (ph + k * dph) >> 16, as long as n * (dph & 0xffff) fits in 32 bits.
+ *
+ * Calculate the initial 'hi' and 'lo' values for 'n' lanes.
+ */
+static inline void wtosc_lanes(uint32_t *hi, uint32_t *lo, unsigned n,
+		uint64_t ph, unsigned dph)
+{
+	unsigned i;
+	for(i = 0; i < n; ++i, ph += dph)
+	{
+		hi[i] = ph >> 16;
+		lo[i] = ph & 0xffff;
+	}
+}
+
+/* Scalar reference, for the last few frames */
+static inline void wtosc_tail(int16_t *d, int32_t *v, unsigned frames,
+		uint64_t ph, unsigned dph, int quality)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s, ph += dph)
+		v[s] = wtosc_Inter(d, ph >> 16, dph >> 16, quality) * 128;
+}
+
+/* Kernel entry points for the A2_quality levels of 'isa' */
+#define	A2_WTKERNELS(isa, attr)						\
+static attr void wtosc_##isa##_lofi(int16_t *d, int32_t *v,		\
+		unsigned frames, uint64_t ph, unsigned dph)		\
+{									\
+	wtosc_##isa(d, v, frames, ph, dph, A2_QLOFI);			\
+}									\
+static attr void wtosc_##isa##_standard(int16_t *d, int32_t *v,		\
+		unsigned frames, uint64_t ph, unsigned dph)		\
+{									\
+	wtosc_##isa(d, v, frames, ph, dph, A2_QSTANDARD);		\
+}									\
+static attr void wtosc_##isa##_hifi(int16_t *d, int32_t *v,		\
+		unsigned frames, uint64_t ph, unsigned dph)		\
+{									\
+	wtosc_##isa(d, v, frames, ph, dph, A2_QHIFI);			\
+}									\
+static const A2_wtinterfunc wtosc_##isa##_kernels[] = {		\
+	wtosc_##isa##_lofi,						\
+	wtosc_##isa##_standard,						\
+	wtosc_##isa##_hifi						\
+};
+
+
+/*---------------------------------------------------------
+	SSE2 (x86-64): 4 frames per iteration
+---------------------------------------------------------*/
+#ifdef A2_SIMD_SSE2
+
+/* Low 32 bits of 32x32 bit products (pmulld is SSE4.1) */
+static inline __m128i sse2_mullo(__m128i a, __m128i b)
+{
+	__m128i e = _mm_mul_epu32(a, b);
+	__m128i o = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+	return _mm_unpacklo_epi32(
+			_mm_shuffle_epi32(e, _MM_SHUFFLE(0, 0, 2, 0)),
+			_mm_shuffle_epi32(o, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/* Sign extend the low/high four int16 of 'v' to int32 */
+#define	SSE2_EXTLO(v)	_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)
+#define	SSE2_EXTHI(v)	_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)
+
+/*
+ * Load d[i - 1] through d[i + 2] for four phases, transposed into 'lo' (four
+ * d[i - 1], four d[i]) and 'hi' (four d[i + 1], four d[i + 2]).
+ */
+static inline void sse2_load4(int16_t *d, __m128i p, __m128i *lo,
+		__m128i *hi)
+{
+	uint32_t i[4];
+	__m128i t01, t23;
+	_mm_storeu_si128((__m128i *)i, _mm_srli_epi32(p, 8));
+	t01 = _mm_unpacklo_epi16(
+			_mm_loadl_epi64((const __m128i *)(d + i[0] - 1)),
+			_mm_loadl_epi64((const __m128i *)(d + i[1] - 1)));
+	t23 = _mm_unpacklo_epi16(
+			_mm_loadl_epi64((const __m128i *)(d + i[2] - 1)),
+			_mm_loadl_epi64((const __m128i *)(d + i[3] - 1)));
+	*lo = _mm_unpacklo_epi32(t01, t23);
+	*hi = _mm_unpackhi_epi32(t01, t23);
+}
+
+/* a2_Lerp() x 4 */
+static inline __m128i sse2_lerp(int16_t *d, __m128i p)
+{
+	__m128i lo, hi, x, w;
+	sse2_load4(d, p, &lo, &hi);
+	x = _mm_and_si128(p, _mm_set1_epi32(0xff));
+	w = _mm_or_si128(_mm_slli_epi32(x, 16),
+			_mm_sub_epi32(_mm_set1_epi32(256), x));
+	/* d[i] * (256 - x) + d[i + 1] * x, using 16 bit pairs */
+	return _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(
+			_mm_unpackhi_epi64(lo, lo), hi), w), 8);
+}
+
+/* a2_Hermite() x 4 */
+static inline __m128i sse2_hermite(int16_t *d, __m128i p)
+{
+	__m128i lo, hi, dm1, d0, d1, d2, x, a, b, c;
+	sse2_load4(d, p, &lo, &hi);
+	dm1 = SSE2_EXTLO(lo);
+	d0 = SSE2_EXTHI(lo);
+	d1 = SSE2_EXTLO(hi);
+	d2 = SSE2_EXTHI(hi);
+	x = _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xff)), 7);
+	c = _mm_srai_epi32(_mm_sub_epi32(d1, dm1), 1);
+	a = _mm_sub_epi32(d0, d1);
+	a = _mm_add_epi32(_mm_add_epi32(a, a), a);
+	a = _mm_srai_epi32(_mm_sub_epi32(_mm_add_epi32(a, d2), dm1), 1);
+	b = _mm_sub_epi32(_mm_add_epi32(_mm_sub_epi32(dm1, d0), c), a);
+	a = _mm_srai_epi32(sse2_mullo(a, x), 15);
+	a = _mm_srai_epi32(sse2_mullo(_mm_add_epi32(a, b), x), 15);
+	return _mm_add_epi32(d0, _mm_srai_epi32(
+			sse2_mullo(_mm_add_epi32(a, c), x), 15));
+}
+
+static inline void wtosc_sse2(int16_t *d, int32_t *v, unsigned frames,
+		uint64_t ph, unsigned dph, int quality)
+{
+	unsigned s;
+	uint32_t h[4], l[4];
+	__m128i hi, lo, dhi, dlo, h2;
+	wtosc_lanes(h, l, 4, ph, dph);
+	hi = _mm_loadu_si128((const __m128i *)h);
+	lo = _mm_loadu_si128((const __m128i *)l);
+	dhi = _mm_set1_epi32((dph >> 16) * 4);
+	dlo = _mm_set1_epi32((dph & 0xffff) * 4);
+	h2 = _mm_set1_epi32(dph >> 17);
+	for(s = 0; s + 4 <= frames; s += 4)
+	{
+		__m128i r;
+		switch(quality)
+		{
+		  case A2_QLOFI:
+			r = _mm_slli_epi32(sse2_lerp(d, hi), 1);
+			break;
+		  case A2_QSTANDARD:
+			r = _mm_add_epi32(sse2_lerp(d, hi),
+					sse2_lerp(d, _mm_add_epi32(hi, h2)));
+			break;
+		  default:
+			r = _mm_add_epi32(sse2_hermite(d, hi),
+					sse2_hermite(d, _mm_add_epi32(hi, h2)));
+			break;
+		}
+		_mm_storeu_si128((__m128i *)(v + s), _mm_slli_epi32(r, 7));
+		lo = _mm_add_epi32(lo, dlo);
+		hi = _mm_add_epi32(_mm_add_epi32(hi, dhi),
+				_mm_srli_epi32(lo, 16));
+		lo = _mm_and_si128(lo, _mm_set1_epi32(0xffff));
+	}
+	wtosc_tail(d, v + s, frames - s, ph + (uint64_t)dph * s, dph,
+			quality);
+}
+
+A2_WTKERNELS(sse2, )
+
+#endif /* A2_SIMD_SSE2 */
+
+
+/*---------------------------------------------------------
+	AVX2 (x86-64): 8 frames per iteration
+---------------------------------------------------------*/
+#ifdef A2_SIMD_AVX2
+
+#define	A2_AVX2	__attribute__((target("avx2")))
+
+/* Sign extend the low/high four int16 of each 128 bit half of 'v' */
+#define	AVX2_EXTLO(v)	_mm256_srai_epi32(_mm256_unpacklo_epi16(v, v), 16)
+#define	AVX2_EXTHI(v)	_mm256_srai_epi32(_mm256_unpackhi_epi16(v, v), 16)
+
+/* Load d[i - 1] through d[i + 2] of frame 'a' and 'b' into one vector */
+#define	AVX2_LOAD2(d, i, a, b)	_mm256_inserti128_si256(		\
+		_mm256_castsi128_si256(_mm_loadl_epi64(			\
+		(const __m128i *)((d) + (i)[a] - 1))),			\
+		_mm_loadl_epi64((const __m128i *)((d) + (i)[b] - 1)), 1)
+
+/*
+ * Load d[i - 1] through d[i + 2] for eight phases, transposed as by
+ * sse2_load4(), with frames 0-3 in the low 128 bit half of 'lo' and 'hi',
+ * and frames 4-7 in the high half.
+ */
+static inline A2_AVX2 void avx2_load8(int16_t *d, __m256i p, __m256i *lo,
+		__m256i *hi)
+{
+	uint32_t i[8];
+	__m256i t01, t23;
+	_mm256_storeu_si256((__m256i *)i, _mm256_srli_epi32(p, 8));
+	t01 = _mm256_unpacklo_epi16(AVX2_LOAD2(d, i, 0, 4),
+			AVX2_LOAD2(d, i, 1, 5));
+	t23 = _mm256_unpacklo_epi16(AVX2_LOAD2(d, i, 2, 6),
+			AVX2_LOAD2(d, i, 3, 7));
+	*lo = _mm256_unpacklo_epi32(t01, t23);
+	*hi = _mm256_unpackhi_epi32(t01, t23);
+}
+
+/* a2_Lerp() x 8 */
+static inline A2_AVX2 __m256i avx2_lerp(int16_t *d, __m256i p)
+{
+	__m256i lo, hi, x, w;
+	avx2_load8(d, p, &lo, &hi);
+	x = _mm256_and_si256(p, _mm256_set1_epi32(0xff));
+	w = _mm256_or_si256(_mm256_slli_epi32(x, 16),
+			_mm256_sub_epi32(_mm256_set1_epi32(256), x));
+	/* d[i] * (256 - x) + d[i + 1] * x, using 16 bit pairs */
+	return _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(
+			_mm256_unpackhi_epi64(lo, lo), hi), w), 8);
+}
+
+/* a2_Hermite() x 8 */
+static inline A2_AVX2 __m256i avx2_hermite(int16_t *d, __m256i p)
+{
+	__m256i lo, hi, dm1, d0, d1, d2, x, a, b, c;
+	avx2_load8(d, p, &lo, &hi);
+	dm1 = AVX2_EXTLO(lo);
+	d0 = AVX2_EXTHI(lo);
+	d1 = AVX2_EXTLO(hi);
+	d2 = AVX2_EXTHI(hi);
+	x = _mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0xff)),
+			7);
+	c = _mm256_srai_epi32(_mm256_sub_epi32(d1, dm1), 1);
+	a = _mm256_sub_epi32(d0, d1);
+	a = _mm256_add_epi32(_mm256_add_epi32(a, a), a);
+	a = _mm256_srai_epi32(_mm256_sub_epi32(_mm256_add_epi32(a, d2), dm1),
+			1);
+	b = _mm256_sub_epi32(_mm256_add_epi32(_mm256_sub_epi32(dm1, d0), c),
+			a);
+	a = _mm256_srai_epi32(_mm256_mullo_epi32(a, x), 15);
+	a = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_add_epi32(a, b), x),
+			15);
+	return _mm256_add_epi32(d0, _mm256_srai_epi32(
+			_mm256_mullo_epi32(_mm256_add_epi32(a, c), x), 15));
+}
+
+static inline A2_AVX2 void wtosc_avx2(int16_t *d, int32_t *v,
+		unsigned frames, uint64_t ph, unsigned dph, int quality)
+{
+	unsigned s;
+	uint32_t h[8], l[8];
+	__m256i hi, lo, dhi, dlo, h2;
+	wtosc_lanes(h, l, 8, ph, dph);
+	hi = _mm256_loadu_si256((const __m256i *)h);
+	lo = _mm256_loadu_si256((const __m256i *)l);
+	dhi = _mm256_set1_epi32((dph >> 16) * 8);
+	dlo = _mm256_set1_epi32((dph & 0xffff) * 8);
+	h2 = _mm256_set1_epi32(dph >> 17);
+	for(s = 0; s + 8 <= frames; s += 8)
+	{
+		__m256i r;
+		switch(quality)
+		{
+		  case A2_QLOFI:
+			r = _mm256_slli_epi32(avx2_lerp(d, hi), 1);
+			break;
+		  case A2_QSTANDARD:
+			r = _mm256_add_epi32(avx2_lerp(d, hi),
+					avx2_lerp(d, _mm256_add_epi32(hi, h2)));
+			break;
+		  default:
+			r = _mm256_add_epi32(avx2_hermite(d, hi),
+					avx2_hermite(d,
+					_mm256_add_epi32(hi, h2)));
+			break;
+		}
+		_mm256_storeu_si256((__m256i *)(v + s),
+				_mm256_slli_epi32(r, 7));
+		lo = _mm256_add_epi32(lo, dlo);
+		hi = _mm256_add_epi32(_mm256_add_epi32(hi, dhi),
+				_mm256_srli_epi32(lo, 16));
+		lo = _mm256_and_si256(lo, _mm256_set1_epi32(0xffff));
+	}
+	wtosc_tail(d, v + s, frames - s, ph + (uint64_t)dph * s, dph,
+			quality);
+}
+
+A2_WTKERNELS(avx2, A2_AVX2)
+
+#endif /* A2_SIMD_AVX2 */
+
+
+/*---------------------------------------------------------
+	NEON (AArch64): 4 frames per iteration
+	NOTE: Not yet verified! Only built if A2_DSP_NEON is defined.
+---------------------------------------------------------*/
+#ifdef A2_SIMD_NEON
+
+/* Load d[i - 1] through d[i + 2] for four phases, transposed */
+static inline void neon_load4(int16_t *d, uint32x4_t p, int32x4_t *dm1,
+		int32x4_t *d0, int32x4_t *d1, int32x4_t *d2)
+{
+	uint32_t i[4];
+	int16x4x2_t t01, t23;
+	int32x2x2_t lo, hi;
+	vst1q_u32(i, vshrq_n_u32(p, 8));
+	t01 = vzip_s16(vld1_s16(d + i[0] - 1), vld1_s16(d + i[1] - 1));
+	t23 = vzip_s16(vld1_s16(d + i[2] - 1), vld1_s16(d + i[3] - 1));
+	lo = vzip_s32(vreinterpret_s32_s16(t01.val[0]),
+			vreinterpret_s32_s16(t23.val[0]));
+	hi = vzip_s32(vreinterpret_s32_s16(t01.val[1]),
+			vreinterpret_s32_s16(t23.val[1]));
+	*dm1 = vmovl_s16(vreinterpret_s16_s32(lo.val[0]));
+	*d0 = vmovl_s16(vreinterpret_s16_s32(lo.val[1]));
+	*d1 = vmovl_s16(vreinterpret_s16_s32(hi.val[0]));
+	*d2 = vmovl_s16(vreinterpret_s16_s32(hi.val[1]));
+}
+
+/* a2_Lerp() x 4 */
+static inline int32x4_t neon_lerp(int16_t *d, uint32x4_t p)
+{
+	int32x4_t dm1, d0, d1, d2, x;
+	neon_load4(d, p, &dm1, &d0, &d1, &d2);
+	x = vreinterpretq_s32_u32(vandq_u32(p, vdupq_n_u32(0xff)));
+	return vshrq_n_s32(vmlaq_s32(vmulq_s32(d0,
+			vsubq_s32(vdupq_n_s32(256), x)), d1, x), 8);
+}
+
+/* a2_Hermite() x 4 */
+static inline int32x4_t neon_hermite(int16_t *d, uint32x4_t p)
+{
+	int32x4_t dm1, d0, d1, d2, x, a, b, c;
+	neon_load4(d, p, &dm1, &d0, &d1, &d2);
+	x = vreinterpretq_s32_u32(vshlq_n_u32(vandq_u32(p,
+			vdupq_n_u32(0xff)), 7));
+	c = vshrq_n_s32(vsubq_s32(d1, dm1), 1);
+	a = vmulq_n_s32(vsubq_s32(d0, d1), 3);
+	a = vshrq_n_s32(vsubq_s32(vaddq_s32(a, d2), dm1), 1);
+	b = vsubq_s32(vaddq_s32(vsubq_s32(dm1, d0), c), a);
+	a = vshrq_n_s32(vmulq_s32(a, x), 15);
+	a = vshrq_n_s32(vmulq_s32(vaddq_s32(a, b), x), 15);
+	return vaddq_s32(d0, vshrq_n_s32(vmulq_s32(vaddq_s32(a, c), x), 15));
+}
+
+static inline void wtosc_neon(int16_t *d, int32_t *v, unsigned frames,
+		uint64_t ph, unsigned dph, int quality)
+{
+	unsigned s;
+	uint32_t h[4], l[4];
+	uint32x4_t hi, lo, dhi, dlo, h2;
+	wtosc_lanes(h, l, 4, ph, dph);
+	hi = vld1q_u32(h);
+	lo = vld1q_u32(l);
+	dhi = vdupq_n_u32((dph >> 16) * 4);
+	dlo = vdupq_n_u32((dph & 0xffff) * 4);
+	h2 = vdupq_n_u32(dph >> 17);
+	for(s = 0; s + 4 <= frames; s += 4)
+	{
+		int32x4_t r;
+		switch(quality)
+		{
+		  case A2_QLOFI:
+			r = vshlq_n_s32(neon_lerp(d, hi), 1);
+			break;
+		  case A2_QSTANDARD:
+			r = vaddq_s32(neon_lerp(d, hi),
+					neon_lerp(d, vaddq_u32(hi, h2)));
+			break;
+		  default:
+			r = vaddq_s32(neon_hermite(d, hi),
+					neon_hermite(d, vaddq_u32(hi, h2)));
+			break;
+		}
+		vst1q_s32(v + s, vshlq_n_s32(r, 7));
+		lo = vaddq_u32(lo, dlo);
+		hi = vaddq_u32(vaddq_u32(hi, dhi), vshrq_n_u32(lo, 16));
+		lo = vandq_u32(lo, vdupq_n_u32(0xffff));
+	}
+	wtosc_tail(d, v + s, frames - s, ph + (uint64_t)dph * s, dph,
+			quality);
+}
+
+A2_WTKERNELS(neon, )
+
+#endif /* A2_SIMD_NEON */
+
+
+const A2_wtinterfunc *a2_WTOscKernels(unsigned simd)
+{
+#ifdef A2_SIMD_AVX2
+	if(simd & A2_CPU_AVX2)
+		return wtosc_avx2_kernels;
+#endif
+#ifdef A2_SIMD_SSE2
+	if(simd & A2_CPU_SSE2)
+		return wtosc_sse2_kernels;
+#endif
+#ifdef A2_SIMD_NEON
+	if(simd & A2_CPU_NEON)
+		return wtosc_neon_kernels;
+#endif
+	return NULL;
+}
@@ -0,0 +1,69 @@
+/*
+ * wtoscsimd.h - Audiality 2 wavetable oscillator SIMD kernels
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef A2_WTOSCSIMD_H
+#define A2_WTOSCSIMD_H
+
+#include "a2_units.h"
+
+/*
+ * Interpolation, selected by quality level (A2_quality). This is also the
+ * reference implementation for the SIMD kernels below.
+ *
+ * NOTE: These all return doubled amplitude samples!
+ */
+static inline int wtosc_Inter(int16_t *d, unsigned ph, unsigned dph,
+		int quality)
+{
+	switch(quality)
+	{
+	  case A2_QLOFI:
+		/* Linear interpolation */
+		return a2_Lerp(d, ph) << 1;
+	  case A2_QSTANDARD:
+		/* Linear interpolation with 2x oversampling */
+		return a2_Lerp(d, ph) + a2_Lerp(d, ph + (dph >> 1));
+	  default:
+		/* Hermite interpolation with 2x oversampling */
+		return a2_Hermite(d, ph) + a2_Hermite(d, ph + (dph >> 1));
+	}
+}
+
+/*
+ * Interpolation kernel. Renders 'frames' samples from wave data 'd' into 'v',
+ * starting at phase 'ph' (48:24 fixp, 1.0/sample), stepping 'dph' per frame,
+ * exactly as wtosc_Inter() at the respective quality level would, only scaled
+ * by 128 (8:24 fixp), ready for the A2_dspfuncs gain primitives.
+ *
+ * NOTE: There are no loop or end checks!
+ */
+typedef void (*A2_wtinterfunc)(int16_t *d, int32_t *v, unsigned frames,
+		uint64_t ph, unsigned dph);
+
+/*
+ * Get the kernels for the best instruction set in 'simd' (A2_cpufeatures),
+ * indexed by A2_quality, or NULL if there are none.
+ */
+const A2_wtinterfunc *a2_WTOscKernels(unsigned simd);
+
+#endif /* A2_WTOSCSIMD_H */
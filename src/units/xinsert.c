@@ -24,48 +24,46 @@
 #include "internals.h"
 #include <stdlib.h>
 
-static inline void xi_copy(int32_t *in, int32_t *out, unsigned offset,
-		unsigned frames)
+static inline void xi_copy(A2_unit *u, int32_t *in, int32_t *out,
+		unsigned offset, unsigned frames)
 {
-	int s;
-	for(s = offset; s < offset + frames; ++s)
-		out[s] = in[s];
+	a2_xinsert_cast(u)->state->dsp->Copy(out + offset, in + offset,
+			frames);
 }
 
-static inline void xi_add(int32_t *in, int32_t *out, unsigned offset,
-		unsigned frames)
+static inline void xi_add(A2_unit *u, int32_t *in, int32_t *out,
+		unsigned offset, unsigned frames)
 {
-	int s;
-	for(s = offset; s < offset + frames; ++s)
-		out[s] += in[s];
+	a2_xinsert_cast(u)->state->dsp->Add(out + offset, in + offset,
+			frames);
 }
 
 
 static inline void xi_run_callback(A2_unit *u, A2_xinsert_client *xic,
-		unsigned offset, unsigned frames, int32_t **bufs)
+		unsigned frames, int32_t **bufs)
 {
 	A2_errors res;
 	A2_xinsert *xi = a2_xinsert_cast(u);
-	int32_t *bufp[A2_MAXCHANNELS];
-	int i;
-
-	/* API doesn't support 'offset', so we need adjusted pointers! */
-	for(i = 0; i < u->ninputs; ++i)
-		bufp[i] = bufs[i] + offset;
-
-	if((res = xic->callback(bufp, u->ninputs, frames, xic->userdata)))
+	if((res = xic->callback(bufs, u->ninputs, frames, xic->userdata)))
 		a2r_Error(xi->state, res, "xinsert client callback");
 }
 
 
-static inline void xi_process(A2_unit *u, unsigned o, unsigned f, int add)
+/*
+ * Run the clients over 'frames' (at most A2_XIFRAG) frames, reading from 'ins'
+ * and writing or adding to 'outs'. These point either into the unit's actual
+ * I/O buffers, or, with A2_PROCFLOAT, into 8:24 buffers converted from and to
+ * float by xi_process_float().
+ */
+static inline void xi_process(A2_unit *u, int32_t **ins, int32_t **outs,
+		unsigned frames, int add)
 {
 	int i;
 	A2_xinsert_client *xic;
 	A2_xinsert *xi = a2_xinsert_cast(u);
-	int32_t bufs[A2_MAXCHANNELS][A2_MAXFRAG];
+	int32_t bufs[A2_MAXCHANNELS][A2_XIFRAG];
 	int32_t *bufp[A2_MAXCHANNELS];
-	int32_t obufs[A2_MAXCHANNELS][A2_MAXFRAG];
+	int32_t obufs[A2_MAXCHANNELS][A2_XIFRAG];
 	int32_t *obufp[A2_MAXCHANNELS];
 	int has_inserts = 0;
 
@@ -84,12 +82,12 @@ static inline void xi_process(A2_unit *u, unsigned o, unsigned f, int add)
 	for(i = 0; i < u->ninputs; ++i)
 	{
 		bufp[i] = bufs[i];
-		if(add || (u->inputs[i] != u->outputs[i]))
-			obufp[i] = u->outputs[i];
+		if(add || (ins[i] != outs[i]))
+			obufp[i] = outs[i];
 		else
 			obufp[i] = obufs[i];
 		if(!add)
-			memset(obufp[i], 0, sizeof(int32_t) * A2_MAXFRAG);
+			xi->state->dsp->Clear(obufp[i], frames);
 	}
 
 	for(xic = xi->clients; xic; xic = xic->next)
@@ -97,7 +95,7 @@ static inline void xi_process(A2_unit *u, unsigned o, unsigned f, int add)
 		if(!(xic->flags & A2_XI_WRITE))
 		{
 			/* READ-only client (assume no NOP clients...) */
-			xi_run_callback(u, xic, o, f, u->inputs);
+			xi_run_callback(u, xic, frames, ins);
 			continue;
 		}
 
@@ -105,40 +103,110 @@ static inline void xi_process(A2_unit *u, unsigned o, unsigned f, int add)
 		{
 			/* INSERT (READ/WRITE): Copy the input first! */
 			for(i = 0; i < u->ninputs; ++i)
-				xi_copy(u->inputs[i], bufs[i], o, f);
+				xi_copy(u, ins[i], bufs[i], 0, frames);
 
 			/* Disable built-in bypass! */
 			has_inserts = 1;
 		}
 
 		/* Process! */
-		xi_run_callback(u, xic, o, f, bufp);
+		xi_run_callback(u, xic, frames, bufp);
 
 		/* Mix the output into the "master" output buffers */
 		for(i = 0; i < u->ninputs; ++i)
-			xi_add(bufs[i], obufp[i], o, f);
+			xi_add(u, bufs[i], obufp[i], 0, frames);
 	}
 
 	/* If there are no insert (READ/WRITE) clients, enable bypass! */
 	if(!has_inserts)
 		for(i = 0; i < u->ninputs; ++i)
-			xi_add(u->inputs[i], obufp[i], o, f);
+			xi_add(u, ins[i], obufp[i], 0, frames);
 
 	/* Replace: Write back any output buffers that were... buffered. :-) */
 	if(!add)
 		for(i = 0; i < u->ninputs; ++i)
-			if(obufp[i] != u->outputs[i])
-				xi_copy(obufp[i], u->outputs[i], o, f);
+			if(obufp[i] != outs[i])
+				xi_copy(u, obufp[i], outs[i], 0, frames);
+}
+
+/* Run xi_process() over a subfragment, in chunks of at most A2_XIFRAG frames */
+static inline void xi_process_chunks(A2_unit *u, unsigned o, unsigned f,
+		int add)
+{
+	int i;
+	int32_t *ins[A2_MAXCHANNELS];
+	int32_t *outs[A2_MAXCHANNELS];
+	while(f)
+	{
+		unsigned frames = f < A2_XIFRAG ? f : A2_XIFRAG;
+		for(i = 0; i < u->ninputs; ++i)
+		{
+			ins[i] = u->inputs[i] + o;
+			outs[i] = u->outputs[i] + o;
+		}
+		xi_process(u, ins, outs, frames, add);
+		o += frames;
+		f -= frames;
+	}
 }
 
 static void xi_Process(A2_unit *u, unsigned offset, unsigned frames)
 {
-	xi_process(u, offset, frames, 0);
+	xi_process_chunks(u, offset, frames, 0);
 }
 
 static void xi_ProcessAdd(A2_unit *u, unsigned offset, unsigned frames)
 {
-	xi_process(u, offset, frames, 1);
+	xi_process_chunks(u, offset, frames, 1);
+}
+
+
+/*
+ * A2_PROCFLOAT: The client API is 8:24 fixed point regardless of the
+ * processing mode, so we convert the inputs, process into intermediate
+ * buffers, and convert the result back to float.
+ */
+static inline void xi_process_float(A2_unit *u, unsigned o, unsigned f,
+		int add)
+{
+	int i;
+	const A2_dspfuncs *dsp = a2_xinsert_cast(u)->state->dsp;
+	int32_t ibufs[A2_MAXCHANNELS][A2_XIFRAG];
+	int32_t obufs[A2_MAXCHANNELS][A2_XIFRAG];
+	int32_t *ibufp[A2_MAXCHANNELS];
+	int32_t *obufp[A2_MAXCHANNELS];
+	for(i = 0; i < u->ninputs; ++i)
+	{
+		ibufp[i] = ibufs[i];
+		obufp[i] = obufs[i];
+	}
+	while(f)
+	{
+		unsigned frames = f < A2_XIFRAG ? f : A2_XIFRAG;
+		for(i = 0; i < u->ninputs; ++i)
+			dsp->FloatToFix(ibufs[i], (float *)u->inputs[i] + o,
+					frames);
+		xi_process(u, ibufp, obufp, frames, 0);
+		for(i = 0; i < u->ninputs; ++i)
+			if(add)
+				dsp->FixToFloatAdd((float *)u->outputs[i] + o,
+						obufs[i], frames);
+			else
+				dsp->FixToFloat((float *)u->outputs[i] + o,
+						obufs[i], frames);
+		o += frames;
+		f -= frames;
+	}
+}
+
+static void xi_ProcessF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	xi_process_float(u, offset, frames, 0);
+}
+
+static void xi_ProcessAddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	xi_process_float(u, offset, frames, 1);
 }
 
 
@@ -148,7 +216,7 @@ static void xi_ProcessBypass(A2_unit *u, unsigned offset,
 	int i;
 	for(i = 0; i < u->ninputs; ++i)
 		if(u->inputs[i] != u->outputs[i])
-			xi_copy(u->inputs[i], u->outputs[i], offset, frames);
+			xi_copy(u, u->inputs[i], u->outputs[i], offset, frames);
 }
 
 
@@ -157,15 +225,39 @@ static void xi_ProcessBypassAdd(A2_unit *u, unsigned offset,
 {
 	int i;
 	for(i = 0; i < u->ninputs; ++i)
-		xi_add(u->inputs[i], u->outputs[i], offset, frames);
+		xi_add(u, u->inputs[i], u->outputs[i], offset, frames);
 }
 
 
-/* Install the appropriate Process callback */
+static void xi_ProcessBypassAddF(A2_unit *u, unsigned offset,
+		unsigned frames)
+{
+	int i;
+	const A2_dspfuncs *dsp = a2_xinsert_cast(u)->state->dsp;
+	for(i = 0; i < u->ninputs; ++i)
+		dsp->AddF((float *)u->outputs[i] + offset,
+				(float *)u->inputs[i] + offset, frames);
+}
+
+
+/*
+ * Install the appropriate Process callback
+ *
+ * NOTE: xi_ProcessBypass() is a plain copy, so it works with A2_PROCFLOAT.
+ */
 static void xi_SetProcess(A2_unit *u)
 {
 	A2_xinsert *xi = a2_xinsert_cast(u);
-	if(xi->clients)
+	if(xi->flags & A2_PROCFLOAT)
+	{
+		if(!xi->clients)
+			u->Process = (xi->flags & A2_PROCADD) ?
+					xi_ProcessBypassAddF : xi_ProcessBypass;
+		else
+			u->Process = (xi->flags & A2_PROCADD) ?
+					xi_ProcessAddF : xi_ProcessF;
+	}
+	else if(xi->clients)
 	{
 		if(xi->flags & A2_PROCADD)
 			u->Process = xi_ProcessAdd;
@@ -189,7 +281,7 @@ static A2_errors xi_Initialize(A2_unit *u, A2_vmstate *vms, void *statedata,
 	A2_voice *v = a2_voice_from_vms(vms);
 
 	/* Initialize private fields */
-	xi->state = (A2_state *)statedata;
+	xi->state = a2_VoiceState((A2_state *)statedata, v);
 	xi->flags = flags;
 	xi->clients = NULL;
 	xi->voice = v->handle;
@@ -222,7 +314,7 @@ const A2_unitdesc a2_xinsert_unitdesc =
 {
 	"xinsert",			/* name */
 
-	A2_MATCHIO | A2_XINSERT,	/* flags */
+	A2_MATCHIO | A2_XINSERT | A2_FLOATIO,	/* flags */
 
 	NULL,				/* registers */
 	NULL,				/* coutputs */
@@ -34,6 +34,13 @@ typedef struct A2_state A2_state;
 typedef struct A2_xinsert A2_xinsert;
 typedef struct A2_xinsert_client A2_xinsert_client;
 
+/*
+ * Maximum number of frames per client callback. Longer subfragments are split,
+ * so that the intermediate buffers on the audio thread stack need not be sized
+ * for A2_MAXFRAG.
+ */
+#define	A2_XIFRAG	A2_DEFAULTFRAG
+
 typedef enum A2_xiflags
 {
 	A2_XI_READ =	0x00000100,	/* Client reads from unit inputs */
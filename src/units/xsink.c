@@ -46,6 +46,39 @@ static void xsink_Process(A2_unit *u, unsigned offset, unsigned frames)
 }
 
 
+/* A2_PROCFLOAT: Clients get 8:24 fixed point, as with normal processing. */
+static void xsink_ProcessF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	int i;
+	A2_errors res;
+	A2_xinsert *xi = a2_xinsert_cast(u);
+	A2_xinsert_client *xic = xi->clients;
+	int32_t bufs[A2_MAXCHANNELS][A2_XIFRAG];
+	int32_t *bufp[A2_MAXCHANNELS];
+
+	if(!xic)
+		return;
+
+	for(i = 0; i < u->ninputs; ++i)
+		bufp[i] = bufs[i];
+
+	while(frames)
+	{
+		unsigned f = frames < A2_XIFRAG ? frames : A2_XIFRAG;
+		for(i = 0; i < u->ninputs; ++i)
+			xi->state->dsp->FloatToFix(bufs[i],
+					(float *)u->inputs[i] + offset, f);
+		for(xic = xi->clients; xic; xic = xic->next)
+			if((res = xic->callback(bufp, u->ninputs, f,
+					xic->userdata)))
+				a2r_Error(xi->state, res,
+						"xsink client callback");
+		offset += f;
+		frames -= f;
+	}
+}
+
+
 /* Install the appropriate Process callback */
 static void xsink_SetProcess(A2_unit *u)
 {
@@ -65,7 +98,10 @@ static A2_errors xsink_Initialize(A2_unit *u, A2_vmstate *vms, void *statedata,
 	xi->clients = NULL;
 	xi->voice = v->handle;
 	xi->SetProcess = xsink_SetProcess;
-	u->Process = xsink_Process;
+	if(flags & A2_PROCFLOAT)
+		u->Process = xsink_ProcessF;
+	else
+		u->Process = xsink_Process;
 
 	return A2_OK;
 }
@@ -92,7 +128,7 @@ const A2_unitdesc a2_xsink_unitdesc =
 {
 	"xsink",			/* name */
 
-	A2_XINSERT,			/* flags */
+	A2_XINSERT | A2_FLOATIO,	/* flags */
 
 	NULL,				/* registers */
 	NULL,				/* coutputs */
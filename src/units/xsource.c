@@ -24,43 +24,52 @@
 #include "internals.h"
 #include <stdlib.h>
 
-static inline void xsrc_clear(int32_t *out, unsigned offset, unsigned frames)
+static inline void xsrc_clear(A2_xinsert *xi, int32_t *out, unsigned offset,
+		unsigned frames)
 {
-	memset(out + offset, 0, frames * sizeof(int32_t));
+	xi->state->dsp->Clear(out + offset, frames);
 }
 
 
-static inline void xsrc_add(int32_t *in, int32_t *out, unsigned offset,
+static inline void xsrc_add(A2_xinsert *xi, int32_t *in, int32_t *out,
 		unsigned frames)
 {
-	int s;
-	for(s = offset; s < offset + frames; ++s)
-		out[s] += in[s];
+	xi->state->dsp->Add(out, in, frames);
 }
 
 
+/*
+ * Run the clients into intermediate buffers, in chunks of at most A2_XIFRAG
+ * frames, mixing their output into the unit outputs.
+ */
 static inline void xsrc_process(A2_unit *u, unsigned o, unsigned f, int add)
 {
 	int i;
 	A2_errors res;
 	A2_xinsert *xi = a2_xinsert_cast(u);
 	A2_xinsert_client *xic;
-	int32_t bufs[A2_MAXCHANNELS][A2_MAXFRAG];
+	int32_t bufs[A2_MAXCHANNELS][A2_XIFRAG];
 	int32_t *bufp[A2_MAXCHANNELS];
 	for(i = 0; i < u->noutputs; ++i)
-		if(add)
-			bufp[i] = bufs[i] + o;
-		else
-			bufp[i] = u->outputs[i] + o;
+		bufp[i] = bufs[i];
 	if(!add)
 		for(i = 0; i < u->noutputs; ++i)
-			xsrc_clear(u->outputs[i], o, f);
-	for(xic = xi->clients; xic; xic = xic->next)
+			xsrc_clear(xi, u->outputs[i], o, f);
+	while(f)
 	{
-		if((res = xic->callback(bufp, u->noutputs, f, xic->userdata)))
-			a2r_Error(xi->state, res, "xsource client callback");
-		for(i = 0; i < u->noutputs; ++i)
-			xsrc_add(bufs[i], u->outputs[i], o, f);
+		unsigned frames = f < A2_XIFRAG ? f : A2_XIFRAG;
+		for(xic = xi->clients; xic; xic = xic->next)
+		{
+			if((res = xic->callback(bufp, u->noutputs, frames,
+					xic->userdata)))
+				a2r_Error(xi->state, res,
+						"xsource client callback");
+			for(i = 0; i < u->noutputs; ++i)
+				xsrc_add(xi, bufs[i], u->outputs[i] + o,
+						frames);
+		}
+		o += frames;
+		f -= frames;
 	}
 }
 
@@ -79,6 +88,57 @@ static void xsrc_ProcessAdd(A2_unit *u, unsigned offset, unsigned frames)
 }
 
 
+/*
+ * A2_PROCFLOAT, any number of clients, either mode. The client API is 8:24
+ * fixed point, so clients render into intermediate buffers, which are then
+ * converted and mixed into the float outputs.
+ */
+static inline void xsrc_process_float(A2_unit *u, unsigned o, unsigned f,
+		int add)
+{
+	int i;
+	A2_errors res;
+	A2_xinsert *xi = a2_xinsert_cast(u);
+	A2_xinsert_client *xic;
+	int32_t bufs[A2_MAXCHANNELS][A2_XIFRAG];
+	int32_t *bufp[A2_MAXCHANNELS];
+	for(i = 0; i < u->noutputs; ++i)
+		bufp[i] = bufs[i];
+	if(!add)
+		for(i = 0; i < u->noutputs; ++i)
+			xsrc_clear(xi, u->outputs[i], o, f);
+	while(f)
+	{
+		unsigned frames = f < A2_XIFRAG ? f : A2_XIFRAG;
+		for(xic = xi->clients; xic; xic = xic->next)
+		{
+			if((res = xic->callback(bufp, u->noutputs, frames,
+					xic->userdata)))
+				a2r_Error(xi->state, res,
+						"xsource client callback");
+			for(i = 0; i < u->noutputs; ++i)
+				xi->state->dsp->FixToFloatAdd(
+						(float *)u->outputs[i] + o,
+						bufs[i], frames);
+		}
+		o += frames;
+		f -= frames;
+	}
+}
+
+
+static void xsrc_ProcessF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	xsrc_process_float(u, offset, frames, 0);
+}
+
+
+static void xsrc_ProcessAddF(A2_unit *u, unsigned offset, unsigned frames)
+{
+	xsrc_process_float(u, offset, frames, 1);
+}
+
+
 /* Single client, overwrite mode - no intermediate buffers needed! */
 static void xsrc_ProcessSingle(A2_unit *u, unsigned offset, unsigned frames)
 {
@@ -98,8 +158,9 @@ static void xsrc_ProcessNil(A2_unit *u, unsigned offset,
 		unsigned frames)
 {
 	int i;
+	A2_xinsert *xi = a2_xinsert_cast(u);
 	for(i = 0; i < u->noutputs; ++i)
-		xsrc_clear(u->outputs[i], offset, frames);
+		xsrc_clear(xi, u->outputs[i], offset, frames);
 }
 
 
@@ -109,11 +170,22 @@ static void xsrc_ProcessNilAdd(A2_unit *u, unsigned offset, unsigned frames)
 }
 
 
-/* Install the appropriate Process callback */
+/*
+ * Install the appropriate Process callback
+ *
+ * NOTE: The "Nil" callbacks only clear, so they work with A2_PROCFLOAT.
+ */
 static void xsrc_SetProcess(A2_unit *u)
 {
 	A2_xinsert *xi = a2_xinsert_cast(u);
-	if(xi->clients)
+	if(xi->clients && (xi->flags & A2_PROCFLOAT))
+	{
+		if(xi->flags & A2_PROCADD)
+			u->Process = xsrc_ProcessAddF;
+		else
+			u->Process = xsrc_ProcessF;
+	}
+	else if(xi->clients)
 	{
 		if(xi->flags & A2_PROCADD)
 			u->Process = xsrc_ProcessAdd;
@@ -172,7 +244,7 @@ const A2_unitdesc a2_xsource_unitdesc =
 {
 	"xsource",			/* name */
 
-	A2_XINSERT,			/* flags */
+	A2_XINSERT | A2_FLOATIO,	/* flags */
 
 	NULL,				/* registers */
 	NULL,				/* coutputs */
@@ -0,0 +1,681 @@
+/*
+ * vmjit.c - Audiality 2 VM code to native code translator
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * This is a baseline translator for x86-64 (System V ABI), that stitches
+ * together native code templates for the register arithmetics, comparison and
+ * branch instructions, which make up the bulk of the instructions executed in
+ * typical scripts. Everything else (timing, unit control, voice management,
+ * calls etc) is left to the interpreter, which enters native code whenever it
+ * is about to dispatch an instruction that has been translated.
+ *
+ * Native code register usage:
+ *	rdi	VM register file ('r')
+ *	rsi	Pointer to the VM instruction counter
+ *	rdx	Pointer to the VM register write tracker
+ *	eax, ecx	Scratch registers
+ *
+ * Each translated instruction decrements the instruction counter, exactly like
+ * the interpreter, and if it hits zero, the counter is restored, and native
+ * code returns to the interpreter at that instruction, so that the interpreter
+ * can abort the VM as usual.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "vmjit.h"
+
+#ifdef A2_VM_JIT
+
+#include <sys/mman.h>
+
+/* Max native code size of a translated instruction (bytes/VM code word) */
+#define	A2_JIT_MAXINSSIZE	128
+
+/* Max size of the exit and bail-out stubs (bytes/VM code word) */
+#define	A2_JIT_MAXSTUBSIZE	32
+
+/* Leading padding, so that offset 0 can mean "not translated" */
+#define	A2_JIT_PADDING		16
+
+/* x86 registers and condition codes */
+#define	XAX	0
+#define	XCX	1
+#define	CC_E	0x4
+#define	CC_NE	0x5
+#define	CC_L	0xc
+#define	CC_GE	0xd
+#define	CC_LE	0xe
+#define	CC_G	0xf
+#define	CC_JMP	-1
+
+typedef enum A2_jitfixuptypes
+{
+	A2JF_BRANCH = 0,	/* Branch to VM code position 'pc' */
+	A2JF_BAIL		/* Restore counter and return to interpreter */
+} A2_jitfixuptypes;
+
+typedef struct A2_jitfixup
+{
+	uint32_t	pos;		/* Position of rel32 field in native code */
+	uint16_t	pc;		/* Target VM code position */
+	uint8_t		type;		/* A2_jitfixuptypes */
+} A2_jitfixup;
+
+/* Opcode of the instruction at position 'pc' of function 'fn' */
+#define	A2_OPCODE(fn, pc)	(((A2_instruction *)((fn)->code + (pc)))->opcode)
+
+typedef struct A2_jit
+{
+	uint8_t		*buf;		/* Native code buffer */
+	size_t		pos;		/* Current write position in 'buf' */
+	A2_jitfixup	*fixups;	/* Branch fixups */
+	unsigned	nfixups;	/* Number of fixups in 'fixups' */
+} A2_jit;
+
+
+/*---------------------------------------------------------
+	Code emitters
+---------------------------------------------------------*/
+
+static inline void a2j_B(A2_jit *j, unsigned b)
+{
+	j->buf[j->pos++] = b;
+}
+
+
+static inline void a2j_D(A2_jit *j, uint32_t d)
+{
+	memcpy(j->buf + j->pos, &d, sizeof(d));
+	j->pos += sizeof(d);
+}
+
+
+/* ModR/M + displacement for x86 register 'x' and VM register 'vr' ([rdi+d]) */
+static inline void a2j_Mem(A2_jit *j, unsigned x, unsigned vr)
+{
+	unsigned d = vr * sizeof(int);
+	if(d < 128)
+	{
+		a2j_B(j, 0x47 | (x << 3));
+		a2j_B(j, d);
+	}
+	else
+	{
+		a2j_B(j, 0x87 | (x << 3));
+		a2j_D(j, d);
+	}
+}
+
+
+/* <op> x, [vr] (or [vr], x) */
+static inline void a2j_Op(A2_jit *j, unsigned op, unsigned x, unsigned vr)
+{
+	a2j_B(j, op);
+	a2j_Mem(j, x, vr);
+}
+
+
+/* <op> /ext dword [vr], imm32 */
+static inline void a2j_OpImm(A2_jit *j, unsigned op, unsigned ext,
+		unsigned vr, int imm)
+{
+	a2j_B(j, op);
+	a2j_Mem(j, ext, vr);
+	a2j_D(j, imm);
+}
+
+
+/* movsxd x64, [vr] */
+static inline void a2j_LoadSX(A2_jit *j, unsigned x, unsigned vr)
+{
+	a2j_B(j, 0x48);
+	a2j_Op(j, 0x63, x, vr);
+}
+
+
+/* cmp dword [vr], 0 */
+static inline void a2j_CmpZero(A2_jit *j, unsigned vr)
+{
+	a2j_B(j, 0x83);
+	a2j_Mem(j, 7, vr);
+	a2j_B(j, 0);
+}
+
+
+/* sar rax, 16; mov [vr], eax */
+static inline void a2j_StoreFixp(A2_jit *j, unsigned vr)
+{
+	a2j_B(j, 0x48);
+	a2j_B(j, 0xc1);
+	a2j_B(j, 0xf8);
+	a2j_B(j, 16);
+	a2j_Op(j, 0x89, XAX, vr);
+}
+
+
+/* mov eax, 'pc'; ret */
+static inline void a2j_Return(A2_jit *j, unsigned pc)
+{
+	a2j_B(j, 0xb8);
+	a2j_D(j, pc);
+	a2j_B(j, 0xc3);
+}
+
+
+/* Conditional (or unconditional if 'cc' is CC_JMP) jump, resolved later */
+static void a2j_Jump(A2_jit *j, int cc, A2_jitfixuptypes type, unsigned pc)
+{
+	A2_jitfixup *fx = &j->fixups[j->nfixups++];
+	if(cc == CC_JMP)
+		a2j_B(j, 0xe9);
+	else
+	{
+		a2j_B(j, 0x0f);
+		a2j_B(j, 0x80 | cc);
+	}
+	fx->pos = j->pos;
+	fx->pc = pc;
+	fx->type = type;
+	a2j_D(j, 0);
+}
+
+
+/*
+ * ecx = (r['a'] <cc> r['b']) << 16; r['a'] = ecx
+ *	xor ecx, ecx; mov eax, [a]; cmp eax, [b]; set<cc> cl; shl ecx, 16;
+ *	mov [a], ecx
+ */
+static void a2j_Compare(A2_jit *j, unsigned a, unsigned b, int cc)
+{
+	a2j_B(j, 0x31);
+	a2j_B(j, 0xc9);
+	a2j_Op(j, 0x8b, XAX, a);
+	a2j_Op(j, 0x3b, XAX, b);
+	a2j_B(j, 0x0f);
+	a2j_B(j, 0x90 | cc);
+	a2j_B(j, 0xc1);
+	a2j_B(j, 0xc1);
+	a2j_B(j, 0xe1);
+	a2j_B(j, 16);
+	a2j_Op(j, 0x89, XCX, a);
+}
+
+
+/*
+ * r['a'] = (!!r['a'] <op> !!r['b']) << 16, where 'op' is one of the 8 bit
+ * forms of and (0x20), or (0x08) and xor (0x30)
+ */
+static void a2j_Logic(A2_jit *j, unsigned a, unsigned b, unsigned op)
+{
+	a2j_CmpZero(j, a);
+	a2j_B(j, 0x0f);		/* setne al */
+	a2j_B(j, 0x95);
+	a2j_B(j, 0xc0);
+	a2j_CmpZero(j, b);
+	a2j_B(j, 0x0f);		/* setne cl */
+	a2j_B(j, 0x95);
+	a2j_B(j, 0xc1);
+	a2j_B(j, op);		/* <op> al, cl */
+	a2j_B(j, 0xc8);
+	a2j_B(j, 0x0f);		/* movzx eax, al */
+	a2j_B(j, 0xb6);
+	a2j_B(j, 0xc0);
+	a2j_B(j, 0xc1);		/* shl eax, 16 */
+	a2j_B(j, 0xe0);
+	a2j_B(j, 16);
+	a2j_Op(j, 0x89, XAX, a);
+}
+
+
+/*
+ * a2_RTMark() for VM register 'vr':
+ *	bt qword [rdx], vr
+ *	jc .done
+ *	bts qword [rdx], vr
+ *	mov eax, [rdx + position]
+ *	mov byte [rdx + rax + regs], vr
+ *	add dword [rdx + position], 1
+ * .done:
+ */
+static void a2j_RTMark(A2_jit *j, unsigned vr)
+{
+	unsigned pos = offsetof(A2_regtracker, position);
+	unsigned regs = offsetof(A2_regtracker, regs);
+	a2j_B(j, 0x48);
+	a2j_B(j, 0x0f);
+	a2j_B(j, 0xba);
+	a2j_B(j, 0x22);
+	a2j_B(j, vr);
+	a2j_B(j, 0x72);
+	a2j_B(j, 17);
+	a2j_B(j, 0x48);
+	a2j_B(j, 0x0f);
+	a2j_B(j, 0xba);
+	a2j_B(j, 0x2a);
+	a2j_B(j, vr);
+	a2j_B(j, 0x8b);
+	a2j_B(j, 0x42);
+	a2j_B(j, pos);
+	a2j_B(j, 0xc6);
+	a2j_B(j, 0x44);
+	a2j_B(j, 0x02);
+	a2j_B(j, regs);
+	a2j_B(j, vr);
+	a2j_B(j, 0x83);
+	a2j_B(j, 0x42);
+	a2j_B(j, pos);
+	a2j_B(j, 1);
+}
+
+
+/*---------------------------------------------------------
+	Translator
+---------------------------------------------------------*/
+
+/* Condition code for Jxx and fused compare instructions */
+static int a2j_CC(A2_opcodes op)
+{
+	switch(op)
+	{
+	  case OP_JZ:
+	  case OP_EQR:
+	  case OP_EQRJZ:
+	  case OP_EQRJNZ:
+		return CC_E;
+	  case OP_JNZ:
+	  case OP_NER:
+	  case OP_NERJZ:
+	  case OP_NERJNZ:
+		return CC_NE;
+	  case OP_JG:
+	  case OP_GR:
+	  case OP_GRJZ:
+	  case OP_GRJNZ:
+		return CC_G;
+	  case OP_JL:
+	  case OP_LR:
+	  case OP_LRJZ:
+	  case OP_LRJNZ:
+		return CC_L;
+	  case OP_JGE:
+	  case OP_GER:
+	  case OP_GERJZ:
+	  case OP_GERJNZ:
+		return CC_GE;
+	  case OP_JLE:
+	  case OP_LER:
+	  case OP_LERJZ:
+	  case OP_LERJNZ:
+		return CC_LE;
+	  default:
+		return CC_JMP;
+	}
+}
+
+
+/* Returns 1 if the instruction at position 'pc' in 'fn' can be translated */
+static int a2j_CanTranslate(A2_function *fn, unsigned pc)
+{
+	A2_instruction *ins = (A2_instruction *)(fn->code + pc);
+	A2_opcodes op = a2_PlainOp(ins->opcode);
+	switch(op)
+	{
+	  case OP_JUMP:
+	  case OP_LOOP:
+	  case OP_JZ:
+	  case OP_JNZ:
+	  case OP_JG:
+	  case OP_JL:
+	  case OP_JGE:
+	  case OP_JLE:
+	  case OP_GRJZ:
+	  case OP_LRJZ:
+	  case OP_GERJZ:
+	  case OP_LERJZ:
+	  case OP_EQRJZ:
+	  case OP_NERJZ:
+	  case OP_GRJNZ:
+	  case OP_LRJNZ:
+	  case OP_GERJNZ:
+	  case OP_LERJNZ:
+	  case OP_EQRJNZ:
+	  case OP_NERJNZ:
+	  {
+		/* Only branches to valid positions, just in case... */
+		int to = (int)pc + (int16_t)ins->a2;
+		return (to >= 0) && (to < fn->size);
+	  }
+	  case OP_LOAD:
+	  case OP_LOADR:
+	  case OP_ADD:
+	  case OP_ADDR:
+	  case OP_SUBR:
+	  case OP_MUL:
+	  case OP_MULR:
+	  case OP_NEGR:
+	  case OP_GR:
+	  case OP_LR:
+	  case OP_GER:
+	  case OP_LER:
+	  case OP_EQR:
+	  case OP_NER:
+	  case OP_ANDR:
+	  case OP_ORR:
+	  case OP_XORR:
+	  case OP_NOTR:
+	  case OP_LDADDR:
+	  case OP_LDSUBR:
+	  case OP_LDMULR:
+	  case OP_LDADD:
+		return 1;
+	  default:
+		return 0;
+	}
+}
+
+
+/* Emit native code for the instruction at 'pc', which must be translatable */
+static void a2j_Instruction(A2_jit *j, A2_function *fn, unsigned pc)
+{
+	A2_instruction *ins = (A2_instruction *)(fn->code + pc);
+	A2_opcodes op = a2_PlainOp(ins->opcode);
+	unsigned to = pc + (int16_t)ins->a2;
+
+	/* sub dword [rsi], 1; jz <bail out> */
+	a2j_B(j, 0x83);
+	a2j_B(j, 0x2e);
+	a2j_B(j, 1);
+	a2j_Jump(j, CC_E, A2JF_BAIL, pc);
+
+	/* Control register write variants */
+	if(op != ins->opcode)
+		a2j_RTMark(j, ins->a1);
+
+	switch(op)
+	{
+	  case OP_JUMP:
+		a2j_Jump(j, CC_JMP, A2JF_BRANCH, to);
+		break;
+	  case OP_LOOP:
+		a2j_OpImm(j, 0x81, 5, ins->a1, 65536);
+		a2j_CmpZero(j, ins->a1);
+		a2j_Jump(j, CC_G, A2JF_BRANCH, to);
+		break;
+	  case OP_JZ:
+	  case OP_JNZ:
+	  case OP_JG:
+	  case OP_JL:
+	  case OP_JGE:
+	  case OP_JLE:
+		a2j_CmpZero(j, ins->a1);
+		a2j_Jump(j, a2j_CC(op), A2JF_BRANCH, to);
+		break;
+	  case OP_GRJZ:
+	  case OP_LRJZ:
+	  case OP_GERJZ:
+	  case OP_LERJZ:
+	  case OP_EQRJZ:
+	  case OP_NERJZ:
+	  case OP_GRJNZ:
+	  case OP_LRJNZ:
+	  case OP_GERJNZ:
+	  case OP_LERJNZ:
+	  case OP_EQRJNZ:
+	  case OP_NERJNZ:
+		a2j_Compare(j, ins->a1, ins->a3, a2j_CC(op));
+		a2j_B(j, 0x85);		/* test ecx, ecx */
+		a2j_B(j, 0xc9);
+		a2j_Jump(j, op < OP_GRJNZ ? CC_E : CC_NE, A2JF_BRANCH, to);
+		break;
+	  case OP_LOAD:
+		a2j_OpImm(j, 0xc7, 0, ins->a1, ins->a3);
+		break;
+	  case OP_LOADR:
+		a2j_Op(j, 0x8b, XAX, ins->a2);
+		a2j_Op(j, 0x89, XAX, ins->a1);
+		break;
+	  case OP_ADD:
+		a2j_OpImm(j, 0x81, 0, ins->a1, ins->a3);
+		break;
+	  case OP_ADDR:
+		a2j_Op(j, 0x8b, XAX, ins->a2);
+		a2j_Op(j, 0x01, XAX, ins->a1);
+		break;
+	  case OP_SUBR:
+		a2j_Op(j, 0x8b, XAX, ins->a2);
+		a2j_Op(j, 0x29, XAX, ins->a1);
+		break;
+	  case OP_MUL:
+		a2j_LoadSX(j, XAX, ins->a1);
+		a2j_B(j, 0x48);		/* imul rax, rax, imm32 */
+		a2j_B(j, 0x69);
+		a2j_B(j, 0xc0);
+		a2j_D(j, ins->a3);
+		a2j_StoreFixp(j, ins->a1);
+		break;
+	  case OP_MULR:
+		a2j_LoadSX(j, XAX, ins->a1);
+		a2j_LoadSX(j, XCX, ins->a2);
+		a2j_B(j, 0x48);		/* imul rax, rcx */
+		a2j_B(j, 0x0f);
+		a2j_B(j, 0xaf);
+		a2j_B(j, 0xc1);
+		a2j_StoreFixp(j, ins->a1);
+		break;
+	  case OP_NEGR:
+		a2j_Op(j, 0x8b, XAX, ins->a2);
+		a2j_B(j, 0xf7);		/* neg eax */
+		a2j_B(j, 0xd8);
+		a2j_Op(j, 0x89, XAX, ins->a1);
+		break;
+	  case OP_GR:
+	  case OP_LR:
+	  case OP_GER:
+	  case OP_LER:
+	  case OP_EQR:
+	  case OP_NER:
+		a2j_Compare(j, ins->a1, ins->a2, a2j_CC(op));
+		break;
+	  case OP_ANDR:
+		a2j_Logic(j, ins->a1, ins->a2, 0x20);
+		break;
+	  case OP_ORR:
+		a2j_Logic(j, ins->a1, ins->a2, 0x08);
+		break;
+	  case OP_XORR:
+		a2j_Logic(j, ins->a1, ins->a2, 0x30);
+		break;
+	  case OP_NOTR:
+		a2j_B(j, 0x31);		/* xor eax, eax */
+		a2j_B(j, 0xc0);
+		a2j_CmpZero(j, ins->a2);
+		a2j_B(j, 0x0f);		/* sete al */
+		a2j_B(j, 0x94);
+		a2j_B(j, 0xc0);
+		a2j_B(j, 0xc1);		/* shl eax, 16 */
+		a2j_B(j, 0xe0);
+		a2j_B(j, 16);
+		a2j_Op(j, 0x89, XAX, ins->a1);
+		break;
+	  /*
+	   * NOTE: The fused instructions write the target register before
+	   *       reading the second operand, as they may be the same register!
+	   */
+	  case OP_LDADDR:
+	  case OP_LDSUBR:
+		a2j_Op(j, 0x8b, XAX, ins->a2 & 0xff);
+		a2j_Op(j, 0x89, XAX, ins->a1);
+		a2j_Op(j, op == OP_LDADDR ? 0x03 : 0x2b, XAX, ins->a2 >> 8);
+		a2j_Op(j, 0x89, XAX, ins->a1);
+		break;
+	  case OP_LDMULR:
+		a2j_LoadSX(j, XAX, ins->a2 & 0xff);
+		a2j_Op(j, 0x89, XAX, ins->a1);
+		a2j_LoadSX(j, XCX, ins->a2 >> 8);
+		a2j_B(j, 0x48);		/* imul rax, rcx */
+		a2j_B(j, 0x0f);
+		a2j_B(j, 0xaf);
+		a2j_B(j, 0xc1);
+		a2j_StoreFixp(j, ins->a1);
+		break;
+	  case OP_LDADD:
+		a2j_Op(j, 0x8b, XAX, ins->a2);
+		a2j_B(j, 0x05);		/* add eax, imm32 */
+		a2j_D(j, ins->a3);
+		a2j_Op(j, 0x89, XAX, ins->a1);
+		break;
+	  default:
+		break;
+	}
+}
+
+
+/*
+ * Resolve branches to translated instructions, and generate stubs for
+ * branches to instructions that are not translated, and for bailing out.
+ * 'stubs' is scratch space for 2 * fn->size stub offsets.
+ */
+static void a2j_Resolve(A2_jit *j, A2_native *n, A2_function *fn,
+		uint32_t *stubs)
+{
+	unsigned i;
+	for(i = 0; i < j->nfixups; ++i)
+	{
+		A2_jitfixup *fx = &j->fixups[i];
+		uint32_t to;
+		int32_t rel;
+		if(fx->type == A2JF_BAIL)
+		{
+			/* add dword [rsi], 1; mov eax, pc; ret */
+			if(!(to = stubs[fn->size + fx->pc]))
+			{
+				to = stubs[fn->size + fx->pc] = j->pos;
+				a2j_B(j, 0x83);
+				a2j_B(j, 0x06);
+				a2j_B(j, 1);
+				a2j_Return(j, fx->pc);
+			}
+		}
+		else if(!(to = n->entry[fx->pc]))
+		{
+			/* mov eax, pc; ret */
+			if(!(to = stubs[fx->pc]))
+			{
+				to = stubs[fx->pc] = j->pos;
+				a2j_Return(j, fx->pc);
+			}
+		}
+		rel = (int32_t)to - (int32_t)(fx->pos + 4);
+		memcpy(j->buf + fx->pos, &rel, sizeof(rel));
+	}
+}
+
+
+A2_native *a2_Translate(A2_function *fn)
+{
+	A2_jit j;
+	A2_native *n;
+	uint32_t *stubs;
+	unsigned i, next, count = 0;
+	void *mem;
+	if(!(n = (A2_native *)calloc(1, sizeof(A2_native) +
+			fn->size * sizeof(uint32_t))))
+		return NULL;
+
+	/* Find out what we can translate */
+	for(i = 0; i < fn->size; i += a2_InsSize(A2_OPCODE(fn, i)))
+		if(a2j_CanTranslate(fn, i))
+		{
+			n->entry[i] = 1;
+			++count;
+		}
+	if(!count)
+	{
+		free(n);
+		return NULL;
+	}
+
+	j.pos = 0;
+	j.nfixups = 0;
+	j.buf = (uint8_t *)malloc(A2_JIT_PADDING + fn->size *
+			(A2_JIT_MAXINSSIZE + A2_JIT_MAXSTUBSIZE));
+	j.fixups = (A2_jitfixup *)malloc(2 * count * sizeof(A2_jitfixup));
+	stubs = (uint32_t *)calloc(2 * fn->size, sizeof(uint32_t));
+	if(!j.buf || !j.fixups || !stubs)
+	{
+		free(j.buf);
+		free(j.fixups);
+		free(stubs);
+		free(n);
+		return NULL;
+	}
+	while(j.pos < A2_JIT_PADDING)
+		a2j_B(&j, 0xcc);	/* int3 */
+
+	/* Translate! */
+	for(i = 0; i < fn->size; i = next)
+	{
+		next = i + a2_InsSize(A2_OPCODE(fn, i));
+		if(!n->entry[i])
+			continue;
+		n->entry[i] = j.pos;
+		a2j_Instruction(&j, fn, i);
+		if((next >= fn->size) || !n->entry[next])
+			a2j_Return(&j, next);
+	}
+	a2j_Resolve(&j, n, fn, stubs);
+	free(stubs);
+	free(j.fixups);
+
+	/* Install the code in executable memory */
+	mem = mmap(NULL, j.pos, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mem == MAP_FAILED)
+	{
+		free(j.buf);
+		free(n);
+		return NULL;
+	}
+	memcpy(mem, j.buf, j.pos);
+	free(j.buf);
+	if(mprotect(mem, j.pos, PROT_READ | PROT_EXEC))
+	{
+		munmap(mem, j.pos);
+		free(n);
+		return NULL;
+	}
+	n->code = (uint8_t *)mem;
+	n->size = j.pos;
+	return n;
+}
+
+
+void a2_FreeNative(A2_native *n)
+{
+	if(!n)
+		return;
+	munmap(n->code, n->size);
+	free(n);
+}
+
+#endif /* A2_VM_JIT */
@@ -0,0 +1,67 @@
+/*
+ * vmjit.h - Audiality 2 VM code to native code translator
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef A2_VMJIT_H
+#define A2_VMJIT_H
+
+#include "internals.h"
+
+#ifdef A2_VM_JIT
+
+/*
+ * Native code for a VM function.
+ *
+ * Translated instructions are stitched together from per-opcode templates, so
+ * that the native code can be entered at any translated instruction, and runs
+ * until it reaches an instruction that is not translated. 'entry' maps VM code
+ * positions to offsets into 'code', where 0 means "not translated."
+ */
+struct A2_native
+{
+	uint8_t		*code;		/* Native code (executable) */
+	size_t		size;		/* Size of 'code' (bytes) */
+	uint32_t	entry[1];	/* VM code position to 'code' offset map */
+};
+
+/*
+ * Native code entry point, as found at 'code' + 'entry[pc]'.
+ *
+ * 'r' is the VM register file, 'inscount' is the VM instruction counter, and
+ * 'rt' is the register write tracker of the VM. Returns the position of the
+ * next instruction for the interpreter to execute, which is either one that
+ * has no native code, or one that the interpreter needs to handle, such as a
+ * division by zero, or running into A2_INSLIMIT.
+ */
+typedef unsigned (*A2_nativefunc)(int *r, unsigned *inscount,
+		A2_regtracker *rt);
+
+/*
+ * Translate the VM code of function 'fn' into native code. Returns NULL if
+ * nothing could be translated, or if we ran out of memory.
+ */
+A2_native *a2_Translate(A2_function *fn);
+
+void a2_FreeNative(A2_native *n);
+
+#endif /* A2_VM_JIT */
+
+#endif /* A2_VMJIT_H */
@@ -75,7 +75,7 @@ static A2_errors a2_wave_alloc(A2_wave *w, unsigned length)
 		A2_wave_wave *ww = &w->d.wave;
 		int size = (length + (1 << i) - 1) >> i;
 		ww->size[i] = size;
-		size = A2_WAVEPRE + size + A2_WAVEPOST;
+		size = A2_WAVEPRE + size + ww->post;
 		if(w->flags & A2_CLEAR)
 			ww->data[i] = (int16_t *)calloc(size, sizeof(int16_t));
 		else
@@ -95,13 +95,13 @@ static void a2_fix_pad(A2_wave *w, unsigned miplevel)
 	{
 		int i;
 		memcpy(d, d + size, A2_WAVEPRE * 2);
-		for(i = 0; i < A2_WAVEPOST; ++i)
+		for(i = 0; i < w->d.wave.post; ++i)
 			d[A2_WAVEPRE + size + i] = d[A2_WAVEPRE + i % size];
 	}
 	else
 	{
 		memset(d, 0, A2_WAVEPRE * 2);
-		memset(d + A2_WAVEPRE + size, 0, A2_WAVEPOST * 2);
+		memset(d + A2_WAVEPRE + size, 0, w->d.wave.post * 2);
 	}
 }
 
@@ -143,7 +143,7 @@ static void a2_render_mipmaps(A2_wave *w)
 			printf("\t%d", d[s]);
 		printf("\n");
 		printf("(");
-		for(s = 0; s < A2_WAVEPOST; ++s)
+		for(s = 0; s < w->d.wave.post; ++s)
 			printf("\t%d", d[w->d.wave.size[i] + s]);
 		printf("\t)\n");
 	}
@@ -603,6 +603,7 @@ A2_handle a2_NewWave(A2_interface *i, A2_wavetypes wt, unsigned period,
 	w->type = wt;
 	w->flags = flags;
 	w->period = period;
+	w->d.wave.post = st->ss->wavepost;
 	switch(w->type)
 	{
 	  case A2_WOFF:
@@ -0,0 +1,501 @@
+/*
+ * workers.c - Audiality 2 parallel voice processing
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdlib.h>
+#include "workers.h"
+
+
+/*---------------------------------------------------------
+	Lane state management
+---------------------------------------------------------*/
+
+static A2_lane *a2_OpenLane(A2_state *st)
+{
+	A2_lane *l = (A2_lane *)calloc(1, sizeof(A2_lane));
+	A2_state *ls;
+	if(!l)
+		return NULL;
+	ls = &l->state;
+	ls->lanemaster = st;
+	ls->ss = st->ss;
+	ls->interfaces = st->interfaces;
+	ls->unitstate = st->unitstate;
+	ls->rootvoice = st->rootvoice;
+	ls->config = st->config;
+	ls->audio = st->audio;
+	ls->sys = st->sys;
+	ls->toapi = st->toapi;
+	ls->msdur = st->msdur;
+	ls->fragment = st->fragment;
+	ls->blocksize = st->blocksize;
+	ls->simd = st->simd;
+	ls->dsp = st->dsp;
+	return l;
+}
+
+
+/* Pass any lane resources and counts over to the master state, and free 'l' */
+static void a2_CloseLane(A2_state *st, A2_lane *l)
+{
+	A2_state *ls = &l->state;
+	int j;
+	for(j = 0; j < A2_NESTLIMIT; ++j)
+	{
+		if(ls->scratch[j])
+			a2_FreeBus(st, ls->scratch[j]);
+		if(ls->fadebus[j])
+			a2_FreeBus(st, ls->fadebus[j]);
+		if(l->bus[j])
+			a2_FreeBus(st, l->bus[j]);
+	}
+	while(ls->blockpool)
+	{
+		A2_block *b = ls->blockpool;
+		ls->blockpool = b->next;
+		a2_FreeBlock(st, b);
+	}
+	while(ls->eventpool)
+	{
+		A2_event *e = ls->eventpool;
+		ls->eventpool = e->next;
+		a2_FreeEvent(st, e);
+	}
+	for(j = 0; j < A2_VOICECLASSES; ++j)
+		while(ls->voicepool[j])
+		{
+			A2_voice *v = ls->voicepool[j];
+			ls->voicepool[j] = v->next;
+			v->next = st->voicepool[j];
+			st->voicepool[j] = v;
+		}
+	st->activevoices += ls->activevoices;
+	st->suspendedvoices += ls->suspendedvoices;
+	st->fadingvoices += ls->fadingvoices;
+	st->stolenvoices += ls->stolenvoices;
+	st->instructions += ls->instructions;
+	free(l);
+}
+
+
+/* Update the timing and other info of lane state 'ls' before a fork */
+static inline void a2_SyncLane(A2_state *st, A2_state *ls)
+{
+	ls->interfaces = st->interfaces;
+	ls->now_frames = st->now_frames;
+	ls->now_ticks = st->now_ticks;
+	ls->now_guard = st->now_guard;
+	ls->now_fragstart = st->now_fragstart;
+	ls->eventseq = st->eventseq;
+}
+
+
+/* Add the counts of lane state 'ls' to the master state after a fork */
+static inline void a2_MergeLane(A2_state *st, A2_state *ls)
+{
+	st->activevoices += ls->activevoices;
+	ls->activevoices = 0;
+	st->suspendedvoices += ls->suspendedvoices;
+	ls->suspendedvoices = 0;
+	st->fadingvoices += ls->fadingvoices;
+	ls->fadingvoices = 0;
+	st->stolenvoices += ls->stolenvoices;
+	ls->stolenvoices = 0;
+	st->instructions += ls->instructions;
+	ls->instructions = 0;
+	if(ls->last_rt_error)
+	{
+		st->last_rt_error = ls->last_rt_error;
+		ls->last_rt_error = A2_OK;
+	}
+
+	/*
+	 * Events sent after the fork must sort after any events sent by the
+	 * lanes, so we continue from the highest sequence number used.
+	 */
+	if((int)(ls->eventseq - st->eventseq) > 0)
+		st->eventseq = ls->eventseq;
+}
+
+
+A2_state *a2_VoiceState(A2_state *st, A2_voice *v)
+{
+	if(!st->workers || !v->lane || (v->lane == A2_LANEPENDING))
+		return st;
+	return &st->workers->lanes[v->lane - 1]->state;
+}
+
+
+/*---------------------------------------------------------
+	Pools
+---------------------------------------------------------*/
+
+void a2_LaneLock(A2_state *st)
+{
+	a2_MutexLock(&st->lanemaster->workers->lock);
+}
+
+
+void a2_LaneUnlock(A2_state *st)
+{
+	a2_MutexUnlock(&st->lanemaster->workers->lock);
+}
+
+
+A2_block *a2_LaneNewBlock(A2_state *st)
+{
+	A2_state *ms = st->lanemaster;
+	A2_block *b;
+	a2_MutexLock(&ms->workers->lock);
+	if((b = ms->blockpool))
+		ms->blockpool = b->next;
+	else if(!(b = (A2_block *)a2r_TakeReserve(ms, A2_BLOCKPOOL)))
+		b = ms->sys->RTAlloc(ms->sys, ms->blocksize);
+	a2_MutexUnlock(&ms->workers->lock);
+	return b;
+}
+
+
+A2_event *a2_LaneNewEvent(A2_state *st)
+{
+	A2_state *ms = st->lanemaster;
+	A2_event *e;
+	a2_MutexLock(&ms->workers->lock);
+	if((e = ms->eventpool))
+		ms->eventpool = e->next;
+	else if(!(e = (A2_event *)a2r_TakeReserve(ms, A2_EVENTPOOL)) &&
+			(e = ms->sys->RTAlloc(ms->sys, sizeof(A2_event))))
+	{
+		EVLEAKTRACK(++ms->numevents;)
+	}
+	a2_MutexUnlock(&ms->workers->lock);
+	return e;
+}
+
+
+A2_voice *a2_LaneNewVoice(A2_state *st, unsigned vclass)
+{
+	A2_state *ms = st->lanemaster;
+	A2_voice *v;
+	a2_MutexLock(&ms->workers->lock);
+	if((v = ms->voicepool[vclass]))
+		ms->voicepool[vclass] = v->next;
+	else
+		v = a2_VoiceAlloc(ms, vclass);
+	a2_MutexUnlock(&ms->workers->lock);
+	return v;
+}
+
+
+void *a2_RTAlloc(A2_state *st, unsigned size)
+{
+	A2_state *ms = st->lanemaster ? st->lanemaster : st;
+	void *p;
+	if(!ms->workers)
+		return ms->sys->RTAlloc(ms->sys, size);
+	a2_MutexLock(&ms->workers->lock);
+	p = ms->sys->RTAlloc(ms->sys, size);
+	a2_MutexUnlock(&ms->workers->lock);
+	return p;
+}
+
+
+void a2_RTFree(A2_state *st, void *block)
+{
+	A2_state *ms = st->lanemaster ? st->lanemaster : st;
+	if(!ms->workers)
+	{
+		ms->sys->RTFree(ms->sys, block);
+		return;
+	}
+	a2_MutexLock(&ms->workers->lock);
+	ms->sys->RTFree(ms->sys, block);
+	a2_MutexUnlock(&ms->workers->lock);
+}
+
+
+void a2_ReclaimLanePools(A2_state *st)
+{
+	A2_workers *w = st->workers;
+	unsigned i, j;
+	for(i = 0; i < A2_RENDERLANES; ++i)
+	{
+		A2_state *ls = &w->lanes[i]->state;
+		if(!st->blockpool && ls->blockpool)
+		{
+			st->blockpool = ls->blockpool;
+			ls->blockpool = NULL;
+		}
+		if(!st->eventpool && ls->eventpool)
+		{
+			st->eventpool = ls->eventpool;
+			ls->eventpool = NULL;
+		}
+		for(j = 0; j < A2_VOICECLASSES; ++j)
+			if(!st->voicepool[j] && ls->voicepool[j])
+			{
+				st->voicepool[j] = ls->voicepool[j];
+				ls->voicepool[j] = NULL;
+			}
+	}
+}
+
+
+/*---------------------------------------------------------
+	Worker threads
+---------------------------------------------------------*/
+
+/* Grab and process lanes of fork 'generation', until there are none left */
+static void a2_WorkerRun(A2_workers *w, unsigned generation)
+{
+	while(1)
+	{
+		A2_lane *l;
+		A2_voice *group;
+		unsigned offset, frames;
+		a2_MutexLock(&w->forklock);
+		if((w->generation != generation) || (w->nextjob >= w->njobs))
+		{
+			a2_MutexUnlock(&w->forklock);
+			return;
+		}
+		l = w->lanes[w->jobs[w->nextjob++]];
+		group = w->group;
+		offset = w->offset;
+		frames = w->frames;
+		a2_MutexUnlock(&w->forklock);
+
+		a2_ProcessLane(l, group, offset, frames);
+
+		a2_MutexLock(&w->forklock);
+		if(++w->done == w->njobs)
+			a2_CondBroadcast(&w->finished);
+		a2_MutexUnlock(&w->forklock);
+	}
+}
+
+
+static void a2_WorkerThread(void *data)
+{
+	A2_workers *w = (A2_workers *)data;
+	unsigned generation;
+	a2_MutexLock(&w->forklock);
+	generation = w->generation;
+	while(!w->quit)
+	{
+		if(w->generation == generation)
+		{
+			a2_CondWait(&w->wake, &w->forklock);
+			continue;
+		}
+		generation = w->generation;
+		a2_MutexUnlock(&w->forklock);
+		a2_WorkerRun(w, generation);
+		a2_MutexLock(&w->forklock);
+	}
+	a2_MutexUnlock(&w->forklock);
+}
+
+
+static void a2_StopWorkers(A2_workers *w)
+{
+	unsigned i;
+	if(!w->nthreads)
+		return;
+	a2_MutexLock(&w->forklock);
+	w->quit = 1;
+	a2_CondBroadcast(&w->wake);
+	a2_MutexUnlock(&w->forklock);
+	for(i = 0; i < w->nthreads; ++i)
+		a2_ThreadJoin(&w->thread[i]);
+	w->nthreads = 0;
+	w->quit = 0;
+}
+
+
+static A2_errors a2_StartWorkers(A2_workers *w, unsigned count)
+{
+	A2_errors res;
+	while(w->nthreads < count)
+	{
+		if((res = a2_ThreadStart(&w->thread[w->nthreads],
+				a2_WorkerThread, w)))
+			return res;
+		++w->nthreads;
+	}
+	return A2_OK;
+}
+
+
+/*---------------------------------------------------------
+	Open/close
+---------------------------------------------------------*/
+
+static A2_errors a2_OpenWorkers(A2_state *st)
+{
+	A2_errors res;
+	unsigned i;
+	A2_workers *w = (A2_workers *)calloc(1, sizeof(A2_workers));
+	if(!w)
+		return A2_OOMEMORY;
+	w->master = st;
+	if((res = a2_MutexOpen(&w->lock)))
+	{
+		free(w);
+		return res;
+	}
+	if((res = a2_MutexOpen(&w->forklock)))
+	{
+		a2_MutexClose(&w->lock);
+		free(w);
+		return res;
+	}
+	a2_CondOpen(&w->wake);
+	a2_CondOpen(&w->finished);
+	st->workers = w;
+	for(i = 0; i < A2_RENDERLANES; ++i)
+		if(!(w->lanes[i] = a2_OpenLane(st)))
+		{
+			a2_CloseWorkers(st);
+			return A2_OOMEMORY;
+		}
+	return A2_OK;
+}
+
+
+void a2_CloseWorkers(A2_state *st)
+{
+	A2_workers *w = st->workers;
+	unsigned i;
+	if(!w)
+		return;
+	a2_StopWorkers(w);
+	for(i = 0; i < A2_RENDERLANES; ++i)
+		if(w->lanes[i])
+			a2_CloseLane(st, w->lanes[i]);
+	a2_CondClose(&w->finished);
+	a2_CondClose(&w->wake);
+	a2_MutexClose(&w->forklock);
+	a2_MutexClose(&w->lock);
+	free(w);
+	st->workers = NULL;
+}
+
+
+A2_errors a2_SetRenderThreads(A2_state *st, unsigned threads)
+{
+	A2_errors res;
+	A2_workers *w;
+	if(threads > A2_RENDERLANES)
+		return A2_VALUERANGE;
+
+	/* The lanes have no VM profiler counters of their own */
+	if(threads && st->prof)
+		return A2_NOTIMPLEMENTED;
+
+	if(!st->workers)
+	{
+		if(!threads)
+			return A2_OK;
+		if((res = a2_OpenWorkers(st)))
+			return res;
+	}
+	w = st->workers;
+	w->threads = threads;
+	if(threads && (w->nthreads == threads - 1))
+		return A2_OK;
+	a2_StopWorkers(w);
+	if(threads > 1)
+		return a2_StartWorkers(w, threads - 1);
+	return A2_OK;
+}
+
+
+/*---------------------------------------------------------
+	Processing
+---------------------------------------------------------*/
+
+void a2_AssignLane(A2_state *st, A2_voice *parent, A2_voice *v)
+{
+	A2_workers *w = st->workers;
+	A2_bus **b = w->lanes[w->nextlane]->bus + parent->nestlevel;
+	v->lane = 0;
+	if(v->flags & A2_PARALLEL)
+		return;
+	if(!*b)
+	{
+		if(!(*b = a2_AllocBus(st, parent->noutputs)))
+			return;
+	}
+	else if(!a2_ReallocBus(st, *b, parent->noutputs))
+		return;
+	v->lane = w->nextlane + 1;
+	v->outputs = (*b)->buffers;
+	w->nextlane = (w->nextlane + 1) % A2_RENDERLANES;
+}
+
+
+void a2_RunLanes(A2_state *st, A2_voice *group, uint32_t lanes,
+		unsigned offset, unsigned frames)
+{
+	A2_workers *w = st->workers;
+	unsigned i, n = 0;
+	for(i = 0; i < A2_RENDERLANES; ++i)
+		if(lanes & (1 << i))
+		{
+			a2_SyncLane(st, &w->lanes[i]->state);
+			w->jobs[n++] = i;
+		}
+
+	if(!w->nthreads || (n == 1))
+	{
+		/* Nothing to gain from waking the workers up! */
+		for(i = 0; i < n; ++i)
+			a2_ProcessLane(w->lanes[w->jobs[i]], group, offset,
+					frames);
+	}
+	else
+	{
+		unsigned generation;
+		a2_MutexLock(&w->forklock);
+		w->group = group;
+		w->offset = offset;
+		w->frames = frames;
+		w->njobs = n;
+		w->nextjob = 0;
+		w->done = 0;
+		generation = ++w->generation;
+		a2_CondBroadcast(&w->wake);
+		a2_MutexUnlock(&w->forklock);
+
+		/* Help out, and then wait for any lanes still in progress */
+		a2_WorkerRun(w, generation);
+		a2_MutexLock(&w->forklock);
+		while(w->done < w->njobs)
+			a2_CondWait(&w->finished, &w->forklock);
+		a2_MutexUnlock(&w->forklock);
+	}
+
+	for(i = 0; i < n; ++i)
+		a2_MergeLane(st, &w->lanes[w->jobs[i]]->state);
+	if(st->activevoices > st->activevoicesmax)
+		st->activevoicesmax = st->activevoices;
+}
@@ -0,0 +1,123 @@
+/*
+ * workers.h - Audiality 2 parallel voice processing
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Subvoices of A2_PARALLEL voices (the root voice, and groups created with
+ * a2_NewGroup()) are assigned to render lanes, round-robin, as they are
+ * started. A voice stays in its lane for its whole life, and any subvoices it
+ * starts belong to the same lane.
+ *
+ * Each lane has an engine state of its own, with its own scratch buses,
+ * block, voice and event pools, and RNGs, so the voices of different lanes can
+ * be processed by different threads. Each lane also has an output bus per
+ * nest level, which the top level voices of the lane send to, instead of the
+ * outputs of the A2_PARALLEL parent voice.
+ *
+ * When a2_ProcessLanes() runs into an A2_PARALLEL voice with subvoices, it
+ * processes any subvoices not in lanes right away, and queues the others on
+ * their lanes. The lanes are then processed by the worker threads and the
+ * calling thread, and when all are done, the lane output buses are mixed into
+ * the outputs of the parent voice, in lane order. Voices that terminated are
+ * freed in the master state at this point.
+ *
+ * Since the mixing is done in integer arithmetic, the result is exactly the
+ * same as when processing all voices directly into the parent bus, and as the
+ * lanes have separate RNGs, the output is identical for any number of threads.
+ */
+
+#ifndef A2_WORKERS_H
+#define A2_WORKERS_H
+
+#include "internals.h"
+
+/* Render lane */
+typedef struct A2_lane
+{
+	A2_state	state;		/* Lane engine state (MUST be first!) */
+	A2_voice	*jobs;		/* Voices to process in the current fork */
+	A2_bus		*bus[A2_NESTLIMIT];	/* Outputs, per parent nest level */
+} A2_lane;
+
+struct A2_workers
+{
+	A2_state	*master;	/* State that owns the lanes */
+	A2_lane		*lanes[A2_RENDERLANES];
+	A2_mutex	lock;		/* Master pools and API messages */
+	unsigned	threads;	/* A2_PRENDERTHREADS */
+	unsigned	nextlane;	/* Next lane to assign a voice to */
+
+	/* Worker threads (threads - 1 of them; the engine thread helps out) */
+	unsigned	nthreads;
+	A2_thread	thread[A2_RENDERLANES];
+
+	/* Current fork, protected by 'forklock' */
+	A2_mutex	forklock;
+	A2_cond		wake;		/* Workers wait here for jobs */
+	A2_cond		finished;	/* Engine thread waits here for join */
+	unsigned	generation;	/* Fork counter */
+	int		quit;		/* Tells the worker threads to quit */
+	A2_voice	*group;		/* Parent voice of the current fork */
+	unsigned	offset, frames;	/* Fragment to process */
+	unsigned	jobs[A2_RENDERLANES];	/* Lanes to process */
+	unsigned	njobs;
+	unsigned	nextjob;	/* Next job to grab */
+	unsigned	done;		/* Number of jobs finished */
+};
+
+/*
+ * Set the number of threads to process render lanes with, including the
+ * engine thread. 0 disables parallel processing of new voices. Lanes are
+ * created the first time this is called with a non-zero count, and remain
+ * until a2_CloseWorkers() is called.
+ *
+ * NOTE: The engine must be locked, or not running!
+ */
+A2_errors a2_SetRenderThreads(A2_state *st, unsigned threads);
+
+/* Stop any worker threads, and free all lanes and lane resources */
+void a2_CloseWorkers(A2_state *st);
+
+/*
+ * Assign voice 'v', that was started under A2_PARALLEL voice 'parent' while
+ * lanes were enabled, to a lane, and redirect its outputs to the lane bus.
+ * A2_PARALLEL voices are kept out of lanes, so that they can distribute their
+ * own subvoices over the lanes.
+ */
+void a2_AssignLane(A2_state *st, A2_voice *parent, A2_voice *v);
+
+/*
+ * Process the lanes set in the bit mask 'lanes', with voices queued on them,
+ * for the subvoices of 'group', using the worker threads, if any. Returns when
+ * all lanes are done.
+ */
+void a2_RunLanes(A2_state *st, A2_voice *group, uint32_t lanes,
+		unsigned offset, unsigned frames);
+
+/* Process the subvoices of A2_PARALLEL voice 'v' over the render lanes */
+void a2_ProcessLanes(A2_state *st, A2_voice *v, unsigned offset,
+		unsigned frames);
+
+/* Process the voices queued on lane 'l' (Called by a2_RunLanes()) */
+void a2_ProcessLane(A2_lane *l, A2_voice *group, unsigned offset,
+		unsigned frames);
+
+#endif /* A2_WORKERS_H */
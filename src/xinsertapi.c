@@ -143,7 +143,7 @@ A2_errors a2_XinsertRemoveClient(A2_xinsert_client *xic)
 		am.b.common.action = A2MT_XICREMOVED;
 		am.b.common.timestamp = st->now_ticks;
 		am.b.xic.client = xic;
-		return a2_writemsg(st->toapi, &am, A2_MSIZE(b.xic));
+		return a2r_WriteMsg(st, &am, A2_MSIZE(b.xic));
 	}
 	else
 	{
@@ -0,0 +1,242 @@
+/*
+ * consttest.c - Audiality 2 compile time constant and dead code test
+ *
+ *	This test loads scripts with named constants passed via
+ *	a2_LoadStringConst(), and checks that constant expressions, and 'if' and
+ *	'while' statements with constant conditions, do what they would do if
+ *	they were evaluated at runtime. Each test program sets a DC level, which
+ *	is compared to that of a reference program. The size of the VM code of
+ *	a program with a foldable expression, and of one with a constant 'if'
+ *	condition, is checked against that of the reference program, and that
+ *	of the same expression evaluated at runtime.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audiality2.h"
+#include "internals.h"
+
+#define	FRAGMENT	256
+
+static const char *script =
+	"export def A (QUALITY * GAIN + 1)\n"
+	"Out(v)\n"
+	"{\n"
+	"	struct { dc }\n"
+	"	value v; set value\n"
+	"	for { d 1000 }\n"
+	"}\n"
+	"export Ref()\n"
+	"{\n"
+	"	1:Out .25\n"
+	"	for { d 1000 }\n"
+	"}\n"
+	"export IfElse()\n"
+	"{\n"
+	"	if (QUALITY > 1) {\n"
+	"		1:Out .25\n"
+	"	} else {\n"
+	"		1:Out .5\n"
+	"	}\n"
+	"	for { d 1000 }\n"
+	"}\n"
+	"export ElseIf()\n"
+	"{\n"
+	"	if (QUALITY < 1) {\n"
+	"		1:Out .5\n"
+	"	} else {\n"
+	"		1:Out .25\n"
+	"	}\n"
+	"	for { d 1000 }\n"
+	"}\n"
+	"export IfZ()\n"
+	"{\n"
+	"	!v .5\n"
+	"	ifz LOW { v .25 }\n"
+	"	if LOW { v .75 }\n"
+	"	1:Out v\n"
+	"	for { d 1000 }\n"
+	"}\n"
+	"export While()\n"
+	"{\n"
+	"	!v .25\n"
+	"	while LOW { v .5 }\n"
+	"	wz QUALITY { v .5 }\n"
+	"	while (QUALITY - 2) { v .75 }\n"
+	"	1:Out v\n"
+	"	for { d 1000 }\n"
+	"}\n"
+	"export DeadLabel()\n"
+	"{\n"
+	"	!v .25\n"
+	"	if LOW {\n"
+	"	.again	v .5\n"
+	"		jump again\n"
+	"	}\n"
+	"	1:Out v\n"
+	"	for { d 1000 }\n"
+	"}\n"
+	"export Folded()\n"
+	"{\n"
+	"	1:Out (QUALITY * GAIN * .5 - .25)\n"
+	"	for { d 1000 }\n"
+	"}\n"
+	"export Unfolded(q g)\n"
+	"{\n"
+	"	1:Out (q * g * .5 - .25)\n"
+	"	for { d 1000 }\n"
+	"}\n"
+	"export Identities()\n"
+	"{\n"
+	"	!a .25\n"
+	"	!b (a * 1 + 0 - 0)\n"
+	"	!c (0 + b / 1)\n"
+	"	1:Out (1 * c)\n"
+	"	for { d 1000 }\n"
+	"}\n";
+
+static const A2_constdef constants[] = {
+	{ "QUALITY",	2 },
+	{ "GAIN",	.5 },
+	{ "LOW",	0 },
+	{ NULL,	0 }
+};
+
+static const char *programs[] = {
+	"IfElse",
+	"ElseIf",
+	"IfZ",
+	"While",
+	"DeadLabel",
+	"Identities",
+	"Folded",
+	NULL
+};
+
+static int failures = 0;
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+/* Run program 'name' for one fragment, and return the last sample rendered */
+static int32_t run_program(A2_interface *iface, A2_driver *drv, A2_handle bank,
+		const char *name)
+{
+	int32_t s;
+	A2_handle vh, h = a2_Get(iface, bank, name);
+	if(h < 0)
+		fail(10, -h);
+	if((vh = a2_Starta(iface, a2_RootVoice(iface), h, 0, NULL)) < 0)
+		fail(11, -vh);
+	if(a2_Run(iface, FRAGMENT) < 0)
+		fail(12, a2_LastError());
+	s = ((A2_audiodriver *)drv)->buffers[0][FRAGMENT - 1];
+	a2_Kill(iface, vh);
+	if(a2_Run(iface, FRAGMENT) < 0)
+		fail(13, a2_LastError());
+	return s;
+}
+
+
+/* Size of the main function of program 'name', in VM code words */
+static int code_size(A2_interface *iface, A2_handle bank, const char *name)
+{
+	A2_program *p;
+	A2_handle h = a2_Get(iface, bank, name);
+	if(h < 0)
+		fail(20, -h);
+	if(!(p = a2_GetProgram(((A2_interface_i *)iface)->state, h)))
+		fail(21, A2_WRONGTYPE);
+	return p->funcs[0].size;
+}
+
+
+static void check(const char *what, int ok)
+{
+	printf("  %-24s %s\n", what, ok ? "ok" : "FAILED");
+	if(!ok)
+		++failures;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int i;
+	int32_t ref;
+	A2_handle bank, h;
+	A2_config *config;
+	A2_interface *iface;
+	A2_driver *drv;
+	static const A2_constdef badconstants[] = {
+		{ "if",	1 },
+		{ NULL,	0 }
+	};
+
+	if(!(drv = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(config = a2_OpenConfig(44100, FRAGMENT, 1,
+			A2_AUTOCLOSE | A2_SILENT)))
+		fail(2, a2_LastError());
+	if(a2_AddDriver(config, drv))
+		fail(3, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(4, a2_LastError());
+
+	printf("Loading...\n");
+	if((bank = a2_LoadStringConst(iface, script, "consttest",
+			constants)) < 0)
+		fail(5, -bank);
+	check("missing constants", a2_LoadString(iface, script,
+			"consttest2") == -A2_EXPEXPRESSION);
+	check("keyword constant", a2_LoadStringConst(iface, script,
+			"consttest3", badconstants) == -A2_SYMBOLDEF);
+	h = a2_Get(iface, bank, "A");
+	check("constant expression", (h >= 0) &&
+			(a2_Value(iface, h) == 2.0f));
+
+	printf("Running...\n");
+	ref = run_program(iface, drv, bank, "Ref");
+	check("reference", ref != 0);
+	for(i = 0; programs[i]; ++i)
+		check(programs[i], run_program(iface, drv, bank,
+				programs[i]) == ref);
+
+	printf("Code size...\n");
+	ref = code_size(iface, bank, "Ref");
+	printf("  Ref %d, Folded %d, Unfolded %d, IfElse %d words\n", ref,
+			code_size(iface, bank, "Folded"),
+			code_size(iface, bank, "Unfolded"),
+			code_size(iface, bank, "IfElse"));
+	check("folded expression", code_size(iface, bank, "Folded") == ref);
+	check("folded vs runtime", code_size(iface, bank, "Folded") <
+			code_size(iface, bank, "Unfolded"));
+	check("dead branch", code_size(iface, bank, "IfElse") == ref);
+
+	a2_Close(iface);
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
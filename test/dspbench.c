@@ -0,0 +1,234 @@
+/*
+ * dspbench.c - Audiality 2 DSP primitive test and benchmark
+ *
+ *	This test checks that the SIMD versions of the A2_dspfuncs primitives
+ *	(clearing, copying, mixing, and scaling with fixed and ramped gains)
+ *	produce the exact same output as the scalar reference versions, and
+ *	then times all versions supported by the CPU, at the maximum engine
+ *	fragment size (A2_MAXFRAG), and at some larger buffer sizes.
+ *
+ *	Usage: dspbench [Mframes]
+ *
+ *	'Mframes' is the number of frames (in millions) to process per
+ *	primitive and buffer size. (Default: 16)
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dspfuncs.h"
+#include "platform.h"
+#include "config.h"
+
+#define	MAXFRAMES	65536
+#define	VERIFYFRAMES	100
+#define	NFUNCS		15
+#define	FIRSTFLOAT	7	/* First float function */
+
+static const unsigned sizes[] = { A2_MAXFRAG, 4096, MAXFRAMES };
+#define	NSIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+static const char *funcnames[NFUNCS] = {
+	"Clear", "Copy", "Add", "Scale", "ScaleAdd", "Ramp", "RampAdd",
+	"AddF", "ScaleF", "ScaleAddF", "RampF", "RampAddF",
+	"FixToFloat", "FixToFloatAdd", "FloatToFix"
+};
+
+static int32_t in[MAXFRAMES + 8];
+static int32_t out[MAXFRAMES + 8];
+static int32_t ref[MAXFRAMES + 8];
+static int failures = 0;
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * Run primitive 'f' of 'df'. The float functions use the same buffers, and get
+ * the gains converted to float, with 1 << 24 meaning unity gain.
+ */
+static void run(const A2_dspfuncs *df, int f, int32_t *o, const int32_t *i,
+		unsigned frames, int gain, int dgain)
+{
+	float *fo = (float *)o;
+	const float *fi = (const float *)i;
+	float fg = gain * (1.0f / 16777216.0f);
+	float fdg = dgain * (1.0f / 16777216.0f);
+	switch(f)
+	{
+	  case 0: df->Clear(o, frames); break;
+	  case 1: df->Copy(o, i, frames); break;
+	  case 2: df->Add(o, i, frames); break;
+	  case 3: df->Scale(o, i, frames, gain); break;
+	  case 4: df->ScaleAdd(o, i, frames, gain); break;
+	  case 5: df->Ramp(o, i, frames, gain, dgain); break;
+	  case 6: df->RampAdd(o, i, frames, gain, dgain); break;
+	  case 7: df->AddF(fo, fi, frames); break;
+	  case 8: df->ScaleF(fo, fi, frames, fg); break;
+	  case 9: df->ScaleAddF(fo, fi, frames, fg); break;
+	  case 10: df->RampF(fo, fi, frames, fg, fdg); break;
+	  case 11: df->RampAddF(fo, fi, frames, fg, fdg); break;
+	  case 12: df->FixToFloat(fo, i, frames); break;
+	  case 13: df->FixToFloatAdd(fo, i, frames); break;
+	  case 14: df->FloatToFix(o, fi, frames); break;
+	}
+}
+
+
+static void fill(int32_t *buf, unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s)
+		buf[s] = (int32_t)(((unsigned)rand() << 16) ^ rand());
+}
+
+
+/* Fill with floats in the [-256, 256] range, to test FloatToFix clamping */
+static void fillf(int32_t *buf, unsigned frames)
+{
+	unsigned s;
+	float *fbuf = (float *)buf;
+	for(s = 0; s < frames; ++s)
+		fbuf[s] = (rand() - RAND_MAX / 2) * (512.0f / RAND_MAX);
+}
+
+
+/* Fill the input and output buffers with data of the right types for 'f' */
+static void fill_io(int f, int32_t *i, int32_t *o, unsigned frames)
+{
+	if((f >= FIRSTFLOAT) && (f != 12) && (f != 13))
+		fillf(i, frames);
+	else
+		fill(i, frames);
+	if((f >= FIRSTFLOAT) && (f != 14))
+		fillf(o, frames);
+	else
+		fill(o, frames);
+}
+
+
+/*
+ * Compare 'df' to the scalar code, with unaligned buffers, tails of all
+ * sizes, and gains in the full 8:24 range, including negative ramps.
+ */
+static void verify(const char *name, const A2_dspfuncs *df)
+{
+	const A2_dspfuncs *sc = a2_DSPFuncs(0);
+	int f;
+	for(f = 0; f < NFUNCS; ++f)
+	{
+		unsigned frames, misalign;
+		int bad = 0;
+		for(frames = 0; frames < VERIFYFRAMES; ++frames)
+			for(misalign = 0; misalign < 4; ++misalign)
+			{
+				int gain = (int)((unsigned)rand() << 8) ^ rand();
+				int dgain = (int)(((unsigned)rand() << 16) ^
+						rand()) >> (rand() % 24);
+				fill_io(f, in, ref, VERIFYFRAMES + 8);
+				memcpy(out, ref, sizeof(int32_t) *
+						(VERIFYFRAMES + 8));
+				run(sc, f, ref + misalign, in + 1, frames,
+						gain, dgain);
+				run(df, f, out + misalign, in + 1, frames,
+						gain, dgain);
+				if(memcmp(out, ref, sizeof(int32_t) *
+						(VERIFYFRAMES + 8)))
+					++bad;
+			}
+		printf("  %-6s %-13s %s\n", name, funcnames[f],
+				bad ? "FAILED!" : "ok");
+		if(bad)
+			++failures;
+	}
+}
+
+
+/* Time 'df' at all buffer sizes, printing Mframes/s */
+static void bench(const char *name, const A2_dspfuncs *df, unsigned total)
+{
+	int f;
+	unsigned sz;
+	printf("  %-10s", name);
+	for(sz = 0; sz < NSIZES; ++sz)
+		printf("   %8u", sizes[sz]);
+	printf("  (Mframes/s)\n");
+	for(f = 0; f < NFUNCS; ++f)
+	{
+		fill_io(f, in, out, MAXFRAMES);
+		printf("    %-14s", funcnames[f]);
+		for(sz = 0; sz < NSIZES; ++sz)
+		{
+			unsigned n, rounds = total / sizes[sz];
+			double t = now();
+			for(n = 0; n < rounds; ++n)
+				run(df, f, out, in, sizes[sz], 0x123456, -17);
+			t = now() - t;
+			printf(" %10.1f", rounds * sizes[sz] / t * 1e-6);
+		}
+		printf("\n");
+	}
+}
+
+
+int main(int argc, const char *argv[])
+{
+	const A2_dspfuncs *sc = a2_DSPFuncs(0);
+	unsigned cpu = a2_CPUFeatures();
+	unsigned total = 16;
+	static const struct {
+		const char	*name;
+		unsigned	feature;
+	} isas[] = {
+		{ "sse2",	A2_CPU_SSE2 },
+		{ "avx2",	A2_CPU_AVX2 },
+		{ "neon",	A2_CPU_NEON },
+		{ NULL,	0 }
+	};
+	int i;
+
+	if(argc >= 2)
+		total = atoi(argv[1]);
+	total <<= 20;
+
+	printf("Verifying SIMD primitives against scalar code:\n");
+	for(i = 0; isas[i].name; ++i)
+		if((cpu & isas[i].feature) &&
+				(a2_DSPFuncs(isas[i].feature) != sc))
+			verify(isas[i].name, a2_DSPFuncs(isas[i].feature));
+
+	printf("\nBenchmarking:\n");
+	bench("scalar", sc, total);
+	for(i = 0; isas[i].name; ++i)
+		if((cpu & isas[i].feature) &&
+				(a2_DSPFuncs(isas[i].feature) != sc))
+			bench(isas[i].name, a2_DSPFuncs(isas[i].feature),
+					total);
+
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * eventstress.c - Audiality 2 voice event queue stress test
+ *
+ *	This test schedules a large number of timestamped messages on a single
+ *	voice ahead of time, in shuffled order, before running the engine. The
+ *	messages are sent in groups that share timestamps, and every message
+ *	sets a DC level. As messages with equal timestamps must be processed in
+ *	the order they were sent, the last message of each group should decide
+ *	the output level, until the time of the next group.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "audiality2.h"
+
+#define	FRAGMENT	256
+
+/* Number of messages, and number of messages per timestamp */
+#define	MESSAGES	10000
+#define	GROUPSIZE	4
+#define	GROUPS		(MESSAGES / GROUPSIZE)
+
+/* Sample frames from the start of the voice to the first group, and between */
+#define	FIRST		100
+#define	SPACING		2
+
+#define	FRAMES		(FIRST + GROUPS * SPACING + FRAGMENT)
+
+static const char *script =
+	"export Hold()\n"
+	"{\n"
+	"	struct { dc }\n"
+	"	for { d 1000 }\n"
+	"	1(V) { value V; set value }\n"
+	"}\n";
+
+static int32_t output[FRAMES + FRAGMENT];
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+/* DC level (16:16) set by message 'm' of group 'g' */
+static int level(int g, int m)
+{
+	return ((g * GROUPSIZE + m) % 4096 + 1) * 16;
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int i, m, frames;
+	int failures = 0;
+	int order[GROUPS];
+	double t0, t1, t2;
+	A2_timestamp start;
+	A2_handle bank, h, vh;
+	A2_config *config;
+	A2_interface *iface;
+	A2_driver *drv;
+
+	if(!(drv = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(config = a2_OpenConfig(48000, FRAGMENT, 1,
+			A2_AUTOCLOSE | A2_TIMESTAMP | A2_SILENT)))
+		fail(2, a2_LastError());
+	if(a2_AddDriver(config, drv))
+		fail(3, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(4, a2_LastError());
+	if((bank = a2_LoadString(iface, script, "eventstress")) < 0)
+		fail(5, -bank);
+	if((h = a2_Get(iface, bank, "Hold")) < 0)
+		fail(6, -h);
+
+	/* Shuffle the groups, so the timestamps arrive in random order */
+	srand(1);
+	for(i = 0; i < GROUPS; ++i)
+		order[i] = i;
+	for(i = GROUPS - 1; i > 0; --i)
+	{
+		int j = rand() % (i + 1);
+		int t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	printf("Scheduling %d messages...\n", MESSAGES);
+	start = a2_TimestampReset(iface);
+	if((vh = a2_Starta(iface, a2_RootVoice(iface), h, 0, NULL)) < 0)
+		fail(7, -vh);
+	t0 = now();
+	for(m = 0; m < GROUPSIZE; ++m)
+		for(i = 0; i < GROUPS; ++i)
+		{
+			int g = order[i];
+			int a = level(g, m);
+			A2_errors res;
+			a2_TimestampSet(iface, start +
+					((FIRST + g * SPACING) << 8));
+			if((res = a2_Senda(iface, vh, 1, 1, &a)))
+				fail(8, res);
+		}
+	t1 = now();
+
+	printf("Running...\n");
+	for(frames = 0; frames < FRAMES; frames += FRAGMENT)
+	{
+		if(a2_Run(iface, FRAGMENT) < 0)
+			fail(9, a2_LastError());
+		memcpy(output + frames, ((A2_audiodriver *)drv)->buffers[0],
+				FRAGMENT * sizeof(int32_t));
+	}
+	t2 = now();
+	printf("  send: %.2f ms, run: %.2f ms\n", (t1 - t0) * 1000.0,
+			(t2 - t1) * 1000.0);
+
+	/*
+	 * The voice may start a little after 'start', so we look for the first
+	 * level instead of assuming where it is.
+	 */
+	for(i = 0; i < FRAMES; ++i)
+		if(output[i] == level(0, GROUPSIZE - 1) << 8)
+			break;
+	if(i + GROUPS * SPACING > FRAMES)
+	{
+		printf("  First group not found!\n");
+		++failures;
+	}
+	else
+		for(m = 0; m < GROUPS; ++m)
+		{
+			int j;
+			int expected = level(m, GROUPSIZE - 1) << 8;
+			for(j = 0; j < SPACING; ++j)
+				if(output[i + m * SPACING + j] != expected)
+				{
+					if(++failures <= 10)
+						printf("  group %d: %d, "
+								"expected %d\n",
+								m,
+								output[i + m *
+								SPACING + j],
+								expected);
+					break;
+				}
+		}
+
+	a2_Close(iface);
+	printf("%d groups failed.\n", failures);
+	return failures ? 1 : 0;
+}
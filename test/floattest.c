@@ -0,0 +1,240 @@
+/*
+ * floattest.c - Audiality 2 32 bit float processing test
+ *
+ *	This test renders scripts into two off-line engine states; one using
+ *	the normal 8:24 fixed point processing, and one with the A2_FLOATPROC
+ *	flag set. The scripts cover all units that support float processing,
+ *	in the various I/O configurations, and as the two modes do not round
+ *	the same way, the rendered audio is compared by signal to noise ratio,
+ *	rather than bit for bit.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	44100
+#define	FRAGMENT	333	/* Odd size, for partial SIMD vectors */
+#define	DURATION	1000	/* ms per test */
+
+static const char *script =
+	"Osc(W P)\n"
+	"{\n"
+	"	struct { wtosc; panmix }\n"
+	"	w W; @p P; @a 0; @pan -.5\n"
+	"	a .4; pan .5; d 200\n"
+	"	a .2; p (P + 2); vol .5; d 300\n"
+	"	a 0; d 50\n"
+	"}\n"
+	"\n"
+	"export Wave(W P)\n"
+	"{\n"
+	"	struct { inline 0 2; panmix PM 2 2; limiter L 2 > }\n"
+	"	PM.vol 1.5; set\n"
+	"	Osc W P; Osc W (P + .5); PM.pan .7; d 600\n"
+	"}\n"
+	"\n"
+	"export Mono(W P)\n"
+	"{\n"
+	"	struct { inline 0 2; panmix PM 2 1; panmix 1 > }\n"
+	"	PM.pan -1.5; set\n"
+	"	Osc W P; Osc W (P - .3); PM.pan .3; d 600\n"
+	"}\n"
+	"\n"
+	"export Chain(W P)\n"
+	"{\n"
+	"	struct {\n"
+	"		inline 0 1\n"
+	"		dcblock DCB 1 1\n"
+	"		filter12 F 1 1\n"
+	"		waveshaper WS 1 1\n"
+	"		panmix PM 1 2\n"
+	"		fbdelay FBD 2 >\n"
+	"	}\n"
+	"	DCB.cutoff 40f\n"
+	"	F.cutoff 5000f; F.q .01; F.lp 1; F.bp .5; F.hp .2; set\n"
+	"	WS.amount 2\n"
+	"	FBD.fbdelay 67; FBD.fbgain .3\n"
+	"	FBD.ldelay 70; FBD.lgain .3\n"
+	"	FBD.rdelay 83; FBD.rgain .3\n"
+	"	Osc W P; F.cutoff 1000f; d 600\n"
+	"}\n"
+	"\n"
+	"export FM()\n"
+	"{\n"
+	"	struct { fm4r; panmix }\n"
+	"	a .5; p1 .5; a1 .3; fb1 .2; p2 1; a2 .5; p3 2; a3 .3; d 200\n"
+	"	a .2; a1 .6; p 1; d 400\n"
+	"}\n"
+	"\n"
+	"export DC()\n"
+	"{\n"
+	"	struct { dc 0 2; panmix 2 > }\n"
+	"	value .3; d 100\n"
+	"	value -.5; d 300\n"
+	"	mode STEP; value .2; d 100\n"
+	"}\n";
+
+/*
+ * Test programs, with minimum signal to noise ratios (dB). The fixed point
+ * filters quantize their coefficients to about 12 bits, so the float versions
+ * do not get very close to those at low cutoff frequencies.
+ */
+static const struct
+{
+	const char	*name;
+	int		waves;		/* Takes wave and pitch arguments */
+	double		minsnr;
+} tests[] = {
+	{ "Wave",	1,	80.0	},
+	{ "Mono",	1,	80.0	},
+	{ "Chain",	1,	25.0	},
+	{ "FM",		0,	80.0	},
+	{ "DC",		0,	80.0	},
+	{ NULL,		0,	0.0	}
+};
+
+static const char *wavenames[] = {
+	"saw",
+	"noise",
+	NULL
+};
+
+/* Engine states; [0] fixed point, [1] float */
+static A2_driver *drivers[2];
+static A2_interface *ifaces[2];
+static A2_handle banks[2];
+static int failures = 0;
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+static void open_state(int i, int flags)
+{
+	A2_config *config;
+	if(!(drivers[i] = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 2,
+			A2_AUTOCLOSE | A2_SILENT | flags)))
+		fail(2, a2_LastError());
+	if(a2_AddDriver(config, drivers[i]))
+		fail(3, a2_LastError());
+	if(!(ifaces[i] = a2_Open(config)))
+		fail(4, a2_LastError());
+	if((banks[i] = a2_LoadString(ifaces[i], script, "floattest")) < 0)
+		fail(5, -banks[i]);
+}
+
+
+static void start(int i, const char *name, const char *wave, float pitch)
+{
+	A2_handle h;
+	if((h = a2_Get(ifaces[i], banks[i], name)) < 0)
+		fail(6, -h);
+	if(wave)
+	{
+		A2_handle w;
+		if((w = a2_Get(ifaces[i], A2_ROOTBANK, wave)) < 0)
+			fail(7, -w);
+		if(a2_Play(ifaces[i], a2_RootVoice(ifaces[i]), h, (float)w,
+				pitch))
+			fail(8, a2_LastError());
+	}
+	else if(a2_Play(ifaces[i], a2_RootVoice(ifaces[i]), h))
+		fail(9, a2_LastError());
+}
+
+
+/* Run both states for 'frames' frames, returning the SNR in dB */
+static double run_compare(unsigned frames)
+{
+	double signal = 0.0, noise = 0.0;
+	while(frames)
+	{
+		int i, c;
+		unsigned s, frag = frames < FRAGMENT ? frames : FRAGMENT;
+		for(i = 0; i < 2; ++i)
+			if(a2_Run(ifaces[i], frag) < 0)
+				fail(10, a2_LastError());
+		for(c = 0; c < 2; ++c)
+		{
+			int32_t *b0 = ((A2_audiodriver *)drivers[0])->buffers[c];
+			int32_t *b1 = ((A2_audiodriver *)drivers[1])->buffers[c];
+			for(s = 0; s < frag; ++s)
+			{
+				double d = (double)b1[s] - b0[s];
+				signal += (double)b0[s] * b0[s];
+				noise += d * d;
+			}
+		}
+		frames -= frag;
+	}
+	if(signal == 0.0)
+		return 0.0;	/* No output is a failure too! */
+	if(noise == 0.0)
+		return 999.0;
+	return 10.0 * log10(signal / noise);
+}
+
+
+static void test(int t, const char *wave, float pitch)
+{
+	int i;
+	double snr;
+	for(i = 0; i < 2; ++i)
+		start(i, tests[t].name, wave, pitch);
+	snr = run_compare(DURATION * SAMPLERATE / 1000);
+	printf("  %-6s %-6s p %5.1f  SNR %6.1f dB%s\n", tests[t].name,
+			wave ? wave : "", pitch, snr,
+			snr < tests[t].minsnr ? "  FAILED!" : "");
+	if(snr < tests[t].minsnr)
+		++failures;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int i, t, w;
+	float p;
+	open_state(0, 0);
+	open_state(1, A2_FLOATPROC);
+	for(t = 0; tests[t].name; ++t)
+	{
+		if(!tests[t].waves)
+		{
+			test(t, NULL, 0.0f);
+			continue;
+		}
+		for(w = 0; wavenames[w]; ++w)
+			for(p = -2.0f; p <= 4.0f; p += 3.0f)
+				test(t, wavenames[w], p);
+	}
+	for(i = 0; i < 2; ++i)
+		a2_Close(ifaces[i]);
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * inplacetest.c - Audiality 2 in-place processing test
+ *
+ *	This test renders each of the 'panmix' processing paths (1->1, 1->2,
+ *	2->1 and 2->2, with constant as well as ramped gains) writing directly
+ *	to the voice outputs, and the same unit wired in place, that is,
+ *	followed by another unit so that its inputs and outputs share the
+ *	buffers of the voice scratch bus. The second unit is an 'fbdelay' with
+ *	only the dry path enabled, so the two are expected to render identical
+ *	output, in fixed point as well as A2_FLOATPROC states. The paths with
+ *	one output run in a subvoice of a voice with a mono 'inline' bus.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	48000
+#define	FRAGMENT	100	/* Not a multiple of the SIMD vector sizes */
+#define	DURATION	500	/* ms per render */
+#define	FRAMES		(DURATION * SAMPLERATE / 1000)
+
+/*
+ * Program body, with constant gains, or ramped gains if R is set, with and
+ * without clamping. 'PM' is the unit under test.
+ */
+#define	PANBODY							\
+	"	w W; a .5\n"						\
+	"	@PM.vol .5; @PM.pan -.3\n"				\
+	"	if R {\n"						\
+	"		PM.vol .7; PM.pan .4; d 100\n"			\
+	"		PM.vol 1.5; PM.pan -1.7; d 100\n"		\
+	"		PM.vol .2; PM.pan 1.3; d 100\n"			\
+	"		PM.vol .9; PM.pan 0; d 100\n"			\
+	"	} else {\n"						\
+	"		d 100\n"					\
+	"		@PM.vol 1.2; @PM.pan .6; d 100\n"		\
+	"		@PM.pan 1.5; d 100\n"				\
+	"		@PM.vol .3; @PM.pan -1.2; d 100\n"		\
+	"	}\n"
+
+/* Stereo source for the paths with two inputs */
+#define	SRC	"	SRC.pan -.4\n"
+
+/* Dry pass-through for the in-place variants */
+#define	DRY	"	fbgain 0; lgain 0; rgain 0\n"
+
+/* Parent with a mono bus for the paths with one output */
+#define	MONO	"	struct { inline 0 1; panmix 1 > }\n"
+
+static const char *script =
+	"Pan1(W R)\n"
+	"{\n"
+	"	struct { wtosc; panmix PM 1 > }\n"
+	PANBODY
+	"}\n"
+	"\n"
+	"Pan2(W R)\n"
+	"{\n"
+	"	struct { wtosc; panmix SRC 1 2; panmix PM 2 > }\n"
+	SRC PANBODY
+	"}\n"
+	"\n"
+	"Pan11(W R)\n"
+	"{\n"
+	"	struct { wtosc; panmix PM 1 1; fbdelay 1 > }\n"
+	DRY PANBODY
+	"}\n"
+	"\n"
+	"Pan12(W R)\n"
+	"{\n"
+	"	struct { wtosc; panmix PM 1 2; fbdelay 2 > }\n"
+	DRY PANBODY
+	"}\n"
+	"\n"
+	"Pan21(W R)\n"
+	"{\n"
+	"	struct { wtosc; panmix SRC 1 2; panmix PM 2 1; fbdelay 1 > }\n"
+	DRY SRC PANBODY
+	"}\n"
+	"\n"
+	"Pan22(W R)\n"
+	"{\n"
+	"	struct { wtosc; panmix SRC 1 2; panmix PM 2 2; fbdelay 2 > }\n"
+	DRY SRC PANBODY
+	"}\n"
+	"\n"
+	"export Direct11(W R)	{ " MONO "	Pan1 W R; d 500 }\n"
+	"export InPlace11(W R)	{ " MONO "	Pan11 W R; d 500 }\n"
+	"export Direct12(W R)	{ Pan1 W R; d 500 }\n"
+	"export InPlace12(W R)	{ Pan12 W R; d 500 }\n"
+	"export Direct21(W R)	{ " MONO "	Pan2 W R; d 500 }\n"
+	"export InPlace21(W R)	{ " MONO "	Pan21 W R; d 500 }\n"
+	"export Direct22(W R)	{ Pan2 W R; d 500 }\n"
+	"export InPlace22(W R)	{ Pan22 W R; d 500 }\n";
+
+static const char *paths[] = {
+	"11",
+	"12",
+	"21",
+	"22",
+	NULL
+};
+
+static const char *wavenames[] = {
+	"saw",
+	"noise",
+	NULL
+};
+
+static int32_t direct[2][FRAMES];
+static int32_t inplace[2][FRAMES];
+static int failures = 0;
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+/* Render program 'name' in a new state into 'out' */
+static void render(int32_t out[2][FRAMES], int flags, const char *name,
+		const char *wave, int ramped)
+{
+	A2_config *config;
+	A2_driver *driver;
+	A2_interface *iface;
+	A2_handle bank, h, w;
+	unsigned s;
+	if(!(driver = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 2,
+			A2_AUTOCLOSE | A2_SILENT | flags)))
+		fail(2, a2_LastError());
+	if(a2_AddDriver(config, driver))
+		fail(3, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(4, a2_LastError());
+	if((bank = a2_LoadString(iface, script, "inplacetest")) < 0)
+		fail(5, -bank);
+	if((h = a2_Get(iface, bank, name)) < 0)
+		fail(6, -h);
+	if((w = a2_Get(iface, A2_ROOTBANK, wave)) < 0)
+		fail(7, -w);
+	if(a2_Play(iface, a2_RootVoice(iface), h, (float)w, (float)ramped))
+		fail(8, a2_LastError());
+	for(s = 0; s < FRAMES; s += FRAGMENT)
+	{
+		int c;
+		unsigned frag = FRAMES - s < FRAGMENT ? FRAMES - s : FRAGMENT;
+		if(a2_Run(iface, frag) < 0)
+			fail(9, a2_LastError());
+		for(c = 0; c < 2; ++c)
+			memcpy(out[c] + s, ((A2_audiodriver *)driver)->buffers[c],
+					frag * sizeof(int32_t));
+	}
+	a2_Close(iface);
+}
+
+
+/* Count the samples that differ, and check that the reference is not silent */
+static void compare(const char *path, int fp, int ramped, const char *wave)
+{
+	unsigned s, c, diffs = 0, silent = 1;
+	for(c = 0; c < 2; ++c)
+		for(s = 0; s < FRAMES; ++s)
+		{
+			if(direct[c][s] != inplace[c][s])
+				++diffs;
+			if(direct[c][s])
+				silent = 0;
+		}
+	printf("  panmix %c %c  %-5s %-8s %-6s %6u differing samples%s%s\n",
+			path[0], path[1], fp ? "float" : "fixed",
+			ramped ? "ramped" : "constant", wave, diffs,
+			silent ? ", silent reference" : "",
+			diffs || silent ? "  FAILED!" : "");
+	if(diffs || silent)
+		++failures;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int p, w, fp, r;
+	printf("panmix, direct vs in place:\n");
+	for(p = 0; paths[p]; ++p)
+		for(fp = 0; fp < 2; ++fp)
+			for(r = 0; r < 2; ++r)
+				for(w = 0; wavenames[w]; ++w)
+				{
+					char name[16];
+					int flags = fp ? A2_FLOATPROC : 0;
+					snprintf(name, sizeof(name), "Direct%s",
+							paths[p]);
+					render(direct, flags, name,
+							wavenames[w], r);
+					snprintf(name, sizeof(name),
+							"InPlace%s", paths[p]);
+					render(inplace, flags, name,
+							wavenames[w], r);
+					compare(paths[p], fp, r, wavenames[w]);
+				}
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * jittest.c - Audiality 2 native code translator differential test
+ *
+ * OVERVIEW
+ *
+ *	This test loads A2S files into two off-line engine states; one with
+ *	native code translation of VM code, and one with the A2_NOJIT flag set,
+ *	so that all VM code runs in the interpreter. Every exported program is
+ *	then started in both states, and the rendered audio is compared bit for
+ *	bit. Halfway through, the voices are sent message 1, which is normally
+ *	"note off" or "stop."
+ *
+ *	If no files are specified, all A2S files in data/ and ../benchmark/ are
+ *	tested, so this is meant to be run from the test/ directory.
+ *
+ *	On platforms where native code translation is not supported, both
+ *	states run the interpreter, so the test always passes.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include "audiality2.h"
+
+/* Default directories to scan for A2S files */
+static const char *dirs[] = {
+	"data",
+	"../benchmark",
+	NULL
+};
+
+/* Configuration */
+int samplerate = 44100;
+int channels = 2;
+int audiobuf = 1024;
+float duration = 4.0f;
+
+/* Engine states; [0] with native code, [1] interpreter only */
+typedef struct JT_state
+{
+	A2_driver	*driver;
+	A2_config	*config;
+	A2_interface	*iface;
+	A2_handle	bank;
+} JT_state;
+
+static int failures = 0;
+static int programs = 0;
+
+
+static void usage(const char *exename)
+{
+	fprintf(stderr,	"\n\nUsage: %s [switches] [file(s)]\n\n", exename);
+	fprintf(stderr, "Switches:  -r<n>       Audio sample rate (Hz)\n"
+			"           -c<n>       Number of audio channels\n"
+			"           -s<n>       Duration per program (s)\n\n"
+			"           -h          Help\n\n");
+}
+
+
+static int parse_args(int argc, const char *argv[])
+{
+	int i;
+	int files = 0;
+	for(i = 1; i < argc; ++i)
+	{
+		if(argv[i][0] != '-')
+		{
+			++files;
+			continue;
+		}
+		if(strncmp(argv[i], "-r", 2) == 0)
+			samplerate = atoi(&argv[i][2]);
+		else if(strncmp(argv[i], "-c", 2) == 0)
+			channels = atoi(&argv[i][2]);
+		else if(strncmp(argv[i], "-s", 2) == 0)
+			duration = atof(&argv[i][2]);
+		else if(strncmp(argv[i], "-h", 2) == 0)
+		{
+			usage(argv[0]);
+			exit(0);
+		}
+		else
+		{
+			fprintf(stderr, "Unknown switch '%s'!\n", argv[i]);
+			exit(1);
+		}
+	}
+	return files;
+}
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+static void open_state(JT_state *s, int flags)
+{
+	if(!(s->driver = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(s->config = a2_OpenConfig(samplerate, audiobuf, channels,
+			A2_AUTOCLOSE | A2_SILENT | flags)))
+		fail(2, a2_LastError());
+	if(a2_AddDriver(s->config, s->driver))
+		fail(3, a2_LastError());
+	if(!(s->iface = a2_Open(s->config)))
+		fail(4, a2_LastError());
+}
+
+
+/* Run both states for 'frames' frames, returning the number of mismatches */
+static int run_compare(JT_state *s, unsigned frames)
+{
+	int mismatches = 0;
+	while(frames)
+	{
+		int i, c;
+		unsigned frag = frames < audiobuf ? frames : audiobuf;
+		for(i = 0; i < 2; ++i)
+			if(a2_Run(s[i].iface, frag) < 0)
+				fail(5, a2_LastError());
+		for(c = 0; c < channels; ++c)
+		{
+			int32_t *b0 = ((A2_audiodriver *)s[0].driver)->buffers[c];
+			int32_t *b1 = ((A2_audiodriver *)s[1].driver)->buffers[c];
+			if(memcmp(b0, b1, frag * sizeof(int32_t)))
+				++mismatches;
+		}
+		frames -= frag;
+	}
+	return mismatches;
+}
+
+
+static void test_program(JT_state *s, int x)
+{
+	int i, mismatches;
+	A2_handle vh[2];
+	A2_errors rterr[2];
+	const char *name = a2_GetExportName(s[0].iface, s[0].bank, x);
+	unsigned frames = duration * samplerate;
+	for(i = 0; i < 2; ++i)
+	{
+		A2_handle h = a2_GetExport(s[i].iface, s[i].bank, x);
+		if(a2_TypeOf(s[i].iface, h) != A2_TPROGRAM)
+			return;
+		vh[i] = a2_Starta(s[i].iface, a2_RootVoice(s[i].iface), h,
+				0, NULL);
+	}
+	++programs;
+	if((vh[0] < 0) || (vh[1] < 0))
+	{
+		if(vh[0] != vh[1])
+		{
+			printf("  %-24s MISMATCH (start: %s/%s)\n", name,
+					a2_ErrorString(-vh[0]),
+					a2_ErrorString(-vh[1]));
+			++failures;
+		}
+		return;
+	}
+	mismatches = run_compare(s, frames / 2);
+	for(i = 0; i < 2; ++i)
+		a2_Send(s[i].iface, vh[i], 1);
+	mismatches += run_compare(s, frames - frames / 2);
+	for(i = 0; i < 2; ++i)
+	{
+		rterr[i] = a2_LastRTError(s[i].iface);
+		a2_Kill(s[i].iface, vh[i]);
+	}
+	run_compare(s, audiobuf);
+	if(mismatches || (rterr[0] != rterr[1]))
+	{
+		printf("  %-24s MISMATCH (%d fragments differ; errors: %s/%s)\n",
+				name, mismatches, a2_ErrorString(rterr[0]),
+				a2_ErrorString(rterr[1]));
+		++failures;
+	}
+	else
+		printf("  %-24s ok\n", name);
+}
+
+
+static void test_file(const char *fn)
+{
+	int i, x;
+	JT_state s[2];
+	open_state(&s[0], 0);
+	open_state(&s[1], A2_NOJIT);
+	printf("%s\n", fn);
+	for(i = 0; i < 2; ++i)
+		s[i].bank = a2_Load(s[i].iface, fn, 0);
+	if((s[0].bank < 0) || (s[1].bank < 0))
+	{
+		if(s[0].bank != s[1].bank)
+		{
+			printf("  MISMATCH (load: %s/%s)\n",
+					a2_ErrorString(-s[0].bank),
+					a2_ErrorString(-s[1].bank));
+			++failures;
+		}
+		else
+			printf("  (not loaded: %s)\n",
+					a2_ErrorString(-s[0].bank));
+	}
+	else
+		for(x = 0; a2_GetExport(s[0].iface, s[0].bank, x) >= 0; ++x)
+			test_program(s, x);
+	for(i = 0; i < 2; ++i)
+		a2_Close(s[i].iface);
+}
+
+
+static void test_dir(const char *dn)
+{
+	struct dirent **names;
+	int i, n = scandir(dn, &names, NULL, alphasort);
+	if(n < 0)
+	{
+		fprintf(stderr, "Could not scan directory '%s'!\n", dn);
+		return;
+	}
+	for(i = 0; i < n; ++i)
+	{
+		const char *ext = strrchr(names[i]->d_name, '.');
+		if(ext && (strcmp(ext, ".a2s") == 0))
+		{
+			char fn[1024];
+			snprintf(fn, sizeof(fn), "%s/%s", dn, names[i]->d_name);
+			test_file(fn);
+		}
+		free(names[i]);
+	}
+	free(names);
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int i;
+	if(parse_args(argc, argv))
+	{
+		for(i = 1; i < argc; ++i)
+			if(argv[i][0] != '-')
+				test_file(argv[i]);
+	}
+	else
+		for(i = 0; dirs[i]; ++i)
+			test_dir(dirs[i]);
+	printf("%d programs tested; %d failed.\n", programs, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,448 @@
+/*
+ * limitertest.c - Audiality 2 limiter unit test and benchmark
+ *
+ *	This test renders a script with and without a 'limiter' unit, and
+ *	compares the output of the unit with that of a reference limiter
+ *	using the original per-sample 64 bit division, applied to the
+ *	unlimited output. It then checks that lookahead mode keeps the peaks
+ *	below the threshold, in fixed point as well as A2_FLOATPROC states,
+ *	that it renders the same output when wired in place, that is, with
+ *	its inputs and outputs sharing buffers, and that it passes quiet
+ *	signals through with the specified delay.
+ *	Finally, the process loop of the limiter unit, with and without
+ *	lookahead, and that of the reference implementation are timed, driven
+ *	directly, one fragment at a time, on the same unlimited input.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "audiality2.h"
+#include "internals.h"
+#include "limiter.h"
+
+#define	SAMPLERATE	48000
+#define	FRAGMENT	256
+#define	DURATION	1500	/* ms per render */
+#define	FRAMES		(DURATION * SAMPLERATE / 1000)
+#define	LOOKAHEAD	2	/* ms */
+#define	LAFRAMES	(LOOKAHEAD * SAMPLERATE / 1000)
+#define	BENCHRUNS	5
+
+/* Minimum SNR (dB) vs the reference implementation, and for pass-through */
+#define	MINSNR		90.0
+#define	MINPASSSNR	80.0
+
+/* Maximum output peak in lookahead mode (8:24) */
+#define	MAXPEAK		((1 << 24) + (1 << 12))
+
+static const char *script =
+	"Src(W P V)\n"
+	"{\n"
+	"	struct { wtosc; panmix }\n"
+	"	w W; @p P; @a 0; @pan -.3\n"
+	"	a V; pan .3; d 200\n"
+	"	a (V * .2); d 400\n"
+	"	a V; p (P + 1); d 5\n"
+	"	a (V * .5); d 600\n"
+	"	a 0; d 100\n"
+	"}\n"
+	"\n"
+	"export Dry(W P V L)\n"
+	"{\n"
+	"	struct { inline 0 > }\n"
+	"	Src W P V; Src W (P + .7) (V * .5); d 1400\n"
+	"}\n"
+	"\n"
+	"export Lim(W P V L)\n"
+	"{\n"
+	"	struct { inline 0 2; limiter LIM 2 > }\n"
+	"	LIM.release 20; LIM.lookahead L\n"
+	"	Src W P V; Src W (P + .7) (V * .5); d 1400\n"
+	"}\n"
+	"\n"
+	"export LimInPlace(W P V L)\n"
+	"{\n"
+	"	struct { inline 0 2; limiter LIM 2; fbdelay 2 > }\n"
+	"	fbgain 0; lgain 0; rgain 0\n"
+	"	LIM.release 20; LIM.lookahead L\n"
+	"	Src W P V; Src W (P + .7) (V * .5); d 1400\n"
+	"}\n";
+
+static const char *wavenames[] = {
+	"saw",
+	"noise",
+	NULL
+};
+
+static const float levels[] = { .3f, 1.5f, 3.0f, 0.0f };
+
+static int32_t dry[2][FRAMES];
+static int32_t wet[2][FRAMES];
+static int32_t ref[2][FRAMES];
+static int32_t inplace[2][FRAMES];
+static int failures = 0;
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static A2_interface *open_state(A2_driver **driver, int flags)
+{
+	A2_config *config;
+	A2_interface *iface;
+	if(!(*driver = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 2,
+			A2_AUTOCLOSE | A2_SILENT | flags)))
+		fail(2, a2_LastError());
+	if(a2_AddDriver(config, *driver))
+		fail(3, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(4, a2_LastError());
+	return iface;
+}
+
+
+/* Render program 'name' in a new state into 'out' */
+static void render(int32_t out[2][FRAMES], int flags, const char *name,
+		const char *wave, float pitch, float level, float lookahead)
+{
+	A2_driver *driver;
+	A2_interface *iface = open_state(&driver, flags);
+	A2_handle bank, h, w;
+	unsigned s;
+	if((bank = a2_LoadString(iface, script, "limitertest")) < 0)
+		fail(5, -bank);
+	if((h = a2_Get(iface, bank, name)) < 0)
+		fail(6, -h);
+	if((w = a2_Get(iface, A2_ROOTBANK, wave)) < 0)
+		fail(7, -w);
+	if(a2_Play(iface, a2_RootVoice(iface), h, (float)w, pitch, level,
+			lookahead))
+		fail(8, a2_LastError());
+	for(s = 0; s < FRAMES; s += FRAGMENT)
+	{
+		int c;
+		unsigned frag = FRAMES - s < FRAGMENT ? FRAMES - s : FRAGMENT;
+		if(a2_Run(iface, frag) < 0)
+			fail(9, a2_LastError());
+		for(c = 0; c < 2; ++c)
+			memcpy(out[c] + s, ((A2_audiodriver *)driver)->buffers[c],
+					frag * sizeof(int32_t));
+	}
+	a2_Close(iface);
+}
+
+
+/*
+ * Run the Process() callback of unit 'u' over 'in', one fragment at a time,
+ * writing the output to 'out', and return the time spent, in seconds.
+ */
+static double run_unit(A2_unit *u, int32_t out[2][FRAMES],
+		int32_t in[2][FRAMES])
+{
+	int32_t *inputs[2] = { in[0], in[1] };
+	int32_t *outputs[2] = { out[0], out[1] };
+	unsigned s;
+	double t0;
+	u->inputs = inputs;
+	u->outputs = outputs;
+	t0 = now();
+	for(s = 0; s < FRAMES; s += FRAGMENT)
+		u->Process(u, s, FRAMES - s < FRAGMENT ? FRAMES - s : FRAGMENT);
+	return now() - t0;
+}
+
+
+/*
+ * The original stereo limiter process loop, with the 64 bit division, as a
+ * unit with the script settings
+ */
+typedef struct REF_limiter
+{
+	A2_unit		header;
+	unsigned	threshold;
+	int		release;
+	unsigned	peak;
+} REF_limiter;
+
+static void ref_Process22(A2_unit *u, unsigned offset, unsigned frames)
+{
+	REF_limiter *lim = (REF_limiter *)u;
+	unsigned s, end = offset + frames;
+	int32_t *in0 = u->inputs[0];
+	int32_t *in1 = u->inputs[1];
+	int32_t *out0 = u->outputs[0];
+	int32_t *out1 = u->outputs[1];
+	for(s = offset; s < end; ++s)
+	{
+		int gain;
+		int lp = abs(in0[s]);
+		int rp = abs(in1[s]);
+		unsigned p = (unsigned)(lp > rp ? lp : rp);
+		p = p + ((p - abs(lp - rp)) >> 1);
+		if(p > lim->peak)
+			lim->peak = p;
+		else
+		{
+			lim->peak -= lim->release;
+			if(lim->peak < lim->threshold)
+				lim->peak = lim->threshold;
+			p = lim->peak;
+		}
+		gain = (32767LL << 16) / ((p + 511) >> 9);
+		out0[s] = (int64_t)in0[s] * gain >> 16;
+		out1[s] = (int64_t)in1[s] * gain >> 16;
+	}
+}
+
+static double reflimit(int32_t out[2][FRAMES], int32_t in[2][FRAMES])
+{
+	REF_limiter lim;
+	memset(&lim, 0, sizeof(lim));
+	lim.header.ninputs = lim.header.noutputs = 2;
+	lim.header.Process = ref_Process22;
+	lim.release = ((20 << 16) << 8) / SAMPLERATE;
+	lim.threshold = 1 << 24;
+	lim.peak = 32768 << 8;
+	return run_unit(&lim.header, out, in);
+}
+
+
+/* Write 'v' (16:16) to control register 'name' of unit 'u' */
+static void set_register(A2_unit *u, const char *name, int v)
+{
+	const A2_crdesc *cr = u->descriptor->registers;
+	int i;
+	for(i = 0; cr[i].name; ++i)
+		if(!strcmp(cr[i].name, name))
+		{
+			u->registers[i] = v;
+			cr[i].write(u, v, 0, 0);
+			return;
+		}
+	fail(20, A2_NOTFOUND);
+}
+
+
+/*
+ * Run a new 'limiter' unit instance, with the script settings, over 'in',
+ * returning the time spent in its Process() callback. 'iface' is an engine
+ * state to allocate the lookahead buffers from.
+ */
+static double limit(A2_interface *iface, int32_t out[2][FRAMES],
+		int32_t in[2][FRAMES], float lookahead)
+{
+	const A2_unitdesc *ud = &a2_limiter_unitdesc;
+	int registers[3];
+	A2_unit *u;
+	A2_errors res;
+	double t;
+	if(!(u = (A2_unit *)calloc(1, ud->instancesize)))
+		fail(21, A2_OOMEMORY);
+	u->descriptor = ud;
+	u->ninputs = u->noutputs = 2;
+	u->registers = registers;
+	if((res = ud->Initialize(u, NULL, ((A2_interface_i *)iface)->state,
+			0)))
+		fail(22, res);
+	set_register(u, "release", 20 << 16);
+	set_register(u, "lookahead", (int)(lookahead * 65536.0f));
+	t = run_unit(u, out, in);
+	ud->Deinitialize(u);
+	free(u);
+	return t;
+}
+
+
+/* SNR (dB) of 'b' vs 'a', with 'b' delayed by 'delay' frames */
+static double snr(int32_t a[2][FRAMES], int32_t b[2][FRAMES], unsigned delay)
+{
+	double signal = 0.0, noise = 0.0;
+	unsigned s, c;
+	for(c = 0; c < 2; ++c)
+		for(s = 0; s < FRAMES - delay; ++s)
+		{
+			double d = (double)b[c][s + delay] - a[c][s];
+			signal += (double)a[c][s] * a[c][s];
+			noise += d * d;
+		}
+	if(signal == 0.0)
+		return 0.0;	/* No output is a failure too! */
+	if(noise == 0.0)
+		return 999.0;
+	return 10.0 * log10(signal / noise);
+}
+
+
+static int32_t maxpeak(int32_t b[2][FRAMES])
+{
+	unsigned s, c;
+	int32_t p = 0;
+	for(c = 0; c < 2; ++c)
+		for(s = 0; s < FRAMES; ++s)
+			if(abs(b[c][s]) > p)
+				p = abs(b[c][s]);
+	return p;
+}
+
+
+static void check_snr(const char *what, const char *wave, float level,
+		double v, double min)
+{
+	printf("  %-16s %-6s %4.1f  SNR %6.1f dB%s\n", what, wave, level, v,
+			v < min ? "  FAILED!" : "");
+	if(v < min)
+		++failures;
+}
+
+
+static void check_peak(const char *what, const char *wave, float level,
+		int32_t p)
+{
+	printf("  %-16s %-6s %4.1f  peak %.6f%s\n", what, wave, level,
+			p / 16777216.0, p > MAXPEAK ? "  FAILED!" : "");
+	if(p > MAXPEAK)
+		++failures;
+}
+
+
+/* Check that 'b' is identical to 'a', and that 'a' is not silent */
+static void check_same(const char *what, const char *wave, float level,
+		int32_t a[2][FRAMES], int32_t b[2][FRAMES])
+{
+	unsigned s, c, diffs = 0, silent = 1;
+	for(c = 0; c < 2; ++c)
+		for(s = 0; s < FRAMES; ++s)
+		{
+			if(a[c][s] != b[c][s])
+				++diffs;
+			if(a[c][s])
+				silent = 0;
+		}
+	printf("  %-16s %-6s %4.1f  %u differing samples%s%s\n", what, wave,
+			level, diffs, silent ? ", silent reference" : "",
+			diffs || silent ? "  FAILED!" : "");
+	if(diffs || silent)
+		++failures;
+}
+
+
+/*
+ * Time the reference and 'limiter' process loops on the same input, after
+ * checking that the latter renders the same output as it does in the engine.
+ */
+static void benchmark(A2_interface *iface, float level)
+{
+	double tlim = 1e9, tla = 1e9, tref = 1e9;
+	int i;
+	render(dry, 0, "Dry", "saw", 0.0f, level, 0.0f);
+	render(wet, 0, "Lim", "saw", 0.0f, level, 0.0f);
+	limit(iface, inplace, dry, 0.0f);
+	check_same("direct", "saw", level, wet, inplace);
+	render(wet, 0, "Lim", "saw", 0.0f, level, LOOKAHEAD);
+	limit(iface, inplace, dry, LOOKAHEAD);
+	check_same("direct lookahead", "saw", level, wet, inplace);
+	for(i = 0; i < BENCHRUNS; ++i)
+	{
+		double t;
+		if((t = reflimit(ref, dry)) < tref)
+			tref = t;
+		if((t = limit(iface, wet, dry, 0.0f)) < tlim)
+			tlim = t;
+		if((t = limit(iface, wet, dry, LOOKAHEAD)) < tla)
+			tla = t;
+	}
+	printf("  Process loops, best of %d:\n", BENCHRUNS);
+	printf("    %-22s %6.2f ns/frame\n", "reference (division)",
+			tref * 1e9 / FRAMES);
+	printf("    %-22s %6.2f ns/frame\n", "limiter",
+			tlim * 1e9 / FRAMES);
+	printf("    %-22s %6.2f ns/frame\n", "limiter, lookahead",
+			tla * 1e9 / FRAMES);
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int w, l, fp;
+	A2_driver *driver;
+	A2_interface *iface;
+	printf("Limiter vs reference implementation:\n");
+	for(w = 0; wavenames[w]; ++w)
+		for(l = 0; levels[l]; ++l)
+		{
+			render(dry, 0, "Dry", wavenames[w], 0.0f, levels[l], 0.0f);
+			render(wet, 0, "Lim", wavenames[w], 0.0f, levels[l], 0.0f);
+			reflimit(ref, dry);
+			check_snr("limiter", wavenames[w], levels[l],
+					snr(ref, wet, 0), MINSNR);
+		}
+
+	printf("Lookahead:\n");
+	for(fp = 0; fp < 2; ++fp)
+		for(w = 0; wavenames[w]; ++w)
+			for(l = 0; levels[l]; ++l)
+			{
+				render(wet, fp ? A2_FLOATPROC : 0, "Lim",
+						wavenames[w], 0.0f, levels[l],
+						LOOKAHEAD);
+				check_peak(fp ? "float lookahead" : "lookahead",
+						wavenames[w], levels[l],
+						maxpeak(wet));
+				render(inplace, fp ? A2_FLOATPROC : 0,
+						"LimInPlace", wavenames[w], 0.0f,
+						levels[l], LOOKAHEAD);
+				check_same(fp ? "float in place" : "in place",
+						wavenames[w], levels[l], wet,
+						inplace);
+			}
+	render(dry, 0, "Dry", "saw", 0.0f, levels[0], 0.0f);
+	render(wet, 0, "Lim", "saw", 0.0f, levels[0], LOOKAHEAD);
+	check_snr("delayed dry", "saw", levels[0], snr(dry, wet, LAFRAMES),
+			MINPASSSNR);
+
+	iface = open_state(&driver, 0);
+	for(l = 0; levels[l]; ++l)
+	{
+		printf("Benchmark, level %.1f:\n", levels[l]);
+		benchmark(iface, levels[l]);
+	}
+	a2_Close(iface);
+
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
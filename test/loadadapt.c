@@ -0,0 +1,169 @@
+/*
+ * loadadapt.c - Audiality 2 CPU load adaptive quality scaling test
+ *
+ *	This test renders offline, as fast as possible, which is measured as a
+ *	DSP load close to 100%. With A2_PCPULOADHIGH set below that, the
+ *	engine is expected to step down to A2_QLOFI, and then start cutting
+ *	voices. With A2_PCPULOADLOW set above the load instead, it is expected
+ *	to lift the voice budget, and step back up to A2_PQUALITY.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	48000
+#define	FRAGMENT	256
+#define	NOTES		32
+
+static const char *script =
+	"export Note(P)\n"
+	"{\n"
+	"	struct { wtosc; panmix }\n"
+	"	w saw; p P; a .02\n"
+	"	d 10000\n"
+	"}\n"
+	"\n"
+	"export FMNote(P)\n"
+	"{\n"
+	"	struct { fm4; panmix }\n"
+	"	p P; a .02; p1 2; a1 .5; p2 3; a2 .5; p3 .5; a3 .5\n"
+	"	d 10000\n"
+	"}\n";
+
+static A2_interface *iface;
+static int failures = 0;
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+static int getprop(A2_properties p)
+{
+	int v;
+	A2_errors res = a2_GetStateProperty(iface, p, &v);
+	if(res)
+		fail(1, res);
+	return v;
+}
+
+
+static void setprop(A2_properties p, int v)
+{
+	A2_errors res = a2_SetStateProperty(iface, p, v);
+	if(res)
+		fail(2, res);
+}
+
+
+/* Render 'ms' milliseconds */
+static void run(unsigned ms)
+{
+	unsigned frames;
+	for(frames = 0; frames < ms * SAMPLERATE / 1000; frames += FRAGMENT)
+		if(a2_Run(iface, FRAGMENT) < 0)
+			fail(3, a2_LastError());
+}
+
+
+static void check(const char *what, int value, int expected)
+{
+	printf("%-40s %5d  (expected %d)%s\n", what, value, expected,
+			value == expected ? "" : "  FAILED!");
+	if(value != expected)
+		++failures;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	A2_handle bank, note, fmnote;
+	A2_config *config;
+	int i, voices;
+
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 2,
+			A2_AUTOCLOSE | A2_SILENT)))
+		fail(4, a2_LastError());
+	if(a2_AddDriver(config, a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(5, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(6, a2_LastError());
+	if((bank = a2_LoadString(iface, script, "loadadapt")) < 0)
+		fail(7, -bank);
+	if((note = a2_Get(iface, bank, "Note")) < 0)
+		fail(8, -note);
+	if((fmnote = a2_Get(iface, bank, "FMNote")) < 0)
+		fail(9, -fmnote);
+
+	check("Default A2_PQUALITY", getprop(A2_PQUALITY), A2_QHIFI);
+	check("A2_PQUALITY out of range",
+			a2_SetStateProperty(iface, A2_PQUALITY, A2_QHIFI + 1),
+			A2_VALUERANGE);
+
+	run(10);
+	for(i = 0; i < NOTES; ++i)
+	{
+		A2_errors res = a2_Play(iface, a2_RootVoice(iface),
+				i & 1 ? fmnote : note, i / 12.0f - 1.0f);
+		if(res)
+			fail(10, res);
+	}
+	run(100);
+	voices = getprop(A2_PACTIVEVOICES);
+
+	/* Overload */
+	setprop(A2_PCPULOADHIGH, 1);
+	setprop(A2_PCPULOADLOW, 0);
+	run(600);
+	check("Overload; A2_PCURRENTQUALITY", getprop(A2_PCURRENTQUALITY),
+			A2_QLOFI);
+	run(1000);
+	check("Overload; voices cut", getprop(A2_PLOADVOICELIMIT) > 0 &&
+			getprop(A2_PACTIVEVOICES) < voices, 1);
+	check("Overload; A2_PQUALITY", getprop(A2_PQUALITY), A2_QHIFI);
+
+	/* Recovery */
+	setprop(A2_PCPULOADHIGH, 10000);
+	setprop(A2_PCPULOADLOW, 10000);
+	run(1000);
+	check("Recovery; A2_PLOADVOICELIMIT", getprop(A2_PLOADVOICELIMIT), 0);
+	check("Recovery; A2_PCURRENTQUALITY", getprop(A2_PCURRENTQUALITY),
+			A2_QHIFI);
+
+	/* Fixed quality, and disabling adaptation */
+	setprop(A2_PQUALITY, A2_QSTANDARD);
+	run(10);
+	check("A2_PQUALITY set", getprop(A2_PCURRENTQUALITY), A2_QSTANDARD);
+	setprop(A2_PCPULOADHIGH, 1);
+	setprop(A2_PCPULOADLOW, 0);
+	run(300);
+	setprop(A2_PCPULOADHIGH, 0);
+	check("Adaptation disabled; A2_PCURRENTQUALITY",
+			getprop(A2_PCURRENTQUALITY), A2_QSTANDARD);
+
+	a2_Close(iface);
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * renderbatch.c - Audiality 2 batch rendering test
+ *
+ *	This test renders a number of waves with a2_RenderBatch(), first using
+ *	only the calling thread, and then with various numbers of threads,
+ *	checking that all jobs render the same data regardless of threading.
+ *
+ *	Usage: renderbatch [max_threads]
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	48000
+#define	LENGTH		(SAMPLERATE / 2)
+#define	JOBS		48
+
+static const char *script =
+	"export Ping(P)\n"
+	"{\n"
+	"	struct { wtosc; filter12 }\n"
+	"	lp 1; q .2; cutoff (P + 3)\n"
+	"	w saw; p P; a .5\n"
+	"	50 { -cutoff .05; *a .95; d 5 }\n"
+	"	w noise; p (P + 4); a .2\n"
+	"	50 { -cutoff .05; *a .9; d 5 }\n"
+	"}\n";
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * Render JOBS waves using 'threads' threads, writing FNV-1a hashes of the
+ * rendered data into 'hashes'. Returns the number of failed jobs.
+ */
+static int render(A2_interface *iface, A2_handle prog, unsigned threads,
+		uint64_t *hashes, double *t)
+{
+	A2_handle waves[JOBS];
+	A2_renderjob jobs[JOBS];
+	int args[JOBS];
+	int i, res, failed = 0;
+	double t0;
+
+	memset(jobs, 0, sizeof(jobs));
+	for(i = 0; i < JOBS; ++i)
+	{
+		if((waves[i] = a2_NewWave(iface, A2_WWAVE, 0, 0)) < 0)
+			fail(10, -waves[i]);
+		args[i] = (i % 24) * 65536 / 12 - 65536;
+		jobs[i].stream = a2_OpenStream(iface, waves[i], 0, 0, 0);
+		if(jobs[i].stream < 0)
+			fail(11, -jobs[i].stream);
+		jobs[i].samplerate = SAMPLERATE;
+		jobs[i].length = LENGTH;
+		jobs[i].program = prog;
+		jobs[i].argc = 1;
+		jobs[i].argv = &args[i];
+	}
+
+	t0 = now();
+	if((res = a2_RenderBatch(iface, jobs, JOBS, threads)) < 0)
+		fail(12, -res);
+	*t = now() - t0;
+
+	for(i = 0; i < JOBS; ++i)
+	{
+		A2_wave *w;
+		unsigned s;
+		uint64_t hash = 14695981039346656037ULL;
+		if(jobs[i].result != LENGTH)
+		{
+			fprintf(stderr, "Job %d failed: %d\n", i,
+					jobs[i].result);
+			++failed;
+		}
+		if((res = a2_Release(iface, jobs[i].stream)))
+			fail(13, res);
+		if(!(w = a2_GetWave(iface, waves[i])))
+			fail(14, A2_WRONGTYPE);
+		for(s = 0; s < w->d.wave.size[0]; ++s)
+		{
+			hash ^= (uint16_t)w->d.wave.data[0][s];
+			hash *= 1099511628211ULL;
+		}
+		hashes[i] = hash;
+		a2_Release(iface, waves[i]);
+	}
+	return failed;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	uint64_t ref[JOBS], hashes[JOBS];
+	A2_handle bank, prog;
+	A2_config *config;
+	A2_interface *iface;
+	int i, threads, maxthreads = 4;
+	int failures = 0;
+	double t, t1;
+	if(argc >= 2)
+		maxthreads = atoi(argv[1]);
+
+	if(!(config = a2_OpenConfig(SAMPLERATE, 1024, 2,
+			A2_AUTOCLOSE | A2_REALTIME | A2_SILENT)))
+		fail(1, a2_LastError());
+	if(a2_AddDriver(config, a2_NewDriver(A2_AUDIODRIVER, "dummy")))
+		fail(2, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(3, a2_LastError());
+	if((bank = a2_LoadString(iface, script, "renderbatch")) < 0)
+		fail(4, -bank);
+	if((prog = a2_Get(iface, bank, "Ping")) < 0)
+		fail(5, -prog);
+
+	printf("Rendering %d waves...\n", JOBS);
+	printf("threads  time (ms)  speedup\n");
+	failures += render(iface, prog, 1, ref, &t1);
+	printf("%5d    %9.2f  %7.2f\n", 1, t1 * 1000.0, 1.0);
+	for(threads = 2; threads <= maxthreads; ++threads)
+	{
+		int mismatches = 0;
+		failures += render(iface, prog, threads, hashes, &t);
+		for(i = 0; i < JOBS; ++i)
+			if(hashes[i] != ref[i])
+				++mismatches;
+		printf("%5d    %9.2f  %7.2f", threads, t * 1000.0, t1 / t);
+		if(mismatches)
+			printf("  %d MISMATCHES!", mismatches);
+		printf("\n");
+		failures += mismatches;
+	}
+
+	a2_Close(iface);
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * renderthreads.c - Audiality 2 parallel voice processing test
+ *
+ *	This test renders a large number of voices started directly on the
+ *	root voice, with A2_PRENDERTHREADS set to various values, and checks
+ *	that the output is identical to that of serial processing. Processing
+ *	times are printed for each thread count. This is done with a script
+ *	that does not use 'rand' or noise, and with one that uses both, as
+ *	voices have random number generators of their own. Finally, the test
+ *	checks that render threads are refused with A2_PROFILE.
+ *
+ *	Usage: renderthreads [max_threads]
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	48000
+#define	FRAGMENT	256
+#define	FRAMES		(SAMPLERATE * 2)
+
+/* Voices started before running, and then one every STARTEVERY fragments */
+#define	VOICES		64
+#define	STARTEVERY	4
+
+/* "Stack" is deterministic as is, whereas "NoiseStack" relies on voice RNGs */
+static const char *script =
+	"Partial(P V L)\n"
+	"{\n"
+	"	struct { wtosc; filter12; panmix }\n"
+	"	lp .5; bp .5; hp .1; q .1\n"
+	"	w saw; p P; a V; cutoff (P + 2); pan (P % 1 - .5)\n"
+	"	L {\n"
+	"		-cutoff .01; +p .0005; d 10\n"
+	"	}\n"
+	"	a 0; d 5\n"
+	"	1(NV) { a NV }\n"
+	"}\n"
+	"\n"
+	"export Stack(P V L)\n"
+	"{\n"
+	"	struct { inline; panmix }\n"
+	"	!i 0\n"
+	"	4 {\n"
+	"		*:Partial P (V * .25) (L - i)\n"
+	"		+P .37; +i 20\n"
+	"	}\n"
+	"	L {\n"
+	"		d 10\n"
+	"		*<1 (V * .2)\n"
+	"	}\n"
+	"	d 100\n"
+	"}\n"
+	"\n"
+	"NoisePartial(P V L)\n"
+	"{\n"
+	"	struct { wtosc; panmix }\n"
+	"	w noise; p (P + rand 1); a V; pan (rand 2 - 1)\n"
+	"	L {\n"
+	"		+p (rand .01 - .005); d 10\n"
+	"	}\n"
+	"	a 0; d 5\n"
+	"	1(NV) { a NV }\n"
+	"}\n"
+	"\n"
+	"export NoiseStack(P V L)\n"
+	"{\n"
+	"	struct { inline; panmix }\n"
+	"	!i 0\n"
+	"	4 {\n"
+	"		*:NoisePartial P (V * .25) (L - i)\n"
+	"		+P .37; +i 20\n"
+	"	}\n"
+	"	L {\n"
+	"		d 10\n"
+	"		*<1 (V * .2)\n"
+	"	}\n"
+	"	d 100\n"
+	"}\n";
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static A2_handle start_stack(A2_interface *iface, A2_handle h, int n)
+{
+	int a[3];
+	a[0] = (n % 37) * 65536 / 12 - 2 * 65536;
+	a[1] = 65536 / 16;
+	a[2] = (60 + (n * 7) % 150) << 16;
+	return a2_Starta(iface, a2_RootVoice(iface), h, 3, a);
+}
+
+
+/*
+ * Render program 'name' with 'threads' render threads, returning an FNV-1a
+ * hash of the output
+ */
+static uint64_t render(int threads, const char *name, double *t)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	int i, frames, n = 0;
+	A2_handle bank, h, vh;
+	A2_config *config;
+	A2_interface *iface;
+	A2_driver *drv;
+	A2_errors res;
+	double t0;
+
+	if(!(drv = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 2,
+			A2_AUTOCLOSE | A2_SILENT)))
+		fail(2, a2_LastError());
+	if(a2_AddDriver(config, drv))
+		fail(3, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(4, a2_LastError());
+	if((res = a2_SetStateProperty(iface, A2_PRENDERTHREADS, threads)))
+		fail(5, res);
+	if((bank = a2_LoadString(iface, script, "renderthreads")) < 0)
+		fail(6, -bank);
+	if((h = a2_Get(iface, bank, name)) < 0)
+		fail(7, -h);
+
+	for(n = 0; n < VOICES; ++n)
+		if((vh = start_stack(iface, h, n)) < 0)
+			fail(8, -vh);
+
+	t0 = now();
+	for(frames = 0; frames < FRAMES; frames += FRAGMENT)
+	{
+		int32_t **bufs = ((A2_audiodriver *)drv)->buffers;
+		if(!(frames / FRAGMENT % STARTEVERY))
+		{
+			if((vh = start_stack(iface, h, n++)) < 0)
+				fail(9, -vh);
+			a2_Release(iface, vh);
+		}
+		if(a2_Run(iface, FRAGMENT) < 0)
+			fail(10, a2_LastError());
+		for(i = 0; i < FRAGMENT * 2; ++i)
+		{
+			hash ^= (uint32_t)bufs[i & 1][i >> 1];
+			hash *= 1099511628211ULL;
+		}
+	}
+	*t = now() - t0;
+
+	a2_Close(iface);
+	return hash;
+}
+
+
+/* Check that render threads are refused in a state with the VM profiler */
+static int check_profile(void)
+{
+	A2_config *config;
+	A2_interface *iface;
+	A2_errors res;
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 2,
+			A2_AUTOCLOSE | A2_SILENT | A2_PROFILE)))
+		fail(11, a2_LastError());
+	if(a2_AddDriver(config, a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(12, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(13, a2_LastError());
+	res = a2_SetStateProperty(iface, A2_PRENDERTHREADS, 2);
+	a2_Close(iface);
+	printf("A2_PROFILE with render threads: %s%s\n", a2_ErrorString(res),
+			res == A2_NOTIMPLEMENTED ? "" : "  FAILED!");
+	return res == A2_NOTIMPLEMENTED;
+}
+
+
+/*
+ * Render program 'name' serially, and with 1 through 'maxthreads' threads,
+ * returning the number of thread counts that did not match serial processing
+ */
+static int check_threads(const char *name, int maxthreads)
+{
+	int threads, failures = 0;
+	uint64_t ref;
+	double t, t1 = 0.0;
+	ref = render(0, name, &t);
+	printf("%s:\n", name);
+	printf("threads  time (ms)  speedup  output\n");
+	printf("  off    %9.2f           %016llx\n", t * 1000.0,
+			(unsigned long long)ref);
+	for(threads = 1; threads <= maxthreads; ++threads)
+	{
+		uint64_t hash = render(threads, name, &t);
+		if(threads == 1)
+			t1 = t;
+		printf("%5d    %9.2f  %7.2f  %016llx%s\n", threads, t * 1000.0,
+				t1 / t, (unsigned long long)hash,
+				hash == ref ? "" : "  MISMATCH!");
+		if(hash != ref)
+			++failures;
+	}
+	return failures;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int maxthreads = 4;
+	int failures = 0;
+	if(argc >= 2)
+		maxthreads = atoi(argv[1]);
+
+	failures += check_threads("Stack", maxthreads);
+	failures += check_threads("NoiseStack", maxthreads);
+	if(!check_profile())
+		++failures;
+
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
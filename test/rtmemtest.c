@@ -0,0 +1,132 @@
+/*
+ * rtmemtest.c - Audiality 2 realtime memory manager test
+ *
+ *	This test runs an engine state with no initial pools on a small "tlsf"
+ *	sysdriver arena, starting voices until the arena has to be refilled,
+ *	and checks that the output matches that of the "malloc" sysdriver, and
+ *	that no allocations failed.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	48000
+#define	FRAGMENT	256
+#define	FRAMES		(SAMPLERATE * 2)
+
+static const char *script =
+	"export Note(P)\n"
+	"{\n"
+	"	struct { wtosc; filter12 }\n"
+	"	w saw; p P; a .05; cutoff (P + 2); q .2\n"
+	"	100 { -cutoff .01; d 10 }\n"
+	"}\n";
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+/* Render using sysdriver 'sysname', returning an FNV-1a hash of the output */
+static uint64_t render(const char *sysname, A2_rtmemstats *stats)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	int i, frames, n = 0;
+	A2_handle bank, h, vh;
+	A2_config *config;
+	A2_interface *iface;
+	A2_driver *drv, *sys;
+	A2_errors res;
+
+	if(!(drv = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(sys = a2_NewDriver(A2_SYSDRIVER, sysname)))
+		fail(2, a2_LastError());
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 2,
+			A2_AUTOCLOSE | A2_SILENT)))
+		fail(3, a2_LastError());
+	if(a2_AddDriver(config, drv) || a2_AddDriver(config, sys))
+		fail(4, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(5, a2_LastError());
+	if((bank = a2_LoadString(iface, script, "rtmemtest")) < 0)
+		fail(6, -bank);
+	if((h = a2_Get(iface, bank, "Note")) < 0)
+		fail(7, -h);
+
+	for(frames = 0; frames < FRAMES; frames += FRAGMENT)
+	{
+		int32_t **bufs = ((A2_audiodriver *)drv)->buffers;
+		for(i = 0; i < 4; ++i, ++n)
+		{
+			if((vh = a2_Start(iface, a2_RootVoice(iface), h,
+					(n % 37 - 24) / 12.0f)) < 0)
+				fail(8, -vh);
+			a2_Release(iface, vh);
+		}
+		if(a2_Run(iface, FRAGMENT) < 0)
+			fail(9, a2_LastError());
+		for(i = 0; i < FRAGMENT * 2; ++i)
+		{
+			hash ^= (uint32_t)bufs[i & 1][i >> 1];
+			hash *= 1099511628211ULL;
+		}
+
+		/* Give the refill thread a chance, as a realtime host would */
+		a2_Sleep(1);
+	}
+
+	if(stats && (res = a2_GetRTMemStats((A2_sysdriver *)sys, stats)))
+		fail(10, res);
+	a2_Close(iface);
+	return hash;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	A2_rtmemstats st;
+	uint64_t ref, hash;
+	int failures = 0;
+
+	ref = render("malloc", NULL);
+	hash = render("tlsf,arena=256,refill=128", &st);
+	printf("malloc output: %016llx\n", (unsigned long long)ref);
+	printf("  tlsf output: %016llx%s\n", (unsigned long long)hash,
+			hash == ref ? "" : "  MISMATCH!");
+	printf("  arenas: %u (%u bytes, %u refills)\n", st.arenas, st.size,
+			st.refills);
+	printf("  used: %u bytes, high water mark: %u bytes\n", st.used,
+			st.highwater);
+	printf("  failed allocations: %u\n", st.failures);
+	if(hash != ref)
+		++failures;
+	if(!st.refills || st.failures)
+		++failures;
+
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * simdtest.c - Audiality 2 SIMD DSP code differential test
+ *
+ *	This test renders oscillators into two off-line engine states; one
+ *	using the SIMD DSP code supported by the CPU, and one with the
+ *	A2_NOSIMD flag set, so that only the scalar reference code is used.
+ *	Mipmapped and plain waves, looped and one-shot, are played with pitch
+ *	and amplitude ramps over a wide range, at every oscillator quality
+ *	level, and the rendered audio is compared bit for bit.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	44100
+#define	FRAGMENT	333	/* Odd size, for partial SIMD vectors */
+#define	DURATION	800	/* ms per oscillator */
+#define	WAVELEN		1000
+#define	WAVEPER		100
+
+static const char *script =
+	"export Osc(W P)\n"
+	"{\n"
+	"	struct { wtosc }\n"
+	"	w W; @p P; @a 0\n"
+	"	a .5; d 30\n"
+	"	p (P + 6); d 300\n"
+	"	a .2; p (P - 3); d 300\n"
+	"	phase .25; d 50\n"
+	"	a 0; d 20\n"
+	"}\n";
+
+/* Engine states; [0] with SIMD code, [1] scalar only */
+typedef struct ST_state
+{
+	A2_driver	*driver;
+	A2_interface	*iface;
+	A2_handle	osc;
+	A2_handle	waves[4];
+} ST_state;
+
+static const char *wavenames[4] = {
+	"saw",
+	"sine",
+	"plain, looped",
+	"plain, one-shot"
+};
+
+static int16_t wavedata[WAVELEN];
+static int failures = 0;
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+static void open_state(ST_state *s, int flags)
+{
+	A2_config *config;
+	A2_handle bank;
+	if(!(s->driver = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 1,
+			A2_AUTOCLOSE | A2_SILENT | flags)))
+		fail(2, a2_LastError());
+	if(a2_AddDriver(config, s->driver))
+		fail(3, a2_LastError());
+	if(!(s->iface = a2_Open(config)))
+		fail(4, a2_LastError());
+	if((bank = a2_LoadString(s->iface, script, "simdtest")) < 0)
+		fail(5, -bank);
+	if((s->osc = a2_Get(s->iface, bank, "Osc")) < 0)
+		fail(6, -s->osc);
+	s->waves[0] = a2_Get(s->iface, A2_ROOTBANK, "saw");
+	s->waves[1] = a2_Get(s->iface, A2_ROOTBANK, "sine");
+	s->waves[2] = a2_UploadWave(s->iface, A2_WWAVE, WAVEPER, A2_LOOPED,
+			A2_I16, wavedata, sizeof(wavedata));
+	s->waves[3] = a2_UploadWave(s->iface, A2_WWAVE, WAVEPER, 0,
+			A2_I16, wavedata, sizeof(wavedata));
+	if((s->waves[0] < 0) || (s->waves[1] < 0) || (s->waves[2] < 0) ||
+			(s->waves[3] < 0))
+		fail(7, A2_NOTFOUND);
+}
+
+
+/* Run both states for 'frames' frames, returning the number of mismatches */
+static int run_compare(ST_state *s, unsigned frames)
+{
+	int mismatches = 0;
+	while(frames)
+	{
+		int i;
+		unsigned frag = frames < FRAGMENT ? frames : FRAGMENT;
+		for(i = 0; i < 2; ++i)
+			if(a2_Run(s[i].iface, frag) < 0)
+				fail(8, a2_LastError());
+		if(memcmp(((A2_audiodriver *)s[0].driver)->buffers[0],
+				((A2_audiodriver *)s[1].driver)->buffers[0],
+				frag * sizeof(int32_t)))
+			++mismatches;
+		frames -= frag;
+	}
+	return mismatches;
+}
+
+
+static void test_osc(ST_state *s, int w, float pitch)
+{
+	int i, mismatches;
+	for(i = 0; i < 2; ++i)
+		if(a2_Play(s[i].iface, a2_RootVoice(s[i].iface), s[i].osc,
+				(float)s[i].waves[w], pitch))
+			fail(9, a2_LastError());
+	mismatches = run_compare(s, DURATION * SAMPLERATE / 1000);
+	printf("  %-16s p %5.1f %s\n", wavenames[w], pitch,
+			mismatches ? "MISMATCH" : "ok");
+	if(mismatches)
+		++failures;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int i, q, w;
+	float p;
+	ST_state s[2];
+	uint32_t seed = 1;
+	for(i = 0; i < WAVELEN; ++i)
+	{
+		seed = seed * 1664525 + 1013904223;
+		wavedata[i] = (int16_t)(seed >> 16);
+	}
+	open_state(&s[0], 0);
+	open_state(&s[1], A2_NOSIMD);
+	for(q = A2_QLOFI; q <= A2_QHIFI; ++q)
+	{
+		printf("Quality %d\n", q);
+		for(i = 0; i < 2; ++i)
+			if(a2_SetStateProperty(s[i].iface, A2_PQUALITY, q))
+				fail(10, a2_LastError());
+		for(w = 0; w < 4; ++w)
+			for(p = -4.0f; p <= 5.0f; p += 3.0f)
+				test_osc(s, w, p);
+	}
+	for(i = 0; i < 2; ++i)
+		a2_Close(s[i].iface);
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
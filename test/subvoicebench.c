@@ -0,0 +1,156 @@
+/*
+ * subvoicebench.c - Audiality 2 subvoice addressing benchmark
+ *
+ *	This test renders offline with a sequencer program that starts a large
+ *	number of attached subvoices with IDs 0 through N - 1, sends messages
+ *	to them by ID, round-robin, and then kills them one by one, also by
+ *	ID. The time spent is printed, and the number of active voices is
+ *	checked afterwards, to verify that every kill reached its voice.
+ *
+ *	Usage: subvoicebench [voices [rounds]]
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	48000
+#define	FRAGMENT	256
+
+/* Subvoices addressed per millisecond, to stay clear of the VM timeslice */
+#define	BATCH		100
+
+/*
+ * IDs 2000 and 5000 are spawned and killed with literal IDs, the latter being
+ * above the range of the subvoice index.
+ */
+static const char *script =
+	"Sub()\n"
+	"{\n"
+	"	end\n"
+	"	1() {}\n"
+	"}\n"
+	"\n"
+	"export Seq(N B R)\n"
+	"{\n"
+	"	!i 0\n"
+	"	(N / B) {\n"
+	"		B { i:Sub; +i 1 }\n"
+	"		d 1\n"
+	"	}\n"
+	"	2000:Sub\n"
+	"	5000:Sub\n"
+	"	R {\n"
+	"		i 0\n"
+	"		(N / B) {\n"
+	"			B { i<1; +i 1 }\n"
+	"			d 1\n"
+	"		}\n"
+	"	}\n"
+	"	i 0\n"
+	"	(N / B) {\n"
+	"		B { kill i; +i 1 }\n"
+	"		d 1\n"
+	"	}\n"
+	"	kill 2000\n"
+	"	kill 5000\n"
+	"	end\n"
+	"}\n";
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int voices = 1000, rounds = 100;
+	int a[3], frames, duration, active, base, peak;
+	A2_handle bank, h, vh;
+	A2_config *config;
+	A2_interface *iface;
+	A2_errors res;
+	double t0, t;
+	if(argc >= 2)
+		voices = atoi(argv[1]);
+	if(argc >= 3)
+		rounds = atoi(argv[2]);
+	voices = (voices + BATCH - 1) / BATCH * BATCH;
+
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 2,
+			A2_AUTOCLOSE | A2_SILENT)))
+		fail(1, a2_LastError());
+	if(a2_AddDriver(config, a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(2, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(3, a2_LastError());
+	if((bank = a2_LoadString(iface, script, "subvoicebench")) < 0)
+		fail(4, -bank);
+	if((h = a2_Get(iface, bank, "Seq")) < 0)
+		fail(5, -h);
+	if((res = a2_GetStateProperty(iface, A2_PACTIVEVOICES, &base)))
+		fail(6, res);
+
+	a[0] = voices << 16;
+	a[1] = BATCH << 16;
+	a[2] = rounds << 16;
+	if((vh = a2_Starta(iface, a2_RootVoice(iface), h, 3, a)) < 0)
+		fail(7, -vh);
+
+	/* Spawn, message and kill phases, plus some margin */
+	duration = (voices / BATCH * (rounds + 2) + 10) * SAMPLERATE / 1000;
+	t0 = now();
+	for(frames = 0; frames < duration; frames += FRAGMENT)
+		if(a2_Run(iface, FRAGMENT) < 0)
+			fail(8, a2_LastError());
+	t = now() - t0;
+
+	if((res = a2_GetStateProperty(iface, A2_PACTIVEVOICES, &active)))
+		fail(9, res);
+	if((res = a2_GetStateProperty(iface, A2_PACTIVEVOICESMAX, &peak)))
+		fail(10, res);
+	a2_Close(iface);
+
+	printf("%d subvoices, %d messages each: %.2f ms, %.1f ns/message\n",
+			voices, rounds, t * 1000.0,
+			t * 1e9 / ((double)voices * rounds));
+	printf("%d voices at peak, %d left (expected %d)\n", peak, active,
+			base + 1);
+	if(active != base + 1)
+	{
+		printf("Subvoices were not all killed!\n");
+		return 1;
+	}
+	return 0;
+}
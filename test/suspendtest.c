@@ -0,0 +1,146 @@
+/*
+ * suspendtest.c - Audiality 2 silent voice suspension test
+ *
+ *	This test plays a one-shot wave with a silent section several times
+ *	longer than the silence detection window, in a state opened with the
+ *	A2_SUSPENDSILENT flag, and in one without, and checks that the two
+ *	render identical output, that is, that the voice is not suspended
+ *	before the end of the wave. It then checks that the voice is actually
+ *	suspended once the oscillator amplitude has been set to 0.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	44100
+#define	FRAGMENT	64
+#define	DURATION	400	/* ms */
+#define	FRAMES		(DURATION * SAMPLERATE / 1000)
+#define	WAVEPER		100
+#define	TONELEN		500	/* Frames of tone at either end of the wave */
+#define	GAPLEN		3000	/* Frames of silence in the middle */
+#define	WAVELEN		(TONELEN + GAPLEN + TONELEN)
+
+/*
+ * Plays the wave in about 150 ms, and then keeps the voice running with the
+ * amplitude set to 0, which should get it suspended.
+ */
+static const char *script =
+	"export Shot(W)\n"
+	"{\n"
+	"	struct { wtosc }\n"
+	"	@w W; @a .5\n"
+	"	d 250\n"
+	"	@a 0\n"
+	"	d 1000\n"
+	"}\n";
+
+static int16_t wavedata[WAVELEN];
+static int32_t output[2][FRAMES];
+static int failures = 0;
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+/*
+ * Render the test program into 'out', and return the number of voices
+ * suspended at the end.
+ */
+static int render(int32_t *out, int flags)
+{
+	A2_config *config;
+	A2_driver *driver;
+	A2_interface *iface;
+	A2_handle bank, h, w;
+	unsigned s;
+	int suspended;
+	if(!(driver = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 1,
+			A2_AUTOCLOSE | A2_SILENT | flags)))
+		fail(2, a2_LastError());
+	if(a2_AddDriver(config, driver))
+		fail(3, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(4, a2_LastError());
+	if((bank = a2_LoadString(iface, script, "suspendtest")) < 0)
+		fail(5, -bank);
+	if((h = a2_Get(iface, bank, "Shot")) < 0)
+		fail(6, -h);
+	if((w = a2_UploadWave(iface, A2_WWAVE, WAVEPER, 0, A2_I16, wavedata,
+			sizeof(wavedata))) < 0)
+		fail(7, -w);
+	if(a2_Play(iface, a2_RootVoice(iface), h, (float)w))
+		fail(8, a2_LastError());
+	for(s = 0; s < FRAMES; s += FRAGMENT)
+	{
+		unsigned frag = FRAMES - s < FRAGMENT ? FRAMES - s : FRAGMENT;
+		if(a2_Run(iface, frag) < 0)
+			fail(9, a2_LastError());
+		memcpy(out + s, ((A2_audiodriver *)driver)->buffers[0],
+				frag * sizeof(int32_t));
+	}
+	if(a2_GetStateProperty(iface, A2_PSUSPENDEDVOICES, &suspended))
+		fail(10, a2_LastError());
+	a2_Close(iface);
+	return suspended;
+}
+
+
+static void check(const char *what, int ok)
+{
+	printf("  %-40s %s\n", what, ok ? "ok" : "FAILED!");
+	if(!ok)
+		++failures;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int i, suspended, lasttone = -1;
+
+	/* Square wave bursts, with silence in between */
+	for(i = 0; i < WAVELEN; ++i)
+		if((i < TONELEN) || (i >= TONELEN + GAPLEN))
+			wavedata[i] = (i / (WAVEPER / 2)) & 1 ? -16384 : 16384;
+
+	printf("One-shot wave with a %d frame silent section:\n", GAPLEN);
+	render(output[0], 0);
+	suspended = render(output[1], A2_SUSPENDSILENT);
+	for(i = 0; i < FRAMES; ++i)
+		if(output[0][i])
+			lasttone = i;
+	check("reference plays the end of the wave",
+			lasttone > FRAMES / 4);
+	check("identical output with A2_SUSPENDSILENT",
+			!memcmp(output[0], output[1], sizeof(output[0])));
+	check("voice suspended after '@a 0'", suspended == 1);
+
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
@@ -11,6 +11,12 @@
  *	played at 1 ms intervals. Ideally, there should be no variations, such
  *	as pitch variations, phasing or other artifacts in the sound generated.
  *
+ *	With the -drift switch, an off-line regression test of the tick timer
+ *	is run instead. A program that performs a long sequence of short TDELAY
+ *	instructions is rendered at a few different tick durations, and the
+ *	time of the final step is checked against the exact musical time. The
+ *	test fails if the error exceeds one sample frame.
+ *
  * KNOWN ISSUES
  *
  *   Aliasing distortion
@@ -64,6 +70,18 @@
 /* Timestamp nudge correction coefficient [0, 1] */
 #define	CORRECTION	0.01f
 
+/* Number of 1000 tick batches to run per drift test */
+#define	DRIFTBATCHES	100
+
+/* Tick durations for the drift test (ms, 16:16 fixp) */
+static const int drift_ticks[] = {
+	21845,		/* ~1/3 ms */
+	1365,		/* ~1/48 ms */
+	9362,		/* ~1/7 ms */
+	65536 * 5 / 4,	/* 1.25 ms */
+	0
+};
+
 
 /* Configuration */
 const char *audiodriver = "default";
@@ -71,6 +89,7 @@ int samplerate = 48000;
 int channels = 2;
 int audiobuf = 4096;
 int waverate = 0;
+int drift = 0;
 
 static int do_exit = 0;
 
@@ -84,6 +103,8 @@ static void usage(const char *exename)
 			"           -r<n>       Audio sample rate (Hz)\n"
 			"           -c<n>       Number of audio channels\n\n"
 			"           -wr<n>      Wave sample rate (Hz)\n"
+			"           -drift      Run off-line tick timer drift "
+			"test\n"
 			"           -h          Help\n\n");
 }
 
@@ -96,7 +117,12 @@ static void parse_args(int argc, const char *argv[])
 	{
 		if(argv[i][0] != '-')
 			continue;
-		if(strncmp(argv[i], "-d", 2) == 0)
+		if(strcmp(argv[i], "-drift") == 0)
+		{
+			drift = 1;
+			printf("[Tick timer drift test]\n");
+		}
+		else if(strncmp(argv[i], "-d", 2) == 0)
 		{
 			audiodriver = &argv[i][2];
 			printf("[Driver: %s]\n", audiodriver);
@@ -149,6 +175,75 @@ static void fail(unsigned where, A2_errors err)
 }
 
 
+/*
+ * Render TickDrift with tick duration 'tick' off-line, and return the error in
+ * sample frames between the step in the output and the exact musical time.
+ */
+static double drift_run(A2_interface *iface, A2_driver *drv, A2_handle ph,
+		int tick)
+{
+	int args[2] = { tick, DRIFTBATCHES << 16 };
+	double expected = (double)DRIFTBATCHES * 1000 * tick * samplerate /
+			65536 / 1000;
+	unsigned frame = 0;
+	A2_handle vh;
+	if((vh = a2_Starta(iface, a2_RootVoice(iface), ph, 2, args)) < 0)
+		fail(20, -vh);
+	while(1)
+	{
+		int i;
+		int32_t *buf = ((A2_audiodriver *)drv)->buffers[0];
+		if(a2_Run(iface, audiobuf) < 0)
+			fail(21, a2_LastError());
+		for(i = 0; i < audiobuf; ++i, ++frame)
+			if(buf[i])
+			{
+				a2_Kill(iface, vh);
+				a2_Run(iface, audiobuf);
+				return frame - expected;
+			}
+		if(frame > expected * 2 + samplerate)
+			fail(22, A2_INTERNAL);	/* No step! */
+	}
+}
+
+
+static int drift_test(void)
+{
+	int i, failures = 0;
+	A2_handle h, ph;
+	A2_driver *drv;
+	A2_config *cfg;
+	A2_interface *iface;
+	if(!(drv = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(10, a2_LastError());
+	if(!(cfg = a2_OpenConfig(samplerate, audiobuf, 1,
+			A2_AUTOCLOSE | A2_SILENT)))
+		fail(11, a2_LastError());
+	if(a2_AddDriver(cfg, drv))
+		fail(12, a2_LastError());
+	if(!(iface = a2_Open(cfg)))
+		fail(13, a2_LastError());
+	if((h = a2_Load(iface, "data/testprograms.a2s", 0)) < 0)
+		fail(14, -h);
+	if((ph = a2_Get(iface, h, "TickDrift")) < 0)
+		fail(15, -ph);
+	for(i = 0; drift_ticks[i]; ++i)
+	{
+		double err = drift_run(iface, drv, ph, drift_ticks[i]);
+		int ok = fabs(err) <= 1.0;
+		printf("  tick %f ms, %d ticks: %+.3f frames  %s\n",
+				drift_ticks[i] / 65536.0f, DRIFTBATCHES * 1000,
+				err, ok ? "ok" : "FAILED");
+		if(!ok)
+			++failures;
+	}
+	a2_Close(iface);
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
+
+
 int main(int argc, const char *argv[])
 {
 	int b, t;
@@ -162,6 +257,8 @@ int main(int argc, const char *argv[])
 
 	/* Command line switches */
 	parse_args(argc, argv);
+	if(drift)
+		return drift_test();
 
 	/* Configure and open master state */
 	if(!(drv = a2_NewDriver(A2_AUDIODRIVER, audiodriver)))
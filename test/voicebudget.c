@@ -0,0 +1,178 @@
+/*
+ * voicebudget.c - Audiality 2 voice budget and voice stealing test
+ *
+ *	This test renders offline, starting more voices than allowed by
+ *	group polyphony limits ('poly'), the A2_PVOICELIMIT state property,
+ *	and a script using 'poly' with subvoice IDs, checking that the
+ *	expected number of voices remain once the stolen voices have faded
+ *	out, and that voices with higher priority ('pri') are kept.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	48000
+#define	FRAGMENT	256
+
+static const char *script =
+	"export Note(P R)\n"
+	"{\n"
+	"	struct { wtosc; panmix }\n"
+	"	w sine; p P; a .1\n"
+	"	pri R\n"
+	"	d 10000\n"
+	"	1() {}\n"
+	"}\n"
+	"\n"
+	"export Seq()\n"
+	"{\n"
+	"	poly 3\n"
+	"	!i 0\n"
+	"	20 { i:Note (i / 12) 0; +i 1; d 5 }\n"
+	"	i 0\n"
+	"	20 { i<1; kill i; +i 1 }\n"
+	"	20 { (i + 100):Note 0 0; +i 1; d 5 }\n"
+	"	end\n"
+	"}\n";
+
+static A2_interface *iface;
+static int failures = 0;
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+static int getprop(A2_properties p)
+{
+	int v;
+	A2_errors res = a2_GetStateProperty(iface, p, &v);
+	if(res)
+		fail(1, res);
+	return v;
+}
+
+
+/* Render 'ms' milliseconds */
+static void run(unsigned ms)
+{
+	unsigned frames;
+	for(frames = 0; frames < ms * SAMPLERATE / 1000; frames += FRAGMENT)
+		if(a2_Run(iface, FRAGMENT) < 0)
+			fail(2, a2_LastError());
+}
+
+
+static void check(const char *what, int value, int expected)
+{
+	printf("%-40s %5d  (expected %d)%s\n", what, value, expected,
+			value == expected ? "" : "  FAILED!");
+	if(value != expected)
+		++failures;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	A2_handle bank, note, seq, g, h, vh;
+	A2_config *config;
+	A2_errors res;
+	int i, base, stolen, ch;
+
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 2,
+			A2_AUTOCLOSE | A2_SILENT)))
+		fail(3, a2_LastError());
+	if(a2_AddDriver(config, a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(4, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(5, a2_LastError());
+	if((bank = a2_LoadString(iface, script, "voicebudget")) < 0)
+		fail(6, -bank);
+	if((note = a2_Get(iface, bank, "Note")) < 0)
+		fail(7, -note);
+	if((seq = a2_Get(iface, bank, "Seq")) < 0)
+		fail(8, -seq);
+	base = getprop(A2_PACTIVEVOICES);
+
+	/* Group with a polyphony limit of 4 */
+	if((g = a2_NewGroup(iface, a2_RootVoice(iface))) < 0)
+		fail(9, -g);
+	if((res = a2_Send(iface, g, 4, 4.0f)))
+		fail(10, res);
+	run(10);
+	for(i = 0; i < 20; ++i)
+		if((res = a2_Play(iface, g, note, i / 12.0f, 0.0f)))
+			fail(11, res);
+	run(50);
+	check("Group with 'poly 4'; voices",
+			getprop(A2_PACTIVEVOICES) - base - 1, 4);
+	check("Group with 'poly 4'; stolen", getprop(A2_PSTOLENVOICES), 16);
+
+	/* The 'pri 1' voice is to be kept, while the others are stolen */
+	if((res = a2_Send(iface, g, 4, 2.0f)))
+		fail(12, res);
+	if((h = a2_Start(iface, g, note, 0.0f, 1.0f)) < 0)
+		fail(13, -h);
+	run(10);
+	for(i = 0; i < 10; ++i)
+	{
+		if((res = a2_Play(iface, g, note, i / 12.0f, 0.0f)))
+			fail(14, res);
+		run(10);
+	}
+	run(50);
+	check("Group with 'poly 2'; voices",
+			getprop(A2_PACTIVEVOICES) - base - 1, 2);
+	check("Group with 'poly 2'; 'pri 1' voice alive",
+			a2_GetProperty(iface, h, A2_PCHANNELS, &ch), A2_OK);
+
+	/* State voice limit */
+	stolen = getprop(A2_PSTOLENVOICES);
+	if((res = a2_SetStateProperty(iface, A2_PVOICELIMIT, base + 1 + 2 + 5)))
+		fail(15, res);
+	for(i = 0; i < 20; ++i)
+		if((res = a2_Play(iface, a2_RootVoice(iface), note, i / 12.0f,
+				0.0f)))
+			fail(16, res);
+	run(50);
+	check("A2_PVOICELIMIT; voices", getprop(A2_PACTIVEVOICES),
+			base + 1 + 2 + 5);
+	check("A2_PVOICELIMIT; stolen", getprop(A2_PSTOLENVOICES) - stolen,
+			15);
+	if((res = a2_SetStateProperty(iface, A2_PVOICELIMIT, 0)))
+		fail(17, res);
+
+	/* Script with 'poly 3', addressing stolen subvoices by ID */
+	base = getprop(A2_PACTIVEVOICES);
+	if((vh = a2_Start(iface, a2_RootVoice(iface), seq)) < 0)
+		fail(18, -vh);
+	run(500);
+	check("Script with 'poly 3'; voices",
+			getprop(A2_PACTIVEVOICES) - base - 1, 3);
+
+	a2_Close(iface);
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}
@@ -7,6 +7,10 @@
  *	audible buzz at the 200 Hz rate at which the notes are played. The
  *	printed "nudge" corrections are supposed to remain close to zero.
  *
+ *	With the -sb switch, the test instead renders offline as fast as
+ *	possible, starting the specified number of voices per fragment, and
+ *	prints the resulting voice spawn throughput.
+ *
  * Copyright 2014-2016 David Olofson <david@olofson.net>
  *
  * This software is provided 'as-is', without any express or implied warranty.
@@ -32,6 +36,7 @@
 #include <signal.h>
 #include <unistd.h>
 #include <math.h>
+#include <time.h>
 #include "audiality2.h"
 
 
@@ -44,6 +49,10 @@
 /* Timestamp nudge correction coefficient [0, 1] */
 #define	CORRECTION	0.01f
 
+/* Spawn benchmark fragment size and duration (frames) */
+#define	BENCHFRAGMENT	256
+#define	BENCHFRAMES	(48000 * 10)
+
 
 /* Configuration */
 const char *audiodriver = "default";
@@ -51,6 +60,7 @@ int samplerate = 48000;
 int channels = 2;
 int audiobuf = 4096;
 int waverate = 0;
+int spawnbench = 0;
 
 static int do_exit = 0;
 
@@ -64,6 +74,7 @@ static void usage(const char *exename)
 			"           -r<n>       Audio sample rate (Hz)\n"
 			"           -c<n>       Number of audio channels\n\n"
 			"           -wr<n>      Wave sample rate (Hz)\n"
+			"           -sb<n>      Spawn benchmark; n voices/fragment\n"
 			"           -h          Help\n\n");
 }
 
@@ -101,6 +112,12 @@ static void parse_args(int argc, const char *argv[])
 			waverate = atoi(&argv[i][3]);
 			printf("[Wave sample rate: %d]\n", waverate);
 		}
+		else if(strncmp(argv[i], "-sb", 3) == 0)
+		{
+			spawnbench = atoi(&argv[i][3]);
+			printf("[Spawn benchmark: %d voices/fragment]\n",
+					spawnbench);
+		}
 		else if(strncmp(argv[i], "-h", 2) == 0)
 		{
 			usage(argv[0]);
@@ -129,6 +146,73 @@ static void fail(unsigned where, A2_errors err)
 }
 
 
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * Render offline through the "buffer" driver, playing 'spawnbench' short
+ * "blips" every fragment. (Voices cannot be released from the API in
+ * offline states, so we use a2_Play() with a self-terminating program.)
+ */
+static void spawn_benchmark(void)
+{
+	int i, frames, spawned = 0;
+	int total, mem;
+	A2_handle h, ph;
+	A2_driver *drv;
+	A2_config *cfg;
+	A2_interface *iface;
+	double t0, t;
+
+	if(!(drv = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(20, a2_LastError());
+	if(!(cfg = a2_OpenConfig(samplerate, BENCHFRAGMENT, channels,
+			A2_AUTOCLOSE | A2_SILENT)))
+		fail(21, a2_LastError());
+	if(a2_AddDriver(cfg, drv))
+		fail(22, a2_LastError());
+	if(!(iface = a2_Open(cfg)))
+		fail(23, a2_LastError());
+	if((h = a2_Load(iface, "data/testprograms.a2s", 0)) < 0)
+		fail(24, -h);
+	if((ph = a2_Get(iface, h, "PlayBlip")) < 0)
+		fail(25, -ph);
+
+	t0 = now();
+	for(frames = 0; frames < BENCHFRAMES && !do_exit;
+			frames += BENCHFRAGMENT)
+	{
+		for(i = 0; i < spawnbench; ++i, ++spawned)
+		{
+			A2_errors res = a2_Play(iface, a2_RootVoice(iface), ph,
+					a2_Rand(iface, 2.0f) - 1.0f, 0.01f);
+			if(res)
+				fail(26, res);
+		}
+		if(a2_Run(iface, BENCHFRAGMENT) < 0)
+			fail(27, a2_LastError());
+		a2_PumpMessages(iface);
+	}
+	t = now() - t0;
+
+	printf("%d voices started in %.2f ms (%.2f s of audio)\n", spawned,
+			t * 1000.0, (double)frames / samplerate);
+	printf("%.0f voices/s, %.2f us/voice (including processing)\n",
+			spawned / t, t * 1e6 / spawned);
+	if(!a2_GetStateProperty(iface, A2_PTOTALVOICES, &total) &&
+			!a2_GetStateProperty(iface, A2_PVOICEMEMORY, &mem) &&
+			total)
+		printf("%d voices allocated, %d bytes/voice\n", total,
+				mem / total);
+	a2_Close(iface);
+}
+
+
 int main(int argc, const char *argv[])
 {
 	int vhi, t;
@@ -143,6 +227,12 @@ int main(int argc, const char *argv[])
 	/* Command line switches */
 	parse_args(argc, argv);
 
+	if(spawnbench > 0)
+	{
+		spawn_benchmark();
+		return 0;
+	}
+
 	/* Configure and open master state */
 	if(!(drv = a2_NewDriver(A2_AUDIODRIVER, audiodriver)))
 		fail(1, a2_LastError());
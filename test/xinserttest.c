@@ -0,0 +1,236 @@
+/*
+ * xinserttest.c - Audiality 2 xsource/xinsert callback test
+ *
+ *	This test runs a state with a fragment size larger than the maximum
+ *	number of frames the 'xsource' and 'xinsert' units pass to their
+ *	client callbacks per call (A2_DEFAULTFRAG), with a program that splits
+ *	the fragments into subfragments of odd sizes. One or two source
+ *	callbacks feed a counting signal into an 'xsource' unit, which goes
+ *	through an 'xinsert' unit in replace mode, with an insert callback
+ *	that negates it. The output is checked sample by sample, to make sure
+ *	the chunks and subfragments are processed in order, without gaps or
+ *	overlaps, and without clearing any frames outside the ones being
+ *	processed. The sizes of the callback calls are checked as well. This
+ *	is done in fixed point as well as A2_FLOATPROC states.
+ *
+ * Copyright 2017 David Olofson <david@olofson.net>
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audiality2.h"
+
+#define	SAMPLERATE	48000
+#define	FRAGMENT	A2_MAXFRAG
+#define	FRAMES		(FRAGMENT * 20)
+
+/*
+ * The 'd' loop wakes the VM up after 148.8 and 36.96 frames, alternately, so
+ * the units run in subfragments of varying sizes, some larger than the chunks
+ * the callbacks are run in. The 'fbdelay' only passes its input through,
+ * but keeps 'xinsert' from writing directly to the voice outputs, as that
+ * would put it in adding mode.
+ */
+static const char *script =
+	"export XTest()\n"
+	"{\n"
+	"	struct { xsource 0 2; xinsert 2 2; fbdelay 2 > }\n"
+	"	fbgain 0; lgain 0; rgain 0\n"
+	"	1000 { d 3.1; d .77 }\n"
+	"}\n";
+
+/* Callback statistics */
+typedef struct XT_stats
+{
+	unsigned	frames;		/* Total frames */
+	unsigned	calls;		/* Number of callback calls */
+	unsigned	maxframes;	/* Largest 'frames' argument */
+	unsigned	badchannels;	/* Calls with the wrong channel count */
+} XT_stats;
+
+#define	MAXSOURCES	2
+
+static XT_stats srcstats[MAXSOURCES], insstats;
+static int32_t output[2][FRAMES];
+static int failures = 0;
+
+
+static void fail(unsigned where, A2_errors err)
+{
+	fprintf(stderr, "ERROR at %d: %s\n", where, a2_ErrorString(err));
+	exit(100);
+}
+
+
+static void count(XT_stats *xs, unsigned nbuffers, unsigned frames)
+{
+	xs->frames += frames;
+	++xs->calls;
+	if(frames > xs->maxframes)
+		xs->maxframes = frames;
+	if(nbuffers != 2)
+		++xs->badchannels;
+}
+
+
+/* Sample 's' of channel 'c' of the source signal */
+static inline int32_t source_sample(unsigned c, unsigned s)
+{
+	return (int32_t)((s + 1) << 8) * (c ? -1 : 1);
+}
+
+
+static A2_errors source_cb(int32_t **buffers, unsigned nbuffers,
+		unsigned frames, void *userdata)
+{
+	XT_stats *xs = (XT_stats *)userdata;
+	unsigned c, s;
+	if(!buffers)
+		return A2_OK;
+	for(c = 0; c < nbuffers; ++c)
+		for(s = 0; s < frames; ++s)
+			buffers[c][s] = source_sample(c, xs->frames + s);
+	count(xs, nbuffers, frames);
+	return A2_OK;
+}
+
+
+static A2_errors insert_cb(int32_t **buffers, unsigned nbuffers,
+		unsigned frames, void *userdata)
+{
+	unsigned c, s;
+	if(!buffers)
+		return A2_OK;
+	for(c = 0; c < nbuffers; ++c)
+		for(s = 0; s < frames; ++s)
+			buffers[c][s] = -buffers[c][s];
+	count(&insstats, nbuffers, frames);
+	return A2_OK;
+}
+
+
+static void render(int flags, int nsources)
+{
+	A2_config *config;
+	A2_driver *driver;
+	A2_interface *iface;
+	A2_handle bank, h, vh, xh;
+	unsigned s;
+	int i;
+	if(!(driver = a2_NewDriver(A2_AUDIODRIVER, "buffer")))
+		fail(1, a2_LastError());
+	if(!(config = a2_OpenConfig(SAMPLERATE, FRAGMENT, 2,
+			A2_AUTOCLOSE | A2_SILENT | flags)))
+		fail(2, a2_LastError());
+	config->fragment = FRAGMENT;
+	if(a2_AddDriver(config, driver))
+		fail(3, a2_LastError());
+	if(!(iface = a2_Open(config)))
+		fail(4, a2_LastError());
+	if((bank = a2_LoadString(iface, script, "xinserttest")) < 0)
+		fail(5, -bank);
+	if((h = a2_Get(iface, bank, "XTest")) < 0)
+		fail(6, -h);
+	if((vh = a2_Start(iface, a2_RootVoice(iface), h)) < 0)
+		fail(7, -vh);
+	memset(srcstats, 0, sizeof(srcstats));
+	memset(&insstats, 0, sizeof(insstats));
+	for(i = 0; i < nsources; ++i)
+		if((xh = a2_SourceCallback(iface, vh, source_cb,
+				&srcstats[i])) < 0)
+			fail(8, -xh);
+	if((xh = a2_InsertCallback(iface, vh, insert_cb, NULL)) < 0)
+		fail(9, -xh);
+	for(s = 0; s < FRAMES; s += FRAGMENT)
+	{
+		int c;
+		if(a2_Run(iface, FRAGMENT) < 0)
+			fail(10, a2_LastError());
+		for(c = 0; c < 2; ++c)
+			memcpy(output[c] + s,
+					((A2_audiodriver *)driver)->buffers[c],
+					FRAGMENT * sizeof(int32_t));
+	}
+	a2_Close(iface);
+}
+
+
+static void check_stats(const char *what, XT_stats *xs, unsigned firstframe,
+		unsigned maxframes)
+{
+	int ok = (xs->maxframes <= maxframes) && !xs->badchannels &&
+			(xs->frames >= FRAMES - firstframe) &&
+			(xs->frames <= FRAMES);
+	printf("  %-6s %5u frames in %4u calls, at most %3u per call%s\n",
+			what, xs->frames, xs->calls, xs->maxframes,
+			ok ? "" : "  FAILED!");
+	if(!ok)
+		++failures;
+}
+
+
+/*
+ * The voice starts in the first fragment, and its output may be delayed by
+ * a subfragment offset, so we look for the first source sample first.
+ *
+ * All callbacks that go through intermediate buffers should be called with at
+ * most A2_DEFAULTFRAG frames at a time. Only a single source in fixed point
+ * mode writes directly to the outputs, and may get whole subfragments.
+ */
+static void check_output(int fp, int nsources)
+{
+	unsigned s, c, first, diffs = 0;
+	int i;
+	for(first = 0; first < FRAMES; ++first)
+		if(output[0][first])
+			break;
+	for(s = first; s < FRAMES; ++s)
+		for(c = 0; c < 2; ++c)
+			if(output[c][s] != -nsources * source_sample(c,
+					s - first))
+				++diffs;
+	printf("  output starts at frame %u, %u differing samples%s\n",
+			first, diffs,
+			(first >= FRAGMENT) || diffs ? "  FAILED!" : "");
+	if((first >= FRAGMENT) || diffs)
+		++failures;
+	for(i = 0; i < nsources; ++i)
+		check_stats("source", &srcstats[i], first,
+				(nsources == 1) && !fp ? FRAGMENT :
+				A2_DEFAULTFRAG);
+	check_stats("insert", &insstats, first, A2_DEFAULTFRAG);
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int fp, n;
+	for(fp = 0; fp < 2; ++fp)
+		for(n = 1; n <= MAXSOURCES; ++n)
+		{
+			printf("%s, %d frame fragments, %d source(s):\n",
+					fp ? "Float" : "Fixed point", FRAGMENT,
+					n);
+			render(fp ? A2_FLOATPROC : 0, n);
+			check_output(fp, n);
+		}
+	printf("%d tests failed.\n", failures);
+	return failures ? 1 : 0;
+}